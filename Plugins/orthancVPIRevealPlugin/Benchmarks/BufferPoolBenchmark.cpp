@@ -0,0 +1,154 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Compares the scratch buffers of BufferPool with the system
+// allocator, on sizes used by the image processing (a tile, a band
+// of resampled rows, a decoded frame, a large intermediate image).
+// Each thread borrows and gives back buffers of one size in a loop,
+// and writes one byte in each of their pages, so that the page faults
+// of fresh memory are accounted for.
+//
+// Usage: BufferPoolBenchmark [megabytes per thread and per size]
+
+static const size_t SIZES[] = { 64 * 1024, 1024 * 1024, 4 * 1024 * 1024, 32 * 1024 * 1024 };
+static const unsigned int THREADS[] = { 1, 4 };
+
+
+static void Touch(void* buffer,
+                  size_t size)
+{
+  for (size_t i = 0; i < size; i += 4096)
+  {
+    reinterpret_cast<char*>(buffer)[i] = static_cast<char>(i);
+  }
+}
+
+
+static void RunSystemAllocator(size_t size,
+                               unsigned int iterations)
+{
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    void* buffer = malloc(size);
+    if (buffer == NULL)
+    {
+      abort();
+    }
+
+    Touch(buffer, size);
+    free(buffer);
+  }
+}
+
+
+static void RunBufferPool(size_t size,
+                          unsigned int iterations)
+{
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    OrthancPlugins::PooledBuffer buffer(size);
+    Touch(buffer.GetData(), buffer.GetSize());
+  }
+}
+
+
+static double Measure(void (*run) (size_t, unsigned int),
+                      size_t size,
+                      unsigned int threads,
+                      unsigned int iterations)
+{
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  boost::thread_group group;
+  for (unsigned int i = 0; i < threads; i++)
+  {
+    group.create_thread(boost::bind(run, size, iterations));
+  }
+
+  group.join_all();
+
+  boost::posix_time::time_duration elapsed =
+    boost::posix_time::microsec_clock::universal_time() - start;
+
+  // Microseconds per buffer, as seen by one thread
+  return static_cast<double>(elapsed.total_microseconds()) / static_cast<double>(iterations);
+}
+
+
+int main(int argc, char** argv)
+{
+  size_t megabytes = 256;
+  if (argc >= 2)
+  {
+    megabytes = boost::lexical_cast<size_t>(argv[1]);
+  }
+
+  printf("    size  threads  malloc/free  BufferPool  (us per buffer)\n");
+
+  for (size_t i = 0; i < sizeof(SIZES) / sizeof(size_t); i++)
+  {
+    const unsigned int iterations =
+      std::max(static_cast<size_t>(1), megabytes * 1024 * 1024 / SIZES[i]);
+
+    for (size_t j = 0; j < sizeof(THREADS) / sizeof(unsigned int); j++)
+    {
+      double system = Measure(RunSystemAllocator, SIZES[i], THREADS[j], iterations);
+      double pool = Measure(RunBufferPool, SIZES[i], THREADS[j], iterations);
+      printf("%6luKB  %7u  %11.1f  %10.1f\n", static_cast<unsigned long>(SIZES[i] / 1024),
+             THREADS[j], system, pool);
+    }
+  }
+
+  OrthancPlugins::BufferPool& pool = OrthancPlugins::BufferPool::GetInstance();
+
+  OrthancPlugins::BufferPool::Statistics statistics;
+  pool.GetStatistics(statistics);
+  printf("\nBufferPool: %lu calls to the system allocator, %lu buffers taken back from the shared pool\n",
+         static_cast<unsigned long>(statistics.allocations_),
+         static_cast<unsigned long>(statistics.sharedReuses_));
+
+  // All the worker threads have exited: Finalize() must free every buffer
+  pool.Finalize();
+  pool.GetStatistics(statistics);
+  if (statistics.allocations_ != statistics.deallocations_ ||
+      statistics.pooledSize_ != 0)
+  {
+    std::cerr << "Some buffers were not freed by Finalize()" << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/EmbeddedDatabaseBackend.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#  include <unistd.h>
+#endif
+
+
+// Measures the embedded index on the transactions that Orthanc runs
+// to store an instance (one transaction per instance, series of 250
+// instances, studies of 2 series), without waiting for the disk:
+//  - the rate of the commits,
+//  - the memory and the disk space taken by each instance, which
+//    bound the size of the index, as the whole index lives in memory,
+//  - the duration of the checkpoint written by "Close()", and of the
+//    loading of this checkpoint by "Open()".
+//
+// Usage: EmbeddedIndexBenchmark [instances] [directory]
+
+static const unsigned int INSTANCES_PER_SERIES = 250;
+static const unsigned int SERIES_PER_STUDY = 2;
+
+
+// The back-end logs through the Orthanc SDK: Only the log messages
+// are printed, no other service is available
+static OrthancPluginErrorCode InvokeService(struct _OrthancPluginContext_t* context,
+                                            _OrthancPluginService service,
+                                            const void* params)
+{
+  switch (service)
+  {
+    case _OrthancPluginService_LogError:
+    case _OrthancPluginService_LogWarning:
+      fprintf(stderr, "%s\n", reinterpret_cast<const char*>(params));
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogInfo:
+      return OrthancPluginErrorCode_Success;
+
+    default:
+      return OrthancPluginErrorCode_NotImplemented;
+  }
+}
+
+
+static OrthancPluginContext  context_ = { NULL, "1.2.0", NULL, InvokeService };
+
+
+static std::string FormatPublicId(unsigned int level,
+                                  unsigned int index)
+{
+  // Same length as the SHA-1 based identifiers of Orthanc
+  char id[64];
+  sprintf(id, "%08x-%08x-%08x-%08x-%08x", level, index, index * 2654435761u, level ^ index, 0x12345678u);
+  return id;
+}
+
+
+static uint64_t GetResidentMemory()
+{
+#if defined(__linux__)
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL)
+  {
+    unsigned long size, resident;
+    const bool ok = (fscanf(fp, "%lu %lu", &size, &resident) == 2);
+    fclose(fp);
+
+    if (ok)
+    {
+      return static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+  }
+#endif
+
+  return 0;   // Unknown
+}
+
+
+static double GetElapsedSeconds(const boost::posix_time::ptime& start)
+{
+  return static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+}
+
+
+static int64_t CreateResource(OrthancPlugins::EmbeddedDatabaseBackend& backend,
+                              OrthancPluginResourceType type,
+                              unsigned int level,
+                              unsigned int index,
+                              int64_t parent)
+{
+  const std::string publicId = FormatPublicId(level, index);
+  const int64_t id = backend.CreateResource(publicId.c_str(), type);
+
+  if (parent >= 0)
+  {
+    backend.AttachChild(parent, id);
+  }
+
+  const std::string value = "Value " + boost::lexical_cast<std::string>(index);
+
+  switch (type)
+  {
+    case OrthancPluginResourceType_Patient:
+      backend.SetMainDicomTag(id, 0x0010, 0x0010, "DOE^JOHN");
+      backend.SetMainDicomTag(id, 0x0010, 0x0020, value.c_str());
+      backend.SetMainDicomTag(id, 0x0010, 0x0030, "19700101");
+      backend.SetMainDicomTag(id, 0x0010, 0x0040, "M");
+      backend.SetIdentifierTag(id, 0x0010, 0x0020, value.c_str());
+      break;
+
+    case OrthancPluginResourceType_Study:
+      backend.SetMainDicomTag(id, 0x0008, 0x0020, "20160101");
+      backend.SetMainDicomTag(id, 0x0008, 0x0030, "120000");
+      backend.SetMainDicomTag(id, 0x0008, 0x0050, value.c_str());
+      backend.SetMainDicomTag(id, 0x0008, 0x1030, "CT THORAX");
+      backend.SetMainDicomTag(id, 0x0020, 0x000d, ("1.2.3.4." + value).c_str());
+      backend.SetIdentifierTag(id, 0x0008, 0x0050, value.c_str());
+      backend.SetIdentifierTag(id, 0x0020, 0x000d, ("1.2.3.4." + value).c_str());
+      break;
+
+    case OrthancPluginResourceType_Series:
+      backend.SetMainDicomTag(id, 0x0008, 0x0060, "CT");
+      backend.SetMainDicomTag(id, 0x0008, 0x103e, "AXIAL 1MM");
+      backend.SetMainDicomTag(id, 0x0020, 0x000e, ("1.2.3.5." + value).c_str());
+      backend.SetMainDicomTag(id, 0x0020, 0x0011, "1");
+      backend.SetIdentifierTag(id, 0x0020, 0x000e, ("1.2.3.5." + value).c_str());
+      break;
+
+    case OrthancPluginResourceType_Instance:
+    {
+      backend.SetMainDicomTag(id, 0x0008, 0x0018, ("1.2.3.6." + value).c_str());
+      backend.SetMainDicomTag(id, 0x0020, 0x0013, value.c_str());
+      backend.SetMainDicomTag(id, 0x0020, 0x0032, "-250\\-250\\100");
+      backend.SetMainDicomTag(id, 0x0020, 0x0037, "1\\0\\0\\0\\1\\0");
+      backend.SetIdentifierTag(id, 0x0008, 0x0018, ("1.2.3.6." + value).c_str());
+
+      const std::string uuid = FormatPublicId(9, index) + "-00000000";
+      OrthancPluginAttachment attachment;
+      attachment.uuid = uuid.c_str();
+      attachment.contentType = 1;   // DICOM
+      attachment.uncompressedSize = 525000;
+      attachment.uncompressedHash = "0123456789abcdef0123456789abcdef";
+      attachment.compressionType = 0;
+      attachment.compressedSize = 525000;
+      attachment.compressedHash = "0123456789abcdef0123456789abcdef";
+      backend.AddAttachment(id, attachment);
+
+      backend.SetMetadata(id, 1, "1");                                   // IndexInSeries
+      backend.SetMetadata(id, 2, "20160101T120000");                     // ReceptionDate
+      backend.SetMetadata(id, 3, "1");                                   // RemoteAET
+      backend.SetMetadata(id, 5, "1.2.840.10008.5.1.4.1.1.2");           // SopClassUid
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  OrthancPluginChange change;
+  change.seq = 0;
+  change.changeType = (type == OrthancPluginResourceType_Instance ? 1 : 2);
+  change.resourceType = type;
+  change.publicId = publicId.c_str();
+  change.date = "20160101T120000";
+  backend.LogChange(change);
+
+  return id;
+}
+
+
+int main(int argc, char** argv)
+{
+  const unsigned int count = (argc >= 2 ? boost::lexical_cast<unsigned int>(argv[1]) : 200000);
+  const std::string directory = (argc >= 3 ? std::string(argv[2]) :
+                                 (boost::filesystem::temp_directory_path() /
+                                  boost::filesystem::unique_path("EmbeddedIndexBenchmark-%%%%-%%%%")).string());
+
+  const uint64_t memoryBefore = GetResidentMemory();
+  uint64_t memoryAfter;
+
+  {
+    OrthancPlugins::EmbeddedDatabaseBackend backend(directory, false, 64 * 1024 * 1024);
+    backend.RegisterOutput(new OrthancPlugins::DatabaseBackendOutput(&context_, NULL));
+    backend.Open();
+
+    int64_t patient = -1, study = -1, series = -1;
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+      backend.StartTransaction();
+
+      if (i % (INSTANCES_PER_SERIES * SERIES_PER_STUDY) == 0)
+      {
+        const unsigned int j = i / (INSTANCES_PER_SERIES * SERIES_PER_STUDY);
+        patient = CreateResource(backend, OrthancPluginResourceType_Patient, 1, j, -1);
+        study = CreateResource(backend, OrthancPluginResourceType_Study, 2, j, patient);
+      }
+
+      if (i % INSTANCES_PER_SERIES == 0)
+      {
+        series = CreateResource(backend, OrthancPluginResourceType_Series, 3, i / INSTANCES_PER_SERIES, study);
+      }
+
+      CreateResource(backend, OrthancPluginResourceType_Instance, 4, i, series);
+      backend.CommitTransaction();
+    }
+
+    const double insertion = GetElapsedSeconds(start);
+    memoryAfter = GetResidentMemory();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    backend.Close();
+    const double checkpoint = GetElapsedSeconds(start);
+
+    const uintmax_t size = boost::filesystem::file_size(boost::filesystem::path(directory) / "index.checkpoint");
+
+    printf("%u instances\n", count);
+    printf("  commits (no sync):         %.0f per second\n", static_cast<double>(count) / insertion);
+    if (memoryBefore != 0)
+    {
+      printf("  memory:                    %.0f bytes per instance\n",
+             static_cast<double>(memoryAfter - memoryBefore) / static_cast<double>(count));
+    }
+    printf("  checkpoint:                %.0f bytes per instance\n",
+           static_cast<double>(size) / static_cast<double>(count));
+    printf("  checkpoint by Close():     %.2f s\n", checkpoint);
+  }
+
+  {
+    OrthancPlugins::EmbeddedDatabaseBackend backend(directory, false, 64 * 1024 * 1024);
+    backend.RegisterOutput(new OrthancPlugins::DatabaseBackendOutput(&context_, NULL));
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    backend.Open();
+    printf("  loading by Open():         %.2f s\n", GetElapsedSeconds(start));
+
+    if (backend.GetResourceCount(OrthancPluginResourceType_Instance) != count)
+    {
+      printf("Bad count of instances after reloading\n");
+      return -1;
+    }
+
+    backend.Close();
+  }
+
+  if (argc < 3)
+  {
+    boost::filesystem::remove_all(directory);
+  }
+
+  return 0;
+}
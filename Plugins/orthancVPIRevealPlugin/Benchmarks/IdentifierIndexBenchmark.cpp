@@ -0,0 +1,352 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/IdentifierIndex.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <map>
+#include <set>
+#include <stdio.h>
+
+#if defined(__linux__)
+#  include <unistd.h>
+#endif
+
+
+// Compares IdentifierIndex with the "std::set" per tag it replaced,
+// on the identifiers of an archive of 10M instances (by default):
+// SOPInstanceUID for the instances, plus the identifiers of 400k
+// series, 100k studies and 50k patients. Measures the memory, the
+// insertion, and the lookups issued by Orthanc (equality on an UID,
+// wildcard on PatientID, range on StudyDate).
+//
+// Usage: IdentifierIndexBenchmark [instances]
+
+static const unsigned int INSTANCES_PER_SERIES = 25;
+static const unsigned int SERIES_PER_STUDY = 4;
+static const unsigned int STUDIES_PER_PATIENT = 2;
+static const unsigned int LOOKUPS = 100000;
+
+static const uint32_t PATIENT_ID = 0x00100020;
+static const uint32_t STUDY_INSTANCE_UID = 0x0020000d;
+static const uint32_t STUDY_DATE = 0x00080020;
+static const uint32_t ACCESSION_NUMBER = 0x00080050;
+static const uint32_t SERIES_INSTANCE_UID = 0x0020000e;
+static const uint32_t SOP_INSTANCE_UID = 0x00080018;
+
+
+// The former index: One "std::set" of (value, internal ID) per tag
+class ReferenceIndex
+{
+private:
+  typedef std::pair<OrthancPluginResourceType, uint32_t>  Tag;
+  typedef std::set< std::pair<std::string, int64_t> >     Values;
+
+  std::map<Tag, Values>  values_;
+
+  static bool Match(const char* pattern,
+                    const char* value)
+  {
+    if (*pattern == '\0')
+    {
+      return *value == '\0';
+    }
+    else if (*pattern == '*')
+    {
+      return (Match(pattern + 1, value) ||
+              (*value != '\0' && Match(pattern, value + 1)));
+    }
+    else
+    {
+      return (*value != '\0' &&
+              (*pattern == '?' || *pattern == *value) &&
+              Match(pattern + 1, value + 1));
+    }
+  }
+
+public:
+  void Add(OrthancPluginResourceType level,
+           uint32_t tag,
+           const std::string& value,
+           int64_t id)
+  {
+    values_[std::make_pair(level, tag)].insert(std::make_pair(value, id));
+  }
+
+  void Lookup(std::list<int64_t>& target,
+              OrthancPluginResourceType level,
+              uint32_t tag,
+              OrthancPluginIdentifierConstraint constraint,
+              const std::string& value) const
+  {
+    std::map<Tag, Values>::const_iterator found = values_.find(std::make_pair(level, tag));
+    if (found == values_.end())
+    {
+      return;
+    }
+
+    const Values& values = found->second;
+
+    switch (constraint)
+    {
+      case OrthancPluginIdentifierConstraint_Equal:
+        for (Values::const_iterator it = values.lower_bound(std::make_pair(value, 0));
+             it != values.end() && it->first == value; ++it)
+        {
+          target.push_back(it->second);
+        }
+        break;
+
+      case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+        for (Values::const_iterator it = values.lower_bound(std::make_pair(value, 0));
+             it != values.end(); ++it)
+        {
+          target.push_back(it->second);
+        }
+        break;
+
+      case OrthancPluginIdentifierConstraint_Wildcard:
+      {
+        const std::string prefix = value.substr(0, value.find_first_of("*?"));
+        for (Values::const_iterator it = values.lower_bound(std::make_pair(prefix, 0));
+             it != values.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        {
+          if (Match(value.c_str(), it->first.c_str()))
+          {
+            target.push_back(it->second);
+          }
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+};
+
+
+static uint64_t GetResidentMemory()
+{
+#if defined(__linux__)
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL)
+  {
+    unsigned long size, resident;
+    const bool ok = (fscanf(fp, "%lu %lu", &size, &resident) == 2);
+    fclose(fp);
+
+    if (ok)
+    {
+      return static_cast<uint64_t>(resident) * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+  }
+#endif
+
+  return 0;   // Unknown
+}
+
+
+static double GetElapsedSeconds(const boost::posix_time::ptime& start)
+{
+  boost::posix_time::time_duration elapsed =
+    boost::posix_time::microsec_clock::universal_time() - start;
+  return static_cast<double>(elapsed.total_microseconds()) / 1000000.0;
+}
+
+
+static std::string FormatUid(unsigned int study,
+                             unsigned int series,
+                             unsigned int instance)
+{
+  // The UIDs of an archive share a long root
+  char uid[96];
+  sprintf(uid, "1.2.826.0.1.3680043.2.1125.%u.%u.%u", study, series, instance);
+  return uid;
+}
+
+
+static std::string FormatPatientId(unsigned int patient)
+{
+  return "DOE^P" + boost::lexical_cast<std::string>(patient);
+}
+
+
+static std::string FormatStudyDate(unsigned int study)
+{
+  char date[16];
+  sprintf(date, "%04u%02u%02u", 2010 + study % 10, 1 + (study / 10) % 12, 1 + (study / 120) % 28);
+  return date;
+}
+
+
+// Pseudo-random generator, so that both indexes get the same lookups
+static unsigned int NextRandom(unsigned int& state)
+{
+  state = state * 1103515245u + 12345u;
+  return (state >> 8);
+}
+
+
+// The internal IDs are allocated as by the back-ends: The patients,
+// studies, series and instances share one sequence
+template <typename Index>
+static void Fill(Index& index,
+                 unsigned int instances)
+{
+  int64_t id = 1;
+
+  for (unsigned int i = 0; i < instances; i++)
+  {
+    const unsigned int series = i / INSTANCES_PER_SERIES;
+    const unsigned int study = series / SERIES_PER_STUDY;
+    const unsigned int patient = study / STUDIES_PER_PATIENT;
+
+    if (i % (INSTANCES_PER_SERIES * SERIES_PER_STUDY * STUDIES_PER_PATIENT) == 0)
+    {
+      index.Add(OrthancPluginResourceType_Patient, PATIENT_ID, FormatPatientId(patient), id++);
+    }
+
+    if (i % (INSTANCES_PER_SERIES * SERIES_PER_STUDY) == 0)
+    {
+      index.Add(OrthancPluginResourceType_Study, PATIENT_ID, FormatPatientId(patient), id);
+      index.Add(OrthancPluginResourceType_Study, STUDY_INSTANCE_UID, FormatUid(study, 0, 0), id);
+      index.Add(OrthancPluginResourceType_Study, STUDY_DATE, FormatStudyDate(study), id);
+      index.Add(OrthancPluginResourceType_Study, ACCESSION_NUMBER, "A" + boost::lexical_cast<std::string>(study), id);
+      id++;
+    }
+
+    if (i % INSTANCES_PER_SERIES == 0)
+    {
+      index.Add(OrthancPluginResourceType_Series, SERIES_INSTANCE_UID, FormatUid(study, series, 0), id++);
+    }
+
+    index.Add(OrthancPluginResourceType_Instance, SOP_INSTANCE_UID, FormatUid(study, series, i), id++);
+  }
+}
+
+
+// Returns the microseconds per lookup, and counts the matches
+template <typename Index>
+static double RunLookups(size_t& matches,
+                         const Index& index,
+                         unsigned int instances,
+                         OrthancPluginIdentifierConstraint constraint,
+                         unsigned int lookups)
+{
+  const unsigned int studies = instances / (INSTANCES_PER_SERIES * SERIES_PER_STUDY);
+  const unsigned int patients = studies / STUDIES_PER_PATIENT;
+
+  unsigned int state = 42;
+  matches = 0;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  for (unsigned int i = 0; i < lookups; i++)
+  {
+    std::list<int64_t> target;
+
+    switch (constraint)
+    {
+      case OrthancPluginIdentifierConstraint_Equal:
+      {
+        const unsigned int instance = NextRandom(state) % instances;
+        const unsigned int series = instance / INSTANCES_PER_SERIES;
+        index.Lookup(target, OrthancPluginResourceType_Instance, SOP_INSTANCE_UID, constraint,
+                     FormatUid(series / SERIES_PER_STUDY, series, instance));
+        break;
+      }
+
+      case OrthancPluginIdentifierConstraint_Wildcard:
+        index.Lookup(target, OrthancPluginResourceType_Patient, PATIENT_ID, constraint,
+                     FormatPatientId(NextRandom(state) % (patients / 10 + 1)) + "*");
+        break;
+
+      case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+        index.Lookup(target, OrthancPluginResourceType_Study, STUDY_DATE, constraint, "20190101");
+        break;
+
+      default:
+        break;
+    }
+
+    matches += target.size();
+  }
+
+  return static_cast<double>(GetElapsedSeconds(start)) * 1000000.0 / static_cast<double>(lookups);
+}
+
+
+template <typename Index>
+static void Run(const char* name,
+                unsigned int instances)
+{
+  const uint64_t memoryBefore = GetResidentMemory();
+
+  // Allocated on the heap, so that the memory of the first index is
+  // not freed before the second one is measured
+  Index* index = new Index;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  Fill(*index, instances);
+  const double insertion = GetElapsedSeconds(start);
+
+  const uint64_t memoryAfter = GetResidentMemory();
+
+  size_t equal, wildcard, range;
+  const double equalTime = RunLookups(equal, *index, instances, OrthancPluginIdentifierConstraint_Equal, LOOKUPS);
+  const double wildcardTime = RunLookups(wildcard, *index, instances, OrthancPluginIdentifierConstraint_Wildcard, LOOKUPS);
+  const double rangeTime = RunLookups(range, *index, instances, OrthancPluginIdentifierConstraint_GreaterOrEqual, 100);
+
+  const unsigned int entries = instances + instances / INSTANCES_PER_SERIES +
+    4 * instances / (INSTANCES_PER_SERIES * SERIES_PER_STUDY) +
+    instances / (INSTANCES_PER_SERIES * SERIES_PER_STUDY * STUDIES_PER_PATIENT);
+
+  printf("%s\n", name);
+  if (memoryBefore != 0)
+  {
+    printf("  memory:                    %.0f MB\n",
+           static_cast<double>(memoryAfter - memoryBefore) / (1024.0 * 1024.0));
+  }
+  printf("  insertion:                 %.2f us per entry\n",
+         insertion * 1000000.0 / static_cast<double>(entries));
+  printf("  equal SOPInstanceUID:      %.2f us (%.1f matches)\n",
+         equalTime, static_cast<double>(equal) / static_cast<double>(LOOKUPS));
+  printf("  wildcard \"DOE^P<k>*\":      %.2f us (%.1f matches)\n",
+         wildcardTime, static_cast<double>(wildcard) / static_cast<double>(LOOKUPS));
+  printf("  StudyDate >= 20190101:     %.0f us (%.0f matches)\n\n",
+         rangeTime, static_cast<double>(range) / 100.0);
+
+  delete index;
+}
+
+
+int main(int argc, char** argv)
+{
+  const unsigned int instances = (argc >= 2 ? boost::lexical_cast<unsigned int>(argv[1]) : 10000000);
+
+  printf("%u instances\n\n", instances);
+  Run<OrthancPlugins::IdentifierIndex>("IdentifierIndex", instances);
+  Run<ReferenceIndex>("std::set per tag", instances);
+
+  return 0;
+}
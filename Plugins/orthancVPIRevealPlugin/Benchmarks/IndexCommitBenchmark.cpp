@@ -0,0 +1,264 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/EmbeddedDatabaseBackend.h"
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <stdio.h>
+
+
+// Measures the throughput of the embedded index with
+// "IndexSynchronous", depending on "IndexAsyncCommitDelay". Several
+// threads store instances as Orthanc does: Each one simulates 1 ms of
+// C-STORE work, then stores one instance in one transaction, while
+// holding a lock that stands for the mutex of the Orthanc index.
+//
+// Usage: IndexCommitBenchmark [instances] [directory]
+
+static const unsigned int THREADS[] = { 1, 8, 16, 32 };
+static const unsigned int DELAYS[] = { 0, 2, 5 };   // In milliseconds
+
+
+// Only the errors of the back-end are printed, no other service of the
+// Orthanc SDK is available
+static OrthancPluginErrorCode InvokeService(struct _OrthancPluginContext_t* context,
+                                            _OrthancPluginService service,
+                                            const void* params)
+{
+  switch (service)
+  {
+    case _OrthancPluginService_LogError:
+      fprintf(stderr, "%s\n", reinterpret_cast<const char*>(params));
+      return OrthancPluginErrorCode_Success;
+
+    case _OrthancPluginService_LogWarning:   // Not to clutter the table
+    case _OrthancPluginService_LogInfo:
+      return OrthancPluginErrorCode_Success;
+
+    default:
+      return OrthancPluginErrorCode_NotImplemented;
+  }
+}
+
+
+static OrthancPluginContext  context_ = { NULL, "1.2.0", NULL, InvokeService };
+
+
+class Writer
+{
+private:
+  OrthancPlugins::EmbeddedDatabaseBackend&  backend_;
+  boost::mutex&                             mutex_;
+  int64_t                                   series_;
+  unsigned int                              next_;
+  unsigned int                              count_;
+  bool                                      failed_;
+
+  void StoreInstance(unsigned int index)
+  {
+    const std::string value = boost::lexical_cast<std::string>(index);
+    const std::string publicId = "instance-" + value;
+    const std::string uid = "1.2.3.6." + value;
+
+    backend_.StartTransaction();
+
+    try
+    {
+      const int64_t id = backend_.CreateResource(publicId.c_str(), OrthancPluginResourceType_Instance);
+      backend_.AttachChild(series_, id);
+      backend_.SetMainDicomTag(id, 0x0008, 0x0018, uid.c_str());
+      backend_.SetMainDicomTag(id, 0x0020, 0x0013, value.c_str());
+      backend_.SetIdentifierTag(id, 0x0008, 0x0018, uid.c_str());
+
+      const std::string uuid = "attachment-" + value;
+      OrthancPluginAttachment attachment;
+      attachment.uuid = uuid.c_str();
+      attachment.contentType = 1;   // DICOM
+      attachment.uncompressedSize = 525000;
+      attachment.uncompressedHash = "0123456789abcdef0123456789abcdef";
+      attachment.compressionType = 0;
+      attachment.compressedSize = 525000;
+      attachment.compressedHash = "0123456789abcdef0123456789abcdef";
+      backend_.AddAttachment(id, attachment);
+
+      backend_.SetMetadata(id, 1, value.c_str());   // IndexInSeries
+
+      OrthancPluginChange change;
+      change.seq = 0;
+      change.changeType = 1;   // NewInstance
+      change.resourceType = OrthancPluginResourceType_Instance;
+      change.publicId = publicId.c_str();
+      change.date = "20160101T120000";
+      backend_.LogChange(change);
+
+      backend_.CommitTransaction();
+    }
+    catch (...)
+    {
+      backend_.RollbackTransaction();
+      throw;
+    }
+  }
+
+public:
+  Writer(OrthancPlugins::EmbeddedDatabaseBackend& backend,
+         boost::mutex& mutex,
+         int64_t series,
+         unsigned int count) :
+    backend_(backend),
+    mutex_(mutex),
+    series_(series),
+    next_(0),
+    count_(count),
+    failed_(false)
+  {
+  }
+
+  void Worker()
+  {
+    for (;;)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));   // Receiving the DICOM file
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (next_ == count_ ||
+          failed_)
+      {
+        return;
+      }
+
+      try
+      {
+        StoreInstance(next_);
+        next_++;
+      }
+      catch (OrthancPlugins::DatabaseException& e)
+      {
+        fprintf(stderr, "Error %d while storing an instance\n", e.GetErrorCode());
+        failed_ = true;
+      }
+    }
+  }
+
+  bool HasFailed() const
+  {
+    return failed_;
+  }
+};
+
+
+// Returns the instances stored per second, or 0 on errors
+static double Run(const std::string& directory,
+                  unsigned int threads,
+                  unsigned int delay,
+                  unsigned int count)
+{
+  boost::filesystem::remove_all(directory);
+
+  OrthancPlugins::EmbeddedDatabaseBackend backend(directory, true, 64 * 1024 * 1024);
+  backend.RegisterOutput(new OrthancPlugins::DatabaseBackendOutput(&context_, NULL));
+  backend.SetAsyncCommitDelay(delay);
+  backend.Open();
+
+  backend.StartTransaction();
+  const int64_t patient = backend.CreateResource("patient", OrthancPluginResourceType_Patient);
+  const int64_t study = backend.CreateResource("study", OrthancPluginResourceType_Study);
+  const int64_t series = backend.CreateResource("series", OrthancPluginResourceType_Series);
+  backend.AttachChild(patient, study);
+  backend.AttachChild(study, series);
+  backend.CommitTransaction();
+
+  boost::mutex mutex;
+  Writer writer(backend, mutex, series, count);
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  boost::thread_group group;
+  for (unsigned int i = 0; i < threads; i++)
+  {
+    group.create_thread(boost::bind(&Writer::Worker, &writer));
+  }
+
+  group.join_all();
+
+  // The pending records are synced by "Close()", which is accounted for
+  backend.Close();
+
+  boost::posix_time::time_duration elapsed =
+    boost::posix_time::microsec_clock::universal_time() - start;
+
+  if (writer.HasFailed() ||
+      elapsed.total_microseconds() == 0)
+  {
+    return 0;
+  }
+  else
+  {
+    return static_cast<double>(count) * 1000000.0 / static_cast<double>(elapsed.total_microseconds());
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  const unsigned int count = (argc >= 2 ? boost::lexical_cast<unsigned int>(argv[1]) : 3000);
+  const std::string directory = (argc >= 3 ? std::string(argv[2]) :
+                                 (boost::filesystem::temp_directory_path() /
+                                  boost::filesystem::unique_path("IndexCommitBenchmark-%%%%-%%%%")).string());
+
+  printf("%u instances, throughput in instances per second\n\n", count);
+  printf("  threads");
+  for (size_t j = 0; j < sizeof(DELAYS) / sizeof(unsigned int); j++)
+  {
+    printf("  delay %2u ms", DELAYS[j]);
+  }
+  printf("\n");
+
+  int result = 0;
+
+  for (size_t i = 0; i < sizeof(THREADS) / sizeof(unsigned int); i++)
+  {
+    printf("  %7u", THREADS[i]);
+
+    for (size_t j = 0; j < sizeof(DELAYS) / sizeof(unsigned int); j++)
+    {
+      const double throughput = Run(directory, THREADS[i], DELAYS[j], count);
+      if (throughput == 0)
+      {
+        result = -1;
+      }
+
+      printf("  %11.0f", throughput);
+      fflush(stdout);
+    }
+
+    printf("\n");
+  }
+
+  boost::filesystem::remove_all(directory);
+
+  return result;
+}
@@ -0,0 +1,183 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "../Common/PixelFormatConversion.h"
+#include "../Common/SimdSupport.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+
+// Times the pixel format conversions with each instruction set that
+// the CPU supports, and checks that the vectorized kernels give the
+// same images as the scalar loops.
+//
+// Usage: PixelFormatConversionBenchmark [width] [height]
+
+using namespace OrthancPlugins;
+
+namespace
+{
+  struct Conversion
+  {
+    OrthancPluginPixelFormat  source_;
+    OrthancPluginPixelFormat  target_;
+    float                     slope_;
+    float                     intercept_;
+  };
+}
+
+
+static const Conversion CONVERSIONS[] = {
+  { OrthancPluginPixelFormat_Grayscale16,       OrthancPluginPixelFormat_Grayscale8,        0.01f,  3.0f },
+  { OrthancPluginPixelFormat_SignedGrayscale16, OrthancPluginPixelFormat_Grayscale8,        0.05f,  128.0f },
+  { OrthancPluginPixelFormat_Grayscale16,       OrthancPluginPixelFormat_SignedGrayscale16, 1.0f,   -32768.0f },
+  { OrthancPluginPixelFormat_Grayscale8,        OrthancPluginPixelFormat_RGB24,             1.2f,   -10.0f },
+  { OrthancPluginPixelFormat_Grayscale16,       OrthancPluginPixelFormat_RGBA32,            0.01f,  0.0f },
+  { OrthancPluginPixelFormat_RGB24,             OrthancPluginPixelFormat_Grayscale8,        1.0f,   0.0f },
+  { OrthancPluginPixelFormat_RGBA32,            OrthancPluginPixelFormat_Grayscale16,       200.0f, 0.0f },
+  { OrthancPluginPixelFormat_RGB24,             OrthancPluginPixelFormat_RGB24,             1.5f,   -64.0f },
+  { OrthancPluginPixelFormat_RGBA32,            OrthancPluginPixelFormat_RGBA32,            0.8f,   20.0f },
+  { OrthancPluginPixelFormat_RGBA32,            OrthancPluginPixelFormat_RGB24,             1.0f,   0.5f },
+  { OrthancPluginPixelFormat_RGB24,             OrthancPluginPixelFormat_RGBA32,            1.0f,   0.5f }
+};
+
+
+static const char* GetFormatName(OrthancPluginPixelFormat format)
+{
+  switch (format)
+  {
+    case OrthancPluginPixelFormat_Grayscale8:
+      return "Grayscale8";
+
+    case OrthancPluginPixelFormat_Grayscale16:
+      return "Grayscale16";
+
+    case OrthancPluginPixelFormat_SignedGrayscale16:
+      return "SignedGrayscale16";
+
+    case OrthancPluginPixelFormat_RGB24:
+      return "RGB24";
+
+    case OrthancPluginPixelFormat_RGBA32:
+      return "RGBA32";
+
+    default:
+      return "?";
+  }
+}
+
+
+static double Measure(std::vector<uint8_t>& target,
+                      const std::vector<uint8_t>& source,
+                      const Conversion& conversion,
+                      unsigned int width,
+                      unsigned int height)
+{
+  static const unsigned int REPETITIONS = 10;
+
+  const unsigned int targetPitch = width * GetBytesPerPixel(conversion.target_);
+  const unsigned int sourcePitch = width * GetBytesPerPixel(conversion.source_);
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  for (unsigned int i = 0; i < REPETITIONS; i++)
+  {
+    ConvertPixelFormat(&target[0], conversion.target_, targetPitch,
+                       &source[0], conversion.source_, sourcePitch,
+                       width, height, conversion.slope_, conversion.intercept_);
+  }
+
+  boost::posix_time::time_duration elapsed =
+    boost::posix_time::microsec_clock::universal_time() - start;
+
+  // Milliseconds per image
+  return static_cast<double>(elapsed.total_microseconds()) / 1000.0 / static_cast<double>(REPETITIONS);
+}
+
+
+int main(int argc, char** argv)
+{
+  unsigned int width = 4000;
+  unsigned int height = 4000;
+  if (argc >= 3)
+  {
+    width = boost::lexical_cast<unsigned int>(argv[1]);
+    height = boost::lexical_cast<unsigned int>(argv[2]);
+  }
+
+  const SimdInstructionSet detected = GetSimdInstructionSet();
+
+  std::vector<uint8_t> source(static_cast<size_t>(width) * height * 4);
+  for (size_t i = 0; i < source.size(); i++)
+  {
+    source[i] = static_cast<uint8_t>(rand());
+  }
+
+  printf("%ux%u image, milliseconds per conversion\n\n", width, height);
+  printf("%-18s  %-18s %8s %8s %8s\n", "source", "target", "None", "SSE2", "AVX2");
+
+  bool identical = true;
+
+  for (size_t i = 0; i < sizeof(CONVERSIONS) / sizeof(Conversion); i++)
+  {
+    const Conversion& conversion = CONVERSIONS[i];
+    const size_t targetSize = static_cast<size_t>(width) * height * GetBytesPerPixel(conversion.target_);
+
+    printf("%-18s  %-18s", GetFormatName(conversion.source_), GetFormatName(conversion.target_));
+
+    std::vector<uint8_t> reference(targetSize);
+    std::vector<uint8_t> target(targetSize);
+
+    for (unsigned int instructionSet = SimdInstructionSet_None;
+         instructionSet <= SimdInstructionSet_AVX2; instructionSet++)
+    {
+      if (instructionSet > detected)
+      {
+        printf(" %8s", "-");
+        continue;
+      }
+
+      RestrictSimdInstructionSet(static_cast<SimdInstructionSet>(instructionSet));
+      printf(" %8.1f", Measure(instructionSet == SimdInstructionSet_None ? reference : target,
+                               source, conversion, width, height));
+
+      if (instructionSet != SimdInstructionSet_None &&
+          target != reference)
+      {
+        printf(" (differs from the scalar loop)");
+        identical = false;
+      }
+    }
+
+    printf("\n");
+  }
+
+  RestrictSimdInstructionSet(SimdInstructionSet_AVX2);
+
+  return (identical ? 0 : -1);
+}
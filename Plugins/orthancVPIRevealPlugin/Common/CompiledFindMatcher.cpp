@@ -0,0 +1,769 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "CompiledFindMatcher.h"
+
+#include "ScopedThreadGroup.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+
+
+namespace OrthancPlugins
+{
+  // Below this number of candidates per band, the cost of starting a
+  // thread is not worth it
+  static const size_t MIN_CANDIDATES_PER_BAND = 1024;
+
+
+  static bool ParseTag(DicomTagKey& tag,
+                       const std::string& s)
+  {
+    unsigned int group, element;
+    char separator;
+
+    if (s.size() == 9 &&
+        sscanf(s.c_str(), "%4x%c%4x", &group, &separator, &element) == 3 &&
+        separator == ',')
+    {
+      tag = (static_cast<DicomTagKey>(group) << 16) | static_cast<DicomTagKey>(element);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  template <typename T>
+  static const T* LookupSorted(const std::vector<std::pair<DicomTagKey, T> >& content,
+                               DicomTagKey tag)
+  {
+    size_t low = 0;
+    size_t high = content.size();
+
+    while (low < high)
+    {
+      size_t middle = (low + high) / 2;
+      if (content[middle].first < tag)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+
+    if (low < content.size() &&
+        content[low].first == tag)
+    {
+      return &content[low].second;
+    }
+    else
+    {
+      return NULL;
+    }
+  }
+
+
+  template <typename T>
+  static bool IsLowerTag(const std::pair<DicomTagKey, T>& a,
+                         const std::pair<DicomTagKey, T>& b)
+  {
+    return a.first < b.first;
+  }
+
+
+  void MatchableDataset::Load(const Json::Value& tags)
+  {
+    if (tags.type() != Json::objectValue)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+    }
+
+    Json::Value::Members members = tags.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      DicomTagKey tag;
+      if (!ParseTag(tag, members[i]))
+      {
+        continue;
+      }
+
+      const Json::Value& value = tags[members[i]];
+
+      if (value.type() == Json::stringValue)
+      {
+        values_.push_back(std::make_pair(tag, boost::trim_copy(value.asString())));
+      }
+      else if (value.type() == Json::arrayValue)
+      {
+        sequences_.push_back(std::make_pair(tag, Items()));
+
+        Items& items = sequences_.back().second;
+        items.reserve(value.size());
+
+        for (Json::Value::ArrayIndex j = 0; j < value.size(); j++)
+        {
+          items.push_back(boost::shared_ptr<MatchableDataset>(new MatchableDataset(value[j])));
+        }
+      }
+
+      // Null values are binary or too long tags, that cannot be matched
+    }
+
+    std::sort(values_.begin(), values_.end(), IsLowerTag<std::string>);
+    std::sort(sequences_.begin(), sequences_.end(), IsLowerTag<Items>);
+  }
+
+
+  MatchableDataset::MatchableDataset(const Json::Value& tags)
+  {
+    Load(tags);
+  }
+
+
+  MatchableDataset::MatchableDataset(OrthancPluginContext* context,
+                                     const void* dicom,
+                                     size_t size)
+  {
+    OrthancString json(context);
+    json.Assign(OrthancPluginDicomBufferToJson(context, dicom, size, OrthancPluginDicomToJsonFormat_Short,
+                                               OrthancPluginDicomToJsonFlags_None, 0));
+
+    if (json.GetContent() == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+    }
+
+    Json::Value tags;
+    json.ToJson(tags);
+    Load(tags);
+  }
+
+
+  const std::string* MatchableDataset::LookupValue(DicomTagKey tag) const
+  {
+    return LookupSorted(values_, tag);
+  }
+
+
+  bool MatchableDataset::LookupSequence(size_t& itemsCount,
+                                        DicomTagKey tag) const
+  {
+    const Items* items = LookupSorted(sequences_, tag);
+    if (items == NULL)
+    {
+      return false;
+    }
+    else
+    {
+      itemsCount = items->size();
+      return true;
+    }
+  }
+
+
+  const MatchableDataset& MatchableDataset::GetSequenceItem(DicomTagKey tag,
+                                                            size_t index) const
+  {
+    const Items* items = LookupSorted(sequences_, tag);
+    if (items == NULL ||
+        index >= items->size())
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    return *(*items)[index];
+  }
+
+
+  MatchableDatasetPointer MatchableDatasetCache::Lookup(const std::string& key,
+                                                        const std::string& version)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::const_iterator found = content_.find(key);
+    if (found != content_.end() &&
+        found->second.first == version)
+    {
+      return found->second.second;
+    }
+    else
+    {
+      return MatchableDatasetPointer();
+    }
+  }
+
+
+  MatchableDatasetPointer MatchableDatasetCache::Store(const std::string& key,
+                                                       const std::string& version,
+                                                       const void* dicom,
+                                                       size_t size)
+  {
+    // Parse outside of the mutex, as this is the costly part
+    MatchableDatasetPointer dataset(new MatchableDataset(context_, dicom, size));
+
+    boost::mutex::scoped_lock lock(mutex_);
+    content_[key] = std::make_pair(version, dataset);
+
+    return dataset;
+  }
+
+
+  void MatchableDatasetCache::Invalidate(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.erase(key);
+  }
+
+
+  size_t MatchableDatasetCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+
+
+  class CompiledFindMatcher::Constraint : public boost::noncopyable
+  {
+  private:
+    DicomTagKey  tag_;
+
+  public:
+    explicit Constraint(DicomTagKey tag) :
+      tag_(tag)
+    {
+    }
+
+    virtual ~Constraint()
+    {
+    }
+
+    DicomTagKey GetTag() const
+    {
+      return tag_;
+    }
+
+    // Must not allocate memory, as it is run by the matching threads
+    virtual bool IsMatch(const MatchableDataset& candidate,
+                         bool caseSensitivePN) const = 0;
+  };
+
+
+  namespace
+  {
+    typedef std::vector<boost::shared_ptr<CompiledFindMatcher::Constraint> >  ConstraintList;
+
+
+    enum ValueRepresentation
+    {
+      ValueRepresentation_Other,
+      ValueRepresentation_PersonName,
+      ValueRepresentation_DateTime   // DA, TM or DT: Range matching
+    };
+
+
+    static ValueRepresentation LookupValueRepresentation(OrthancPluginContext* context,
+                                                         DicomTagKey tag)
+    {
+      char name[16];
+      sprintf(name, "%04x,%04x", static_cast<unsigned int>(tag >> 16),
+              static_cast<unsigned int>(tag & 0xffff));
+
+      OrthancPluginDictionaryEntry entry;
+      if (OrthancPluginLookupDictionary(context, &entry, name) != OrthancPluginErrorCode_Success)
+      {
+        return ValueRepresentation_Other;   // Private or unknown tag
+      }
+
+      switch (entry.vr)
+      {
+        case OrthancPluginValueRepresentation_DA:
+        case OrthancPluginValueRepresentation_DT:
+        case OrthancPluginValueRepresentation_TM:
+          return ValueRepresentation_DateTime;
+
+        case OrthancPluginValueRepresentation_PN:
+          return ValueRepresentation_PersonName;
+
+        default:
+          return ValueRepresentation_Other;
+      }
+    }
+
+
+    // The value representations are read from the dictionary of the
+    // Orthanc core, once per tag, as the queries reuse the same tags
+    class ValueRepresentationCache : public boost::noncopyable
+    {
+    private:
+      typedef std::map<DicomTagKey, ValueRepresentation>  Content;
+
+      boost::mutex  mutex_;
+      Content       content_;
+
+    public:
+      ValueRepresentation Lookup(OrthancPluginContext* context,
+                                 DicomTagKey tag)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        Content::const_iterator found = content_.find(tag);
+        if (found != content_.end())
+        {
+          return found->second;
+        }
+
+        const ValueRepresentation vr = LookupValueRepresentation(context, tag);
+        content_[tag] = vr;
+        return vr;
+      }
+    };
+
+
+    static ValueRepresentationCache  valueRepresentations_;
+
+
+    static bool IsSameCharacter(char a,
+                                char b,
+                                bool caseSensitive)
+    {
+      if (caseSensitive)
+      {
+        return a == b;
+      }
+      else
+      {
+        return (toupper(static_cast<unsigned char>(a)) ==
+                toupper(static_cast<unsigned char>(b)));
+      }
+    }
+
+
+    static bool IsSameString(const std::string& a,
+                             const std::string& b,
+                             bool caseSensitive)
+    {
+      if (a.size() != b.size())
+      {
+        return false;
+      }
+
+      for (size_t i = 0; i < a.size(); i++)
+      {
+        if (!IsSameCharacter(a[i], b[i], caseSensitive))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+
+    // "*" matches any sequence of characters, "?" any single character
+    static bool MatchWildcard(const char* pattern,
+                              const char* value,
+                              bool caseSensitive)
+    {
+      const char* star = NULL;
+      const char* resume = NULL;
+
+      while (*value != '\0')
+      {
+        if (*pattern == '*')
+        {
+          star = pattern++;
+          resume = value;
+        }
+        else if (*pattern != '\0' &&
+                 (*pattern == '?' ||
+                  IsSameCharacter(*pattern, *value, caseSensitive)))
+        {
+          pattern++;
+          value++;
+        }
+        else if (star != NULL)
+        {
+          // Let the last star absorb one more character
+          pattern = star + 1;
+          value = ++resume;
+        }
+        else
+        {
+          return false;
+        }
+      }
+
+      while (*pattern == '*')
+      {
+        pattern++;
+      }
+
+      return *pattern == '\0';
+    }
+
+
+    // Single value, list of values (separated by backslashes) and
+    // wildcard matching
+    class ValuesConstraint : public CompiledFindMatcher::Constraint
+    {
+    private:
+      std::vector<std::string>  values_;
+      std::vector<bool>         isWildcard_;
+      bool                      isPersonName_;
+
+    public:
+      ValuesConstraint(DicomTagKey tag,
+                       const std::string& query,
+                       bool isPersonName,
+                       bool allowWildcards) :
+        Constraint(tag),
+        isPersonName_(isPersonName)
+      {
+        size_t start = 0;
+
+        for (;;)
+        {
+          size_t end = query.find('\\', start);
+          std::string value = boost::trim_copy(query.substr(start, end == std::string::npos ? std::string::npos : end - start));
+
+          values_.push_back(value);
+          isWildcard_.push_back(allowWildcards &&
+                                value.find_first_of("*?") != std::string::npos);
+
+          if (end == std::string::npos)
+          {
+            break;
+          }
+
+          start = end + 1;
+        }
+      }
+
+      virtual bool IsMatch(const MatchableDataset& candidate,
+                           bool caseSensitivePN) const
+      {
+        const std::string* value = candidate.LookupValue(GetTag());
+        if (value == NULL)
+        {
+          return false;
+        }
+
+        const bool caseSensitive = (!isPersonName_ || caseSensitivePN);
+
+        for (size_t i = 0; i < values_.size(); i++)
+        {
+          if (isWildcard_[i] ?
+              MatchWildcard(values_[i].c_str(), value->c_str(), caseSensitive) :
+              IsSameString(values_[i], *value, caseSensitive))
+          {
+            return true;
+          }
+        }
+
+        return false;
+      }
+    };
+
+
+    // Range matching on dates and times ("lower-upper", "lower-" or
+    // "-upper"), that compare as strings
+    class RangeConstraint : public CompiledFindMatcher::Constraint
+    {
+    private:
+      std::string  lower_;
+      std::string  upper_;
+
+    public:
+      RangeConstraint(DicomTagKey tag,
+                      const std::string& lower,
+                      const std::string& upper) :
+        Constraint(tag),
+        lower_(lower),
+        upper_(upper)
+      {
+      }
+
+      virtual bool IsMatch(const MatchableDataset& candidate,
+                           bool caseSensitivePN) const
+      {
+        const std::string* value = candidate.LookupValue(GetTag());
+
+        return (value != NULL &&
+                !value->empty() &&
+                (lower_.empty() || lower_.compare(*value) <= 0) &&
+                (upper_.empty() || value->compare(0, upper_.size(), upper_) <= 0));
+      }
+    };
+
+
+    // Matches if one item of the sequence satisfies all the nested
+    // constraints
+    class SequenceConstraint : public CompiledFindMatcher::Constraint
+    {
+    private:
+      ConstraintList  nested_;
+
+    public:
+      SequenceConstraint(DicomTagKey tag,
+                         const ConstraintList& nested) :
+        Constraint(tag),
+        nested_(nested)
+      {
+      }
+
+      virtual bool IsMatch(const MatchableDataset& candidate,
+                           bool caseSensitivePN) const
+      {
+        size_t count;
+        if (!candidate.LookupSequence(count, GetTag()))
+        {
+          return false;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+          const MatchableDataset& item = candidate.GetSequenceItem(GetTag(), i);
+
+          bool match = true;
+          for (size_t j = 0; match && j < nested_.size(); j++)
+          {
+            match = nested_[j]->IsMatch(item, caseSensitivePN);
+          }
+
+          if (match)
+          {
+            return true;
+          }
+        }
+
+        return false;
+      }
+    };
+  }
+
+
+  static void CompileConstraints(ConstraintList& target,
+                                 OrthancPluginContext* context,
+                                 const Json::Value& query)
+  {
+    if (query.type() != Json::objectValue)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+    }
+
+    Json::Value::Members members = query.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      DicomTagKey tag;
+      if (!ParseTag(tag, members[i]) ||
+          (tag >> 16) == 0x0002 ||   // Meta-header
+          tag == 0x00080005)         // SpecificCharacterSet
+      {
+        continue;
+      }
+
+      const Json::Value& value = query[members[i]];
+
+      if (value.type() == Json::arrayValue)
+      {
+        if (value.size() == 0)
+        {
+          continue;   // Universal matching
+        }
+
+        ConstraintList nested;
+        CompileConstraints(nested, context, value[0]);
+
+        if (!nested.empty())
+        {
+          target.push_back(boost::shared_ptr<CompiledFindMatcher::Constraint>(new SequenceConstraint(tag, nested)));
+        }
+      }
+      else if (value.type() == Json::stringValue)
+      {
+        const std::string s = boost::trim_copy(value.asString());
+        if (s.empty())
+        {
+          continue;   // Universal matching
+        }
+
+        const ValueRepresentation vr = valueRepresentations_.Lookup(context, tag);
+        const size_t dash = s.find('-');
+
+        if (vr == ValueRepresentation_DateTime &&
+            dash != std::string::npos)
+        {
+          target.push_back(boost::shared_ptr<CompiledFindMatcher::Constraint>(
+                             new RangeConstraint(tag, boost::trim_copy(s.substr(0, dash)),
+                                                 boost::trim_copy(s.substr(dash + 1)))));
+        }
+        else
+        {
+          target.push_back(boost::shared_ptr<CompiledFindMatcher::Constraint>(
+                             new ValuesConstraint(tag, s, vr == ValueRepresentation_PersonName,
+                                                  vr != ValueRepresentation_DateTime)));
+        }
+      }
+    }
+  }
+
+
+  void CompiledFindMatcher::Compile(OrthancPluginContext* context,
+                                    const Json::Value& query)
+  {
+    caseSensitivePN_ = false;
+    CompileConstraints(constraints_, context, query);
+  }
+
+
+  CompiledFindMatcher::CompiledFindMatcher(OrthancPluginContext*  context,
+                                           const Json::Value&     query)
+  {
+    Compile(context, query);
+  }
+
+
+  CompiledFindMatcher::CompiledFindMatcher(OrthancPluginContext*              context,
+                                           const OrthancPluginWorklistQuery*  worklist)
+  {
+    if (worklist == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    MemoryBuffer dicom(context);
+    dicom.GetDicomQuery(worklist);
+
+    Json::Value query;
+    dicom.DicomToJson(query, OrthancPluginDicomToJsonFormat_Short, OrthancPluginDicomToJsonFlags_None, 0);
+    Compile(context, query);
+  }
+
+
+  CompiledFindMatcher::CompiledFindMatcher(OrthancPluginContext*  context,
+                                           const void*            query,
+                                           uint32_t               size)
+  {
+    OrthancString json(context);
+    json.Assign(OrthancPluginDicomBufferToJson(context, query, size, OrthancPluginDicomToJsonFormat_Short,
+                                               OrthancPluginDicomToJsonFlags_None, 0));
+
+    if (json.GetContent() == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+    }
+
+    Json::Value tags;
+    json.ToJson(tags);
+    Compile(context, tags);
+  }
+
+
+  bool CompiledFindMatcher::IsMatch(const MatchableDataset& candidate) const
+  {
+    for (size_t i = 0; i < constraints_.size(); i++)
+    {
+      if (!constraints_[i]->IsMatch(candidate, caseSensitivePN_))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  static void MatchBand(const CompiledFindMatcher* matcher,
+                        const std::vector<MatchableDatasetPointer>* candidates,
+                        uint8_t* flags,
+                        size_t first,
+                        size_t end)
+  {
+    for (size_t i = first; i < end; i++)
+    {
+      const MatchableDataset* candidate = (*candidates)[i].get();
+      flags[i] = (candidate != NULL && matcher->IsMatch(*candidate)) ? 1 : 0;
+    }
+  }
+
+
+  void CompiledFindMatcher::IsMatchBatch(std::vector<size_t>& matches,
+                                         const std::vector<MatchableDatasetPointer>& candidates,
+                                         unsigned int threadsCount) const
+  {
+    matches.clear();
+
+    if (candidates.empty())
+    {
+      return;
+    }
+
+    if (threadsCount == 0)
+    {
+      threadsCount = boost::thread::hardware_concurrency();
+    }
+
+    const size_t count = candidates.size();
+    const size_t bandsCount = std::min(static_cast<size_t>(threadsCount), count / MIN_CANDIDATES_PER_BAND);
+
+    std::vector<uint8_t> flags(count);
+
+    if (bandsCount <= 1)
+    {
+      MatchBand(this, &candidates, &flags[0], 0, count);
+    }
+    else
+    {
+      // The workers never throw exceptions, as the constraints do not
+      // allocate memory. The threads are joined before "flags" is
+      // destroyed, even if one of them cannot be created.
+      ScopedThreadGroup threads;
+      for (size_t band = 1; band < bandsCount; band++)
+      {
+        threads.CreateThread(boost::bind(MatchBand, this, &candidates, &flags[0],
+                                          count * band / bandsCount,
+                                          count * (band + 1) / bandsCount));
+      }
+
+      MatchBand(this, &candidates, &flags[0], 0, count / bandsCount);
+      threads.JoinAll();
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+      if (flags[i])
+      {
+        matches.push_back(i);
+      }
+    }
+  }
+}
@@ -0,0 +1,165 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // DICOM tag, as "(group << 16) | element"
+  typedef uint32_t  DicomTagKey;
+
+
+  /**
+   * Values of the tags of a DICOM dataset, extracted once, so that
+   * many queries can be matched against the dataset without parsing
+   * it again. The values are sorted by tag, and the items of the
+   * sequences are kept as nested datasets (e.g. the "Scheduled
+   * Procedure Step Sequence" of the worklists).
+   **/
+  class MatchableDataset : public boost::noncopyable
+  {
+  private:
+    typedef std::vector<boost::shared_ptr<MatchableDataset> >  Items;
+
+    std::vector<std::pair<DicomTagKey, std::string> >  values_;
+    std::vector<std::pair<DicomTagKey, Items> >        sequences_;
+
+    void Load(const Json::Value& tags);
+
+  public:
+    // The tags are in the "short" format of "DicomToJson()"
+    explicit MatchableDataset(const Json::Value& tags);
+
+    MatchableDataset(OrthancPluginContext* context,
+                     const void* dicom,
+                     size_t size);
+
+    // Returns NULL if the tag is absent, or is not a string
+    const std::string* LookupValue(DicomTagKey tag) const;
+
+    // Returns "false" if the tag is absent, or is not a sequence
+    bool LookupSequence(size_t& itemsCount,
+                        DicomTagKey tag) const;
+
+    const MatchableDataset& GetSequenceItem(DicomTagKey tag,
+                                            size_t index) const;
+  };
+
+
+  typedef boost::shared_ptr<const MatchableDataset>  MatchableDatasetPointer;
+
+
+  /**
+   * Parsed datasets, indexed by a key (e.g. the path of a worklist
+   * file), together with a version (e.g. its modification time). A
+   * dataset is only parsed again if its version changes.
+   **/
+  class MatchableDatasetCache : public boost::noncopyable
+  {
+  private:
+    typedef std::map<std::string, std::pair<std::string, MatchableDatasetPointer> >  Content;
+
+    OrthancPluginContext*  context_;
+    boost::mutex           mutex_;
+    Content                content_;
+
+  public:
+    MatchableDatasetCache(OrthancPluginContext* context) :
+      context_(context)
+    {
+    }
+
+    // Returns NULL if the dataset is not cached with this version
+    MatchableDatasetPointer Lookup(const std::string& key,
+                                   const std::string& version);
+
+    // Parses the DICOM buffer, and caches the result
+    MatchableDatasetPointer Store(const std::string& key,
+                                  const std::string& version,
+                                  const void* dicom,
+                                  size_t size);
+
+    void Invalidate(const std::string& key);
+
+    size_t GetSize();
+  };
+
+
+  /**
+   * Matcher that compiles a C-FIND query once into a list of
+   * constraints, then evaluates them against parsed datasets, with
+   * the rules of the DICOM standard (PS 3.4, C.2.2.2): Universal,
+   * single value, list of values, wildcard, range (for dates and
+   * times) and sequence matching. Unlike "FindMatcher", no call to
+   * the Orthanc core is made to evaluate a candidate.
+   **/
+  class CompiledFindMatcher : public boost::noncopyable
+  {
+  public:
+    class Constraint;   // Defined in the .cpp file
+
+  private:
+    typedef std::vector<boost::shared_ptr<Constraint> >  Constraints;
+
+    Constraints  constraints_;
+    bool         caseSensitivePN_;
+
+    void Compile(OrthancPluginContext* context,
+                 const Json::Value& query);
+
+  public:
+    // The query is in the "short" format of "DicomToJson()". The
+    // context gives access to the dictionary of the DICOM tags.
+    CompiledFindMatcher(OrthancPluginContext*  context,
+                        const Json::Value&     query);
+
+    CompiledFindMatcher(OrthancPluginContext*              context,
+                        const OrthancPluginWorklistQuery*  worklist);
+
+    CompiledFindMatcher(OrthancPluginContext*  context,
+                        const void*            query,
+                        uint32_t               size);
+
+    // Same as the "CaseSensitivePN" option of Orthanc (false by default)
+    void SetCaseSensitivePN(bool caseSensitive)
+    {
+      caseSensitivePN_ = caseSensitive;
+    }
+
+    bool IsMatch(const MatchableDataset& candidate) const;
+
+    // Stores in "matches" the indexes of the matching candidates, in
+    // increasing order. The candidates are split between
+    // "threadsCount" threads (0 means all the cores).
+    void IsMatchBatch(std::vector<size_t>& matches,
+                      const std::vector<MatchableDatasetPointer>& candidates,
+                      unsigned int threadsCount) const;
+  };
+}
@@ -0,0 +1,276 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "DecodedFrameCache.h"
+
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  DecodedFrame::DecodedFrame(OrthancImage* image,
+                             const Json::Value& tags) :
+    image_(image),
+    tags_(tags)
+  {
+    if (image == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NullPointer);
+    }
+
+    memorySize_ = static_cast<size_t>(image->GetPitch()) * image->GetHeight();
+  }
+
+
+  void DecodedFrameCache::Remove(Content::iterator it)
+  {
+    currentSize_ -= it->second.frame_->GetMemorySize();
+    recency_.erase(it->second.recency_);
+    content_.erase(it);
+  }
+
+
+  void DecodedFrameCache::MakeRoom(size_t size)
+  {
+    while (!recency_.empty() &&
+           currentSize_ + size > maxSize_)
+    {
+      Content::iterator victim = content_.find(recency_.back());
+      assert(victim != content_.end());
+      Remove(victim);
+    }
+  }
+
+
+  void DecodedFrameCache::Store(const Key& key,
+                                DecodedFramePointer frame)
+  {
+    if (frame->GetMemorySize() > maxSize_)
+    {
+      return;  // Too large to be cached
+    }
+
+    MakeRoom(frame->GetMemorySize());
+
+    recency_.push_front(key);
+
+    Entry& entry = content_[key];
+    entry.frame_ = frame;
+    entry.recency_ = recency_.begin();
+    currentSize_ += frame->GetMemorySize();
+  }
+
+
+  void DecodedFrameCache::CompleteDecoding(const Key& key,
+                                           DecodedFramePointer frame,
+                                           OrthancPluginErrorCode error)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Pending::iterator it = pending_.find(key);
+    assert(it != pending_.end());
+
+    PendingDecoding& pending = *it->second;
+    pending.done_ = true;
+    pending.frame_ = frame;
+    pending.error_ = error;
+
+    if (error == OrthancPluginErrorCode_Success &&
+        !pending.invalidated_)
+    {
+      Store(key, frame);
+    }
+
+    pending_.erase(it);
+    decoded_.notify_all();
+  }
+
+
+  DecodedFrame* DecodedFrameCache::Decode(const std::string& instanceId,
+                                          unsigned int frame)
+  {
+    MemoryBuffer dicom(context_);
+    if (!dicom.RestApiGet("/instances/" + instanceId + "/file", false))
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+    }
+
+    Json::Value tags;
+    dicom.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short,
+                      OrthancPluginDicomToJsonFlags_None, 256);
+
+    OrthancImage* image = new OrthancImage(context_);
+
+    try
+    {
+      image->DecodeDicomImage(dicom.GetData(), dicom.GetSize(), frame);
+    }
+    catch (...)
+    {
+      delete image;
+      throw;
+    }
+
+    return new DecodedFrame(image, tags);
+  }
+
+
+  DecodedFrameCache::DecodedFrameCache(OrthancPluginContext* context,
+                                       size_t maxSize) :
+    context_(context),
+    maxSize_(maxSize),
+    currentSize_(0)
+  {
+  }
+
+
+  void DecodedFrameCache::SetMaximumSize(size_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxSize_ = maxSize;
+    MakeRoom(0);
+  }
+
+
+  size_t DecodedFrameCache::GetMaximumSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_;
+  }
+
+
+  size_t DecodedFrameCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  DecodedFramePointer DecodedFrameCache::Acquire(const std::string& instanceId,
+                                                 unsigned int frame)
+  {
+    const Key key(instanceId, frame);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Content::iterator found = content_.find(key);
+      if (found != content_.end())
+      {
+        // Cache hit: Mark the frame as the most recently used
+        recency_.splice(recency_.begin(), recency_, found->second.recency_);
+        return found->second.frame_;
+      }
+
+      Pending::iterator pending = pending_.find(key);
+      if (pending != pending_.end())
+      {
+        // Another thread is decoding this frame: Wait for its result
+        boost::shared_ptr<PendingDecoding> decoding = pending->second;
+        while (!decoding->done_)
+        {
+          decoded_.wait(lock);
+        }
+
+        if (decoding->error_ == OrthancPluginErrorCode_Success)
+        {
+          return decoding->frame_;
+        }
+        else
+        {
+          ORTHANC_PLUGINS_THROW_EXCEPTION(decoding->error_);
+        }
+      }
+
+      pending_[key].reset(new PendingDecoding);
+    }
+
+    // This thread is in charge of decoding the frame, which is done
+    // without holding the mutex
+    DecodedFramePointer decoded;
+
+    try
+    {
+      decoded.reset(Decode(instanceId, frame));
+    }
+#if HAS_ORTHANC_EXCEPTION == 1
+    catch (Orthanc::OrthancException& e)
+    {
+      CompleteDecoding(key, decoded, static_cast<OrthancPluginErrorCode>(e.GetErrorCode()));
+      throw;
+    }
+#else
+    catch (PluginException& e)
+    {
+      CompleteDecoding(key, decoded, e.GetErrorCode());
+      throw;
+    }
+#endif
+    catch (...)
+    {
+      CompleteDecoding(key, decoded, OrthancPluginErrorCode_Plugin);
+      throw;
+    }
+
+    CompleteDecoding(key, decoded, OrthancPluginErrorCode_Success);
+    return decoded;
+  }
+
+
+  void DecodedFrameCache::Invalidate(const std::string& instanceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // The keys are sorted by instance, then by frame number
+    Content::iterator it = content_.lower_bound(Key(instanceId, 0));
+    while (it != content_.end() &&
+           it->first.first == instanceId)
+    {
+      Content::iterator next = it;
+      ++next;
+      Remove(it);
+      it = next;
+    }
+
+    // Prevent the frames that are being decoded from entering the cache
+    for (Pending::iterator pending = pending_.lower_bound(Key(instanceId, 0));
+         pending != pending_.end() && pending->first.first == instanceId; ++pending)
+    {
+      pending->second->invalidated_ = true;
+    }
+  }
+
+
+  void DecodedFrameCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    content_.clear();
+    recency_.clear();
+    currentSize_ = 0;
+
+    for (Pending::iterator it = pending_.begin(); it != pending_.end(); ++it)
+    {
+      it->second->invalidated_ = true;
+    }
+  }
+}
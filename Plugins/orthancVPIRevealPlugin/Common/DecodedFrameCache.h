@@ -0,0 +1,160 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+
+
+namespace OrthancPlugins
+{
+  class DecodedFrame : public boost::noncopyable
+  {
+  private:
+    boost::scoped_ptr<OrthancImage>  image_;
+    Json::Value                      tags_;
+    size_t                           memorySize_;
+
+  public:
+    // This takes the ownership of the image. The tags are those of
+    // the parent instance, in the "short" format.
+    DecodedFrame(OrthancImage* image,
+                 const Json::Value& tags);
+
+    OrthancImage& GetImage() const
+    {
+      return *image_;
+    }
+
+    const Json::Value& GetTags() const
+    {
+      return tags_;
+    }
+
+    size_t GetMemorySize() const
+    {
+      return memorySize_;
+    }
+  };
+
+
+  typedef boost::shared_ptr<DecodedFrame>  DecodedFramePointer;
+
+
+  /**
+   * LRU cache of the decoded frames, indexed by (instance, frame) and
+   * limited by the total size of their pixel buffers. Concurrent
+   * requests for the same frame are merged: Only the first one
+   * decodes the frame, the others wait for its result. The frames
+   * are shared pointers, so an evicted frame stays valid as long as
+   * some request is still using it.
+   **/
+  class DecodedFrameCache : public boost::noncopyable
+  {
+  private:
+    typedef std::pair<std::string, unsigned int>  Key;
+
+    struct Entry
+    {
+      DecodedFramePointer        frame_;
+      std::list<Key>::iterator   recency_;
+    };
+
+    struct PendingDecoding
+    {
+      bool                    done_;
+      bool                    invalidated_;
+      DecodedFramePointer     frame_;
+      OrthancPluginErrorCode  error_;
+
+      PendingDecoding() :
+        done_(false),
+        invalidated_(false),
+        error_(OrthancPluginErrorCode_Success)
+      {
+      }
+    };
+
+    typedef std::map<Key, Entry>                                 Content;
+    typedef std::map<Key, boost::shared_ptr<PendingDecoding> >   Pending;
+
+    OrthancPluginContext*      context_;
+    boost::mutex               mutex_;
+    boost::condition_variable  decoded_;
+    size_t                     maxSize_;
+    size_t                     currentSize_;
+    Content                    content_;
+    std::list<Key>             recency_;   // Most recently used at the front
+    Pending                    pending_;
+
+    void Remove(Content::iterator it);
+
+    void MakeRoom(size_t size);
+
+    void Store(const Key& key,
+               DecodedFramePointer frame);
+
+    void CompleteDecoding(const Key& key,
+                          DecodedFramePointer frame,
+                          OrthancPluginErrorCode error);
+
+  protected:
+    // Reads the instance through the REST API of Orthanc, then
+    // decodes the frame. This transfers ownership.
+    virtual DecodedFrame* Decode(const std::string& instanceId,
+                                 unsigned int frame);
+
+  public:
+    DecodedFrameCache(OrthancPluginContext* context,
+                      size_t maxSize);
+
+    virtual ~DecodedFrameCache()
+    {
+    }
+
+    OrthancPluginContext* GetContext() const
+    {
+      return context_;
+    }
+
+    void SetMaximumSize(size_t maxSize);
+
+    size_t GetMaximumSize();
+
+    size_t GetCurrentSize();
+
+    DecodedFramePointer Acquire(const std::string& instanceId,
+                                unsigned int frame);
+
+    // Must be called whenever an instance is deleted
+    void Invalidate(const std::string& instanceId);
+
+    void Clear();
+  };
+}
@@ -0,0 +1,792 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "ImageResampling.h"
+
+#include "PixelFormatConversion.h"
+#include "SimdSupport.h"
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Below this number of rows per band, the cost of handing a band
+  // over to another thread is not worth it
+  static const unsigned int MIN_ROWS_PER_BAND = 32;
+
+  typedef boost::function<void (unsigned int /* first row */,
+                                unsigned int /* end row */)>  BandWorker;
+
+
+  // Threads that are shared by all the resampling passes, so that
+  // each pass does not pay for starting and joining its threads. The
+  // thread that submits a pass also processes its bands, which
+  // guarantees progress even if all the threads are busy.
+  class BandThreads : public boost::noncopyable
+  {
+  private:
+    // Never throws: The error code is returned instead
+    static OrthancPluginErrorCode ProcessBand(const BandWorker& worker,
+                                              unsigned int firstRow,
+                                              unsigned int endRow)
+    {
+      try
+      {
+        worker(firstRow, endRow);
+        return OrthancPluginErrorCode_Success;
+      }
+#if HAS_ORTHANC_EXCEPTION == 1
+      catch (Orthanc::OrthancException& e)
+      {
+        return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+      }
+#else
+      catch (PluginException& e)
+      {
+        return e.GetErrorCode();
+      }
+#endif
+      catch (std::bad_alloc&)
+      {
+        return OrthancPluginErrorCode_NotEnoughMemory;
+      }
+      catch (...)
+      {
+        return OrthancPluginErrorCode_InternalError;
+      }
+    }
+
+    struct Pass
+    {
+      const BandWorker*       worker_;
+      unsigned int            pending_;   // Bands not processed yet
+      OrthancPluginErrorCode  error_;
+    };
+
+    struct Band
+    {
+      Pass*         pass_;
+      unsigned int  firstRow_;
+      unsigned int  endRow_;
+    };
+
+    boost::mutex               mutex_;
+    boost::condition_variable  bandQueued_;
+    boost::condition_variable  bandDone_;
+    std::deque<Band>           queue_;
+    bool                       stopping_;
+    boost::thread_group        threads_;
+
+    // Called with the mutex locked, that is unlocked while the band
+    // is processed
+    void Process(boost::mutex::scoped_lock& lock,
+                 const Band& band)
+    {
+      lock.unlock();
+      OrthancPluginErrorCode error = ProcessBand(*band.pass_->worker_, band.firstRow_, band.endRow_);
+      lock.lock();
+
+      if (error != OrthancPluginErrorCode_Success &&
+          band.pass_->error_ == OrthancPluginErrorCode_Success)
+      {
+        band.pass_->error_ = error;
+      }
+
+      band.pass_->pending_--;
+      if (band.pass_->pending_ == 0)
+      {
+        bandDone_.notify_all();
+      }
+    }
+
+    void Worker()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (;;)
+      {
+        while (queue_.empty() &&
+               !stopping_)
+        {
+          bandQueued_.wait(lock);
+        }
+
+        if (stopping_)
+        {
+          return;
+        }
+
+        Band band = queue_.front();
+        queue_.pop_front();
+        Process(lock, band);
+      }
+    }
+
+    BandThreads() :
+      stopping_(false)
+    {
+      // The calling thread processes one band of each pass
+      unsigned int count = boost::thread::hardware_concurrency();
+      if (count > 1)
+      {
+        try
+        {
+          for (unsigned int i = 0; i + 1 < count; i++)
+          {
+            threads_.create_thread(boost::bind(&BandThreads::Worker, this));
+          }
+        }
+        catch (...)
+        {
+          // Go on with the threads that could be started
+        }
+      }
+    }
+
+  public:
+    ~BandThreads()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopping_ = true;
+        bandQueued_.notify_all();
+      }
+
+      threads_.join_all();
+    }
+
+    static BandThreads& GetInstance()
+    {
+      static BandThreads instance;
+      return instance;
+    }
+
+    void Run(unsigned int rowsCount,
+             unsigned int bandsCount,
+             const BandWorker& worker)
+    {
+      Pass pass;
+      pass.worker_ = &worker;
+      pass.pending_ = bandsCount;
+      pass.error_ = OrthancPluginErrorCode_Success;
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (unsigned int band = 0; band < bandsCount; band++)
+      {
+        Band item;
+        item.pass_ = &pass;
+        item.firstRow_ = rowsCount * band / bandsCount;
+        item.endRow_ = rowsCount * (band + 1) / bandsCount;
+        queue_.push_back(item);
+      }
+
+      bandQueued_.notify_all();
+
+      // Process the bands of this pass that no thread has taken yet,
+      // then wait for the other ones
+      while (pass.pending_ > 0)
+      {
+        std::deque<Band>::iterator it = queue_.begin();
+        while (it != queue_.end() &&
+               it->pass_ != &pass)
+        {
+          ++it;
+        }
+
+        if (it == queue_.end())
+        {
+          bandDone_.wait(lock);
+        }
+        else
+        {
+          Band band = *it;
+          queue_.erase(it);
+          Process(lock, band);
+        }
+      }
+
+      if (pass.error_ != OrthancPluginErrorCode_Success)
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(pass.error_);
+      }
+    }
+  };
+
+
+  static void ProcessBands(unsigned int rowsCount,
+                           unsigned int threadsCount,
+                           const BandWorker& worker)
+  {
+    if (threadsCount == 0)
+    {
+      threadsCount = boost::thread::hardware_concurrency();
+    }
+
+    unsigned int bandsCount = std::min(threadsCount, rowsCount / MIN_ROWS_PER_BAND);
+
+    if (bandsCount <= 1)
+    {
+      worker(0, rowsCount);
+    }
+    else
+    {
+      BandThreads::GetInstance().Run(rowsCount, bandsCount, worker);
+    }
+  }
+
+
+  template <typename T>
+  static inline T RoundedAverage(int64_t sum,
+                                 int64_t count)
+  {
+    // Round half away from zero
+    if (sum >= 0)
+    {
+      return static_cast<T>((sum + count / 2) / count);
+    }
+    else
+    {
+      return static_cast<T>(-((-sum + count / 2) / count));
+    }
+  }
+
+
+  template <typename T,
+            unsigned int Channels>
+  static void DownscaleBand(uint8_t* target,
+                            unsigned int targetPitch,
+                            const uint8_t* source,
+                            unsigned int sourcePitch,
+                            unsigned int targetWidth,
+                            unsigned int factor,
+                            unsigned int firstRow,
+                            unsigned int endRow)
+  {
+    const unsigned int rowSize = targetWidth * Channels;
+    const int64_t count = static_cast<int64_t>(factor) * static_cast<int64_t>(factor);
+
+    PooledBuffer buffer(rowSize * sizeof(int64_t));
+    int64_t* sums = reinterpret_cast<int64_t*>(buffer.GetData());
+
+    for (unsigned int y = firstRow; y < endRow; y++)
+    {
+      std::fill(sums, sums + rowSize, 0);
+
+      for (unsigned int dy = 0; dy < factor; dy++)
+      {
+        const T* p = reinterpret_cast<const T*>(source + (static_cast<size_t>(y) * factor + dy) * sourcePitch);
+
+        for (unsigned int x = 0; x < targetWidth; x++)
+        {
+          int64_t* sum = &sums[x * Channels];
+
+          for (unsigned int dx = 0; dx < factor; dx++, p += Channels)
+          {
+            for (unsigned int c = 0; c < Channels; c++)
+            {
+              sum[c] += p[c];
+            }
+          }
+        }
+      }
+
+      T* q = reinterpret_cast<T*>(target + static_cast<size_t>(y) * targetPitch);
+      for (unsigned int i = 0; i < rowSize; i++)
+      {
+        q[i] = RoundedAverage<T>(sums[i], count);
+      }
+    }
+  }
+
+
+  template <typename T,
+            unsigned int Channels>
+  static void DownscaleTemplate(void* target,
+                                unsigned int targetPitch,
+                                const void* source,
+                                unsigned int sourcePitch,
+                                unsigned int sourceWidth,
+                                unsigned int sourceHeight,
+                                unsigned int factor,
+                                unsigned int threadsCount)
+  {
+    ProcessBands(sourceHeight / factor, threadsCount,
+                 boost::bind(DownscaleBand<T, Channels>,
+                             reinterpret_cast<uint8_t*>(target), targetPitch,
+                             reinterpret_cast<const uint8_t*>(source), sourcePitch,
+                             sourceWidth / factor, factor, _1, _2));
+  }
+
+
+  void DownscaleBuffer(void*                     target,
+                       unsigned int              targetPitch,
+                       const void*               source,
+                       unsigned int              sourcePitch,
+                       OrthancPluginPixelFormat  format,
+                       unsigned int              sourceWidth,
+                       unsigned int              sourceHeight,
+                       unsigned int              factor,
+                       unsigned int              threadsCount)
+  {
+    if (factor == 0 ||
+        targetPitch < (sourceWidth / factor) * GetBytesPerPixel(format) ||
+        sourcePitch < sourceWidth * GetBytesPerPixel(format))
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    switch (format)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        DownscaleTemplate<uint8_t, 1>(target, targetPitch, source, sourcePitch,
+                                      sourceWidth, sourceHeight, factor, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_Grayscale16:
+        DownscaleTemplate<uint16_t, 1>(target, targetPitch, source, sourcePitch,
+                                       sourceWidth, sourceHeight, factor, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        DownscaleTemplate<int16_t, 1>(target, targetPitch, source, sourcePitch,
+                                      sourceWidth, sourceHeight, factor, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_RGB24:
+        DownscaleTemplate<uint8_t, 3>(target, targetPitch, source, sourcePitch,
+                                      sourceWidth, sourceHeight, factor, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_RGBA32:
+        DownscaleTemplate<uint8_t, 4>(target, targetPitch, source, sourcePitch,
+                                      sourceWidth, sourceHeight, factor, threadsCount);
+        break;
+
+      default:
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotImplemented);
+    }
+  }
+
+
+  /**
+   * Lanczos resampling
+   **/
+
+  namespace
+  {
+    // Weights of the source samples contributing to each target
+    // sample, along one axis
+    class FilterBank : public boost::noncopyable
+    {
+    private:
+      unsigned int               windowSize_;
+      std::vector<unsigned int>  starts_;
+      std::vector<unsigned int>  counts_;
+      std::vector<float>         weights_;
+
+      static float Lanczos3(float x)
+      {
+        static const float PI = 3.14159265358979f;
+
+        x = std::fabs(x);
+        if (x < 1e-6f)
+        {
+          return 1.0f;
+        }
+        else if (x >= 3.0f)
+        {
+          return 0.0f;
+        }
+        else
+        {
+          const float y = PI * x;
+          return 3.0f * std::sin(y) * std::sin(y / 3.0f) / (y * y);
+        }
+      }
+
+    public:
+      FilterBank(unsigned int sourceSize,
+                 unsigned int targetSize)
+      {
+        const float scale = static_cast<float>(sourceSize) / static_cast<float>(targetSize);
+
+        // When downscaling, the kernel is stretched to cover all the
+        // source samples, which provides the low-pass filtering
+        const float filterScale = std::max(scale, 1.0f);
+        const float support = 3.0f * filterScale;
+
+        windowSize_ = static_cast<unsigned int>(std::ceil(2.0f * support)) + 2;
+        starts_.resize(targetSize);
+        counts_.resize(targetSize);
+        weights_.resize(targetSize * windowSize_);
+
+        for (unsigned int i = 0; i < targetSize; i++)
+        {
+          const float center = (static_cast<float>(i) + 0.5f) * scale;
+
+          int left = static_cast<int>(std::floor(center - support));
+          int right = static_cast<int>(std::ceil(center + support));
+          left = std::max(left, 0);
+          right = std::min(right, static_cast<int>(sourceSize));
+          right = std::min(right, left + static_cast<int>(windowSize_));
+
+          float* w = &weights_[i * windowSize_];
+          float total = 0;
+
+          for (int j = left; j < right; j++)
+          {
+            w[j - left] = Lanczos3((static_cast<float>(j) + 0.5f - center) / filterScale);
+            total += w[j - left];
+          }
+
+          // Normalize, so that flat regions are preserved near the borders
+          for (int j = left; j < right; j++)
+          {
+            w[j - left] /= total;
+          }
+
+          starts_[i] = static_cast<unsigned int>(left);
+          counts_[i] = static_cast<unsigned int>(right - left);
+        }
+      }
+
+      unsigned int GetStart(unsigned int i) const
+      {
+        return starts_[i];
+      }
+
+      unsigned int GetCount(unsigned int i) const
+      {
+        return counts_[i];
+      }
+
+      const float* GetWeights(unsigned int i) const
+      {
+        return &weights_[i * windowSize_];
+      }
+    };
+  }
+
+
+  static void AccumulateRow(float* target,
+                            const float* source,
+                            float weight,
+                            unsigned int size)
+  {
+    unsigned int i = 0;
+
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1
+    if (GetSimdInstructionSet() != SimdInstructionSet_None)
+    {
+      const __m128 w = _mm_set1_ps(weight);
+      for (; i + 4 <= size; i += 4)
+      {
+        _mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i),
+                                             _mm_mul_ps(_mm_loadu_ps(source + i), w)));
+      }
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+      target[i] += weight * source[i];
+    }
+  }
+
+
+  template <typename T,
+            unsigned int Channels>
+  static void HorizontalLanczosBand(float* intermediate,
+                                    const uint8_t* source,
+                                    unsigned int sourcePitch,
+                                    unsigned int targetWidth,
+                                    const FilterBank& bank,
+                                    unsigned int firstRow,
+                                    unsigned int endRow)
+  {
+    for (unsigned int y = firstRow; y < endRow; y++)
+    {
+      const T* p = reinterpret_cast<const T*>(source + static_cast<size_t>(y) * sourcePitch);
+      float* q = intermediate + static_cast<size_t>(y) * targetWidth * Channels;
+
+      for (unsigned int x = 0; x < targetWidth; x++, q += Channels)
+      {
+        const T* s = p + bank.GetStart(x) * Channels;
+        const float* w = bank.GetWeights(x);
+        const unsigned int count = bank.GetCount(x);
+
+        float sum[Channels];
+        for (unsigned int c = 0; c < Channels; c++)
+        {
+          sum[c] = 0;
+        }
+
+        for (unsigned int k = 0; k < count; k++, s += Channels)
+        {
+          for (unsigned int c = 0; c < Channels; c++)
+          {
+            sum[c] += w[k] * static_cast<float>(s[c]);
+          }
+        }
+
+        for (unsigned int c = 0; c < Channels; c++)
+        {
+          q[c] = sum[c];
+        }
+      }
+    }
+  }
+
+
+  template <typename T,
+            unsigned int Channels>
+  static void VerticalLanczosBand(uint8_t* target,
+                                  unsigned int targetPitch,
+                                  const float* intermediate,
+                                  unsigned int targetWidth,
+                                  const FilterBank& bank,
+                                  unsigned int firstRow,
+                                  unsigned int endRow)
+  {
+    const unsigned int rowSize = targetWidth * Channels;
+    PooledBuffer buffer(rowSize * sizeof(float));
+    float* sums = reinterpret_cast<float*>(buffer.GetData());
+
+    for (unsigned int y = firstRow; y < endRow; y++)
+    {
+      std::fill(sums, sums + rowSize, 0.0f);
+
+      const float* w = bank.GetWeights(y);
+      const unsigned int count = bank.GetCount(y);
+
+      for (unsigned int k = 0; k < count; k++)
+      {
+        AccumulateRow(sums, intermediate + static_cast<size_t>(bank.GetStart(y) + k) * rowSize, w[k], rowSize);
+      }
+
+      T* q = reinterpret_cast<T*>(target + static_cast<size_t>(y) * targetPitch);
+      for (unsigned int i = 0; i < rowSize; i++)
+      {
+        q[i] = ClampAndRound<T>(sums[i]);
+      }
+    }
+  }
+
+
+  template <typename T,
+            unsigned int Channels>
+  static void ResizeLanczosTemplate(void* target,
+                                    unsigned int targetPitch,
+                                    unsigned int targetWidth,
+                                    unsigned int targetHeight,
+                                    const void* source,
+                                    unsigned int sourcePitch,
+                                    unsigned int sourceWidth,
+                                    unsigned int sourceHeight,
+                                    unsigned int threadsCount)
+  {
+    const FilterBank horizontal(sourceWidth, targetWidth);
+    const FilterBank vertical(sourceHeight, targetHeight);
+
+    // Result of the horizontal pass: "sourceHeight" rows of
+    // "targetWidth" pixels
+    PooledBuffer buffer(static_cast<size_t>(sourceHeight) * targetWidth * Channels * sizeof(float));
+    float* intermediate = reinterpret_cast<float*>(buffer.GetData());
+
+    ProcessBands(sourceHeight, threadsCount,
+                 boost::bind(HorizontalLanczosBand<T, Channels>, intermediate,
+                             reinterpret_cast<const uint8_t*>(source), sourcePitch,
+                             targetWidth, boost::cref(horizontal), _1, _2));
+
+    ProcessBands(targetHeight, threadsCount,
+                 boost::bind(VerticalLanczosBand<T, Channels>,
+                             reinterpret_cast<uint8_t*>(target), targetPitch,
+                             intermediate, targetWidth, boost::cref(vertical), _1, _2));
+  }
+
+
+  void ResizeBufferLanczos(void*                     target,
+                           unsigned int              targetPitch,
+                           unsigned int              targetWidth,
+                           unsigned int              targetHeight,
+                           const void*               source,
+                           unsigned int              sourcePitch,
+                           unsigned int              sourceWidth,
+                           unsigned int              sourceHeight,
+                           OrthancPluginPixelFormat  format,
+                           unsigned int              threadsCount)
+  {
+    if (targetWidth == 0 ||
+        targetHeight == 0 ||
+        sourceWidth == 0 ||
+        sourceHeight == 0 ||
+        targetPitch < targetWidth * GetBytesPerPixel(format) ||
+        sourcePitch < sourceWidth * GetBytesPerPixel(format))
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    switch (format)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        ResizeLanczosTemplate<uint8_t, 1>(target, targetPitch, targetWidth, targetHeight,
+                                          source, sourcePitch, sourceWidth, sourceHeight, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_Grayscale16:
+        ResizeLanczosTemplate<uint16_t, 1>(target, targetPitch, targetWidth, targetHeight,
+                                           source, sourcePitch, sourceWidth, sourceHeight, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        ResizeLanczosTemplate<int16_t, 1>(target, targetPitch, targetWidth, targetHeight,
+                                          source, sourcePitch, sourceWidth, sourceHeight, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_RGB24:
+        ResizeLanczosTemplate<uint8_t, 3>(target, targetPitch, targetWidth, targetHeight,
+                                          source, sourcePitch, sourceWidth, sourceHeight, threadsCount);
+        break;
+
+      case OrthancPluginPixelFormat_RGBA32:
+        ResizeLanczosTemplate<uint8_t, 4>(target, targetPitch, targetWidth, targetHeight,
+                                          source, sourcePitch, sourceWidth, sourceHeight, threadsCount);
+        break;
+
+      default:
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotImplemented);
+    }
+  }
+
+
+  OrthancImage* DownscaleImage(OrthancImage&  source,
+                               unsigned int   factor,
+                               unsigned int   threadsCount)
+  {
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    if (factor == 0 ||
+        width / factor == 0 ||
+        height / factor == 0)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    OrthancImage* target = new OrthancImage(source.GetContext(), source.GetPixelFormat(),
+                                            width / factor, height / factor);
+
+    try
+    {
+      DownscaleBuffer(target->GetWritableBuffer(), target->GetPitch(),
+                      source.GetBuffer(), source.GetPitch(), source.GetPixelFormat(),
+                      width, height, factor, threadsCount);
+      return target;
+    }
+    catch (...)
+    {
+      delete target;
+      throw;
+    }
+  }
+
+
+  OrthancImage* ResizeImageLanczos(OrthancImage&  source,
+                                   unsigned int   targetWidth,
+                                   unsigned int   targetHeight,
+                                   unsigned int   threadsCount)
+  {
+    OrthancImage* target = new OrthancImage(source.GetContext(), source.GetPixelFormat(),
+                                            targetWidth, targetHeight);
+
+    try
+    {
+      ResizeBufferLanczos(target->GetWritableBuffer(), target->GetPitch(), targetWidth, targetHeight,
+                          source.GetBuffer(), source.GetPitch(), source.GetWidth(), source.GetHeight(),
+                          source.GetPixelFormat(), threadsCount);
+      return target;
+    }
+    catch (...)
+    {
+      delete target;
+      throw;
+    }
+  }
+
+
+  OrthancImage* ResizeImage(OrthancImage&  source,
+                            unsigned int   targetWidth,
+                            unsigned int   targetHeight,
+                            unsigned int   threadsCount)
+  {
+    if (targetWidth == 0 ||
+        targetHeight == 0)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    if (width == targetWidth &&
+        height == targetHeight)
+    {
+      return ConvertPixelFormat(source, source.GetPixelFormat());
+    }
+
+    const unsigned int factor = std::min(width / targetWidth, height / targetHeight);
+
+    if (factor < 2)
+    {
+      return ResizeImageLanczos(source, targetWidth, targetHeight, threadsCount);
+    }
+
+    // The area averaging is much cheaper than Lanczos, and is the
+    // exact low-pass filter for integer factors
+    OrthancImage* reduced = DownscaleImage(source, factor, threadsCount);
+
+    if (reduced->GetWidth() == targetWidth &&
+        reduced->GetHeight() == targetHeight)
+    {
+      return reduced;
+    }
+
+    try
+    {
+      OrthancImage* resized = ResizeImageLanczos(*reduced, targetWidth, targetHeight, threadsCount);
+      delete reduced;
+      return resized;
+    }
+    catch (...)
+    {
+      delete reduced;
+      throw;
+    }
+  }
+}
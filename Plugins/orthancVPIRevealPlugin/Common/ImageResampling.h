@@ -0,0 +1,82 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Resampling of the Grayscale8, Grayscale16, SignedGrayscale16,
+   * RGB24 and RGBA32 images. The work is split into bands of rows
+   * that are processed by "threadsCount" threads ("0" means one
+   * thread per CPU core). Small images are processed by the calling
+   * thread.
+   **/
+
+  // Area averaging over blocks of "factor x factor" pixels. The size
+  // of the target is the size of the source divided by "factor",
+  // rounded down.
+  void DownscaleBuffer(void*                     target,
+                       unsigned int              targetPitch,
+                       const void*               source,
+                       unsigned int              sourcePitch,
+                       OrthancPluginPixelFormat  format,
+                       unsigned int              sourceWidth,
+                       unsigned int              sourceHeight,
+                       unsigned int              factor,
+                       unsigned int              threadsCount);
+
+  // Separable Lanczos-3 filter, for arbitrary target sizes
+  void ResizeBufferLanczos(void*                     target,
+                           unsigned int              targetPitch,
+                           unsigned int              targetWidth,
+                           unsigned int              targetHeight,
+                           const void*               source,
+                           unsigned int              sourcePitch,
+                           unsigned int              sourceWidth,
+                           unsigned int              sourceHeight,
+                           OrthancPluginPixelFormat  format,
+                           unsigned int              threadsCount);
+
+  // This transfers ownership
+  OrthancImage* DownscaleImage(OrthancImage&  source,
+                               unsigned int   factor,
+                               unsigned int   threadsCount);
+
+  // This transfers ownership
+  OrthancImage* ResizeImageLanczos(OrthancImage&  source,
+                                   unsigned int   targetWidth,
+                                   unsigned int   targetHeight,
+                                   unsigned int   threadsCount);
+
+  // Shrinks the image by the largest integer factor using area
+  // averaging, then applies Lanczos for the remaining fractional
+  // factor (if any). Enlarging only uses Lanczos. This transfers
+  // ownership.
+  OrthancImage* ResizeImage(OrthancImage&  source,
+                            unsigned int   targetWidth,
+                            unsigned int   targetHeight,
+                            unsigned int   threadsCount);
+}
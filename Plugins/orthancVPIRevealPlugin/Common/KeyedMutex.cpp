@@ -0,0 +1,105 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "KeyedMutex.h"
+
+
+namespace OrthancPlugins
+{
+  KeyedMutex::Item& KeyedMutex::Acquire(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Items::iterator found = items_.find(key);
+    if (found == items_.end())
+    {
+      Item* item = new Item;
+      item->users_ = 0;
+
+      try
+      {
+        found = items_.insert(std::make_pair(key, item)).first;
+      }
+      catch (...)
+      {
+        delete item;
+        throw;
+      }
+    }
+
+    found->second->users_++;
+    return *found->second;
+  }
+
+
+  void KeyedMutex::Release(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Items::iterator found = items_.find(key);
+    if (found != items_.end())
+    {
+      found->second->users_--;
+      if (found->second->users_ == 0)
+      {
+        delete found->second;
+        items_.erase(found);
+      }
+    }
+  }
+
+
+  KeyedMutex::~KeyedMutex()
+  {
+    for (Items::iterator it = items_.begin(); it != items_.end(); ++it)
+    {
+      delete it->second;
+    }
+  }
+
+
+  KeyedMutex::ScopedLock::ScopedLock(KeyedMutex& that,
+                                     const std::string& key) :
+    that_(that),
+    key_(key),
+    item_(that.Acquire(key))
+  {
+    try
+    {
+      item_.mutex_.lock();
+    }
+    catch (...)
+    {
+      that_.Release(key_);
+      throw;
+    }
+  }
+
+
+  KeyedMutex::ScopedLock::~ScopedLock()
+  {
+    item_.mutex_.unlock();
+    that_.Release(key_);
+  }
+}
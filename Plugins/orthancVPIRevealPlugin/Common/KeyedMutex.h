@@ -0,0 +1,77 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Mutexes indexed by a string (e.g. the identifier of a resource),
+   * that are created on demand and released as soon as no thread
+   * uses them. This serializes the computations about the same
+   * resource, without blocking the computations about the other
+   * resources.
+   **/
+  class KeyedMutex : public boost::noncopyable
+  {
+  private:
+    struct Item
+    {
+      boost::mutex  mutex_;
+      unsigned int  users_;   // Threads holding or waiting for "mutex_"
+    };
+
+    typedef std::map<std::string, Item*>  Items;
+
+    boost::mutex  mutex_;   // Protects "items_"
+    Items         items_;
+
+    Item& Acquire(const std::string& key);
+
+    void Release(const std::string& key);
+
+  public:
+    ~KeyedMutex();
+
+    class ScopedLock : public boost::noncopyable
+    {
+    private:
+      KeyedMutex&  that_;
+      std::string  key_;
+      Item&        item_;
+
+    public:
+      ScopedLock(KeyedMutex& that,
+                 const std::string& key);
+
+      ~ScopedLock();
+    };
+  };
+}
@@ -0,0 +1,460 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "MultiFrameDecoder.h"
+
+#include "PixelFormatConversion.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <map>
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    // State that is shared by the decoding threads and by the thread
+    // that started the decoding. Frames are handed out by increasing
+    // number, so if some frame fails, all the frames before it have
+    // already been handed out and can still be delivered.
+    class DecodingState : public boost::noncopyable
+    {
+    private:
+      typedef std::map<unsigned int, OrthancImage*>  DecodedFrames;
+
+      OrthancPluginContext*      context_;
+      const void*                dicom_;
+      size_t                     size_;
+      boost::mutex               mutex_;
+      boost::condition_variable  changed_;
+      unsigned int               next_;        // Next frame to be decoded
+      unsigned int               end_;
+      unsigned int               handled_;     // Next frame to be handled
+      unsigned int               maxPending_;
+      bool                       stopped_;
+      bool                       hasError_;
+      unsigned int               errorFrame_;
+      OrthancPluginErrorCode     error_;
+      DecodedFrames              decoded_;
+
+      // Target buffer, if the frames are not streamed
+      uint8_t*                   target_;
+      OrthancPluginPixelFormat   targetFormat_;
+      unsigned int               targetPitch_;
+      unsigned int               targetWidth_;
+      unsigned int               targetHeight_;
+
+      void CopyToTarget(unsigned int frame,
+                        OrthancImage& image)
+      {
+        if (image.GetWidth() != targetWidth_ ||
+            image.GetHeight() != targetHeight_)
+        {
+          ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_IncompatibleImageSize);
+        }
+
+        const size_t frameSize = static_cast<size_t>(targetPitch_) * targetHeight_;
+
+        ConvertPixelFormat(target_ + static_cast<size_t>(frame) * frameSize,
+                           targetFormat_, targetPitch_,
+                           image.GetBuffer(), image.GetPixelFormat(), image.GetPitch(),
+                           targetWidth_, targetHeight_, 1.0f, 0.0f);
+      }
+
+      // Never throws: The error code is returned instead
+      OrthancPluginErrorCode DecodeFrame(OrthancImage*& image,
+                                         unsigned int frame)
+      {
+        image = NULL;
+
+        try
+        {
+          image = new OrthancImage(context_);
+          image->DecodeDicomImage(dicom_, size_, frame);
+
+          if (target_ != NULL)
+          {
+            CopyToTarget(frame, *image);
+            delete image;
+            image = NULL;
+          }
+
+          return OrthancPluginErrorCode_Success;
+        }
+#if HAS_ORTHANC_EXCEPTION == 1
+        catch (Orthanc::OrthancException& e)
+        {
+          delete image;
+          return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+        }
+#else
+        catch (PluginException& e)
+        {
+          delete image;
+          return e.GetErrorCode();
+        }
+#endif
+        catch (std::bad_alloc&)
+        {
+          delete image;
+          return OrthancPluginErrorCode_NotEnoughMemory;
+        }
+        catch (...)
+        {
+          delete image;
+          return OrthancPluginErrorCode_Plugin;
+        }
+      }
+
+    public:
+      DecodingState(OrthancPluginContext* context,
+                    const void* dicom,
+                    size_t size,
+                    unsigned int firstFrame,
+                    unsigned int count,
+                    unsigned int maxPending) :
+        context_(context),
+        dicom_(dicom),
+        size_(size),
+        next_(firstFrame),
+        end_(firstFrame + count),
+        handled_(firstFrame),
+        maxPending_(maxPending),
+        stopped_(false),
+        hasError_(false),
+        errorFrame_(0),
+        error_(OrthancPluginErrorCode_Success),
+        target_(NULL),
+        targetFormat_(OrthancPluginPixelFormat_Grayscale8),
+        targetPitch_(0),
+        targetWidth_(0),
+        targetHeight_(0)
+      {
+      }
+
+      ~DecodingState()
+      {
+        for (DecodedFrames::iterator it = decoded_.begin(); it != decoded_.end(); ++it)
+        {
+          delete it->second;
+        }
+      }
+
+      // The frame "firstFrame" is written at the beginning of "target"
+      void SetTarget(void* target,
+                     OrthancPluginPixelFormat format,
+                     unsigned int pitch,
+                     unsigned int width,
+                     unsigned int height,
+                     unsigned int firstFrame)
+      {
+        const size_t frameSize = static_cast<size_t>(pitch) * height;
+        target_ = reinterpret_cast<uint8_t*>(target) - static_cast<size_t>(firstFrame) * frameSize;
+        targetFormat_ = format;
+        targetPitch_ = pitch;
+        targetWidth_ = width;
+        targetHeight_ = height;
+      }
+
+      void Stop()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        changed_.notify_all();
+      }
+
+      void Worker()
+      {
+        for (;;)
+        {
+          unsigned int frame;
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            while (!stopped_ &&
+                   !hasError_ &&
+                   next_ < end_ &&
+                   next_ - handled_ >= maxPending_)
+            {
+              changed_.wait(lock);
+            }
+
+            if (stopped_ ||
+                hasError_ ||
+                next_ >= end_)
+            {
+              return;
+            }
+
+            frame = next_++;
+          }
+
+          OrthancImage* image;
+          OrthancPluginErrorCode error = DecodeFrame(image, frame);
+
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (error != OrthancPluginErrorCode_Success)
+          {
+            if (!hasError_ ||
+                frame < errorFrame_)
+            {
+              hasError_ = true;
+              errorFrame_ = frame;
+              error_ = error;
+            }
+          }
+          else if (image != NULL)
+          {
+            decoded_[frame] = image;
+          }
+
+          changed_.notify_all();
+        }
+      }
+
+      // Waits for the given frame to be decoded. This transfers
+      // ownership.
+      OrthancImage* WaitFrame(unsigned int frame)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (;;)
+        {
+          DecodedFrames::iterator found = decoded_.find(frame);
+          if (found != decoded_.end())
+          {
+            OrthancImage* image = found->second;
+            decoded_.erase(found);
+            return image;
+          }
+
+          if (hasError_ &&
+              errorFrame_ == frame)
+          {
+            ORTHANC_PLUGINS_THROW_EXCEPTION(error_);
+          }
+
+          changed_.wait(lock);
+        }
+      }
+
+      void SetHandled(unsigned int frame)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        handled_ = frame + 1;
+        changed_.notify_all();
+      }
+
+      void CheckError()
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (hasError_)
+        {
+          ORTHANC_PLUGINS_THROW_EXCEPTION(error_);
+        }
+      }
+    };
+
+
+    // Stops and joins the decoding threads, even if an exception is
+    // thrown by the handler of the frames
+    class DecodingThreads : public boost::noncopyable
+    {
+    private:
+      DecodingState&       state_;
+      boost::thread_group  threads_;
+
+    public:
+      DecodingThreads(DecodingState& state,
+                      unsigned int count) :
+        state_(state)
+      {
+        try
+        {
+          for (unsigned int i = 0; i < count; i++)
+          {
+            threads_.create_thread(boost::bind(&DecodingState::Worker, &state));
+          }
+        }
+        catch (...)
+        {
+          Join();
+          throw;
+        }
+      }
+
+      ~DecodingThreads()
+      {
+        Join();
+      }
+
+      void Wait()
+      {
+        threads_.join_all();
+      }
+
+      void Join()
+      {
+        state_.Stop();
+        threads_.join_all();
+      }
+    };
+  }
+
+
+  unsigned int MultiFrameDecoder::GetEffectiveThreadsCount(unsigned int framesCount) const
+  {
+    unsigned int count = threadsCount_;
+
+    if (count == 0)
+    {
+      count = boost::thread::hardware_concurrency();
+    }
+
+    if (count > framesCount)
+    {
+      count = framesCount;
+    }
+
+    return (count == 0 ? 1 : count);
+  }
+
+
+  MultiFrameDecoder::MultiFrameDecoder(OrthancPluginContext* context,
+                                       const void* dicom,
+                                       size_t size) :
+    context_(context),
+    dicom_(dicom),
+    size_(size),
+    threadsCount_(0),
+    maxPendingFrames_(0)
+  {
+    if (dicom == NULL &&
+        size != 0)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NullPointer);
+    }
+  }
+
+
+  void MultiFrameDecoder::DecodeFrames(IFrameHandler& handler,
+                                       unsigned int firstFrame,
+                                       unsigned int count)
+  {
+    if (count == 0)
+    {
+      return;
+    }
+
+    const unsigned int threadsCount = GetEffectiveThreadsCount(count);
+    const unsigned int maxPending = (maxPendingFrames_ == 0 ? 2 * threadsCount : maxPendingFrames_);
+
+    DecodingState state(context_, dicom_, size_, firstFrame, count, maxPending);
+    DecodingThreads threads(state, threadsCount);
+
+    for (unsigned int frame = firstFrame; frame < firstFrame + count; frame++)
+    {
+      OrthancImage* image = state.WaitFrame(frame);
+
+      try
+      {
+        handler.Handle(frame, *image);
+      }
+      catch (...)
+      {
+        delete image;
+        throw;
+      }
+
+      delete image;
+      state.SetHandled(frame);
+    }
+  }
+
+
+  void MultiFrameDecoder::DecodeFrames(void* target,
+                                       OrthancPluginPixelFormat format,
+                                       unsigned int pitch,
+                                       unsigned int width,
+                                       unsigned int height,
+                                       unsigned int firstFrame,
+                                       unsigned int count)
+  {
+    if (count == 0)
+    {
+      return;
+    }
+
+    if (target == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NullPointer);
+    }
+
+    if (pitch < width * GetBytesPerPixel(format))
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    // The frames are not kept in memory, so they are not throttled
+    DecodingState state(context_, dicom_, size_, firstFrame, count, count);
+    state.SetTarget(target, format, pitch, width, height, firstFrame);
+
+    {
+      // The calling thread takes part in the decoding
+      DecodingThreads threads(state, GetEffectiveThreadsCount(count) - 1);
+      state.Worker();
+      threads.Wait();
+    }
+
+    state.CheckError();
+  }
+
+
+  unsigned int MultiFrameDecoder::GetFramesCount(const Json::Value& tags)
+  {
+    static const char* const NUMBER_OF_FRAMES = "0028,0008";
+
+    if (tags.type() != Json::objectValue ||
+        !tags.isMember(NUMBER_OF_FRAMES) ||
+        tags[NUMBER_OF_FRAMES].type() != Json::stringValue)
+    {
+      return 1;
+    }
+
+    try
+    {
+      int count = boost::lexical_cast<int>(boost::algorithm::trim_copy(tags[NUMBER_OF_FRAMES].asString()));
+      return (count > 0 ? static_cast<unsigned int>(count) : 1);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return 1;
+    }
+  }
+}
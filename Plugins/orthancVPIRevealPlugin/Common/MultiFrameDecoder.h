@@ -0,0 +1,123 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Decodes a range of frames of one DICOM instance (enhanced CT/MR,
+   * ultrasound cine...) using a pool of threads. The DICOM file is
+   * shared by all the threads, and must stay valid until the end of
+   * the decoding. Note that the Orthanc SDK parses the file again at
+   * each call to OrthancPluginDecodeDicomImage(): Only the file, not
+   * the parsed dataset, can be shared between the threads.
+   **/
+  class MultiFrameDecoder : public boost::noncopyable
+  {
+  public:
+    class IFrameHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IFrameHandler()
+      {
+      }
+
+      // Called by the thread that started the decoding, by
+      // increasing frame number. The image is released once this
+      // method returns.
+      virtual void Handle(unsigned int frame,
+                          OrthancImage& image) = 0;
+    };
+
+  private:
+    OrthancPluginContext*  context_;
+    const void*            dicom_;
+    size_t                 size_;
+    unsigned int           threadsCount_;
+    unsigned int           maxPendingFrames_;
+
+    unsigned int GetEffectiveThreadsCount(unsigned int framesCount) const;
+
+  public:
+    MultiFrameDecoder(OrthancPluginContext* context,
+                      const void* dicom,
+                      size_t size);
+
+    OrthancPluginContext* GetContext() const
+    {
+      return context_;
+    }
+
+    // "0" means one thread per CPU core (this is the default)
+    void SetThreadsCount(unsigned int threadsCount)
+    {
+      threadsCount_ = threadsCount;
+    }
+
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    // Maximum number of decoded frames that are waiting to be handled
+    // while streaming, which bounds the memory that is used if the
+    // handler is slower than the decoding. "0" means two frames per
+    // thread (this is the default).
+    void SetMaxPendingFrames(unsigned int count)
+    {
+      maxPendingFrames_ = count;
+    }
+
+    unsigned int GetMaxPendingFrames() const
+    {
+      return maxPendingFrames_;
+    }
+
+    // Streams the frames "firstFrame" to "firstFrame + count - 1" to
+    // the handler, in order, as soon as they are decoded
+    void DecodeFrames(IFrameHandler& handler,
+                      unsigned int firstFrame,
+                      unsigned int count);
+
+    // Writes the frames into a buffer provided by the caller, one
+    // frame after the other ("pitch * height" bytes per frame). The
+    // frames are converted to "format" if needed, and must all have
+    // the given size.
+    void DecodeFrames(void* target,
+                      OrthancPluginPixelFormat format,
+                      unsigned int pitch,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int firstFrame,
+                      unsigned int count);
+
+    // Reads the "NumberOfFrames" tag (0028,0008) from tags in the
+    // "short" format, defaulting to 1
+    static unsigned int GetFramesCount(const Json::Value& tags);
+  };
+}
@@ -32,8 +32,18 @@
 
 #include "OrthancPluginCppWrapper.h"
 
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #include <json/reader.h>
 #include <json/writer.h>
+#include <algorithm>
+#include <ctype.h>
+#include <limits>
+#include <new>
+#include <set>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
 
 namespace OrthancPlugins
@@ -269,6 +279,19 @@ namespace OrthancPlugins
   }
 
 
+  void MemoryBuffer::CreateDicom(const Json::Value& tags,
+                                 OrthancImage& pixelData,
+                                 OrthancPluginCreateDicomFlags flags)
+  {
+    Clear();
+
+    Json::FastWriter writer;
+    std::string s = writer.write(tags);
+
+    Check(OrthancPluginCreateDicom(context_, &buffer_, s.c_str(), pixelData.GetObject(), flags));
+  }
+
+
   void MemoryBuffer::ReadFile(const std::string& path)
   {
     Clear();
@@ -718,6 +741,25 @@ namespace OrthancPlugins
   }
 
 
+  OrthancImage::OrthancImage(OrthancPluginContext*     context,
+                             OrthancPluginPixelFormat  format,
+                             uint32_t                  width,
+                             uint32_t                  height,
+                             uint32_t                  pitch,
+                             void*                     buffer) :
+    context_(context)
+  {
+    if (context == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      image_ = OrthancPluginCreateImageAccessor(context, format, width, height, pitch, buffer);
+    }
+  }
+
+
   void OrthancImage::UncompressPngImage(const void* data,
                                         size_t size)
   {
@@ -793,6 +835,20 @@ namespace OrthancPlugins
   }
 
 
+  void* OrthancImage::GetWritableBuffer()
+  {
+    CheckImageAvailable();
+    return OrthancPluginGetImageBuffer(context_, image_);
+  }
+
+
+  const OrthancPluginImage* OrthancImage::GetObject()
+  {
+    CheckImageAvailable();
+    return image_;
+  }
+
+
   void OrthancImage::CompressPngImage(MemoryBuffer& target)
   {
     CheckImageAvailable();
@@ -908,6 +964,747 @@ namespace OrthancPlugins
   }
 
 
+  void FindAnswersWriter::Setup(size_t limit,
+                                unsigned int timeout)
+  {
+    limit_ = limit;
+    hasDeadline_ = (timeout != 0);
+    answersCount_ = 0;
+    complete_ = true;
+
+    if (hasDeadline_)
+    {
+      deadline_ = boost::get_system_time() + boost::posix_time::milliseconds(timeout);
+    }
+  }
+
+
+  void FindAnswersWriter::MarkIncomplete()
+  {
+    if (complete_)
+    {
+      complete_ = false;
+
+      OrthancPluginErrorCode code;
+      if (findAnswers_ != NULL)
+      {
+        code = OrthancPluginFindMarkIncomplete(context_, findAnswers_);
+      }
+      else
+      {
+        code = OrthancPluginWorklistMarkIncomplete(context_, worklistAnswers_);
+      }
+
+      if (code != OrthancPluginErrorCode_Success)
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(code);
+      }
+    }
+  }
+
+
+  FindAnswersWriter::FindAnswersWriter(OrthancPluginContext*      context,
+                                       OrthancPluginFindAnswers*  answers,
+                                       size_t                     limit,
+                                       unsigned int               timeout) :
+    context_(context),
+    findAnswers_(answers),
+    worklistAnswers_(NULL),
+    worklistQuery_(NULL)
+  {
+    if (answers == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    Setup(limit, timeout);
+  }
+
+
+  FindAnswersWriter::FindAnswersWriter(OrthancPluginContext*              context,
+                                       OrthancPluginWorklistAnswers*      answers,
+                                       const OrthancPluginWorklistQuery*  query,
+                                       size_t                             limit,
+                                       unsigned int                       timeout) :
+    context_(context),
+    findAnswers_(NULL),
+    worklistAnswers_(answers),
+    worklistQuery_(query)
+  {
+    if (answers == NULL ||
+        query == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    Setup(limit, timeout);
+  }
+
+
+  bool FindAnswersWriter::AddAnswer(const void* dicom,
+                                    size_t size)
+  {
+    if (!complete_)
+    {
+      return false;
+    }
+
+    if (limit_ != 0 &&
+        answersCount_ == limit_)
+    {
+      // One match more than the limit: The other ones are not needed
+      MarkIncomplete();
+      return false;
+    }
+
+    OrthancPluginErrorCode code;
+    if (findAnswers_ != NULL)
+    {
+      code = OrthancPluginFindAddAnswer(context_, findAnswers_, dicom, static_cast<uint32_t>(size));
+    }
+    else
+    {
+      code = OrthancPluginWorklistAddAnswer(context_, worklistAnswers_, worklistQuery_,
+                                            dicom, static_cast<uint32_t>(size));
+    }
+
+    if (code != OrthancPluginErrorCode_Success)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(code);
+    }
+
+    answersCount_++;
+
+    return CheckTimeout();
+  }
+
+
+  bool FindAnswersWriter::CheckTimeout()
+  {
+    if (complete_ &&
+        hasDeadline_ &&
+        boost::get_system_time() >= deadline_)
+    {
+      LogWarning(context_, "C-FIND query timed out after " +
+                 boost::lexical_cast<std::string>(answersCount_) + " answer(s), marking it as incomplete");
+      MarkIncomplete();
+    }
+
+    return complete_;
+  }
+
+
+
+  MultipartWriter::MultipartWriter(OrthancPluginContext*     context,
+                                   OrthancPluginRestOutput*  output,
+                                   const std::string&        subType,
+                                   const std::string&        contentType) :
+    context_(context),
+    output_(output),
+    itemsCount_(0)
+  {
+    OrthancPluginErrorCode code = OrthancPluginStartMultipartAnswer(context, output, subType.c_str(), contentType.c_str());
+    if (code != OrthancPluginErrorCode_Success)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(code);
+    }
+  }
+
+
+  bool MultipartWriter::SendItem(const void* data,
+                                 size_t size)
+  {
+    if (size > std::numeric_limits<uint32_t>::max())
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotEnoughMemory);
+    }
+
+    if (OrthancPluginSendMultipartItem(context_, output_, reinterpret_cast<const char*>(data),
+                                       static_cast<uint32_t>(size)) == OrthancPluginErrorCode_Success)
+    {
+      itemsCount_++;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool MultipartWriter::SendItem(const void* data,
+                                 size_t size,
+                                 const std::map<std::string, std::string>& headers)
+  {
+    if (size > std::numeric_limits<uint32_t>::max())
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotEnoughMemory);
+    }
+
+    std::vector<const char*> keys, values;
+    keys.reserve(headers.size());
+    values.reserve(headers.size());
+
+    for (std::map<std::string, std::string>::const_iterator
+           it = headers.begin(); it != headers.end(); ++it)
+    {
+      keys.push_back(it->first.c_str());
+      values.push_back(it->second.c_str());
+    }
+
+    if (OrthancPluginSendMultipartItem2(context_, output_, reinterpret_cast<const char*>(data),
+                                        static_cast<uint32_t>(size), static_cast<uint32_t>(headers.size()),
+                                        keys.empty() ? NULL : &keys[0],
+                                        values.empty() ? NULL : &values[0]) == OrthancPluginErrorCode_Success)
+    {
+      itemsCount_++;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  static const char* FindSubstring(const char* start,
+                                   const char* end,
+                                   const std::string& pattern)
+  {
+    const size_t length = pattern.size();
+
+    while (static_cast<size_t>(end - start) >= length)
+    {
+      const char* candidate = reinterpret_cast<const char*>(memchr(start, pattern[0], end - start - length + 1));
+      if (candidate == NULL)
+      {
+        return NULL;
+      }
+
+      if (memcmp(candidate, pattern.c_str(), length) == 0)
+      {
+        return candidate;
+      }
+
+      start = candidate + 1;
+    }
+
+    return NULL;
+  }
+
+
+  static bool LookupBoundary(std::string& boundary,
+                             const std::string& contentType)
+  {
+    std::string lower = contentType;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower.compare(0, 10, "multipart/") != 0)
+    {
+      return false;
+    }
+
+    size_t position = lower.find("boundary=");
+    if (position == std::string::npos)
+    {
+      return false;
+    }
+
+    // The boundary is case-sensitive: Read it from the original string
+    boundary = contentType.substr(position + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+
+    if (boundary.size() >= 2 &&
+        boundary[0] == '"' &&
+        boundary[boundary.size() - 1] == '"')
+    {
+      boundary = boundary.substr(1, boundary.size() - 2);
+    }
+
+    return !boundary.empty();
+  }
+
+
+  static void ParseItemHeaders(std::map<std::string, std::string>& headers,
+                               const char* start,
+                               const char* end)
+  {
+    while (start < end)
+    {
+      const char* eol = FindSubstring(start, end, "\r\n");
+      if (eol == NULL)
+      {
+        eol = end;
+      }
+
+      std::string line(start, eol);
+      size_t colon = line.find(':');
+      if (colon != std::string::npos)
+      {
+        std::string key = line.substr(0, colon);
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+        size_t first = line.find_first_not_of(" \t", colon + 1);
+        headers[key] = (first == std::string::npos ? "" : line.substr(first));
+      }
+
+      start = eol + 2;
+    }
+  }
+
+
+  bool ParseMultipartBody(std::vector<MultipartItem>& items,
+                          const std::string& contentType,
+                          const void* body,
+                          size_t size)
+  {
+    items.clear();
+
+    std::string boundary;
+    if (!LookupBoundary(boundary, contentType))
+    {
+      return false;
+    }
+
+    const char* start = reinterpret_cast<const char*>(body);
+    const char* end = start + size;
+    const std::string delimiter = "--" + boundary;
+    const std::string separator = "\r\n" + delimiter;
+
+    const char* current = FindSubstring(start, end, delimiter);
+    if (current == NULL)
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      current += delimiter.size();
+
+      if (end - current >= 2 &&
+          current[0] == '-' &&
+          current[1] == '-')
+      {
+        return true;  // Closing delimiter
+      }
+
+      // Skip the end of the delimiter line
+      const char* eol = FindSubstring(current, end, "\r\n");
+      if (eol == NULL)
+      {
+        return false;
+      }
+
+      const char* headersEnd = FindSubstring(eol, end, "\r\n\r\n");
+      if (headersEnd == NULL)
+      {
+        return false;
+      }
+
+      const char* content = headersEnd + 4;
+      const char* next = FindSubstring(content, end, separator);
+      if (next == NULL)
+      {
+        return false;
+      }
+
+      MultipartItem item;
+      ParseItemHeaders(item.headers_, eol + 2, headersEnd + 2);
+      item.data_ = content;
+      item.size_ = next - content;
+      items.push_back(item);
+
+      current = next + 2;
+    }
+  }
+
+
+  static const unsigned int POOL_CLASSES_COUNT = 15;               // From 4KB to 64MB
+  static const size_t POOL_MIN_CLASS_SIZE = 4096;
+  static const unsigned int POOL_LOCAL_SLOTS = 2;                  // Per size class and per thread
+  static const size_t POOL_LOCAL_MAX_SIZE = 16 * 1024 * 1024;      // Per thread
+
+
+  // Returns "false" if the buffer is too large to be pooled
+  static bool LookupSizeClass(unsigned int& sizeClass,
+                              size_t& capacity,
+                              size_t size)
+  {
+    capacity = POOL_MIN_CLASS_SIZE;
+
+    for (sizeClass = 0; sizeClass < POOL_CLASSES_COUNT; sizeClass++)
+    {
+      if (size <= capacity)
+      {
+        return true;
+      }
+
+      capacity *= 2;
+    }
+
+    return false;
+  }
+
+
+  class BufferPool::PImpl : public boost::noncopyable
+  {
+  private:
+    // The buffers kept at hand by one thread. Its mutex is only taken
+    // by this thread (hence without contention), and by "Finalize()".
+    // Fixed-size arrays, so that releasing a buffer never allocates.
+    struct LocalCache
+    {
+      PImpl*        pool_;
+      boost::mutex  mutex_;
+      bool          enabled_;
+      void*         buffers_[POOL_CLASSES_COUNT][POOL_LOCAL_SLOTS];
+      unsigned int  counts_[POOL_CLASSES_COUNT];
+      size_t        size_;
+    };
+
+    boost::mutex           mutex_;    // Protects all the members below
+    std::vector<void*>     shared_[POOL_CLASSES_COUNT];
+    std::set<LocalCache*>  caches_;   // The caches of all the live threads
+    size_t                 pooledSize_;
+    size_t                 maxPooledSize_;
+    bool                   finalized_;
+    uint64_t               allocations_;
+    uint64_t               deallocations_;
+    uint64_t               sharedReuses_;
+
+    // Must be declared last, as its destructor hands the buffers of
+    // the current thread over to the shared pool
+    boost::thread_specific_ptr<LocalCache>  local_;
+
+    // Called by Boost when a thread exits
+    static void CleanupLocalCache(LocalCache* cache)
+    {
+      PImpl& pool = *cache->pool_;
+
+      {
+        boost::mutex::scoped_lock lock(pool.mutex_);
+        pool.caches_.erase(cache);
+      }
+
+      // From now on, "Finalize()" cannot reach this cache
+      for (unsigned int i = 0; i < POOL_CLASSES_COUNT; i++)
+      {
+        for (unsigned int j = 0; j < cache->counts_[i]; j++)
+        {
+          pool.ReleaseShared(cache->buffers_[i][j], i, POOL_MIN_CLASS_SIZE << i);
+        }
+      }
+
+      delete cache;
+    }
+
+    // Returns NULL if the cache of the current thread cannot be
+    // created, or if the pool is finalized
+    LocalCache* GetLocalCache()
+    {
+      LocalCache* local = local_.get();
+      if (local != NULL)
+      {
+        return local;
+      }
+
+      try
+      {
+        local = new LocalCache;
+      }
+      catch (std::exception&)
+      {
+        return NULL;
+      }
+
+      local->pool_ = this;
+      local->enabled_ = true;
+      local->size_ = 0;
+      memset(local->counts_, 0, sizeof(local->counts_));
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        bool registered = false;
+        if (!finalized_)
+        {
+          try
+          {
+            caches_.insert(local);
+            registered = true;
+          }
+          catch (std::bad_alloc&)
+          {
+          }
+        }
+
+        if (!registered)
+        {
+          delete local;
+          return NULL;
+        }
+      }
+
+      local_.reset(local);
+      return local;
+    }
+
+    void ReleaseShared(void* buffer,
+                       unsigned int sizeClass,
+                       size_t capacity)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!finalized_ &&
+            pooledSize_ + capacity <= maxPooledSize_)
+        {
+          try
+          {
+            shared_[sizeClass].push_back(buffer);
+            pooledSize_ += capacity;
+            return;
+          }
+          catch (std::bad_alloc&)
+          {
+            // Fall back to freeing the buffer
+          }
+        }
+
+        deallocations_++;
+      }
+
+      free(buffer);
+    }
+
+  public:
+    PImpl() :
+      pooledSize_(0),
+      maxPooledSize_(64 * 1024 * 1024),
+      finalized_(false),
+      allocations_(0),
+      deallocations_(0),
+      sharedReuses_(0),
+      local_(CleanupLocalCache)
+    {
+    }
+
+    ~PImpl()
+    {
+      Finalize();
+    }
+
+    void* Acquire(size_t& capacity,
+                  size_t size)
+    {
+      unsigned int sizeClass;
+      if (LookupSizeClass(sizeClass, capacity, size))
+      {
+        LocalCache* local = local_.get();
+        if (local != NULL)
+        {
+          boost::mutex::scoped_lock lock(local->mutex_);
+
+          if (local->counts_[sizeClass] > 0)
+          {
+            local->counts_[sizeClass]--;
+            local->size_ -= capacity;
+            return local->buffers_[sizeClass][local->counts_[sizeClass]];
+          }
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!shared_[sizeClass].empty())
+        {
+          void* buffer = shared_[sizeClass].back();
+          shared_[sizeClass].pop_back();
+          pooledSize_ -= capacity;
+          sharedReuses_++;
+          return buffer;
+        }
+
+        allocations_++;
+      }
+      else
+      {
+        capacity = size;
+
+        boost::mutex::scoped_lock lock(mutex_);
+        allocations_++;
+      }
+
+      void* buffer = malloc(capacity);
+      if (buffer == NULL)
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotEnoughMemory);
+      }
+
+      return buffer;
+    }
+
+    void Release(void* buffer,
+                 size_t capacity)
+    {
+      if (buffer == NULL)
+      {
+        return;
+      }
+
+      unsigned int sizeClass;
+      size_t classSize;
+      if (!LookupSizeClass(sizeClass, classSize, capacity) ||
+          classSize != capacity)
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          deallocations_++;
+        }
+
+        free(buffer);
+        return;
+      }
+
+      LocalCache* local = GetLocalCache();
+      if (local != NULL)
+      {
+        boost::mutex::scoped_lock lock(local->mutex_);
+
+        if (local->enabled_ &&
+            local->counts_[sizeClass] < POOL_LOCAL_SLOTS &&
+            local->size_ + capacity <= POOL_LOCAL_MAX_SIZE)
+        {
+          local->buffers_[sizeClass][local->counts_[sizeClass]] = buffer;
+          local->counts_[sizeClass]++;
+          local->size_ += capacity;
+          return;
+        }
+      }
+
+      ReleaseShared(buffer, sizeClass, capacity);
+    }
+
+    void SetMaxPooledSize(size_t size)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      maxPooledSize_ = size;
+    }
+
+    void Finalize()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      finalized_ = true;
+
+      // Empty the caches of all the threads. They stay registered
+      // until their thread exits, but no longer keep any buffer.
+      for (std::set<LocalCache*>::iterator it = caches_.begin(); it != caches_.end(); ++it)
+      {
+        LocalCache& cache = **it;
+        boost::mutex::scoped_lock cacheLock(cache.mutex_);
+
+        for (unsigned int i = 0; i < POOL_CLASSES_COUNT; i++)
+        {
+          for (unsigned int j = 0; j < cache.counts_[i]; j++)
+          {
+            free(cache.buffers_[i][j]);
+          }
+
+          deallocations_ += cache.counts_[i];
+          cache.counts_[i] = 0;
+        }
+
+        cache.size_ = 0;
+        cache.enabled_ = false;
+      }
+
+      for (unsigned int i = 0; i < POOL_CLASSES_COUNT; i++)
+      {
+        for (size_t j = 0; j < shared_[i].size(); j++)
+        {
+          free(shared_[i][j]);
+        }
+
+        deallocations_ += shared_[i].size();
+        shared_[i].clear();
+      }
+
+      pooledSize_ = 0;
+    }
+
+    void GetStatistics(Statistics& target)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      target.allocations_ = allocations_;
+      target.deallocations_ = deallocations_;
+      target.sharedReuses_ = sharedReuses_;
+      target.pooledSize_ = pooledSize_;
+    }
+  };
+
+
+  BufferPool::BufferPool() :
+    pimpl_(new PImpl)
+  {
+  }
+
+
+  BufferPool::~BufferPool()
+  {
+    delete pimpl_;
+  }
+
+
+  BufferPool& BufferPool::GetInstance()
+  {
+    static BufferPool instance;
+    return instance;
+  }
+
+
+  void* BufferPool::Acquire(size_t& capacity,
+                            size_t size)
+  {
+    return pimpl_->Acquire(capacity, size);
+  }
+
+
+  void BufferPool::Release(void* buffer,
+                           size_t capacity)
+  {
+    pimpl_->Release(buffer, capacity);
+  }
+
+
+  void BufferPool::SetMaxPooledSize(size_t size)
+  {
+    pimpl_->SetMaxPooledSize(size);
+  }
+
+
+  void BufferPool::Finalize()
+  {
+    pimpl_->Finalize();
+  }
+
+
+  void BufferPool::GetStatistics(Statistics& target)
+  {
+    pimpl_->GetStatistics(target);
+  }
+
+
+  PooledBuffer::PooledBuffer(size_t size) :
+    size_(size)
+  {
+    data_ = BufferPool::GetInstance().Acquire(capacity_, size);
+  }
+
+
+  PooledBuffer::~PooledBuffer()
+  {
+    BufferPool::GetInstance().Release(data_, capacity_);
+  }
+
 
   bool RestApiGet(Json::Value& result,
                   OrthancPluginContext* context,
@@ -1020,6 +1817,40 @@ namespace OrthancPlugins
   }
 
 
+  bool LookupHttpGetArgument(std::string& value,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& key)
+  {
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      if (key == request->getKeys[i])
+      {
+        value.assign(request->getValues[i]);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool LookupHttpHeader(std::string& value,
+                        const OrthancPluginHttpRequest* request,
+                        const std::string& key)
+  {
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      if (key == request->headersKeys[i])
+      {
+        value.assign(request->headersValues[i]);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
   static void ReportIncompatibleVersion(OrthancPluginContext* context,
                                         unsigned int major,
                                         unsigned int minor,
@@ -35,7 +35,10 @@
 #include <orthanc/OrthancCPlugin.h>
 #include <boost/noncopyable.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/thread_time.hpp>
 #include <json/value.h>
+#include <map>
+#include <vector>
 
 #if !defined(HAS_ORTHANC_EXCEPTION)
 #  error The macro HAS_ORTHANC_EXCEPTION must be defined
@@ -86,6 +89,9 @@ namespace OrthancPlugins
 #endif
 
 
+  class OrthancImage;
+
+
   class MemoryBuffer : public boost::noncopyable
   {
   private:
@@ -171,6 +177,11 @@ namespace OrthancPlugins
     void CreateDicom(const Json::Value& tags,
                      OrthancPluginCreateDicomFlags flags);
 
+    // The pixel data is taken from the image, not from the tags
+    void CreateDicom(const Json::Value& tags,
+                     OrthancImage& pixelData,
+                     OrthancPluginCreateDicomFlags flags);
+
     void ReadFile(const std::string& path);
 
     void GetDicomQuery(const OrthancPluginWorklistQuery* query);
@@ -297,11 +308,25 @@ namespace OrthancPlugins
                  uint32_t                  width,
                  uint32_t                  height);
 
+    // Wraps a buffer that is not copied, and that must outlive the
+    // image (e.g. a "PooledBuffer")
+    OrthancImage(OrthancPluginContext*     context,
+                 OrthancPluginPixelFormat  format,
+                 uint32_t                  width,
+                 uint32_t                  height,
+                 uint32_t                  pitch,
+                 void*                     buffer);
+
     ~OrthancImage()
     {
       Clear();
     }
 
+    OrthancPluginContext* GetContext() const
+    {
+      return context_;
+    }
+
     void UncompressPngImage(const void* data,
                             size_t size);
 
@@ -322,6 +347,11 @@ namespace OrthancPlugins
     
     const void* GetBuffer();
 
+    void* GetWritableBuffer();
+
+    // The object still belongs to this image
+    const OrthancPluginImage* GetObject();
+
     void CompressPngImage(MemoryBuffer& target);
 
     void CompressJpegImage(MemoryBuffer& target,
@@ -374,6 +404,220 @@ namespace OrthancPlugins
   };
 
 
+  // Sends the answers to a C-FIND query (either a regular one, or a
+  // modality worklist query) as soon as they are matched, so that
+  // the scanning can stop early. If there are more matches than the
+  // limit, or if the timeout is elapsed, the answers are marked as
+  // incomplete, and the caller is told to stop scanning.
+  class FindAnswersWriter : public boost::noncopyable
+  {
+  private:
+    OrthancPluginContext*              context_;
+    OrthancPluginFindAnswers*          findAnswers_;
+    OrthancPluginWorklistAnswers*      worklistAnswers_;
+    const OrthancPluginWorklistQuery*  worklistQuery_;
+    size_t                             limit_;
+    bool                               hasDeadline_;
+    boost::system_time                 deadline_;
+    size_t                             answersCount_;
+    bool                               complete_;
+
+    void Setup(size_t limit,
+               unsigned int timeout);
+
+    void MarkIncomplete();
+
+  public:
+    // A "limit" of zero means no limit, and a "timeout" (in
+    // milliseconds) of zero means no timeout
+    FindAnswersWriter(OrthancPluginContext*      context,
+                      OrthancPluginFindAnswers*  answers,
+                      size_t                     limit,
+                      unsigned int               timeout);
+
+    FindAnswersWriter(OrthancPluginContext*              context,
+                      OrthancPluginWorklistAnswers*      answers,
+                      const OrthancPluginWorklistQuery*  query,
+                      size_t                             limit,
+                      unsigned int                       timeout);
+
+    // Returns "false" if the scanning must stop. In this case, the
+    // answer might have been dropped (if over the limit).
+    bool AddAnswer(const void* dicom,
+                   size_t size);
+
+    bool AddAnswer(const std::string& dicom)
+    {
+      return AddAnswer(dicom.empty() ? NULL : dicom.c_str(), dicom.size());
+    }
+
+    bool AddAnswer(const MemoryBuffer& dicom)
+    {
+      return AddAnswer(dicom.GetData(), dicom.GetSize());
+    }
+
+    // To be called regularly while scanning candidates that do not
+    // match, so that the timeout is enforced even if no answer is
+    // found. Returns "false" if the scanning must stop.
+    bool CheckTimeout();
+
+    // Whether all the matches were sent. Once "false", the scanning
+    // must stop.
+    bool IsComplete() const
+    {
+      return complete_;
+    }
+
+    size_t GetAnswersCount() const
+    {
+      return answersCount_;
+    }
+  };
+
+
+  // Streams a HTTP multipart answer, one item at a time, so that the
+  // first items are sent before the last ones are available
+  class MultipartWriter : public boost::noncopyable
+  {
+  private:
+    OrthancPluginContext*     context_;
+    OrthancPluginRestOutput*  output_;
+    size_t                    itemsCount_;
+
+  public:
+    // Starts the answer: No other answer can be sent afterwards
+    MultipartWriter(OrthancPluginContext*     context,
+                    OrthancPluginRestOutput*  output,
+                    const std::string&        subType,     // "mixed" or "related"
+                    const std::string&        contentType);
+
+    // Returns "false" if the connection was closed by the client
+    bool SendItem(const void* data,
+                  size_t size);
+
+    // Same as above, with additional HTTP headers for this item
+    // (e.g. "Content-Location")
+    bool SendItem(const void* data,
+                  size_t size,
+                  const std::map<std::string, std::string>& headers);
+
+    bool SendItem(const std::string& item)
+    {
+      return SendItem(item.empty() ? NULL : item.c_str(), item.size());
+    }
+
+    bool SendItem(const MemoryBuffer& item)
+    {
+      return SendItem(item.GetData(), item.GetSize());
+    }
+
+    size_t GetItemsCount() const
+    {
+      return itemsCount_;
+    }
+  };
+
+
+  struct MultipartItem
+  {
+    std::map<std::string, std::string>  headers_;   // Keys in lower case
+    const char*                         data_;      // Points into the body
+    size_t                              size_;
+  };
+
+  // Splits the body of a multipart HTTP request (e.g.
+  // "multipart/form-data"), given its "Content-Type" header. The
+  // items point into the body, which must stay valid. Returns
+  // "false" if the body is not a valid multipart body.
+  bool ParseMultipartBody(std::vector<MultipartItem>& items,
+                          const std::string& contentType,
+                          const void* body,
+                          size_t size);
+
+
+  // Recycles the scratch buffers holding intermediate pixel data
+  // (resampling passes, pixel format conversions, tiles...). The
+  // buffers are grouped into size classes (powers of two, starting
+  // at 4KB). Each thread keeps a few buffers at hand, and only goes
+  // through the shared pool (protected by a mutex) on a miss. The
+  // caches of the threads are registered in the pool, so that
+  // "Finalize()" frees the buffers of every thread.
+  class BufferPool : public boost::noncopyable
+  {
+  public:
+    struct Statistics
+    {
+      uint64_t  allocations_;     // Calls to the system allocator
+      uint64_t  deallocations_;
+      uint64_t  sharedReuses_;    // Buffers taken back from the shared pool
+      size_t    pooledSize_;      // Bytes waiting in the shared pool
+    };
+
+  private:
+    class PImpl;
+
+    PImpl*  pimpl_;
+
+    BufferPool();
+
+  public:
+    ~BufferPool();
+
+    static BufferPool& GetInstance();
+
+    // Returns a buffer of at least "size" bytes, whose actual size is
+    // stored in "capacity". The buffer must be given back to
+    // "Release()" together with this capacity.
+    void* Acquire(size_t& capacity,
+                  size_t size);
+
+    void Release(void* buffer,
+                 size_t capacity);
+
+    // Upper bound on the memory kept by the shared pool (64MB by default)
+    void SetMaxPooledSize(size_t size);
+
+    // Frees the shared pool and the caches of all the threads, and
+    // stops recycling the buffers. To be called from
+    // "OrthancPluginFinalize()": The threads that used the pool must
+    // have exited before the plugin is unloaded.
+    void Finalize();
+
+    void GetStatistics(Statistics& target);
+  };
+
+
+  // Scratch buffer borrowed from the pool for its lifetime. Its
+  // content is left uninitialized.
+  class PooledBuffer : public boost::noncopyable
+  {
+  private:
+    void*   data_;
+    size_t  size_;
+    size_t  capacity_;
+
+  public:
+    explicit PooledBuffer(size_t size);
+
+    ~PooledBuffer();
+
+    void* GetData()
+    {
+      return data_;
+    }
+
+    const void* GetData() const
+    {
+      return data_;
+    }
+
+    size_t GetSize() const
+    {
+      return size_;
+    }
+  };
+
+
   bool RestApiGet(Json::Value& result,
                   OrthancPluginContext* context,
                   const std::string& uri,
@@ -429,6 +673,16 @@ namespace OrthancPlugins
                      const std::string& uri,
                      bool applyPlugins);
 
+  bool LookupHttpGetArgument(std::string& value,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& key);
+
+  // The key must be given in lower case, as the Orthanc core
+  // converts the names of the HTTP headers to lower case
+  bool LookupHttpHeader(std::string& value,
+                        const OrthancPluginHttpRequest* request,
+                        const std::string& key);
+
   inline void LogError(OrthancPluginContext* context,
                        const std::string& message)
   {
@@ -0,0 +1,811 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "PixelFormatConversion.h"
+#include "SimdSupport.h"
+
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  typedef void (*RowKernel) (void* target,
+                             const void* source,
+                             unsigned int width,
+                             float slope,
+                             float intercept);
+
+
+  unsigned int GetBytesPerPixel(OrthancPluginPixelFormat format)
+  {
+    switch (format)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        return 1;
+
+      case OrthancPluginPixelFormat_Grayscale16:
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        return 2;
+
+      case OrthancPluginPixelFormat_RGB24:
+        return 3;
+
+      case OrthancPluginPixelFormat_RGBA32:
+        return 4;
+
+      default:
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  static inline float GetLuminance(const uint8_t* rgb)
+  {
+    // Same coefficients as in the Orthanc core (ITU-R BT.709)
+    return (0.2126f * static_cast<float>(rgb[0]) +
+            0.7152f * static_cast<float>(rgb[1]) +
+            0.0722f * static_cast<float>(rgb[2]));
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  static void ScalarGrayscaleToGrayscale(void* target,
+                                         const void* source,
+                                         unsigned int width,
+                                         float slope,
+                                         float intercept)
+  {
+    TargetType* p = reinterpret_cast<TargetType*>(target);
+    const SourceType* q = reinterpret_cast<const SourceType*>(source);
+
+    for (unsigned int x = 0; x < width; x++)
+    {
+      p[x] = ClampAndRound<TargetType>(slope * static_cast<float>(q[x]) + intercept);
+    }
+  }
+
+
+  template <typename TargetType,
+            unsigned int SourceChannels>
+  static void ScalarColorToGrayscale(void* target,
+                                     const void* source,
+                                     unsigned int width,
+                                     float slope,
+                                     float intercept)
+  {
+    TargetType* p = reinterpret_cast<TargetType*>(target);
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(source);
+
+    for (unsigned int x = 0; x < width; x++, q += SourceChannels)
+    {
+      p[x] = ClampAndRound<TargetType>(slope * GetLuminance(q) + intercept);
+    }
+  }
+
+
+  template <unsigned int TargetChannels,
+            typename SourceType>
+  static void ScalarGrayscaleToColor(void* target,
+                                     const void* source,
+                                     unsigned int width,
+                                     float slope,
+                                     float intercept)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(target);
+    const SourceType* q = reinterpret_cast<const SourceType*>(source);
+
+    for (unsigned int x = 0; x < width; x++, p += TargetChannels)
+    {
+      const uint8_t value = ClampAndRound<uint8_t>(slope * static_cast<float>(q[x]) + intercept);
+      p[0] = value;
+      p[1] = value;
+      p[2] = value;
+
+      if (TargetChannels == 4)
+      {
+        p[3] = 255;
+      }
+    }
+  }
+
+
+  template <unsigned int TargetChannels,
+            unsigned int SourceChannels>
+  static void ScalarColorToColor(void* target,
+                                 const void* source,
+                                 unsigned int width,
+                                 float slope,
+                                 float intercept)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(target);
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(source);
+
+    for (unsigned int x = 0; x < width; x++, p += TargetChannels, q += SourceChannels)
+    {
+      p[0] = ClampAndRound<uint8_t>(slope * static_cast<float>(q[0]) + intercept);
+      p[1] = ClampAndRound<uint8_t>(slope * static_cast<float>(q[1]) + intercept);
+      p[2] = ClampAndRound<uint8_t>(slope * static_cast<float>(q[2]) + intercept);
+
+      if (TargetChannels == 4)
+      {
+        // The alpha channel is not rescaled
+        p[3] = (SourceChannels == 4 ? q[3] : 255);
+      }
+    }
+  }
+
+
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1
+  /**
+   * SSE2 kernels, processing 8 pixels per iteration
+   **/
+
+  static inline void LoadSse2(__m128& low, __m128& high, const uint8_t* source)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)), zero);
+    low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+  }
+
+  static inline void LoadSse2(__m128& low, __m128& high, const uint16_t* source)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+  }
+
+  static inline void LoadSse2(__m128& low, __m128& high, const int16_t* source)
+  {
+    // Sign extension by an arithmetic shift of the duplicated words
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+  }
+
+  static inline void StoreSse2(uint8_t* target, __m128i low, __m128i high)
+  {
+    const __m128i v = _mm_packs_epi32(low, high);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target), _mm_packus_epi16(v, v));
+  }
+
+  static inline void StoreSse2(uint16_t* target, __m128i low, __m128i high)
+  {
+    // SSE2 has no unsigned saturation from 32 to 16 bits: Shift the
+    // range to signed values, then flip back the sign bit
+    const __m128i offset = _mm_set1_epi32(32768);
+    const __m128i v = _mm_packs_epi32(_mm_sub_epi32(low, offset), _mm_sub_epi32(high, offset));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_xor_si128(v, _mm_set1_epi16(-32768)));
+  }
+
+  static inline void StoreSse2(int16_t* target, __m128i low, __m128i high)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_packs_epi32(low, high));
+  }
+
+
+  // Applies "slope * value + intercept" to 4 values, then rounds and
+  // clamps them to the range of the target type, with the same
+  // floating-point operations as "ClampAndRound()"
+  template <typename TargetType>
+  class Sse2Rescaling
+  {
+  private:
+    __m128   slope_;
+    __m128   intercept_;
+    __m128   min_;
+    __m128   max_;
+    __m128   half_;
+    __m128i  base_;
+
+  public:
+    Sse2Rescaling(float slope,
+                  float intercept) :
+      slope_(_mm_set1_ps(slope)),
+      intercept_(_mm_set1_ps(intercept)),
+      min_(_mm_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::min()))),
+      max_(_mm_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::max()))),
+      half_(_mm_set1_ps(0.5f)),
+      base_(_mm_set1_epi32(static_cast<int32_t>(std::numeric_limits<TargetType>::min())))
+    {
+    }
+
+    __m128i Apply(__m128 v) const
+    {
+      v = _mm_add_ps(_mm_mul_ps(v, slope_), intercept_);
+      v = _mm_add_ps(_mm_sub_ps(_mm_min_ps(_mm_max_ps(v, min_), max_), min_), half_);
+      return _mm_add_epi32(_mm_cvttps_epi32(v), base_);
+    }
+  };
+
+
+  template <typename TargetType,
+            typename SourceType>
+  static void Sse2GrayscaleToGrayscale(void* target,
+                                       const void* source,
+                                       unsigned int width,
+                                       float slope,
+                                       float intercept)
+  {
+    TargetType* p = reinterpret_cast<TargetType*>(target);
+    const SourceType* q = reinterpret_cast<const SourceType*>(source);
+
+    const Sse2Rescaling<TargetType> rescaling(slope, intercept);
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128 low, high;
+      LoadSse2(low, high, q + x);
+      StoreSse2(p + x, rescaling.Apply(low), rescaling.Apply(high));
+    }
+
+    ScalarGrayscaleToGrayscale<TargetType, SourceType>(p + x, q + x, width - x, slope, intercept);
+  }
+
+
+  /**
+   * The color kernels process 4 pixels at once, one per 32-bit lane
+   * of a SSE2 register, with the channels in its bytes (red first).
+   * SSE2 has no byte shuffle: RGB24 pixels are moved to and from the
+   * lanes by shifts and masks. The loads of RGB24 read 16 bytes (6
+   * pixels), and the stores write 14 bytes (5 pixels), hence the
+   * margins of the loops below.
+   **/
+
+  // The 4th byte of the lanes is undefined
+  static inline __m128i LoadRgb24Sse2(const uint8_t* source)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(v, _mm_srli_si128(v, 3)),
+                              _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9)));
+  }
+
+  static inline void StoreRgb24Sse2(uint8_t* target, __m128i pixels)
+  {
+    // Drop the 4th byte of the lanes: Each 64-bit half then holds 2
+    // pixels in its 6 lowest bytes
+    const __m128i first = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+    const __m128i v = _mm_or_si128(_mm_and_si128(pixels, first),
+                                   _mm_and_si128(_mm_srli_epi64(pixels, 8), _mm_slli_epi64(first, 24)));
+
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target), v);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target + 6), _mm_unpackhi_epi64(v, v));
+  }
+
+  template <unsigned int Channels>
+  static inline __m128i LoadColorSse2(const uint8_t* source)
+  {
+    return (Channels == 3 ?
+            LoadRgb24Sse2(source) :
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+  }
+
+  template <unsigned int Channels>
+  static inline void StoreColorSse2(uint8_t* target, __m128i pixels)
+  {
+    if (Channels == 3)
+    {
+      StoreRgb24Sse2(target, pixels);
+    }
+    else
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target), pixels);
+    }
+  }
+
+  static inline __m128 GetLuminanceSse2(__m128i pixels)
+  {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 red = _mm_cvtepi32_ps(_mm_and_si128(pixels, mask));
+    const __m128 green = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask));
+    const __m128 blue = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask));
+
+    // Same order of the operations as in "GetLuminance()"
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(red, _mm_set1_ps(0.2126f)),
+                                 _mm_mul_ps(green, _mm_set1_ps(0.7152f))),
+                      _mm_mul_ps(blue, _mm_set1_ps(0.0722f)));
+  }
+
+  // Rescales each of the 16 bytes
+  static inline __m128i RescaleBytesSse2(__m128i v,
+                                         const Sse2Rescaling<uint8_t>& rescaling)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_unpacklo_epi8(v, zero);
+    const __m128i high = _mm_unpackhi_epi8(v, zero);
+
+    return _mm_packus_epi16(
+      _mm_packs_epi32(rescaling.Apply(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero))),
+                      rescaling.Apply(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)))),
+      _mm_packs_epi32(rescaling.Apply(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero))),
+                      rescaling.Apply(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)))));
+  }
+
+
+  template <typename TargetType,
+            unsigned int SourceChannels>
+  static void Sse2ColorToGrayscale(void* target,
+                                   const void* source,
+                                   unsigned int width,
+                                   float slope,
+                                   float intercept)
+  {
+    TargetType* p = reinterpret_cast<TargetType*>(target);
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(source);
+
+    const Sse2Rescaling<TargetType> rescaling(slope, intercept);
+    const unsigned int margin = (SourceChannels == 3 ? 6 : 4);
+
+    unsigned int x = 0;
+    for (; x + 4 + margin <= width; x += 8)
+    {
+      const __m128 low = GetLuminanceSse2(LoadColorSse2<SourceChannels>(q + x * SourceChannels));
+      const __m128 high = GetLuminanceSse2(LoadColorSse2<SourceChannels>(q + (x + 4) * SourceChannels));
+      StoreSse2(p + x, rescaling.Apply(low), rescaling.Apply(high));
+    }
+
+    ScalarColorToGrayscale<TargetType, SourceChannels>(p + x, q + x * SourceChannels, width - x, slope, intercept);
+  }
+
+
+  template <unsigned int TargetChannels,
+            typename SourceType>
+  static void Sse2GrayscaleToColor(void* target,
+                                   const void* source,
+                                   unsigned int width,
+                                   float slope,
+                                   float intercept)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(target);
+    const SourceType* q = reinterpret_cast<const SourceType*>(source);
+
+    const Sse2Rescaling<uint8_t> rescaling(slope, intercept);
+    const __m128i alpha = _mm_slli_epi32(_mm_set1_epi32(0xff), 24);
+    const unsigned int margin = (TargetChannels == 3 ? 5 : 4);
+
+    unsigned int x = 0;
+    for (; x + 4 + margin <= width; x += 8)
+    {
+      __m128 low, high;
+      LoadSse2(low, high, q + x);
+
+      // Replicate each value over the 4 bytes of its lane
+      const __m128i words = _mm_packs_epi32(rescaling.Apply(low), rescaling.Apply(high));
+      const __m128i bytes = _mm_packus_epi16(words, words);
+      const __m128i pairs = _mm_unpacklo_epi8(bytes, bytes);
+
+      StoreColorSse2<TargetChannels>(p + x * TargetChannels,
+                                     _mm_or_si128(_mm_unpacklo_epi16(pairs, pairs), alpha));
+      StoreColorSse2<TargetChannels>(p + (x + 4) * TargetChannels,
+                                     _mm_or_si128(_mm_unpackhi_epi16(pairs, pairs), alpha));
+    }
+
+    ScalarGrayscaleToColor<TargetChannels, SourceType>(p + x * TargetChannels, q + x, width - x, slope, intercept);
+  }
+
+
+  template <unsigned int TargetChannels,
+            unsigned int SourceChannels>
+  static void Sse2ColorToColor(void* target,
+                               const void* source,
+                               unsigned int width,
+                               float slope,
+                               float intercept)
+  {
+    uint8_t* p = reinterpret_cast<uint8_t*>(target);
+    const uint8_t* q = reinterpret_cast<const uint8_t*>(source);
+
+    const Sse2Rescaling<uint8_t> rescaling(slope, intercept);
+    const __m128i alpha = _mm_slli_epi32(_mm_set1_epi32(0xff), 24);
+    const unsigned int margin = (SourceChannels == 3 ? 6 : (TargetChannels == 3 ? 5 : 4));
+
+    unsigned int x = 0;
+    for (; x + margin <= width; x += 4)
+    {
+      const __m128i pixels = LoadColorSse2<SourceChannels>(q + x * SourceChannels);
+      __m128i rescaled = RescaleBytesSse2(pixels, rescaling);
+
+      if (TargetChannels == 4)
+      {
+        // The alpha channel is not rescaled
+        rescaled = _mm_or_si128(_mm_andnot_si128(alpha, rescaled),
+                                SourceChannels == 4 ? _mm_and_si128(pixels, alpha) : alpha);
+      }
+
+      StoreColorSse2<TargetChannels>(p + x * TargetChannels, rescaled);
+    }
+
+    ScalarColorToColor<TargetChannels, SourceChannels>(p + x * TargetChannels, q + x * SourceChannels,
+                                                       width - x, slope, intercept);
+  }
+
+
+  // The channels of RGB24 are rescaled independently: They are
+  // processed as a grayscale row that is 3 times wider
+  static void Sse2Rgb24ToRgb24(void* target,
+                               const void* source,
+                               unsigned int width,
+                               float slope,
+                               float intercept)
+  {
+    Sse2GrayscaleToGrayscale<uint8_t, uint8_t>(target, source, 3 * width, slope, intercept);
+  }
+
+
+  /**
+   * AVX2 kernels, processing 16 pixels per iteration
+   **/
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void LoadAvx2(__m256& low, __m256& high, const uint8_t* source)
+  {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+    low = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+    high = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void LoadAvx2(__m256& low, __m256& high, const uint16_t* source)
+  {
+    low = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source))));
+    high = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 8))));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void LoadAvx2(__m256& low, __m256& high, const int16_t* source)
+  {
+    low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source))));
+    high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 8))));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline __m128i PackAvx2(__m256i v)
+  {
+    // "_mm256_packs_epi32()" works within each 128-bit lane, which
+    // would interleave the pixels: Pack the two halves instead
+    return _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void StoreAvx2(uint8_t* target, __m256i low, __m256i high)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_packus_epi16(PackAvx2(low), PackAvx2(high)));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void StoreAvx2(uint16_t* target, __m256i low, __m256i high)
+  {
+    const __m256i offset = _mm256_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(-32768);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target),
+                     _mm_xor_si128(PackAvx2(_mm256_sub_epi32(low, offset)), flip));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target + 8),
+                     _mm_xor_si128(PackAvx2(_mm256_sub_epi32(high, offset)), flip));
+  }
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 inline void StoreAvx2(int16_t* target, __m256i low, __m256i high)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target), PackAvx2(low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target + 8), PackAvx2(high));
+  }
+
+
+  template <typename TargetType,
+            typename SourceType>
+  static ORTHANC_PLUGINS_TARGET_AVX2 void Avx2GrayscaleToGrayscale(void* target,
+                                                                   const void* source,
+                                                                   unsigned int width,
+                                                                   float slope,
+                                                                   float intercept)
+  {
+    TargetType* p = reinterpret_cast<TargetType*>(target);
+    const SourceType* q = reinterpret_cast<const SourceType*>(source);
+
+    const __m256 vslope = _mm256_set1_ps(slope);
+    const __m256 vintercept = _mm256_set1_ps(intercept);
+    const __m256 vmin = _mm256_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::min()));
+    const __m256 vmax = _mm256_set1_ps(static_cast<float>(std::numeric_limits<TargetType>::max()));
+    const __m256 vhalf = _mm256_set1_ps(0.5f);
+    const __m256i vbase = _mm256_set1_epi32(static_cast<int32_t>(std::numeric_limits<TargetType>::min()));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m256 low, high;
+      LoadAvx2(low, high, q + x);
+
+      // No FMA, in order to get the same rounding as the scalar loop
+      low = _mm256_add_ps(_mm256_mul_ps(low, vslope), vintercept);
+      high = _mm256_add_ps(_mm256_mul_ps(high, vslope), vintercept);
+
+      low = _mm256_add_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_max_ps(low, vmin), vmax), vmin), vhalf);
+      high = _mm256_add_ps(_mm256_sub_ps(_mm256_min_ps(_mm256_max_ps(high, vmin), vmax), vmin), vhalf);
+
+      StoreAvx2(p + x,
+                _mm256_add_epi32(_mm256_cvttps_epi32(low), vbase),
+                _mm256_add_epi32(_mm256_cvttps_epi32(high), vbase));
+    }
+
+    ScalarGrayscaleToGrayscale<TargetType, SourceType>(p + x, q + x, width - x, slope, intercept);
+  }
+
+
+  static ORTHANC_PLUGINS_TARGET_AVX2 void Avx2Rgb24ToRgb24(void* target,
+                                                           const void* source,
+                                                           unsigned int width,
+                                                           float slope,
+                                                           float intercept)
+  {
+    Avx2GrayscaleToGrayscale<uint8_t, uint8_t>(target, source, 3 * width, slope, intercept);
+  }
+#endif
+
+
+  template <typename SourceType>
+  static RowKernel LookupGrayscaleKernel(OrthancPluginPixelFormat targetFormat,
+                                         SimdInstructionSet instructionSet)
+  {
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1
+    if (instructionSet == SimdInstructionSet_AVX2)
+    {
+      switch (targetFormat)
+      {
+        case OrthancPluginPixelFormat_Grayscale8:
+          return Avx2GrayscaleToGrayscale<uint8_t, SourceType>;
+
+        case OrthancPluginPixelFormat_Grayscale16:
+          return Avx2GrayscaleToGrayscale<uint16_t, SourceType>;
+
+        case OrthancPluginPixelFormat_SignedGrayscale16:
+          return Avx2GrayscaleToGrayscale<int16_t, SourceType>;
+
+        default:
+          break;
+      }
+    }
+
+    // The AVX2 CPUs use the SSE2 kernels for the color targets
+    if (instructionSet != SimdInstructionSet_None)
+    {
+      switch (targetFormat)
+      {
+        case OrthancPluginPixelFormat_Grayscale8:
+          return Sse2GrayscaleToGrayscale<uint8_t, SourceType>;
+
+        case OrthancPluginPixelFormat_Grayscale16:
+          return Sse2GrayscaleToGrayscale<uint16_t, SourceType>;
+
+        case OrthancPluginPixelFormat_SignedGrayscale16:
+          return Sse2GrayscaleToGrayscale<int16_t, SourceType>;
+
+        case OrthancPluginPixelFormat_RGB24:
+          return Sse2GrayscaleToColor<3, SourceType>;
+
+        case OrthancPluginPixelFormat_RGBA32:
+          return Sse2GrayscaleToColor<4, SourceType>;
+
+        default:
+          break;
+      }
+    }
+#endif
+
+    switch (targetFormat)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        return ScalarGrayscaleToGrayscale<uint8_t, SourceType>;
+
+      case OrthancPluginPixelFormat_Grayscale16:
+        return ScalarGrayscaleToGrayscale<uint16_t, SourceType>;
+
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        return ScalarGrayscaleToGrayscale<int16_t, SourceType>;
+
+      case OrthancPluginPixelFormat_RGB24:
+        return ScalarGrayscaleToColor<3, SourceType>;
+
+      case OrthancPluginPixelFormat_RGBA32:
+        return ScalarGrayscaleToColor<4, SourceType>;
+
+      default:
+        return NULL;
+    }
+  }
+
+
+  template <unsigned int SourceChannels>
+  static RowKernel LookupColorKernel(OrthancPluginPixelFormat targetFormat,
+                                     SimdInstructionSet instructionSet)
+  {
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1
+    if (SourceChannels == 3 &&
+        targetFormat == OrthancPluginPixelFormat_RGB24)
+    {
+      switch (instructionSet)
+      {
+        case SimdInstructionSet_AVX2:
+          return Avx2Rgb24ToRgb24;
+
+        case SimdInstructionSet_SSE2:
+          return Sse2Rgb24ToRgb24;
+
+        default:
+          break;
+      }
+    }
+
+    // Apart from the case above, there is no AVX2 color kernel
+    if (instructionSet != SimdInstructionSet_None)
+    {
+      switch (targetFormat)
+      {
+        case OrthancPluginPixelFormat_Grayscale8:
+          return Sse2ColorToGrayscale<uint8_t, SourceChannels>;
+
+        case OrthancPluginPixelFormat_Grayscale16:
+          return Sse2ColorToGrayscale<uint16_t, SourceChannels>;
+
+        case OrthancPluginPixelFormat_SignedGrayscale16:
+          return Sse2ColorToGrayscale<int16_t, SourceChannels>;
+
+        case OrthancPluginPixelFormat_RGB24:
+          return Sse2ColorToColor<3, SourceChannels>;
+
+        case OrthancPluginPixelFormat_RGBA32:
+          return Sse2ColorToColor<4, SourceChannels>;
+
+        default:
+          break;
+      }
+    }
+#endif
+
+    switch (targetFormat)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        return ScalarColorToGrayscale<uint8_t, SourceChannels>;
+
+      case OrthancPluginPixelFormat_Grayscale16:
+        return ScalarColorToGrayscale<uint16_t, SourceChannels>;
+
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        return ScalarColorToGrayscale<int16_t, SourceChannels>;
+
+      case OrthancPluginPixelFormat_RGB24:
+        return ScalarColorToColor<3, SourceChannels>;
+
+      case OrthancPluginPixelFormat_RGBA32:
+        return ScalarColorToColor<4, SourceChannels>;
+
+      default:
+        return NULL;
+    }
+  }
+
+
+  static RowKernel LookupKernel(OrthancPluginPixelFormat targetFormat,
+                                OrthancPluginPixelFormat sourceFormat)
+  {
+    const SimdInstructionSet instructionSet = GetSimdInstructionSet();
+
+    switch (sourceFormat)
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+        return LookupGrayscaleKernel<uint8_t>(targetFormat, instructionSet);
+
+      case OrthancPluginPixelFormat_Grayscale16:
+        return LookupGrayscaleKernel<uint16_t>(targetFormat, instructionSet);
+
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        return LookupGrayscaleKernel<int16_t>(targetFormat, instructionSet);
+
+      case OrthancPluginPixelFormat_RGB24:
+        return LookupColorKernel<3>(targetFormat, instructionSet);
+
+      case OrthancPluginPixelFormat_RGBA32:
+        return LookupColorKernel<4>(targetFormat, instructionSet);
+
+      default:
+        return NULL;
+    }
+  }
+
+
+  void ConvertPixelFormat(void*                     targetBuffer,
+                          OrthancPluginPixelFormat  targetFormat,
+                          unsigned int              targetPitch,
+                          const void*               sourceBuffer,
+                          OrthancPluginPixelFormat  sourceFormat,
+                          unsigned int              sourcePitch,
+                          unsigned int              width,
+                          unsigned int              height,
+                          float                     slope,
+                          float                     intercept)
+  {
+    if (width == 0 ||
+        height == 0)
+    {
+      return;
+    }
+
+    if (targetBuffer == NULL ||
+        sourceBuffer == NULL ||
+        targetPitch < width * GetBytesPerPixel(targetFormat) ||
+        sourcePitch < width * GetBytesPerPixel(sourceFormat))
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    uint8_t* target = reinterpret_cast<uint8_t*>(targetBuffer);
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(sourceBuffer);
+
+    if (targetFormat == sourceFormat &&
+        slope == 1.0f &&
+        intercept == 0.0f)
+    {
+      const size_t rowSize = width * GetBytesPerPixel(targetFormat);
+      for (unsigned int y = 0; y < height; y++)
+      {
+        memcpy(target + static_cast<size_t>(y) * targetPitch,
+               source + static_cast<size_t>(y) * sourcePitch, rowSize);
+      }
+
+      return;
+    }
+
+    RowKernel kernel = LookupKernel(targetFormat, sourceFormat);
+    if (kernel == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotImplemented);
+    }
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+      // The offsets are computed in "size_t", as "y * pitch" can
+      // overflow "unsigned int" for the images larger than 4GB
+      kernel(target + static_cast<size_t>(y) * targetPitch,
+             source + static_cast<size_t>(y) * sourcePitch, width, slope, intercept);
+    }
+  }
+
+
+  OrthancImage* ConvertPixelFormat(OrthancImage&             source,
+                                   OrthancPluginPixelFormat  targetFormat,
+                                   float                     slope,
+                                   float                     intercept)
+  {
+    const unsigned int width = source.GetWidth();
+    const unsigned int height = source.GetHeight();
+
+    OrthancImage* target = new OrthancImage(source.GetContext(), targetFormat, width, height);
+
+    try
+    {
+      ConvertPixelFormat(target->GetWritableBuffer(), targetFormat, target->GetPitch(),
+                         source.GetBuffer(), source.GetPixelFormat(), source.GetPitch(),
+                         width, height, slope, intercept);
+      return target;
+    }
+    catch (...)
+    {
+      delete target;
+      throw;
+    }
+  }
+}
@@ -0,0 +1,92 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+
+#include <limits>
+
+
+namespace OrthancPlugins
+{
+  unsigned int GetBytesPerPixel(OrthancPluginPixelFormat format);
+
+  template <typename T>
+  inline T ClampAndRound(float value)
+  {
+    // The rounding is done with the very same floating-point
+    // operations as in the vectorized kernels, so that all the
+    // instruction sets produce the same images
+    const float minValue = static_cast<float>(std::numeric_limits<T>::min());
+    const float maxValue = static_cast<float>(std::numeric_limits<T>::max());
+
+    if (value <= minValue)
+    {
+      return std::numeric_limits<T>::min();
+    }
+    else if (value >= maxValue)
+    {
+      return std::numeric_limits<T>::max();
+    }
+    else
+    {
+      return static_cast<T>(static_cast<int32_t>(value - minValue + 0.5f) +
+                            static_cast<int32_t>(std::numeric_limits<T>::min()));
+    }
+  }
+
+  /**
+   * Converts a raw image buffer between two pixel formats. Each
+   * target value is computed as "slope * source + intercept", then
+   * rounded and clamped to the range of the target format. Color
+   * sources are reduced to their luminance if the target is
+   * grayscale, and grayscale sources are replicated over the RGB
+   * channels. All the conversions are vectorized with SSE2. AVX2 is
+   * used for the grayscale targets and for RGB24-to-RGB24, the other
+   * color targets keeping the SSE2 kernels.
+   **/
+  void ConvertPixelFormat(void*                     targetBuffer,
+                          OrthancPluginPixelFormat  targetFormat,
+                          unsigned int              targetPitch,
+                          const void*               sourceBuffer,
+                          OrthancPluginPixelFormat  sourceFormat,
+                          unsigned int              sourcePitch,
+                          unsigned int              width,
+                          unsigned int              height,
+                          float                     slope,
+                          float                     intercept);
+
+  // This transfers ownership
+  OrthancImage* ConvertPixelFormat(OrthancImage&             source,
+                                   OrthancPluginPixelFormat  targetFormat,
+                                   float                     slope,
+                                   float                     intercept);
+
+  // This transfers ownership
+  inline OrthancImage* ConvertPixelFormat(OrthancImage&             source,
+                                          OrthancPluginPixelFormat  targetFormat)
+  {
+    return ConvertPixelFormat(source, targetFormat, 1.0f, 0.0f);
+  }
+}
@@ -0,0 +1,62 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Group of threads that are joined when the group goes out of
+   * scope, including if "create_thread()" throws after some threads
+   * were started. This prevents the threads from outliving the data
+   * that their caller shares with them. The threads must end by
+   * themselves.
+   **/
+  class ScopedThreadGroup : public boost::noncopyable
+  {
+  private:
+    boost::thread_group  threads_;
+
+  public:
+    ~ScopedThreadGroup()
+    {
+      threads_.join_all();
+    }
+
+    template <typename F>
+    void CreateThread(F function)
+    {
+      threads_.create_thread(function);
+    }
+
+    void JoinAll()
+    {
+      threads_.join_all();
+    }
+  };
+}
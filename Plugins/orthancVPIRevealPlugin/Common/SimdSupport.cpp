@@ -0,0 +1,123 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "SimdSupport.h"
+
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1 && defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+
+namespace OrthancPlugins
+{
+  static SimdInstructionSet DetectSimdInstructionSet()
+  {
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 0
+    return SimdInstructionSet_None;
+
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool hasSse2 = (info[3] & (1 << 26)) != 0;
+    const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+    const bool hasAvx = (info[2] & (1 << 28)) != 0;
+
+    bool hasAvx2 = false;
+    if (maxLeaf >= 7 &&
+        hasOsxsave &&
+        hasAvx &&
+        (_xgetbv(0) & 6) == 6)  // The OS saves the YMM registers
+    {
+      __cpuidex(info, 7, 0);
+      hasAvx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (hasAvx2)
+    {
+      return SimdInstructionSet_AVX2;
+    }
+    else if (hasSse2)
+    {
+      return SimdInstructionSet_SSE2;
+    }
+    else
+    {
+      return SimdInstructionSet_None;
+    }
+
+#else
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return SimdInstructionSet_AVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+      return SimdInstructionSet_SSE2;
+    }
+    else
+    {
+      return SimdInstructionSet_None;
+    }
+#endif
+  }
+
+
+  // The detection is done once, while the plugin is loaded
+  static SimdInstructionSet  detected_ = DetectSimdInstructionSet();
+  static SimdInstructionSet  maximum_ = SimdInstructionSet_AVX2;
+
+
+  SimdInstructionSet GetSimdInstructionSet()
+  {
+    return (detected_ < maximum_ ? detected_ : maximum_);
+  }
+
+
+  void RestrictSimdInstructionSet(SimdInstructionSet maximum)
+  {
+    maximum_ = maximum;
+  }
+
+
+  const char* EnumerationToString(SimdInstructionSet instructionSet)
+  {
+    switch (instructionSet)
+    {
+      case SimdInstructionSet_None:
+        return "None";
+
+      case SimdInstructionSet_SSE2:
+        return "SSE2";
+
+      case SimdInstructionSet_AVX2:
+        return "AVX2";
+
+      default:
+        return "?";
+    }
+  }
+}
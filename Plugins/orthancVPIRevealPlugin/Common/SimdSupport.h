@@ -0,0 +1,64 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define ORTHANC_PLUGINS_HAS_X86_SIMD  1
+#else
+#  define ORTHANC_PLUGINS_HAS_X86_SIMD  0
+#endif
+
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1
+#  include <emmintrin.h>
+#  include <immintrin.h>
+#endif
+
+// Visual Studio accepts the AVX2 intrinsics in any function, whereas
+// gcc and clang require the target to be enabled function by function
+#if ORTHANC_PLUGINS_HAS_X86_SIMD == 1 && (defined(__GNUC__) || defined(__clang__))
+#  define ORTHANC_PLUGINS_TARGET_AVX2  __attribute__((target("avx2")))
+#else
+#  define ORTHANC_PLUGINS_TARGET_AVX2
+#endif
+
+
+namespace OrthancPlugins
+{
+  enum SimdInstructionSet
+  {
+    SimdInstructionSet_None = 0,
+    SimdInstructionSet_SSE2 = 1,
+    SimdInstructionSet_AVX2 = 2
+  };
+
+  // Returns the best instruction set that is supported both by the
+  // compiler and by the CPU, unless it was restricted by a previous
+  // call to "RestrictSimdInstructionSet()"
+  SimdInstructionSet GetSimdInstructionSet();
+
+  // Forces the kernels to use a less capable instruction set (e.g. to
+  // compare the vectorized loops against the scalar ones)
+  void RestrictSimdInstructionSet(SimdInstructionSet maximum);
+
+  const char* EnumerationToString(SimdInstructionSet instructionSet);
+}
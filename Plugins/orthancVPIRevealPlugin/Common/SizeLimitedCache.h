@@ -0,0 +1,169 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <list>
+#include <map>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * LRU cache indexed by a string (e.g. the identifier of a
+   * resource), and limited by the total size of its values. The size
+   * of each value is given to "Store()". This class is not
+   * thread-safe: Its users protect it by their own mutex.
+   **/
+  template <typename Value>
+  class SizeLimitedCache : public boost::noncopyable
+  {
+  private:
+    struct Entry
+    {
+      Value                             value_;
+      size_t                            size_;
+      std::list<std::string>::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Entry>  Content;
+
+    size_t                  maxSize_;
+    size_t                  currentSize_;
+    Content                 content_;
+    std::list<std::string>  recency_;   // Most recently used at the front
+
+    void Remove(typename Content::iterator it)
+    {
+      // Copies, as the entry is erased before notifying the subclass
+      const std::string key = it->first;
+      const Value value = it->second.value_;
+
+      currentSize_ -= it->second.size_;
+      recency_.erase(it->second.recency_);
+      content_.erase(it);
+
+      OnRemoved(key, value);
+    }
+
+  protected:
+    // Called whenever a value leaves the cache (eviction, replacement
+    // or invalidation)
+    virtual void OnRemoved(const std::string& key,
+                           const Value& value)
+    {
+    }
+
+  public:
+    explicit SizeLimitedCache(size_t maxSize) :
+      maxSize_(maxSize),
+      currentSize_(0)
+    {
+    }
+
+    virtual ~SizeLimitedCache()
+    {
+    }
+
+    // Marks the value as the most recently used
+    bool Lookup(Value& value,
+                const std::string& key)
+    {
+      typename Content::iterator found = content_.find(key);
+      if (found == content_.end())
+      {
+        return false;
+      }
+      else
+      {
+        recency_.splice(recency_.begin(), recency_, found->second.recency_);
+        value = found->second.value_;
+        return true;
+      }
+    }
+
+    // Replaces the previous value of the key. A value that is larger
+    // than the whole cache is not stored.
+    void Store(const std::string& key,
+               const Value& value,
+               size_t size)
+    {
+      Invalidate(key);
+
+      if (size > maxSize_)
+      {
+        return;  // Too large to be cached
+      }
+
+      while (!recency_.empty() &&
+             currentSize_ + size > maxSize_)
+      {
+        Remove(content_.find(recency_.back()));
+      }
+
+      recency_.push_front(key);
+
+      try
+      {
+        Entry& entry = content_[key];
+        entry.value_ = value;
+        entry.size_ = size;
+        entry.recency_ = recency_.begin();
+      }
+      catch (...)
+      {
+        recency_.pop_front();
+        throw;
+      }
+
+      currentSize_ += size;
+    }
+
+    bool Invalidate(const std::string& key)
+    {
+      typename Content::iterator found = content_.find(key);
+      if (found == content_.end())
+      {
+        return false;
+      }
+      else
+      {
+        Remove(found);
+        return true;
+      }
+    }
+
+    bool Contains(const std::string& key) const
+    {
+      return content_.find(key) != content_.end();
+    }
+
+    bool IsEmpty() const
+    {
+      return content_.empty();
+    }
+  };
+}
@@ -0,0 +1,312 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "TilePyramid.h"
+
+#include "ImageResampling.h"
+#include "PixelFormatConversion.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <algorithm>
+#include <json/reader.h>
+#include <json/writer.h>
+#include <string.h>
+
+
+namespace OrthancPlugins
+{
+  static void CheckCorrupted(bool condition)
+  {
+    if (!condition)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_CorruptedFile);
+    }
+  }
+
+
+  void TilePyramid::AddLevel(OrthancImage& image,
+                             std::string& tiles,
+                             uint8_t quality)
+  {
+    Level level;
+    level.width_ = image.GetWidth();
+    level.height_ = image.GetHeight();
+    level.countX_ = (level.width_ + tileSize_ - 1) / tileSize_;
+    level.countY_ = (level.height_ + tileSize_ - 1) / tileSize_;
+    level.tiles_.reserve(level.countX_ * level.countY_);
+
+    const OrthancPluginPixelFormat format = image.GetPixelFormat();
+    const unsigned int bytesPerPixel = GetBytesPerPixel(format);
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(image.GetBuffer());
+    const unsigned int sourcePitch = image.GetPitch();
+
+    // All the tiles of the level are copied into the same scratch buffer
+    const unsigned int tilePitch = tileSize_ * bytesPerPixel;
+    PooledBuffer buffer(static_cast<size_t>(tilePitch) * tileSize_);
+    uint8_t* target = reinterpret_cast<uint8_t*>(buffer.GetData());
+
+    for (unsigned int ty = 0; ty < level.countY_; ty++)
+    {
+      for (unsigned int tx = 0; tx < level.countX_; tx++)
+      {
+        const unsigned int x = tx * tileSize_;
+        const unsigned int y = ty * tileSize_;
+        const unsigned int width = std::min(tileSize_, level.width_ - x);
+        const unsigned int height = std::min(tileSize_, level.height_ - y);
+
+        for (unsigned int row = 0; row < height; row++)
+        {
+          memcpy(target + row * tilePitch,
+                 source + (y + row) * sourcePitch + x * bytesPerPixel,
+                 width * bytesPerPixel);
+        }
+
+        OrthancImage tile(image.GetContext(), format, width, height, tilePitch, target);
+
+        MemoryBuffer jpeg(image.GetContext());
+        tile.CompressJpegImage(jpeg, quality);
+
+        level.tiles_.push_back(std::make_pair(tiles.size(), jpeg.GetSize()));
+        tiles.append(jpeg.GetData(), jpeg.GetSize());
+      }
+    }
+
+    levels_.push_back(level);
+  }
+
+
+  void TilePyramid::Serialize(const std::string& tiles)
+  {
+    Json::Value index = Json::objectValue;
+    index["TileSize"] = tileSize_;
+    index["Levels"] = Json::arrayValue;
+
+    for (size_t i = 0; i < levels_.size(); i++)
+    {
+      Json::Value level = Json::objectValue;
+      level["Width"] = levels_[i].width_;
+      level["Height"] = levels_[i].height_;
+      level["Tiles"] = Json::arrayValue;
+
+      for (size_t j = 0; j < levels_[i].tiles_.size(); j++)
+      {
+        level["Tiles"].append(static_cast<Json::UInt64>(levels_[i].tiles_[j].first));
+        level["Tiles"].append(static_cast<Json::UInt64>(levels_[i].tiles_[j].second));
+      }
+
+      index["Levels"].append(level);
+    }
+
+    Json::FastWriter writer;
+    const std::string json = writer.write(index);
+    const uint32_t length = static_cast<uint32_t>(json.size());
+
+    // Little-endian size of the index, the index, then the tiles
+    content_.clear();
+    content_.reserve(4 + json.size() + tiles.size());
+    content_.push_back(static_cast<char>(length & 0xff));
+    content_.push_back(static_cast<char>((length >> 8) & 0xff));
+    content_.push_back(static_cast<char>((length >> 16) & 0xff));
+    content_.push_back(static_cast<char>((length >> 24) & 0xff));
+    content_.append(json);
+    content_.append(tiles);
+
+    tilesOffset_ = 4 + json.size();
+  }
+
+
+  TilePyramid* TilePyramid::Build(OrthancImage& image,
+                                  unsigned int tileSize,
+                                  uint8_t quality)
+  {
+    if (tileSize < 16)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    if (image.GetPixelFormat() != OrthancPluginPixelFormat_Grayscale8 &&
+        image.GetPixelFormat() != OrthancPluginPixelFormat_RGB24)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_IncompatibleImageFormat);
+    }
+
+    TilePyramid* pyramid = new TilePyramid;
+
+    try
+    {
+      pyramid->tileSize_ = tileSize;
+
+      std::string tiles;
+      OrthancImage* level = &image;
+      boost::scoped_ptr<OrthancImage> downscaled;
+
+      for (;;)
+      {
+        pyramid->AddLevel(*level, tiles, quality);
+
+        const unsigned int width = level->GetWidth();
+        const unsigned int height = level->GetHeight();
+
+        if ((width <= tileSize && height <= tileSize) ||
+            width < 2 ||
+            height < 2)
+        {
+          break;
+        }
+
+        // Each level is computed from the previous one
+        OrthancImage* next = DownscaleImage(*level, 2, 0);
+        downscaled.reset(next);
+        level = next;
+      }
+
+      pyramid->Serialize(tiles);
+      return pyramid;
+    }
+    catch (...)
+    {
+      delete pyramid;
+      throw;
+    }
+  }
+
+
+  TilePyramid* TilePyramid::Parse(const void* content,
+                                  size_t size)
+  {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(content);
+    CheckCorrupted(content != NULL && size >= 4);
+
+    const size_t length = (static_cast<size_t>(bytes[0]) |
+                           (static_cast<size_t>(bytes[1]) << 8) |
+                           (static_cast<size_t>(bytes[2]) << 16) |
+                           (static_cast<size_t>(bytes[3]) << 24));
+    CheckCorrupted(length <= size - 4);
+
+    Json::Value index;
+    Json::Reader reader;
+    const char* json = reinterpret_cast<const char*>(bytes + 4);
+    CheckCorrupted(reader.parse(json, json + length, index) &&
+                   index.type() == Json::objectValue &&
+                   index.isMember("TileSize") &&
+                   index["TileSize"].isUInt() &&
+                   index["TileSize"].asUInt() > 0 &&
+                   index.isMember("Levels") &&
+                   index["Levels"].type() == Json::arrayValue);
+
+    TilePyramid* pyramid = new TilePyramid;
+
+    try
+    {
+      pyramid->tileSize_ = index["TileSize"].asUInt();
+      pyramid->tilesOffset_ = 4 + length;
+
+      const size_t tilesSize = size - pyramid->tilesOffset_;
+      const Json::Value& levels = index["Levels"];
+
+      for (Json::Value::ArrayIndex i = 0; i < levels.size(); i++)
+      {
+        const Json::Value& source = levels[i];
+        CheckCorrupted(source.type() == Json::objectValue &&
+                       source.isMember("Width") &&
+                       source["Width"].isUInt() &&
+                       source.isMember("Height") &&
+                       source["Height"].isUInt() &&
+                       source.isMember("Tiles") &&
+                       source["Tiles"].type() == Json::arrayValue);
+
+        Level level;
+        level.width_ = source["Width"].asUInt();
+        level.height_ = source["Height"].asUInt();
+        level.countX_ = (level.width_ + pyramid->tileSize_ - 1) / pyramid->tileSize_;
+        level.countY_ = (level.height_ + pyramid->tileSize_ - 1) / pyramid->tileSize_;
+
+        const Json::Value& tiles = source["Tiles"];
+        CheckCorrupted(tiles.size() == 2 * level.countX_ * level.countY_);
+
+        level.tiles_.resize(level.countX_ * level.countY_);
+        for (size_t j = 0; j < level.tiles_.size(); j++)
+        {
+          const Json::Value& offset = tiles[static_cast<Json::Value::ArrayIndex>(2 * j)];
+          const Json::Value& tileSize = tiles[static_cast<Json::Value::ArrayIndex>(2 * j + 1)];
+          CheckCorrupted(offset.isUInt64() &&
+                         tileSize.isUInt64() &&
+                         offset.asUInt64() <= tilesSize &&
+                         tileSize.asUInt64() <= tilesSize - offset.asUInt64());
+
+          level.tiles_[j] = std::make_pair(static_cast<size_t>(offset.asUInt64()),
+                                           static_cast<size_t>(tileSize.asUInt64()));
+        }
+
+        pyramid->levels_.push_back(level);
+      }
+
+      pyramid->content_.assign(reinterpret_cast<const char*>(content), size);
+      return pyramid;
+    }
+    catch (...)
+    {
+      delete pyramid;
+      throw;
+    }
+  }
+
+
+  bool TilePyramid::LookupTile(const char*& jpeg,
+                               size_t& size,
+                               unsigned int level,
+                               unsigned int x,
+                               unsigned int y) const
+  {
+    if (level >= levels_.size() ||
+        x >= levels_[level].countX_ ||
+        y >= levels_[level].countY_)
+    {
+      return false;
+    }
+
+    const std::pair<size_t, size_t>& tile = levels_[level].tiles_[y * levels_[level].countX_ + x];
+    jpeg = content_.c_str() + tilesOffset_ + tile.first;
+    size = tile.second;
+    return true;
+  }
+
+
+  void TilePyramid::Format(Json::Value& target) const
+  {
+    target = Json::objectValue;
+    target["TileSize"] = tileSize_;
+    target["Levels"] = Json::arrayValue;
+
+    for (size_t i = 0; i < levels_.size(); i++)
+    {
+      Json::Value level = Json::objectValue;
+      level["Width"] = levels_[i].width_;
+      level["Height"] = levels_[i].height_;
+      level["CountX"] = levels_[i].countX_;
+      level["CountY"] = levels_[i].countY_;
+      target["Levels"].append(level);
+    }
+  }
+}
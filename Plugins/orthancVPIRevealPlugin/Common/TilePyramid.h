@@ -0,0 +1,106 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "OrthancPluginCppWrapper.h"
+
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Multi-resolution pyramid of square JPEG tiles. Level 0 is the
+   * full resolution, and each level is half the size of the previous
+   * one, down to the first level that fits in one tile. The tiles on
+   * the right and bottom borders are smaller than the others. The
+   * pyramid can be serialized, e.g. to be stored as an attachment.
+   **/
+  class TilePyramid : public boost::noncopyable
+  {
+  private:
+    struct Level
+    {
+      unsigned int  width_;
+      unsigned int  height_;
+      unsigned int  countX_;
+      unsigned int  countY_;
+      std::vector<std::pair<size_t, size_t> >  tiles_;   // (offset, size), row by row
+    };
+
+    unsigned int        tileSize_;
+    std::vector<Level>  levels_;
+    std::string         content_;      // Serialized pyramid
+    size_t              tilesOffset_;  // Location of the first tile in "content_"
+
+    TilePyramid() :
+      tileSize_(0),
+      tilesOffset_(0)
+    {
+    }
+
+    void AddLevel(OrthancImage& image,
+                  std::string& tiles,
+                  uint8_t quality);
+
+    void Serialize(const std::string& tiles);
+
+  public:
+    // The image must be Grayscale8 or RGB24 (e.g. a rendered frame).
+    // This transfers ownership.
+    static TilePyramid* Build(OrthancImage& image,
+                              unsigned int tileSize,
+                              uint8_t quality);
+
+    // This transfers ownership
+    static TilePyramid* Parse(const void* content,
+                              size_t size);
+
+    const std::string& GetContent() const
+    {
+      return content_;
+    }
+
+    unsigned int GetTileSize() const
+    {
+      return tileSize_;
+    }
+
+    unsigned int GetLevelsCount() const
+    {
+      return static_cast<unsigned int>(levels_.size());
+    }
+
+    // Returns "false" if the tile does not exist
+    bool LookupTile(const char*& jpeg,
+                    size_t& size,
+                    unsigned int level,
+                    unsigned int x,
+                    unsigned int y) const;
+
+    // Dimensions of the levels, as expected by the viewers
+    void Format(Json::Value& target) const;
+  };
+}
@@ -0,0 +1,394 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "WorklistStore.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <algorithm>
+#include <iterator>
+
+
+namespace OrthancPlugins
+{
+  static const DicomTagKey TAG_PATIENT_ID = 0x00100020;
+  static const DicomTagKey TAG_SCHEDULED_PROCEDURE_STEP_SEQUENCE = 0x00400100;
+  static const DicomTagKey TAG_MODALITY = 0x00080060;
+  static const DicomTagKey TAG_SCHEDULED_STATION_AET = 0x00400001;
+  static const DicomTagKey TAG_SCHEDULED_START_DATE = 0x00400002;
+
+
+  static void UpdateIndex(std::map<std::string, std::set<uint64_t> >& index,
+                          const std::string* value,
+                          uint64_t id,
+                          bool remove)
+  {
+    if (value == NULL ||
+        value->empty())
+    {
+      return;
+    }
+
+    if (remove)
+    {
+      std::map<std::string, std::set<uint64_t> >::iterator found = index.find(*value);
+      if (found != index.end())
+      {
+        found->second.erase(id);
+        if (found->second.empty())
+        {
+          index.erase(found);
+        }
+      }
+    }
+    else
+    {
+      index[*value].insert(id);
+    }
+  }
+
+
+  void WorklistStore::UpdateIndexes(EntryId id,
+                                    const MatchableDataset& dataset,
+                                    bool remove)
+  {
+    UpdateIndex(patientIds_, dataset.LookupValue(TAG_PATIENT_ID), id, remove);
+
+    size_t count;
+    if (dataset.LookupSequence(count, TAG_SCHEDULED_PROCEDURE_STEP_SEQUENCE))
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        const MatchableDataset& item = dataset.GetSequenceItem(TAG_SCHEDULED_PROCEDURE_STEP_SEQUENCE, i);
+        UpdateIndex(modalities_, item.LookupValue(TAG_MODALITY), id, remove);
+        UpdateIndex(stationAets_, item.LookupValue(TAG_SCHEDULED_STATION_AET), id, remove);
+        UpdateIndex(startDates_, item.LookupValue(TAG_SCHEDULED_START_DATE), id, remove);
+      }
+    }
+  }
+
+
+  void WorklistStore::RemoveInternal(std::map<std::string, EntryId>::iterator key)
+  {
+    std::map<EntryId, EntryPointer>::iterator entry = entries_.find(key->second);
+    if (entry != entries_.end())
+    {
+      UpdateIndexes(entry->first, *entry->second->dataset_, true);
+      entries_.erase(entry);
+    }
+
+    keys_.erase(key);
+  }
+
+
+  // Returns "false" if the query does not constrain this tag to a
+  // single value (universal, list of values or wildcard matching)
+  static bool LookupSingleValue(std::string& value,
+                                const Json::Value& query,
+                                const std::string& tag)
+  {
+    if (query.type() == Json::objectValue &&
+        query.isMember(tag) &&
+        query[tag].type() == Json::stringValue)
+    {
+      value = boost::trim_copy(query[tag].asString());
+      return (!value.empty() &&
+              value.find_first_of("*?\\") == std::string::npos);
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  static void Restrict(std::vector<uint64_t>& candidates,
+                       bool& restricted,
+                       const std::vector<uint64_t>& ids)
+  {
+    if (restricted)
+    {
+      std::vector<uint64_t> intersection;
+      std::set_intersection(candidates.begin(), candidates.end(), ids.begin(), ids.end(),
+                            std::back_inserter(intersection));
+      candidates.swap(intersection);
+    }
+    else
+    {
+      candidates = ids;
+      restricted = true;
+    }
+  }
+
+
+  static void RestrictToValue(std::vector<uint64_t>& candidates,
+                              bool& restricted,
+                              const std::map<std::string, std::set<uint64_t> >& index,
+                              const std::string& value)
+  {
+    std::vector<uint64_t> ids;
+
+    std::map<std::string, std::set<uint64_t> >::const_iterator found = index.find(value);
+    if (found != index.end())
+    {
+      ids.assign(found->second.begin(), found->second.end());
+    }
+
+    Restrict(candidates, restricted, ids);
+  }
+
+
+  // Same semantics as the range matching of "CompiledFindMatcher"
+  static void RestrictToRange(std::vector<uint64_t>& candidates,
+                              bool& restricted,
+                              const std::map<std::string, std::set<uint64_t> >& index,
+                              const std::string& lower,
+                              const std::string& upper)
+  {
+    std::vector<uint64_t> ids;
+
+    std::map<std::string, std::set<uint64_t> >::const_iterator it =
+      (lower.empty() ? index.begin() : index.lower_bound(lower));
+
+    for (; it != index.end(); ++it)
+    {
+      if (!upper.empty() &&
+          it->first.compare(0, upper.size(), upper) > 0)
+      {
+        break;
+      }
+
+      ids.insert(ids.end(), it->second.begin(), it->second.end());
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    Restrict(candidates, restricted, ids);
+  }
+
+
+  bool WorklistStore::LookupCandidates(std::vector<EntryId>& candidates,
+                                       const Json::Value& query)
+  {
+    bool restricted = false;
+    std::string value;
+
+    if (LookupSingleValue(value, query, "0010,0020"))
+    {
+      RestrictToValue(candidates, restricted, patientIds_, value);
+    }
+
+    if (query.isMember("0040,0100") &&
+        query["0040,0100"].type() == Json::arrayValue &&
+        query["0040,0100"].size() > 0)
+    {
+      const Json::Value& step = query["0040,0100"][0];
+
+      if (LookupSingleValue(value, step, "0008,0060"))
+      {
+        RestrictToValue(candidates, restricted, modalities_, value);
+      }
+
+      if (LookupSingleValue(value, step, "0040,0001"))
+      {
+        RestrictToValue(candidates, restricted, stationAets_, value);
+      }
+
+      if (LookupSingleValue(value, step, "0040,0002"))
+      {
+        const size_t dash = value.find('-');
+        if (dash == std::string::npos)
+        {
+          RestrictToValue(candidates, restricted, startDates_, value);
+        }
+        else
+        {
+          RestrictToRange(candidates, restricted, startDates_,
+                          boost::trim_copy(value.substr(0, dash)),
+                          boost::trim_copy(value.substr(dash + 1)));
+        }
+      }
+    }
+
+    return restricted;
+  }
+
+
+  void WorklistStore::Store(const std::string& key,
+                            const std::string& version,
+                            const std::string& dicom,
+                            MatchableDatasetPointer dataset)
+  {
+    if (dataset.get() == NULL)
+    {
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NullPointer);
+    }
+
+    boost::shared_ptr<Entry> entry(new Entry);
+    entry->key_ = key;
+    entry->version_ = version;
+    entry->dicom_ = dicom;
+    entry->dataset_ = dataset;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::map<std::string, EntryId>::iterator found = keys_.find(key);
+    if (found != keys_.end())
+    {
+      RemoveInternal(found);
+    }
+
+    const EntryId id = nextId_++;
+    entries_[id] = entry;
+    keys_[key] = id;
+    UpdateIndexes(id, *dataset, false);
+  }
+
+
+  bool WorklistStore::Remove(const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::map<std::string, EntryId>::iterator found = keys_.find(key);
+    if (found == keys_.end())
+    {
+      return false;
+    }
+    else
+    {
+      RemoveInternal(found);
+      return true;
+    }
+  }
+
+
+  bool WorklistStore::LookupVersion(std::string& version,
+                                    const std::string& key)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::map<std::string, EntryId>::const_iterator found = keys_.find(key);
+    if (found == keys_.end())
+    {
+      return false;
+    }
+    else
+    {
+      version = entries_[found->second]->version_;
+      return true;
+    }
+  }
+
+
+  void WorklistStore::ListKeys(std::vector<std::string>& keys)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    keys.clear();
+    keys.reserve(keys_.size());
+
+    for (std::map<std::string, EntryId>::const_iterator it = keys_.begin(); it != keys_.end(); ++it)
+    {
+      keys.push_back(it->first);
+    }
+  }
+
+
+  size_t WorklistStore::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return entries_.size();
+  }
+
+
+  void WorklistStore::CollectCandidates(std::vector<EntryPointer>& candidates,
+                                        const Json::Value& query)
+  {
+    candidates.clear();
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::vector<EntryId> ids;
+      if (LookupCandidates(ids, query))
+      {
+        candidates.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+          candidates.push_back(entries_[ids[i]]);
+        }
+      }
+      else
+      {
+        candidates.reserve(entries_.size());
+        for (std::map<EntryId, EntryPointer>::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+        {
+          candidates.push_back(it->second);
+        }
+      }
+    }
+  }
+
+
+  void WorklistStore::Find(FindAnswersWriter& writer,
+                           const Json::Value& query,
+                           const CompiledFindMatcher& matcher)
+  {
+    // The candidates are matched by chunks, which keeps the matching
+    // parallel while checking the limit and the timeout regularly. The
+    // exact matching is done outside of the mutex, so that the store
+    // can be updated meanwhile.
+    static const size_t CHUNK_SIZE = 4096;
+
+    std::vector<EntryPointer> candidates;
+    CollectCandidates(candidates, query);
+
+    std::vector<MatchableDatasetPointer> datasets;
+    std::vector<size_t> matches;
+
+    for (size_t start = 0; start < candidates.size(); start += CHUNK_SIZE)
+    {
+      if (!writer.CheckTimeout())
+      {
+        return;
+      }
+
+      const size_t end = std::min(start + CHUNK_SIZE, candidates.size());
+
+      datasets.resize(end - start);
+      for (size_t i = start; i < end; i++)
+      {
+        datasets[i - start] = candidates[i]->dataset_;
+      }
+
+      matcher.IsMatchBatch(matches, datasets, 0);
+
+      for (size_t i = 0; i < matches.size(); i++)
+      {
+        if (!writer.AddAnswer(candidates[start + matches[i]]->dicom_))
+        {
+          return;
+        }
+      }
+    }
+  }
+}
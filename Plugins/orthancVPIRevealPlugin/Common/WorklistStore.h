@@ -0,0 +1,112 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "CompiledFindMatcher.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <set>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * In-memory store of worklists, with secondary indexes on the keys
+   * that most worklist queries constrain: Modality,
+   * ScheduledStationAETitle and ScheduledProcedureStepStartDate (in
+   * the Scheduled Procedure Step Sequence), and PatientID. A query
+   * first intersects the entries of the indexes it can use, then
+   * only runs the full matching on the remaining candidates.
+   **/
+  class WorklistStore : public boost::noncopyable
+  {
+  public:
+    struct Entry
+    {
+      std::string              key_;       // E.g. the path of the worklist file
+      std::string              version_;   // E.g. its modification time
+      std::string              dicom_;
+      MatchableDatasetPointer  dataset_;
+    };
+
+    typedef boost::shared_ptr<const Entry>  EntryPointer;
+
+  private:
+    typedef uint64_t                                   EntryId;
+    typedef std::map<std::string, std::set<EntryId> >  Index;
+
+    boost::mutex                           mutex_;
+    EntryId                                nextId_;
+    std::map<EntryId, EntryPointer>        entries_;
+    std::map<std::string, EntryId>         keys_;
+    Index                                  modalities_;
+    Index                                  stationAets_;
+    Index                                  startDates_;
+    Index                                  patientIds_;
+
+    void UpdateIndexes(EntryId id,
+                       const MatchableDataset& dataset,
+                       bool remove);
+
+    void RemoveInternal(std::map<std::string, EntryId>::iterator key);
+
+    bool LookupCandidates(std::vector<EntryId>& candidates,
+                          const Json::Value& query);
+
+    void CollectCandidates(std::vector<EntryPointer>& candidates,
+                           const Json::Value& query);
+
+  public:
+    WorklistStore() :
+      nextId_(0)
+    {
+    }
+
+    // Replaces the entry with the same key, if any
+    void Store(const std::string& key,
+               const std::string& version,
+               const std::string& dicom,
+               MatchableDatasetPointer dataset);
+
+    bool Remove(const std::string& key);
+
+    // Returns "false" if no entry has this key
+    bool LookupVersion(std::string& version,
+                       const std::string& key);
+
+    void ListKeys(std::vector<std::string>& keys);
+
+    size_t GetSize();
+
+    // The query is in the "short" format of "DicomToJson()", and
+    // must have been compiled into the matcher. The matches are sent
+    // to the writer as they are found, and the scan stops once the
+    // writer reaches its limit or its timeout.
+    void Find(FindAnswersWriter& writer,
+              const Json::Value& query,
+              const CompiledFindMatcher& matcher);
+  };
+}
@@ -0,0 +1,188 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "ChangeLog.h"
+
+#include <algorithm>
+
+
+namespace OrthancPlugins
+{
+  // Number of changes per segment
+  static const size_t SEGMENT_SIZE = 1024;
+
+
+  struct ChangeSeqComparator
+  {
+    bool operator() (int64_t seq,
+                     const ChangeLog::Change& change) const
+    {
+      return seq < change.seq_;
+    }
+  };
+
+
+  void ChangeLog::Clear()
+  {
+    for (size_t i = 0; i < segments_.size(); i++)
+    {
+      delete segments_[i];
+    }
+
+    segments_.clear();
+    size_ = 0;
+  }
+
+
+  void ChangeLog::Swap(ChangeLog& other)
+  {
+    segments_.swap(other.segments_);
+    std::swap(size_, other.size_);
+  }
+
+
+  void ChangeLog::Append(const Change& change)
+  {
+    if (size_ != 0 &&
+        change.seq_ <= GetLast().seq_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    if (segments_.empty() ||
+        segments_.back()->size() == SEGMENT_SIZE)
+    {
+      segments_.push_back(new Segment);
+      segments_.back()->reserve(SEGMENT_SIZE);
+    }
+
+    segments_.back()->push_back(change);
+    size_++;
+  }
+
+
+  void ChangeLog::RemoveLast()
+  {
+    if (size_ == 0)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    segments_.back()->pop_back();
+    size_--;
+
+    if (segments_.back()->empty())
+    {
+      delete segments_.back();
+      segments_.pop_back();
+    }
+  }
+
+
+  const ChangeLog::Change& ChangeLog::GetAt(uint64_t index) const
+  {
+    if (index >= size_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    return (*segments_[static_cast<size_t>(index / SEGMENT_SIZE)]) [static_cast<size_t>(index % SEGMENT_SIZE)];
+  }
+
+
+  uint64_t ChangeLog::FindAfter(int64_t seq) const
+  {
+    // First segment whose last change is after "seq"
+    size_t low = 0;
+    size_t high = segments_.size();
+
+    while (low < high)
+    {
+      size_t middle = (low + high) / 2;
+      if (segments_[middle]->back().seq_ > seq)
+      {
+        high = middle;
+      }
+      else
+      {
+        low = middle + 1;
+      }
+    }
+
+    if (low == segments_.size())
+    {
+      return size_;
+    }
+
+    const Segment& segment = *segments_[low];
+    Segment::const_iterator found = std::upper_bound(segment.begin(), segment.end(), seq, ChangeSeqComparator());
+
+    return (static_cast<uint64_t>(low) * SEGMENT_SIZE +
+            static_cast<uint64_t>(found - segment.begin()));
+  }
+
+
+  bool ChangeLog::LookupExpired(int64_t& lastSeq,
+                                uint64_t maxCount,
+                                const std::string& minDate) const
+  {
+    if (maxCount == 0 &&
+        minDate.empty())
+    {
+      return false;   // The changes are kept forever
+    }
+
+    bool found = false;
+    uint64_t remaining = size_;
+
+    for (size_t i = 0; i < segments_.size(); i++)
+    {
+      const Segment& segment = *segments_[i];
+
+      // A segment is only dropped if none of the two limits keeps it
+      if ((maxCount == 0 || remaining - segment.size() >= maxCount) &&
+          (minDate.empty() || segment.back().date_ < minDate))
+      {
+        lastSeq = segment.back().seq_;
+        remaining -= segment.size();
+        found = true;
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    return found;
+  }
+
+
+  void ChangeLog::DropUntil(int64_t lastSeq)
+  {
+    while (!segments_.empty() &&
+           segments_.front()->back().seq_ <= lastSeq)
+    {
+      size_ -= segments_.front()->size();
+      delete segments_.front();
+      segments_.pop_front();
+    }
+  }
+}
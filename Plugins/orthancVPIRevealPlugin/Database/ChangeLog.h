@@ -0,0 +1,115 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <orthanc/OrthancCppDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Append-only log of the changes, that can be used by the database
+  // back-ends to implement "LogChange()", "GetChanges()" and
+  // "GetLastChange()". The changes are stored in segments of fixed
+  // size, sorted by increasing sequence number. The retention drops
+  // whole segments from the front of the log, which costs nothing
+  // more than freeing them (no compaction and no vacuum).
+  class ChangeLog : public boost::noncopyable
+  {
+  public:
+    struct Change
+    {
+      int64_t                    seq_;
+      int32_t                    changeType_;
+      OrthancPluginResourceType  resourceType_;
+      int64_t                    resourceId_;   // Internal ID
+      std::string                date_;         // ISO format, as "20160101T123456"
+    };
+
+  private:
+    typedef std::vector<Change>  Segment;
+
+    // All the segments are full, except the last one
+    std::deque<Segment*>  segments_;
+    uint64_t              size_;
+
+  public:
+    ChangeLog() :
+      size_(0)
+    {
+    }
+
+    ~ChangeLog()
+    {
+      Clear();
+    }
+
+    void Clear();
+
+    void Swap(ChangeLog& other);
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    bool IsEmpty() const
+    {
+      return size_ == 0;
+    }
+
+    // The sequence numbers must be increasing
+    void Append(const Change& change);
+
+    void RemoveLast();
+
+    // In O(1), the first change having index 0
+    const Change& GetAt(uint64_t index) const;
+
+    const Change& GetLast() const
+    {
+      return GetAt(size_ - 1);
+    }
+
+    // Index of the first change whose sequence number is greater than
+    // "seq", or "GetSize()" if none. Reading the next changes by
+    // increasing index is sequential inside each segment.
+    uint64_t FindAfter(int64_t seq) const;
+
+    // Looks for the segments at the front of the log that can be
+    // dropped, while keeping at least "maxCount" changes (0 means no
+    // limit), as well as the changes whose date is not older than
+    // "minDate" (an empty string means no limit). If both limits are
+    // set, a segment is only dropped if it is beyond both of them. On
+    // success, "lastSeq" is set to the last change to be dropped.
+    bool LookupExpired(int64_t& lastSeq,
+                       uint64_t maxCount,
+                       const std::string& minDate) const;
+
+    // Drops the segments whose changes are all up to "lastSeq"
+    void DropUntil(int64_t lastSeq);
+  };
+}
@@ -0,0 +1,354 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "DatabaseMetrics.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <sstream>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+
+namespace OrthancPlugins
+{
+  // The histograms cover the durations from 2^MIN_OCTAVE to
+  // 2^(MAX_OCTAVE + 1) nanoseconds, plus one bucket below and one
+  // bucket above
+  static const unsigned int MIN_OCTAVE = 7;
+  static const unsigned int MAX_OCTAVE = 34;
+  static const unsigned int BUCKETS_COUNT = 2 * (MAX_OCTAVE - MIN_OCTAVE + 1) + 2;
+
+
+  struct Counters
+  {
+    uint64_t  counts_[DatabaseCall_Count];
+    uint64_t  errors_[DatabaseCall_Count];
+    uint64_t  durations_[DatabaseCall_Count];   // Sum, in nanoseconds
+    uint64_t  buckets_[DatabaseCall_Count][BUCKETS_COUNT];
+
+    Counters()
+    {
+      memset(counts_, 0, sizeof(counts_));
+      memset(errors_, 0, sizeof(errors_));
+      memset(durations_, 0, sizeof(durations_));
+      memset(buckets_, 0, sizeof(buckets_));
+    }
+
+    void Add(const Counters& other)
+    {
+      for (unsigned int i = 0; i < DatabaseCall_Count; i++)
+      {
+        counts_[i] += other.counts_[i];
+        errors_[i] += other.errors_[i];
+        durations_[i] += other.durations_[i];
+
+        for (unsigned int j = 0; j < BUCKETS_COUNT; j++)
+        {
+          buckets_[i][j] += other.buckets_[i][j];
+        }
+      }
+    }
+  };
+
+
+  struct DatabaseMetrics::Shard
+  {
+    boost::mutex  mutex_;
+    Counters      counters_;
+  };
+
+
+  static uint64_t GetNanoseconds()
+  {
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<uint64_t>(static_cast<double>(counter.QuadPart) * 1.0e9 /
+                                 static_cast<double>(frequency.QuadPart));
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (static_cast<uint64_t>(now.tv_sec) * static_cast<uint64_t>(1000000000) +
+            static_cast<uint64_t>(now.tv_nsec));
+#endif
+  }
+
+
+  static unsigned int GetBucket(uint64_t duration)
+  {
+    if (duration < (static_cast<uint64_t>(1) << MIN_OCTAVE))
+    {
+      return 0;
+    }
+
+    unsigned int octave = MIN_OCTAVE;
+    while (octave <= MAX_OCTAVE &&
+           (duration >> (octave + 1)) != 0)
+    {
+      octave++;
+    }
+
+    if (octave > MAX_OCTAVE)
+    {
+      return BUCKETS_COUNT - 1;
+    }
+    else
+    {
+      // The bit after the leading one selects the half of the octave
+      return 1 + 2 * (octave - MIN_OCTAVE) + static_cast<unsigned int>((duration >> (octave - 1)) & 1);
+    }
+  }
+
+
+  // Upper bound of the durations in one bucket (except the last one),
+  // in nanoseconds
+  static uint64_t GetUpperBound(unsigned int bucket)
+  {
+    if (bucket == 0)
+    {
+      return static_cast<uint64_t>(1) << MIN_OCTAVE;
+    }
+
+    const unsigned int octave = MIN_OCTAVE + (bucket - 1) / 2;
+    if ((bucket - 1) % 2 == 0)
+    {
+      return static_cast<uint64_t>(3) << (octave - 1);
+    }
+    else
+    {
+      return static_cast<uint64_t>(1) << (octave + 1);
+    }
+  }
+
+
+  static const char* GetCallName(DatabaseCall call)
+  {
+    switch (call)
+    {
+      case DatabaseCall_AddAttachment:             return "AddAttachment";
+      case DatabaseCall_AttachChild:               return "AttachChild";
+      case DatabaseCall_ClearChanges:              return "ClearChanges";
+      case DatabaseCall_ClearExportedResources:    return "ClearExportedResources";
+      case DatabaseCall_CreateResource:            return "CreateResource";
+      case DatabaseCall_DeleteAttachment:          return "DeleteAttachment";
+      case DatabaseCall_DeleteMetadata:            return "DeleteMetadata";
+      case DatabaseCall_DeleteResource:            return "DeleteResource";
+      case DatabaseCall_GetAllInternalIds:         return "GetAllInternalIds";
+      case DatabaseCall_GetAllPublicIds:           return "GetAllPublicIds";
+      case DatabaseCall_GetAllPublicIdsWithLimit:  return "GetAllPublicIdsWithLimit";
+      case DatabaseCall_GetChanges:                return "GetChanges";
+      case DatabaseCall_GetChildrenInternalId:     return "GetChildrenInternalId";
+      case DatabaseCall_GetChildrenPublicId:       return "GetChildrenPublicId";
+      case DatabaseCall_GetExportedResources:      return "GetExportedResources";
+      case DatabaseCall_GetLastChange:             return "GetLastChange";
+      case DatabaseCall_GetLastExportedResource:   return "GetLastExportedResource";
+      case DatabaseCall_GetMainDicomTags:          return "GetMainDicomTags";
+      case DatabaseCall_GetPublicId:               return "GetPublicId";
+      case DatabaseCall_GetResourceCount:          return "GetResourceCount";
+      case DatabaseCall_GetResourceType:           return "GetResourceType";
+      case DatabaseCall_GetTotalCompressedSize:    return "GetTotalCompressedSize";
+      case DatabaseCall_GetTotalUncompressedSize:  return "GetTotalUncompressedSize";
+      case DatabaseCall_IsExistingResource:        return "IsExistingResource";
+      case DatabaseCall_IsProtectedPatient:        return "IsProtectedPatient";
+      case DatabaseCall_ListAvailableMetadata:     return "ListAvailableMetadata";
+      case DatabaseCall_ListAvailableAttachments:  return "ListAvailableAttachments";
+      case DatabaseCall_LogChange:                 return "LogChange";
+      case DatabaseCall_LogExportedResource:       return "LogExportedResource";
+      case DatabaseCall_LookupAttachment:          return "LookupAttachment";
+      case DatabaseCall_LookupGlobalProperty:      return "LookupGlobalProperty";
+      case DatabaseCall_LookupIdentifier3:         return "LookupIdentifier3";
+      case DatabaseCall_LookupMetadata:            return "LookupMetadata";
+      case DatabaseCall_LookupParent:              return "LookupParent";
+      case DatabaseCall_LookupResource:            return "LookupResource";
+      case DatabaseCall_SelectPatientToRecycle:    return "SelectPatientToRecycle";
+      case DatabaseCall_SelectPatientToRecycle2:   return "SelectPatientToRecycle2";
+      case DatabaseCall_SetGlobalProperty:         return "SetGlobalProperty";
+      case DatabaseCall_SetMainDicomTag:           return "SetMainDicomTag";
+      case DatabaseCall_SetIdentifierTag:          return "SetIdentifierTag";
+      case DatabaseCall_SetMetadata:               return "SetMetadata";
+      case DatabaseCall_SetProtectedPatient:       return "SetProtectedPatient";
+      case DatabaseCall_StartTransaction:          return "StartTransaction";
+      case DatabaseCall_RollbackTransaction:       return "RollbackTransaction";
+      case DatabaseCall_CommitTransaction:         return "CommitTransaction";
+      case DatabaseCall_Open:                      return "Open";
+      case DatabaseCall_Close:                     return "Close";
+      case DatabaseCall_GetDatabaseVersion:        return "GetDatabaseVersion";
+      case DatabaseCall_UpgradeDatabase:           return "UpgradeDatabase";
+      case DatabaseCall_ClearMainDicomTags:        return "ClearMainDicomTags";
+      default:
+        throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  // The shards are released with the metrics, not when their thread
+  // exits, as their counters must be kept
+  void DatabaseMetrics::KeepShard(Shard*)
+  {
+  }
+
+
+  DatabaseMetrics::Shard* DatabaseMetrics::GetLocalShard()
+  {
+    Shard* shard = local_.get();
+
+    if (shard == NULL)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      shards_.reserve(shards_.size() + 1);
+      shard = new Shard;
+      shards_.push_back(shard);
+      local_.reset(shard);
+    }
+
+    return shard;
+  }
+
+
+  DatabaseMetrics::DatabaseMetrics() :
+    local_(KeepShard)
+  {
+  }
+
+
+  DatabaseMetrics::~DatabaseMetrics()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      delete shards_[i];
+    }
+  }
+
+
+  uint64_t DatabaseMetrics::StartCall()
+  {
+    return GetNanoseconds();
+  }
+
+
+  void DatabaseMetrics::EndCall(DatabaseCall call,
+                                uint64_t start,
+                                bool success)
+  {
+    const uint64_t duration = GetNanoseconds() - start;
+
+    // The metrics must never make a callback fail
+    try
+    {
+      Shard& shard = *GetLocalShard();
+
+      boost::mutex::scoped_lock lock(shard.mutex_);
+      shard.counters_.counts_[call]++;
+      shard.counters_.durations_[call] += duration;
+      shard.counters_.buckets_[call][GetBucket(duration)]++;
+
+      if (!success)
+      {
+        shard.counters_.errors_[call]++;
+      }
+    }
+    catch (...)
+    {
+    }
+  }
+
+
+  void DatabaseMetrics::Format(std::string& target)
+  {
+    boost::scoped_ptr<Counters> totals(new Counters);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (size_t i = 0; i < shards_.size(); i++)
+      {
+        boost::mutex::scoped_lock shardLock(shards_[i]->mutex_);
+        totals->Add(shards_[i]->counters_);
+      }
+    }
+
+    std::ostringstream s;
+    s.precision(9);
+
+    s << "# HELP orthanc_vpi_index_calls_total Number of calls from Orthanc to the index\n"
+      << "# TYPE orthanc_vpi_index_calls_total counter\n";
+
+    for (unsigned int i = 0; i < DatabaseCall_Count; i++)
+    {
+      if (totals->counts_[i] != 0)
+      {
+        s << "orthanc_vpi_index_calls_total{call=\"" << GetCallName(static_cast<DatabaseCall>(i))
+          << "\"} " << totals->counts_[i] << "\n";
+      }
+    }
+
+    s << "# HELP orthanc_vpi_index_errors_total Number of calls to the index that failed\n"
+      << "# TYPE orthanc_vpi_index_errors_total counter\n";
+
+    for (unsigned int i = 0; i < DatabaseCall_Count; i++)
+    {
+      if (totals->counts_[i] != 0)
+      {
+        s << "orthanc_vpi_index_errors_total{call=\"" << GetCallName(static_cast<DatabaseCall>(i))
+          << "\"} " << totals->errors_[i] << "\n";
+      }
+    }
+
+    s << "# HELP orthanc_vpi_index_call_duration_seconds Duration of the calls to the index\n"
+      << "# TYPE orthanc_vpi_index_call_duration_seconds histogram\n";
+
+    for (unsigned int i = 0; i < DatabaseCall_Count; i++)
+    {
+      if (totals->counts_[i] != 0)
+      {
+        const std::string name = GetCallName(static_cast<DatabaseCall>(i));
+
+        // The buckets of Prometheus are cumulative
+        uint64_t count = 0;
+        for (unsigned int j = 0; j + 1 < BUCKETS_COUNT; j++)
+        {
+          count += totals->buckets_[i][j];
+          s << "orthanc_vpi_index_call_duration_seconds_bucket{call=\"" << name << "\",le=\""
+            << static_cast<double>(GetUpperBound(j)) / 1.0e9 << "\"} " << count << "\n";
+        }
+
+        s << "orthanc_vpi_index_call_duration_seconds_bucket{call=\"" << name << "\",le=\"+Inf\"} "
+          << totals->counts_[i] << "\n"
+          << "orthanc_vpi_index_call_duration_seconds_sum{call=\"" << name << "\"} "
+          << static_cast<double>(totals->durations_[i]) / 1.0e9 << "\n"
+          << "orthanc_vpi_index_call_duration_seconds_count{call=\"" << name << "\"} "
+          << totals->counts_[i] << "\n";
+      }
+    }
+
+    target = s.str();
+  }
+}
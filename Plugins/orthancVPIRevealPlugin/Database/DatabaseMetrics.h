@@ -0,0 +1,71 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include <orthanc/OrthancCppDatabasePlugin.h>
+
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Counts, errors and latency histograms of the callbacks of a
+  // database back-end, cf. "IDatabaseBackend::SetMetrics()".
+  //
+  // Each thread records into its own shard, that is only locked by
+  // this thread (hence without contention) and by "Format()". The
+  // histograms are log-linear as in HDR histograms: Each power of two
+  // from 128 ns to 34 s is split into 2 buckets, which bounds the
+  // relative error on the latencies by 50%.
+  class DatabaseMetrics : public IDatabaseMetrics
+  {
+  private:
+    struct Shard;
+
+    boost::mutex                       mutex_;   // Protects "shards_"
+    std::vector<Shard*>                shards_;
+    boost::thread_specific_ptr<Shard>  local_;   // Not owned, cf. "shards_"
+
+    static void KeepShard(Shard* shard);
+
+    Shard* GetLocalShard();
+
+  public:
+    DatabaseMetrics();
+
+    virtual ~DatabaseMetrics();
+
+    virtual uint64_t StartCall();
+
+    virtual void EndCall(DatabaseCall call,
+                         uint64_t start,
+                         bool success);
+
+    // Writes the metrics in the text exposition format of Prometheus
+    void Format(std::string& target);
+  };
+}
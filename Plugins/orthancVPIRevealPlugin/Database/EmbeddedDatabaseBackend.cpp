@@ -0,0 +1,943 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "EmbeddedDatabaseBackend.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancPlugins
+{
+  static const uint32_t MAGIC = 0x58495056;   // "VPIX"
+
+  enum Operation
+  {
+    Operation_AddAttachment = 1,
+    Operation_AttachChild = 2,
+    Operation_ClearChanges = 3,
+    Operation_ClearExportedResources = 4,
+    Operation_CreateResource = 5,
+    Operation_DeleteAttachment = 6,
+    Operation_DeleteMetadata = 7,
+    Operation_DeleteResource = 8,
+    Operation_LogChange = 9,
+    Operation_LogExportedResource = 10,
+    Operation_SetGlobalProperty = 11,
+    Operation_SetMainDicomTag = 12,
+    Operation_SetIdentifierTag = 13,
+    Operation_SetMetadata = 14,
+    Operation_SetProtectedPatient = 15,
+    Operation_ClearMainDicomTags = 16,
+    Operation_DropChanges = 17
+  };
+
+
+  static uint32_t GetTagKey(uint16_t group,
+                            uint16_t element)
+  {
+    return (static_cast<uint32_t>(group) << 16) | static_cast<uint32_t>(element);
+  }
+
+
+  static void WriteHeader(RecordFile& file,
+                          uint64_t generation)
+  {
+    RecordWriter writer;
+    writer.WriteUInt32(MAGIC);
+    writer.WriteUInt64(generation);
+    file.Append(writer);
+  }
+
+
+  static uint64_t ReadHeader(const std::string& record)
+  {
+    RecordReader reader(record);
+    if (reader.ReadUInt32() != MAGIC)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+    }
+
+    return reader.ReadUInt64();
+  }
+
+
+  class EmbeddedDatabaseBackend::CheckpointLoader : public RecordFile::IVisitor
+  {
+  private:
+    IndexTables&  tables_;
+    uint64_t&     generation_;
+    bool          first_;
+
+  public:
+    CheckpointLoader(IndexTables& tables,
+                     uint64_t& generation) :
+      tables_(tables),
+      generation_(generation),
+      first_(true)
+    {
+    }
+
+    virtual void Visit(const std::string& record)
+    {
+      if (first_)
+      {
+        generation_ = ReadHeader(record);
+        first_ = false;
+      }
+      else
+      {
+        tables_.LoadRecord(record);
+      }
+    }
+  };
+
+
+  class EmbeddedDatabaseBackend::LogReplayer : public RecordFile::IVisitor
+  {
+  private:
+    EmbeddedDatabaseBackend&  backend_;
+    bool                      first_;
+    bool                      stale_;
+    size_t                    count_;
+
+  public:
+    LogReplayer(EmbeddedDatabaseBackend& backend) :
+      backend_(backend),
+      first_(true),
+      stale_(false),
+      count_(0)
+    {
+    }
+
+    virtual void Visit(const std::string& record)
+    {
+      if (first_)
+      {
+        // A log that is older than the checkpoint is a leftover of a
+        // crash during the checkpoint: Its content is in the checkpoint
+        stale_ = (ReadHeader(record) != backend_.generation_);
+        first_ = false;
+      }
+      else if (!stale_)
+      {
+        backend_.Replay(record);
+        count_++;
+      }
+    }
+
+    bool IsValid() const
+    {
+      return !first_ && !stale_;
+    }
+
+    size_t GetCount() const
+    {
+      return count_;
+    }
+  };
+
+
+  std::string EmbeddedDatabaseBackend::GetPath(const char* filename) const
+  {
+    return (boost::filesystem::path(directory_) / filename).string();
+  }
+
+
+  void EmbeddedDatabaseBackend::CreateLog()
+  {
+    // The records that are not synced yet are all in the checkpoint
+    WaitSyncIdle();
+    log_.reset(NULL);
+
+    const std::string path = GetPath("index.log");
+    const std::string tmp = GetPath("index.log.tmp");
+
+    {
+      RecordFile log(tmp, true);
+      WriteHeader(log, generation_);
+      log.Flush(true);
+    }
+
+    RecordFile::Replace(tmp, path);
+    log_.reset(new RecordFile(path, false));
+    emptyLogSize_ = log_->GetSize();
+  }
+
+
+  void EmbeddedDatabaseBackend::Checkpoint()
+  {
+    const std::string path = GetPath("index.checkpoint");
+    const std::string tmp = GetPath("index.checkpoint.tmp");
+
+    {
+      RecordFile checkpoint(tmp, true);
+      WriteHeader(checkpoint, generation_ + 1);
+      GetTables().Save(checkpoint);
+      checkpoint.Flush(true);
+    }
+
+    // From now on, the previous log is ignored at startup
+    RecordFile::Replace(tmp, path);
+    generation_++;
+
+    CreateLog();
+  }
+
+
+  void EmbeddedDatabaseBackend::WritePending()
+  {
+    if (!pending_.IsEmpty())
+    {
+      if (log_.get() == NULL)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      if (syncThread_.get() == NULL)
+      {
+        log_->Append(pending_);
+        log_->Flush(synchronous_);
+      }
+      else
+      {
+        {
+          boost::mutex::scoped_lock lock(syncMutex_);
+          if (syncFailed_)
+          {
+            // Cf. "SyncLoop()"
+            throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+          }
+        }
+
+        log_->Append(pending_);
+        log_->Flush(false);
+
+        boost::mutex::scoped_lock lock(syncMutex_);
+        syncPending_ = true;
+        syncCondition_.notify_all();
+      }
+
+      pending_.Clear();
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::SyncLoop()
+  {
+    boost::mutex::scoped_lock lock(syncMutex_);
+
+    for (;;)
+    {
+      while (!syncPending_ &&
+             !syncStopping_)
+      {
+        syncCondition_.wait(lock);
+      }
+
+      if (!syncPending_)
+      {
+        return;   // Stopping, and everything is on the disk
+      }
+
+      // Let the commits of the next "asyncCommitDelay_" milliseconds
+      // share the same sync
+      const boost::system_time deadline = (boost::get_system_time() +
+                                           boost::posix_time::milliseconds(asyncCommitDelay_));
+      while (!syncStopping_ &&
+             syncCondition_.timed_wait(lock, deadline))
+      {
+      }
+
+      // "log_" cannot be replaced while "syncRunning_" is set, cf. "WaitSyncIdle()"
+      RecordFile& log = *log_;
+      syncPending_ = false;
+      syncRunning_ = true;
+
+      bool success = true;
+
+      lock.unlock();
+
+      try
+      {
+        log.Sync();
+      }
+      catch (DatabaseException&)
+      {
+        success = false;
+      }
+
+      lock.lock();
+
+      syncRunning_ = false;
+      if (!success &&
+          !syncFailed_)
+      {
+        // The commits that were synced have already returned: Refuse
+        // any further write, as the disk cannot be trusted anymore
+        GetOutput().LogError("Cannot sync the log of the index to the disk, the last " +
+                             boost::lexical_cast<std::string>(asyncCommitDelay_) +
+                             " ms of commits may be lost, and the index refuses any further write: " +
+                             log.GetPath());
+        syncFailed_ = true;
+      }
+
+      syncCondition_.notify_all();
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::StartSyncThread()
+  {
+    if (syncThread_.get() == NULL)
+    {
+      syncPending_ = false;
+      syncRunning_ = false;
+      syncStopping_ = false;
+      syncFailed_ = false;
+      syncThread_.reset(new boost::thread(&EmbeddedDatabaseBackend::SyncLoop, this));
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::StopSyncThread()
+  {
+    if (syncThread_.get() != NULL)
+    {
+      {
+        boost::mutex::scoped_lock lock(syncMutex_);
+        syncStopping_ = true;
+        syncCondition_.notify_all();
+      }
+
+      // The pending records are synced before the thread stops
+      syncThread_->join();
+      syncThread_.reset(NULL);
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::WaitSyncIdle()
+  {
+    if (syncThread_.get() != NULL)
+    {
+      boost::mutex::scoped_lock lock(syncMutex_);
+
+      while (syncRunning_)
+      {
+        syncCondition_.wait(lock);
+      }
+
+      syncPending_ = false;
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::CheckpointIfNeeded()
+  {
+    if (log_.get() == NULL &&
+        !checkpointFailed_)
+    {
+      // The back-end is closed
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    // If a checkpoint has failed once the new checkpoint was renamed,
+    // there is no log anymore: The next checkpoint creates it
+    if (checkpointFailed_ ||
+        log_->GetSize() > checkpointSize_)
+    {
+      checkpointFailed_ = true;
+      Checkpoint();
+      checkpointFailed_ = false;
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::EndOperation()
+  {
+    // The modifications that are done outside of a transaction are
+    // committed at once
+    if (!GetTables().IsTransactionActive())
+    {
+      if (log_.get() == NULL &&
+          checkpointFailed_)
+      {
+        // The checkpoint contains the modification
+        pending_.Clear();
+      }
+      else
+      {
+        WritePending();
+      }
+
+      CheckpointIfNeeded();
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::Replay(const std::string& record)
+  {
+    IndexTables& tables = GetTables();
+    RecordReader reader(record);
+
+    while (!reader.IsEnd())
+    {
+      const uint8_t operation = reader.ReadUInt8();
+
+      switch (operation)
+      {
+        case Operation_AddAttachment:
+        {
+          int64_t id = reader.ReadInt64();
+
+          IndexTables::Attachment attachment;
+          reader.ReadString(attachment.uuid_);
+          attachment.contentType_ = reader.ReadInt32();
+          attachment.uncompressedSize_ = reader.ReadUInt64();
+          reader.ReadString(attachment.uncompressedHash_);
+          attachment.compressionType_ = reader.ReadInt32();
+          attachment.compressedSize_ = reader.ReadUInt64();
+          reader.ReadString(attachment.compressedHash_);
+
+          tables.AddAttachment(id, attachment);
+          break;
+        }
+
+        case Operation_AttachChild:
+        {
+          int64_t parent = reader.ReadInt64();
+          int64_t child = reader.ReadInt64();
+          tables.AttachChild(parent, child);
+          break;
+        }
+
+        case Operation_ClearChanges:
+          tables.ClearChanges();
+          break;
+
+        case Operation_ClearExportedResources:
+          tables.ClearExportedResources();
+          break;
+
+        case Operation_CreateResource:
+        {
+          int64_t id = reader.ReadInt64();
+          OrthancPluginResourceType type = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+          std::string publicId = reader.ReadString();
+
+          // The internal IDs are allocated deterministically
+          if (tables.CreateResource(publicId, type) != id)
+          {
+            throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+          }
+          break;
+        }
+
+        case Operation_DeleteAttachment:
+        {
+          int64_t id = reader.ReadInt64();
+          int32_t contentType = reader.ReadInt32();
+
+          IndexTables::Attachment deleted;
+          tables.DeleteAttachment(deleted, id, contentType);
+          break;
+        }
+
+        case Operation_DeleteMetadata:
+        {
+          int64_t id = reader.ReadInt64();
+          int32_t type = reader.ReadInt32();
+          tables.DeleteMetadata(id, type);
+          break;
+        }
+
+        case Operation_DeleteResource:
+        {
+          IndexTables::Deletion deletion;
+          tables.DeleteResource(deletion, reader.ReadInt64());
+          break;
+        }
+
+        case Operation_LogChange:
+        {
+          int32_t changeType = reader.ReadInt32();
+          int64_t resourceId = reader.ReadInt64();
+          OrthancPluginResourceType resourceType = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+          std::string date = reader.ReadString();
+          tables.LogChange(changeType, resourceId, resourceType, date);
+          break;
+        }
+
+        case Operation_LogExportedResource:
+        {
+          IndexTables::ExportedResource resource;
+          resource.resourceType_ = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+          reader.ReadString(resource.publicId_);
+          reader.ReadString(resource.modality_);
+          reader.ReadString(resource.date_);
+          reader.ReadString(resource.patientId_);
+          reader.ReadString(resource.studyInstanceUid_);
+          reader.ReadString(resource.seriesInstanceUid_);
+          reader.ReadString(resource.sopInstanceUid_);
+          tables.LogExportedResource(resource);
+          break;
+        }
+
+        case Operation_SetGlobalProperty:
+        {
+          int32_t property = reader.ReadInt32();
+          tables.SetGlobalProperty(property, reader.ReadString());
+          break;
+        }
+
+        case Operation_SetMainDicomTag:
+        case Operation_SetIdentifierTag:
+        {
+          int64_t id = reader.ReadInt64();
+          uint32_t tag = reader.ReadUInt32();
+          std::string value = reader.ReadString();
+
+          if (operation == Operation_SetIdentifierTag)
+          {
+            tables.SetIdentifierTag(id, tag, value);
+          }
+          else
+          {
+            tables.SetMainDicomTag(id, tag, value);
+          }
+          break;
+        }
+
+        case Operation_SetMetadata:
+        {
+          int64_t id = reader.ReadInt64();
+          int32_t type = reader.ReadInt32();
+          tables.SetMetadata(id, type, reader.ReadString());
+          break;
+        }
+
+        case Operation_SetProtectedPatient:
+        {
+          int64_t id = reader.ReadInt64();
+          tables.SetProtectedPatient(id, reader.ReadUInt8() != 0);
+          break;
+        }
+
+        case Operation_ClearMainDicomTags:
+          tables.ClearMainDicomTags(reader.ReadInt64());
+          break;
+
+        case Operation_DropChanges:
+          tables.DropChanges(reader.ReadInt64());
+          break;
+
+        default:
+          throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+      }
+    }
+  }
+
+
+  EmbeddedDatabaseBackend::EmbeddedDatabaseBackend(const std::string& directory,
+                                                   bool synchronous,
+                                                   uint64_t checkpointSize) :
+    MemoryDatabaseBackend(""),   // The checkpoints replace the snapshot
+    directory_(directory),
+    synchronous_(synchronous),
+    checkpointSize_(checkpointSize),
+    generation_(0),
+    emptyLogSize_(0),
+    checkpointFailed_(false),
+    asyncCommitDelay_(0),
+    syncPending_(false),
+    syncRunning_(false),
+    syncStopping_(false),
+    syncFailed_(false)
+  {
+  }
+
+
+  EmbeddedDatabaseBackend::~EmbeddedDatabaseBackend()
+  {
+    StopSyncThread();
+  }
+
+
+  void EmbeddedDatabaseBackend::Open()
+  {
+    boost::system::error_code error;
+    boost::filesystem::create_directories(directory_, error);
+    if (!boost::filesystem::is_directory(directory_))
+    {
+      GetOutput().LogError("Cannot create the directory of the index: " + directory_);
+      throw DatabaseException(OrthancPluginErrorCode_DirectoryExpected);
+    }
+
+    IndexTables& tables = GetTables();
+    tables.Clear();
+    generation_ = 0;
+    checkpointFailed_ = false;
+
+    {
+      // The checkpoints are renamed once complete: A corrupted
+      // checkpoint is reported, not truncated
+      CheckpointLoader loader(tables, generation_);
+      if (RecordFile::Read(GetPath("index.checkpoint"), loader, false))
+      {
+        tables.FinalizeLoading();
+      }
+    }
+
+    // A crash can leave a partial record at the end of the log
+    LogReplayer replayer(*this);
+    RecordFile::Read(GetPath("index.log"), replayer, true);
+
+    LoadSizes();
+
+    if (replayer.IsValid())
+    {
+      log_.reset(new RecordFile(GetPath("index.log"), false));
+      emptyLogSize_ = 0;   // Force a checkpoint at the next closing
+    }
+    else
+    {
+      CreateLog();
+    }
+
+    if (synchronous_ &&
+        asyncCommitDelay_ > 0)
+    {
+      StartSyncThread();
+    }
+
+    GetOutput().LogWarning("Embedded index opened from " + directory_ + ", after replaying " +
+                           boost::lexical_cast<std::string>(replayer.GetCount()) + " transaction(s)");
+  }
+
+
+  void EmbeddedDatabaseBackend::Close()
+  {
+    if (log_.get() != NULL ||
+        checkpointFailed_)
+    {
+      if (GetTables().IsTransactionActive())
+      {
+        RollbackTransaction();
+      }
+
+      StoreSizes();
+
+      // Speed up the next startup, as nothing will have to be replayed
+      if (checkpointFailed_ ||
+          log_->GetSize() != emptyLogSize_)
+      {
+        Checkpoint();
+        checkpointFailed_ = false;
+      }
+
+      StopSyncThread();
+      log_.reset(NULL);
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::AddAttachment(int64_t id,
+                                              const OrthancPluginAttachment& attachment)
+  {
+    MemoryDatabaseBackend::AddAttachment(id, attachment);
+
+    pending_.WriteUInt8(Operation_AddAttachment);
+    pending_.WriteInt64(id);
+    pending_.WriteString(attachment.uuid);
+    pending_.WriteInt32(attachment.contentType);
+    pending_.WriteUInt64(attachment.uncompressedSize);
+    pending_.WriteString(attachment.uncompressedHash);
+    pending_.WriteInt32(attachment.compressionType);
+    pending_.WriteUInt64(attachment.compressedSize);
+    pending_.WriteString(attachment.compressedHash);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::AttachChild(int64_t parent,
+                                            int64_t child)
+  {
+    MemoryDatabaseBackend::AttachChild(parent, child);
+
+    pending_.WriteUInt8(Operation_AttachChild);
+    pending_.WriteInt64(parent);
+    pending_.WriteInt64(child);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::ClearChanges()
+  {
+    MemoryDatabaseBackend::ClearChanges();
+
+    pending_.WriteUInt8(Operation_ClearChanges);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::ClearExportedResources()
+  {
+    MemoryDatabaseBackend::ClearExportedResources();
+
+    pending_.WriteUInt8(Operation_ClearExportedResources);
+    EndOperation();
+  }
+
+
+  int64_t EmbeddedDatabaseBackend::CreateResource(const char* publicId,
+                                                  OrthancPluginResourceType type)
+  {
+    int64_t id = MemoryDatabaseBackend::CreateResource(publicId, type);
+
+    pending_.WriteUInt8(Operation_CreateResource);
+    pending_.WriteInt64(id);
+    pending_.WriteInt32(type);
+    pending_.WriteString(publicId);
+    EndOperation();
+
+    return id;
+  }
+
+
+  void EmbeddedDatabaseBackend::DeleteAttachment(int64_t id,
+                                                 int32_t attachment)
+  {
+    MemoryDatabaseBackend::DeleteAttachment(id, attachment);
+
+    pending_.WriteUInt8(Operation_DeleteAttachment);
+    pending_.WriteInt64(id);
+    pending_.WriteInt32(attachment);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::DeleteMetadata(int64_t id,
+                                               int32_t metadataType)
+  {
+    MemoryDatabaseBackend::DeleteMetadata(id, metadataType);
+
+    pending_.WriteUInt8(Operation_DeleteMetadata);
+    pending_.WriteInt64(id);
+    pending_.WriteInt32(metadataType);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::DeleteResource(int64_t id)
+  {
+    MemoryDatabaseBackend::DeleteResource(id);
+
+    pending_.WriteUInt8(Operation_DeleteResource);
+    pending_.WriteInt64(id);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::LogChange(const OrthancPluginChange& change)
+  {
+    MemoryDatabaseBackend::LogChange(change);
+
+    // The change is logged with the internal ID of its resource
+    int64_t id;
+    OrthancPluginResourceType type;
+    GetTables().LookupResource(id, type, change.publicId);
+
+    pending_.WriteUInt8(Operation_LogChange);
+    pending_.WriteInt32(change.changeType);
+    pending_.WriteInt64(id);
+    pending_.WriteInt32(type);
+    pending_.WriteString(change.date);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::LogExportedResource(const OrthancPluginExportedResource& resource)
+  {
+    MemoryDatabaseBackend::LogExportedResource(resource);
+
+    pending_.WriteUInt8(Operation_LogExportedResource);
+    pending_.WriteInt32(resource.resourceType);
+    pending_.WriteString(resource.publicId);
+    pending_.WriteString(resource.modality);
+    pending_.WriteString(resource.date);
+    pending_.WriteString(resource.patientId);
+    pending_.WriteString(resource.studyInstanceUid);
+    pending_.WriteString(resource.seriesInstanceUid);
+    pending_.WriteString(resource.sopInstanceUid);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::SetGlobalProperty(int32_t property,
+                                                  const char* value)
+  {
+    MemoryDatabaseBackend::SetGlobalProperty(property, value);
+
+    pending_.WriteUInt8(Operation_SetGlobalProperty);
+    pending_.WriteInt32(property);
+    pending_.WriteString(value);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::SetMainDicomTag(int64_t id,
+                                                uint16_t group,
+                                                uint16_t element,
+                                                const char* value)
+  {
+    MemoryDatabaseBackend::SetMainDicomTag(id, group, element, value);
+
+    pending_.WriteUInt8(Operation_SetMainDicomTag);
+    pending_.WriteInt64(id);
+    pending_.WriteUInt32(GetTagKey(group, element));
+    pending_.WriteString(value);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::SetIdentifierTag(int64_t id,
+                                                 uint16_t group,
+                                                 uint16_t element,
+                                                 const char* value)
+  {
+    MemoryDatabaseBackend::SetIdentifierTag(id, group, element, value);
+
+    pending_.WriteUInt8(Operation_SetIdentifierTag);
+    pending_.WriteInt64(id);
+    pending_.WriteUInt32(GetTagKey(group, element));
+    pending_.WriteString(value);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::SetMetadata(int64_t id,
+                                            int32_t metadataType,
+                                            const char* value)
+  {
+    MemoryDatabaseBackend::SetMetadata(id, metadataType, value);
+
+    pending_.WriteUInt8(Operation_SetMetadata);
+    pending_.WriteInt64(id);
+    pending_.WriteInt32(metadataType);
+    pending_.WriteString(value);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::SetProtectedPatient(int64_t internalId,
+                                                    bool isProtected)
+  {
+    MemoryDatabaseBackend::SetProtectedPatient(internalId, isProtected);
+
+    pending_.WriteUInt8(Operation_SetProtectedPatient);
+    pending_.WriteInt64(internalId);
+    pending_.WriteUInt8(isProtected ? 1 : 0);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::StartTransaction()
+  {
+    if (log_.get() == NULL &&
+        checkpointFailed_)
+    {
+      // The transaction could not be logged: Retry the checkpoint
+      // that has failed after the previous commit, outside of a
+      // transaction. Otherwise, the checkpoint is retried after the
+      // next commit.
+      CheckpointIfNeeded();
+    }
+
+    MemoryDatabaseBackend::StartTransaction();
+    pending_.Clear();
+  }
+
+
+  void EmbeddedDatabaseBackend::RollbackTransaction()
+  {
+    MemoryDatabaseBackend::RollbackTransaction();
+    pending_.Clear();
+  }
+
+
+  void EmbeddedDatabaseBackend::CommitTransaction()
+  {
+    if (!GetTables().IsTransactionActive())
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    // If writing the log fails, the transaction stays active, and
+    // Orthanc rolls it back. The log cuts off the bytes of the record
+    // that might have reached the file, or refuses any further write
+    // if it cannot, so that the transaction is never replayed.
+    StoreSizes();
+    WritePending();
+    CommitTables();
+
+    // The transaction is committed: If an exception escaped from now
+    // on, Orthanc would roll back a transaction that is both in
+    // memory and in the log. The errors are only logged, and a failed
+    // checkpoint is retried at the next transaction.
+    try
+    {
+      DropExpiredChanges();
+      CheckpointIfNeeded();
+    }
+    catch (DatabaseException& e)
+    {
+      GetOutput().LogError("Error " + boost::lexical_cast<std::string>(e.GetErrorCode()) +
+                           " in the index after a commit, while dropping the expired changes or "
+                           "writing a checkpoint to " + directory_);
+    }
+    catch (std::bad_alloc&)
+    {
+      GetOutput().LogError("Not enough memory in the index after a commit, while dropping the expired "
+                           "changes or writing a checkpoint to " + directory_);
+    }
+  }
+
+
+  void EmbeddedDatabaseBackend::DropChanges(int64_t lastSeq)
+  {
+    MemoryDatabaseBackend::DropChanges(lastSeq);
+
+    pending_.WriteUInt8(Operation_DropChanges);
+    pending_.WriteInt64(lastSeq);
+    EndOperation();
+  }
+
+
+  void EmbeddedDatabaseBackend::ClearMainDicomTags(int64_t internalId)
+  {
+    MemoryDatabaseBackend::ClearMainDicomTags(internalId);
+
+    pending_.WriteUInt8(Operation_ClearMainDicomTags);
+    pending_.WriteInt64(internalId);
+    EndOperation();
+  }
+}
@@ -0,0 +1,183 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "MemoryDatabaseBackend.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Embedded index for Orthanc, that needs no database server. The
+   * index lives in memory (cf. "MemoryDatabaseBackend"), and is made
+   * durable by a log-structured store in one directory:
+   *
+   *  - "index.checkpoint" contains a full copy of the tables.
+   *  - "index.log" contains one record per committed transaction
+   *    since the checkpoint, with the operations to be replayed.
+   *
+   * A commit only appends one record to the log (and waits for the
+   * disk if "synchronous" is set). Once the log grows beyond
+   * "checkpointSize" bytes, a new checkpoint is written and the log
+   * is emptied.
+   *
+   * As Orthanc serializes the calls to the index, a commit that waits
+   * for the disk also blocks all the other commits, so that they
+   * cannot share its sync (no group commit). Instead, an asynchronous
+   * commit delay can be set: The commits then only hand their record
+   * over to the system and return, and a background thread waits for
+   * the disk at most once per delay on behalf of all the commits in
+   * between. This is opt-in, as a crash then loses the transactions
+   * of the last delay, although Orthanc has already acknowledged them
+   * (a transaction is never torn, though). If the background sync
+   * fails, the back-end refuses any further write.
+   *
+   * The whole index must fit in memory: There is no on-disk tree
+   * whose pages would be loaded on demand. This keeps the reads free
+   * of I/O, as Orthanc serializes them with the writes.
+   **/
+  class EmbeddedDatabaseBackend : public MemoryDatabaseBackend
+  {
+  private:
+    class CheckpointLoader;
+    class LogReplayer;
+
+    std::string                    directory_;
+    bool                           synchronous_;
+    uint64_t                       checkpointSize_;
+    boost::scoped_ptr<RecordFile>  log_;
+    uint64_t                       generation_;
+    uint64_t                       emptyLogSize_;
+    bool                           checkpointFailed_;   // To be retried by the next commit
+    RecordWriter                   pending_;   // Operations of the current transaction
+
+    // Asynchronous commit, cf. "SyncLoop()"
+    unsigned int                   asyncCommitDelay_;   // In milliseconds
+    boost::mutex                   syncMutex_;
+    boost::condition_variable      syncCondition_;
+    boost::scoped_ptr<boost::thread>  syncThread_;
+    bool                           syncPending_;
+    bool                           syncRunning_;
+    bool                           syncStopping_;
+    bool                           syncFailed_;
+
+    std::string GetPath(const char* filename) const;
+
+    void CreateLog();
+
+    void Checkpoint();
+
+    void WritePending();
+
+    void SyncLoop();
+
+    void StartSyncThread();
+
+    void StopSyncThread();
+
+    void WaitSyncIdle();
+
+    void CheckpointIfNeeded();
+
+    void EndOperation();
+
+    void Replay(const std::string& record);
+
+  protected:
+    virtual void DropChanges(int64_t lastSeq);
+
+  public:
+    EmbeddedDatabaseBackend(const std::string& directory,
+                            bool synchronous,
+                            uint64_t checkpointSize);
+
+    virtual ~EmbeddedDatabaseBackend();
+
+    // In milliseconds, 0 waits for the disk at each commit. Otherwise,
+    // a crash loses the commits of the last delay. Only meaningful if
+    // "synchronous" is set, and before "Open()".
+    void SetAsyncCommitDelay(unsigned int delay)
+    {
+      asyncCommitDelay_ = delay;
+    }
+
+    virtual void Open();
+
+    virtual void Close();
+
+    virtual void AddAttachment(int64_t id,
+                               const OrthancPluginAttachment& attachment);
+
+    virtual void AttachChild(int64_t parent,
+                             int64_t child);
+
+    virtual void ClearChanges();
+
+    virtual void ClearExportedResources();
+
+    virtual int64_t CreateResource(const char* publicId,
+                                   OrthancPluginResourceType type);
+
+    virtual void DeleteAttachment(int64_t id,
+                                  int32_t attachment);
+
+    virtual void DeleteMetadata(int64_t id,
+                                int32_t metadataType);
+
+    virtual void DeleteResource(int64_t id);
+
+    virtual void LogChange(const OrthancPluginChange& change);
+
+    virtual void LogExportedResource(const OrthancPluginExportedResource& resource);
+
+    virtual void SetGlobalProperty(int32_t property,
+                                   const char* value);
+
+    virtual void SetMainDicomTag(int64_t id,
+                                 uint16_t group,
+                                 uint16_t element,
+                                 const char* value);
+
+    virtual void SetIdentifierTag(int64_t id,
+                                  uint16_t group,
+                                  uint16_t element,
+                                  const char* value);
+
+    virtual void SetMetadata(int64_t id,
+                             int32_t metadataType,
+                             const char* value);
+
+    virtual void SetProtectedPatient(int64_t internalId,
+                                     bool isProtected);
+
+    virtual void StartTransaction();
+
+    virtual void RollbackTransaction();
+
+    virtual void CommitTransaction();
+
+    virtual void ClearMainDicomTags(int64_t internalId);
+  };
+}
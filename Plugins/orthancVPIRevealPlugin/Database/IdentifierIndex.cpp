@@ -0,0 +1,554 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IdentifierIndex.h"
+
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  // Number of entries above which a block is split in two halves
+  static const uint32_t MAX_BLOCK_SIZE = 64;
+
+
+  // Case-sensitive matching, where "*" matches any sequence of
+  // characters, and "?" matches exactly one character
+  static bool MatchWildcard(const char* pattern,
+                            const char* value)
+  {
+    const char* starPattern = NULL;
+    const char* starValue = NULL;
+
+    while (*value != '\0')
+    {
+      if (*pattern == '*')
+      {
+        starPattern = pattern++;
+        starValue = value;
+      }
+      else if (*pattern == '?' ||
+               *pattern == *value)
+      {
+        pattern++;
+        value++;
+      }
+      else if (starPattern != NULL)
+      {
+        // Let the last star absorb one more character
+        pattern = starPattern + 1;
+        value = ++starValue;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    while (*pattern == '*')
+    {
+      pattern++;
+    }
+
+    return *pattern == '\0';
+  }
+
+
+  // The key starts with the level and the tag in big endian, so that
+  // the entries of one tag are consecutive and sorted by value
+  static void MakeKey(std::string& key,
+                      OrthancPluginResourceType level,
+                      uint32_t tag,
+                      const std::string& value)
+  {
+    key.clear();
+    key.reserve(5 + value.size());
+    key.push_back(static_cast<char>(level));
+    key.push_back(static_cast<char>(tag >> 24));
+    key.push_back(static_cast<char>(tag >> 16));
+    key.push_back(static_cast<char>(tag >> 8));
+    key.push_back(static_cast<char>(tag));
+    key.append(value);
+  }
+
+
+  static bool IsLess(const std::string& key1,
+                     int64_t id1,
+                     const std::string& key2,
+                     int64_t id2)
+  {
+    int c = key1.compare(key2);
+    return (c < 0 || (c == 0 && id1 < id2));
+  }
+
+
+  static void WriteVarint(std::string& target,
+                          uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      target.push_back(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+
+    target.push_back(static_cast<char>(value));
+  }
+
+
+  static uint64_t ReadVarint(const std::string& source,
+                             size_t& position)
+  {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+
+    for (;;)
+    {
+      assert(position < source.size());
+      const uint8_t b = static_cast<uint8_t>(source[position++]);
+      value |= static_cast<uint64_t>(b & 0x7f) << shift;
+
+      if (b < 0x80)
+      {
+        return value;
+      }
+
+      shift += 7;
+    }
+  }
+
+
+  // An entry is made of the length of the prefix shared with the
+  // previous key, of the remaining suffix, and of the internal ID
+  static void WriteEntry(std::string& target,
+                         const std::string& previous,
+                         const std::string& key,
+                         int64_t id)
+  {
+    size_t shared = 0;
+    while (shared < previous.size() &&
+           shared < key.size() &&
+           previous[shared] == key[shared])
+    {
+      shared++;
+    }
+
+    WriteVarint(target, shared);
+    WriteVarint(target, key.size() - shared);
+    target.append(key, shared, std::string::npos);
+    WriteVarint(target, static_cast<uint64_t>(id));
+  }
+
+
+  // On entry, "key" contains the previous key
+  static void ReadEntry(std::string& key,
+                        int64_t& id,
+                        const std::string& source,
+                        size_t& position)
+  {
+    const size_t shared = static_cast<size_t>(ReadVarint(source, position));
+    const size_t length = static_cast<size_t>(ReadVarint(source, position));
+    assert(shared <= key.size() &&
+           position + length <= source.size());
+
+    key.resize(shared);
+    key.append(source, position, length);
+    position += length;
+
+    id = static_cast<int64_t>(ReadVarint(source, position));
+  }
+
+
+  class IdentifierIndex::Cursor : public boost::noncopyable
+  {
+  private:
+    const std::vector<Block*>&  blocks_;
+    size_t                      block_;
+    size_t                      position_;
+    std::string                 key_;
+    int64_t                     id_;
+    bool                        valid_;
+
+  public:
+    Cursor(const std::vector<Block*>& blocks,
+           size_t block) :
+      blocks_(blocks),
+      block_(block),
+      position_(0),
+      id_(-1),
+      valid_(true)
+    {
+      Next();
+    }
+
+    bool IsValid() const
+    {
+      return valid_;
+    }
+
+    const std::string& GetKey() const
+    {
+      return key_;
+    }
+
+    int64_t GetId() const
+    {
+      return id_;
+    }
+
+    void Next()
+    {
+      while (block_ < blocks_.size() &&
+             position_ == blocks_[block_]->data_.size())
+      {
+        block_++;
+        position_ = 0;
+        key_.clear();
+      }
+
+      if (block_ == blocks_.size())
+      {
+        valid_ = false;
+      }
+      else
+      {
+        ReadEntry(key_, id_, blocks_[block_]->data_, position_);
+      }
+    }
+  };
+
+
+  size_t IdentifierIndex::FindBlock(const std::string& key,
+                                    int64_t id) const
+  {
+    // Last block whose first entry is not greater than (key, id)
+    size_t low = 0;
+    size_t high = blocks_.size();
+
+    while (low < high)
+    {
+      size_t middle = (low + high) / 2;
+      if (IsLess(key, id, blocks_[middle]->firstKey_, blocks_[middle]->firstId_))
+      {
+        high = middle;
+      }
+      else
+      {
+        low = middle + 1;
+      }
+    }
+
+    return (low == 0 ? 0 : low - 1);
+  }
+
+
+  void IdentifierIndex::SplitBlock(size_t index)
+  {
+    Block& block = *blocks_[index];
+
+    std::string key;
+    int64_t id = -1;
+    size_t start = 0;
+    size_t position = 0;
+
+    for (uint32_t i = 0; i <= block.count_ / 2; i++)
+    {
+      start = position;
+      ReadEntry(key, id, block.data_, position);
+    }
+
+    // The middle entry starts the new block, with its full key
+    blocks_.insert(blocks_.begin() + index + 1, new Block);
+
+    Block& second = *blocks_[index + 1];
+    second.firstKey_ = key;
+    second.firstId_ = id;
+    second.count_ = block.count_ - block.count_ / 2;
+    WriteEntry(second.data_, "", key, id);
+    second.data_.append(block.data_, position, std::string::npos);
+
+    block.count_ = block.count_ / 2;
+    block.data_.resize(start);
+  }
+
+
+  void IdentifierIndex::Clear()
+  {
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      delete blocks_[i];
+    }
+
+    blocks_.clear();
+    size_ = 0;
+  }
+
+
+  void IdentifierIndex::Add(OrthancPluginResourceType level,
+                            uint32_t tag,
+                            const std::string& value,
+                            int64_t id)
+  {
+    std::string key;
+    MakeKey(key, level, tag, value);
+
+    if (blocks_.empty())
+    {
+      blocks_.push_back(new Block);
+
+      Block& block = *blocks_.back();
+      block.firstKey_ = key;
+      block.firstId_ = id;
+      block.count_ = 1;
+      WriteEntry(block.data_, "", key, id);
+
+      size_++;
+      return;
+    }
+
+    const size_t index = FindBlock(key, id);
+    Block& block = *blocks_[index];
+
+    std::string previous, current;
+    int64_t currentId = -1;
+    size_t position = 0;
+    bool inserted = false;
+
+    while (!inserted &&
+           position < block.data_.size())
+    {
+      const size_t start = position;
+      ReadEntry(current, currentId, block.data_, position);
+
+      if (IsLess(key, id, current, currentId))
+      {
+        // Insert before the current entry, whose prefix must be
+        // computed against the new key
+        std::string replacement;
+        WriteEntry(replacement, previous, key, id);
+        WriteEntry(replacement, key, current, currentId);
+        block.data_.replace(start, position - start, replacement);
+
+        if (start == 0)
+        {
+          block.firstKey_ = key;
+          block.firstId_ = id;
+        }
+
+        inserted = true;
+      }
+      else if (!IsLess(current, currentId, key, id))
+      {
+        return;   // Already indexed
+      }
+      else
+      {
+        previous = current;
+      }
+    }
+
+    if (!inserted)
+    {
+      WriteEntry(block.data_, previous, key, id);
+    }
+
+    block.count_++;
+    size_++;
+
+    if (block.count_ > MAX_BLOCK_SIZE)
+    {
+      SplitBlock(index);
+    }
+  }
+
+
+  bool IdentifierIndex::Remove(OrthancPluginResourceType level,
+                               uint32_t tag,
+                               const std::string& value,
+                               int64_t id)
+  {
+    if (blocks_.empty())
+    {
+      return false;
+    }
+
+    std::string key;
+    MakeKey(key, level, tag, value);
+
+    const size_t index = FindBlock(key, id);
+    Block& block = *blocks_[index];
+
+    std::string previous, current;
+    int64_t currentId = -1;
+    size_t position = 0;
+
+    while (position < block.data_.size())
+    {
+      const size_t start = position;
+      ReadEntry(current, currentId, block.data_, position);
+
+      if (IsLess(key, id, current, currentId))
+      {
+        return false;
+      }
+      else if (!IsLess(current, currentId, key, id))
+      {
+        if (position < block.data_.size())
+        {
+          // The next entry takes the place of the removed one
+          int64_t nextId;
+          ReadEntry(current, nextId, block.data_, position);
+
+          std::string replacement;
+          WriteEntry(replacement, previous, current, nextId);
+          block.data_.replace(start, position - start, replacement);
+
+          if (start == 0)
+          {
+            block.firstKey_ = current;
+            block.firstId_ = nextId;
+          }
+        }
+        else
+        {
+          block.data_.resize(start);
+        }
+
+        block.count_--;
+        size_--;
+
+        if (block.count_ == 0)
+        {
+          delete blocks_[index];
+          blocks_.erase(blocks_.begin() + index);
+        }
+
+        return true;
+      }
+
+      previous = current;
+    }
+
+    return false;
+  }
+
+
+  void IdentifierIndex::Lookup(std::list<int64_t>& target,
+                               OrthancPluginResourceType level,
+                               uint32_t tag,
+                               OrthancPluginIdentifierConstraint constraint,
+                               const std::string& value) const
+  {
+    std::string header, start, bound;
+    MakeKey(header, level, tag, "");
+
+    switch (constraint)
+    {
+      case OrthancPluginIdentifierConstraint_Equal:
+      case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+        start = header + value;
+        break;
+
+      case OrthancPluginIdentifierConstraint_SmallerOrEqual:
+        start = header;
+        bound = header + value;
+        break;
+
+      case OrthancPluginIdentifierConstraint_Wildcard:
+        // Only scan the values sharing the prefix before the first wildcard
+        start = header + value.substr(0, value.find_first_of("*?"));
+        break;
+
+      default:
+        throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    if (blocks_.empty())
+    {
+      return;
+    }
+
+    // All the internal IDs are positive
+    Cursor cursor(blocks_, FindBlock(start, 0));
+    while (cursor.IsValid() &&
+           cursor.GetKey().compare(start) < 0)
+    {
+      cursor.Next();
+    }
+
+    for (; cursor.IsValid(); cursor.Next())
+    {
+      const std::string& key = cursor.GetKey();
+
+      switch (constraint)
+      {
+        case OrthancPluginIdentifierConstraint_Equal:
+          if (key != start)
+          {
+            return;
+          }
+          break;
+
+        case OrthancPluginIdentifierConstraint_SmallerOrEqual:
+          if (key.compare(bound) > 0)
+          {
+            return;
+          }
+          break;
+
+        case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+          if (key.compare(0, header.size(), header) != 0)
+          {
+            return;   // Past the values of the tag
+          }
+          break;
+
+        case OrthancPluginIdentifierConstraint_Wildcard:
+          if (key.compare(0, start.size(), start) != 0)
+          {
+            return;   // Past the values with the prefix
+          }
+          else if (!MatchWildcard(value.c_str(), key.c_str() + header.size()))
+          {
+            continue;
+          }
+          break;
+
+        default:
+          break;
+      }
+
+      target.push_back(cursor.GetId());
+    }
+  }
+
+
+  uint64_t IdentifierIndex::GetEncodedSize() const
+  {
+    uint64_t size = 0;
+
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      size += blocks_[i]->firstKey_.size() + blocks_[i]->data_.size();
+    }
+
+    return size;
+  }
+}
@@ -0,0 +1,106 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <orthanc/OrthancCppDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <list>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  // Sorted index from the identifier tags of the resources to their
+  // internal IDs, that can be used by the database back-ends to
+  // implement "IDatabaseBackend::LookupIdentifier()".
+  //
+  // The entries are sorted by (level, tag, value, internal ID), and
+  // are stored in blocks of consecutive entries. Inside a block, each
+  // key only stores the suffix that differs from the previous key
+  // ("front coding"): As the keys of one tag share a 5-byte header,
+  // and as the DICOM UIDs share long prefixes, an entry typically
+  // takes a few bytes instead of a tree node and a heap-allocated
+  // string. The values are indexed as they are received, as Orthanc
+  // normalizes the identifiers before storing and looking them up.
+  class IdentifierIndex : public boost::noncopyable
+  {
+  private:
+    struct Block
+    {
+      std::string  firstKey_;
+      int64_t      firstId_;
+      uint32_t     count_;
+      std::string  data_;    // Front-coded entries, including the first one
+    };
+
+    class Cursor;
+
+    std::vector<Block*>  blocks_;
+    uint64_t             size_;
+
+    size_t FindBlock(const std::string& key,
+                     int64_t id) const;
+
+    void SplitBlock(size_t index);
+
+  public:
+    IdentifierIndex() :
+      size_(0)
+    {
+    }
+
+    ~IdentifierIndex()
+    {
+      Clear();
+    }
+
+    void Clear();
+
+    void Add(OrthancPluginResourceType level,
+             uint32_t tag,
+             const std::string& value,
+             int64_t id);
+
+    // Returns "false" if the entry was not indexed
+    bool Remove(OrthancPluginResourceType level,
+                uint32_t tag,
+                const std::string& value,
+                int64_t id);
+
+    // Appends the matching internal IDs to "target", sorted by value
+    void Lookup(std::list<int64_t>& target,
+                OrthancPluginResourceType level,
+                uint32_t tag,
+                OrthancPluginIdentifierConstraint constraint,
+                const std::string& value) const;
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    // Bytes used by the front-coded entries, for the statistics
+    uint64_t GetEncodedSize() const;
+  };
+}
@@ -0,0 +1,1886 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IndexTables.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  enum RecordType
+  {
+    RecordType_Header = 1,
+    RecordType_GlobalProperty = 2,
+    RecordType_Resource = 3,
+    RecordType_Change = 4,
+    RecordType_ExportedResource = 5,
+    RecordType_End = 6
+  };
+
+  static const uint32_t FORMAT_VERSION = 1;
+
+  // Value of the recycling links of the resources that are not in
+  // the recycling order (i.e. protected patients and other levels)
+  static const int64_t NOT_RECYCLABLE = -2;
+
+
+  static bool IsValidResourceType(OrthancPluginResourceType type)
+  {
+    return (type == OrthancPluginResourceType_Patient ||
+            type == OrthancPluginResourceType_Study ||
+            type == OrthancPluginResourceType_Series ||
+            type == OrthancPluginResourceType_Instance);
+  }
+
+
+  struct ExportedSeqComparator
+  {
+    bool operator() (int64_t seq,
+                     const IndexTables::ExportedResource& resource) const
+    {
+      return seq < resource.seq_;
+    }
+  };
+
+
+  static void WriteTags(RecordWriter& writer,
+                        const IndexTables::Tags& tags)
+  {
+    writer.WriteUInt32(static_cast<uint32_t>(tags.size()));
+    for (IndexTables::Tags::const_iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+      writer.WriteUInt32(it->first);
+      writer.WriteString(it->second);
+    }
+  }
+
+
+  static void ReadTags(IndexTables::Tags& tags,
+                       RecordReader& reader)
+  {
+    uint32_t count = reader.ReadUInt32();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t tag = reader.ReadUInt32();
+      reader.ReadString(tags[tag]);
+    }
+  }
+
+
+  static void WriteAttachment(RecordWriter& writer,
+                              const IndexTables::Attachment& attachment)
+  {
+    writer.WriteString(attachment.uuid_);
+    writer.WriteInt32(attachment.contentType_);
+    writer.WriteUInt64(attachment.uncompressedSize_);
+    writer.WriteString(attachment.uncompressedHash_);
+    writer.WriteInt32(attachment.compressionType_);
+    writer.WriteUInt64(attachment.compressedSize_);
+    writer.WriteString(attachment.compressedHash_);
+  }
+
+
+  static void ReadAttachment(IndexTables::Attachment& attachment,
+                             RecordReader& reader)
+  {
+    reader.ReadString(attachment.uuid_);
+    attachment.contentType_ = reader.ReadInt32();
+    attachment.uncompressedSize_ = reader.ReadUInt64();
+    reader.ReadString(attachment.uncompressedHash_);
+    attachment.compressionType_ = reader.ReadInt32();
+    attachment.compressedSize_ = reader.ReadUInt64();
+    reader.ReadString(attachment.compressedHash_);
+  }
+
+
+  // 64-bit FNV-1a
+  static uint64_t HashPublicId(const std::string& publicId)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < publicId.size(); i++)
+    {
+      hash ^= static_cast<uint8_t>(publicId[i]);
+      hash *= 1099511628211ULL;
+    }
+
+    return hash;
+  }
+
+
+  IndexTables::PublicIdIndex::PublicIdIndex()
+  {
+    Clear();
+  }
+
+
+  void IndexTables::PublicIdIndex::Clear()
+  {
+    Slot empty;
+    empty.hash_ = 0;
+    empty.id_ = 0;
+
+    slots_.assign(1024, empty);
+    size_ = 0;
+  }
+
+
+  void IndexTables::PublicIdIndex::Grow()
+  {
+    // The new slots are value-initialized, hence empty
+    std::vector<Slot> previous(slots_.size() * 2);
+    previous.swap(slots_);
+
+    const size_t mask = slots_.size() - 1;
+
+    for (size_t i = 0; i < previous.size(); i++)
+    {
+      if (previous[i].id_ != 0)
+      {
+        size_t j = static_cast<size_t>(previous[i].hash_) & mask;
+        while (slots_[j].id_ != 0)
+        {
+          j = (j + 1) & mask;
+        }
+
+        slots_[j] = previous[i];
+      }
+    }
+  }
+
+
+  bool IndexTables::PublicIdIndex::Find(int64_t& id,
+                                        const std::vector<std::string>& publicIds,
+                                        const std::string& publicId) const
+  {
+    const uint64_t hash = HashPublicId(publicId);
+    const size_t mask = slots_.size() - 1;
+
+    for (size_t i = static_cast<size_t>(hash) & mask; slots_[i].id_ != 0; i = (i + 1) & mask)
+    {
+      if (slots_[i].hash_ == hash &&
+          publicIds[static_cast<size_t>(slots_[i].id_)] == publicId)
+      {
+        id = slots_[i].id_;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  void IndexTables::PublicIdIndex::Insert(const std::vector<std::string>& publicIds,
+                                          int64_t id)
+  {
+    // Keep the load factor below 1/2
+    if (2 * (size_ + 1) > slots_.size())
+    {
+      Grow();
+    }
+
+    const uint64_t hash = HashPublicId(publicIds[static_cast<size_t>(id)]);
+    const size_t mask = slots_.size() - 1;
+
+    size_t i = static_cast<size_t>(hash) & mask;
+    while (slots_[i].id_ != 0)
+    {
+      i = (i + 1) & mask;
+    }
+
+    slots_[i].hash_ = hash;
+    slots_[i].id_ = id;
+    size_++;
+  }
+
+
+  void IndexTables::PublicIdIndex::Erase(const std::vector<std::string>& publicIds,
+                                         int64_t id)
+  {
+    const size_t mask = slots_.size() - 1;
+
+    size_t i = static_cast<size_t>(HashPublicId(publicIds[static_cast<size_t>(id)])) & mask;
+    while (slots_[i].id_ != id)
+    {
+      if (slots_[i].id_ == 0)
+      {
+        return;   // Not indexed
+      }
+
+      i = (i + 1) & mask;
+    }
+
+    // Backward-shift deletion: Move back the next slots of the
+    // cluster whose home slot does not lie after the hole, so that
+    // no tombstone is needed
+    size_t j = i;
+    for (;;)
+    {
+      j = (j + 1) & mask;
+      if (slots_[j].id_ == 0)
+      {
+        break;
+      }
+
+      const size_t home = static_cast<size_t>(slots_[j].hash_) & mask;
+      if ((j > i && (home <= i || home > j)) ||
+          (j < i && (home <= i && home > j)))
+      {
+        slots_[i] = slots_[j];
+        i = j;
+      }
+    }
+
+    slots_[i].id_ = 0;
+    size_--;
+  }
+
+
+  void IndexTables::CheckExisting(int64_t id) const
+  {
+    if (!IsExisting(id))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_UnknownResource);
+    }
+  }
+
+
+  IndexTables::ResourceContent& IndexTables::GetContent(int64_t id) const
+  {
+    CheckExisting(id);
+    return *contents_[static_cast<size_t>(id)];
+  }
+
+
+  void IndexTables::AddUndo(UndoType type,
+                            int64_t id,
+                            int64_t key,
+                            bool existed,
+                            const std::string& value)
+  {
+    if (transaction_)
+    {
+      UndoRecord record;
+      record.type_ = type;
+      record.id_ = id;
+      record.key_ = key;
+      record.existed_ = existed;
+      record.value_ = value;
+      record.resource_ = NULL;
+      undo_.push_back(record);
+    }
+  }
+
+
+  void IndexTables::AppendRow()
+  {
+    types_.push_back(OrthancPluginResourceType_Patient);
+    publicIds_.push_back(std::string());
+    parents_.push_back(-1);
+    firstChildren_.push_back(-1);
+    nextSiblings_.push_back(-1);
+    previousSiblings_.push_back(-1);
+    recyclingPrevious_.push_back(NOT_RECYCLABLE);
+    recyclingNext_.push_back(NOT_RECYCLABLE);
+    contents_.push_back(NULL);
+  }
+
+
+  void IndexTables::LinkChild(int64_t parent,
+                              int64_t child)
+  {
+    const size_t p = static_cast<size_t>(parent);
+    const size_t c = static_cast<size_t>(child);
+
+    parents_[c] = parent;
+    previousSiblings_[c] = -1;
+    nextSiblings_[c] = firstChildren_[p];
+
+    if (firstChildren_[p] != -1)
+    {
+      previousSiblings_[static_cast<size_t>(firstChildren_[p])] = child;
+    }
+
+    firstChildren_[p] = child;
+  }
+
+
+  void IndexTables::UnlinkChild(int64_t child)
+  {
+    const size_t c = static_cast<size_t>(child);
+
+    if (IsExisting(parents_[c]))
+    {
+      if (previousSiblings_[c] == -1)
+      {
+        firstChildren_[static_cast<size_t>(parents_[c])] = nextSiblings_[c];
+      }
+      else
+      {
+        nextSiblings_[static_cast<size_t>(previousSiblings_[c])] = nextSiblings_[c];
+      }
+
+      if (nextSiblings_[c] != -1)
+      {
+        previousSiblings_[static_cast<size_t>(nextSiblings_[c])] = previousSiblings_[c];
+      }
+    }
+
+    previousSiblings_[c] = -1;
+    nextSiblings_[c] = -1;
+  }
+
+
+  void IndexTables::LinkResource(int64_t id,
+                                 DeletedResource& resource,
+                                 bool linkParent)
+  {
+    const size_t i = static_cast<size_t>(id);
+    assert(contents_[i] == NULL);
+
+    types_[i] = resource.type_;
+    publicIds_[i].swap(resource.publicId_);
+    parents_[i] = resource.parent_;
+    firstChildren_[i] = -1;
+    nextSiblings_[i] = -1;
+    previousSiblings_[i] = -1;
+    recyclingPrevious_[i] = NOT_RECYCLABLE;
+    recyclingNext_[i] = NOT_RECYCLABLE;
+    contents_[i] = resource.content_;
+    resource.content_ = NULL;
+
+    publicIdIndex_.Insert(publicIds_, id);
+    byType_[types_[i]].insert(id);
+
+    const ResourceContent& content = *contents_[i];
+
+    for (Tags::const_iterator it = content.identifiers_.begin();
+         it != content.identifiers_.end(); ++it)
+    {
+      identifierIndex_.Add(types_[i], it->first, it->second, id);
+    }
+
+    if (resource.recyclable_)
+    {
+      InsertIntoRecycling(id, resource.recyclingPrevious_);
+    }
+
+    if (linkParent &&
+        IsExisting(parents_[i]))
+    {
+      LinkChild(parents_[i], id);
+    }
+  }
+
+
+  IndexTables::DeletedResource* IndexTables::UnlinkResource(int64_t id)
+  {
+    CheckExisting(id);
+
+    const size_t i = static_cast<size_t>(id);
+    const ResourceContent& content = *contents_[i];
+
+    UnlinkChild(id);
+
+    const bool recyclable = IsRecyclable(id);
+    const int64_t recyclingPrevious = (recyclable ? RemoveFromRecycling(id) : -1);
+
+    for (Tags::const_iterator it = content.identifiers_.begin();
+         it != content.identifiers_.end(); ++it)
+    {
+      identifierIndex_.Remove(types_[i], it->first, it->second, id);
+    }
+
+    byType_[types_[i]].erase(id);
+    publicIdIndex_.Erase(publicIds_, id);
+
+    DeletedResource* resource = new DeletedResource;
+    resource->type_ = types_[i];
+    resource->publicId_.swap(publicIds_[i]);
+    resource->parent_ = parents_[i];
+    resource->recyclable_ = recyclable;
+    resource->recyclingPrevious_ = recyclingPrevious;
+    resource->content_ = contents_[i];
+    contents_[i] = NULL;
+
+    return resource;
+  }
+
+
+  bool IndexTables::IsRecyclable(int64_t id) const
+  {
+    return recyclingPrevious_[static_cast<size_t>(id)] != NOT_RECYCLABLE;
+  }
+
+
+  void IndexTables::InsertIntoRecycling(int64_t id,
+                                        int64_t previous)
+  {
+    const size_t i = static_cast<size_t>(id);
+    assert(!IsRecyclable(id));
+
+    const int64_t next = (previous == -1 ? recyclingFirst_ : recyclingNext_[static_cast<size_t>(previous)]);
+
+    recyclingPrevious_[i] = previous;
+    recyclingNext_[i] = next;
+
+    if (previous == -1)
+    {
+      recyclingFirst_ = id;
+    }
+    else
+    {
+      recyclingNext_[static_cast<size_t>(previous)] = id;
+    }
+
+    if (next == -1)
+    {
+      recyclingLast_ = id;
+    }
+    else
+    {
+      recyclingPrevious_[static_cast<size_t>(next)] = id;
+    }
+  }
+
+
+  int64_t IndexTables::RemoveFromRecycling(int64_t id)
+  {
+    const size_t i = static_cast<size_t>(id);
+    assert(IsRecyclable(id));
+
+    const int64_t previous = recyclingPrevious_[i];
+    const int64_t next = recyclingNext_[i];
+
+    if (previous == -1)
+    {
+      recyclingFirst_ = next;
+    }
+    else
+    {
+      recyclingNext_[static_cast<size_t>(previous)] = next;
+    }
+
+    if (next == -1)
+    {
+      recyclingLast_ = previous;
+    }
+    else
+    {
+      recyclingPrevious_[static_cast<size_t>(next)] = previous;
+    }
+
+    recyclingPrevious_[i] = NOT_RECYCLABLE;
+    recyclingNext_[i] = NOT_RECYCLABLE;
+
+    return previous;
+  }
+
+
+  void IndexTables::UpdateRecycling(int64_t id,
+                                    bool recyclable)
+  {
+    const bool wasRecyclable = IsRecyclable(id);
+    const int64_t previous = (wasRecyclable ? RemoveFromRecycling(id) : -1);
+
+    // The rollback puts the patient back after its previous neighbor
+    AddUndo(UndoType_Recycling, id, previous, wasRecyclable, "");
+
+    if (recyclable)
+    {
+      InsertIntoRecycling(id, recyclingLast_);
+    }
+  }
+
+
+  void IndexTables::SetTagInternal(int64_t id,
+                                   bool isIdentifier,
+                                   uint32_t tag,
+                                   const std::string& value)
+  {
+    ResourceContent& content = GetContent(id);
+    Tags& tags = (isIdentifier ? content.identifiers_ : content.mainDicomTags_);
+
+    Tags::iterator found = tags.find(tag);
+    if (found == tags.end())
+    {
+      AddUndo(isIdentifier ? UndoType_IdentifierTag : UndoType_MainDicomTag, id, tag, false, "");
+      found = tags.insert(std::make_pair(tag, std::string())).first;
+    }
+    else
+    {
+      AddUndo(isIdentifier ? UndoType_IdentifierTag : UndoType_MainDicomTag, id, tag, true, found->second);
+
+      if (isIdentifier)
+      {
+        identifierIndex_.Remove(types_[static_cast<size_t>(id)], tag, found->second, id);
+      }
+    }
+
+    found->second = value;
+
+    if (isIdentifier)
+    {
+      identifierIndex_.Add(types_[static_cast<size_t>(id)], tag, value, id);
+    }
+  }
+
+
+  bool IndexTables::RemoveTagInternal(int64_t id,
+                                      bool isIdentifier,
+                                      uint32_t tag)
+  {
+    ResourceContent& content = GetContent(id);
+    Tags& tags = (isIdentifier ? content.identifiers_ : content.mainDicomTags_);
+
+    Tags::iterator found = tags.find(tag);
+    if (found == tags.end())
+    {
+      return false;
+    }
+
+    AddUndo(isIdentifier ? UndoType_IdentifierTag : UndoType_MainDicomTag, id, tag, true, found->second);
+
+    if (isIdentifier)
+    {
+      identifierIndex_.Remove(types_[static_cast<size_t>(id)], tag, found->second, id);
+    }
+
+    tags.erase(found);
+    return true;
+  }
+
+
+  void IndexTables::SetAttachmentInternal(int64_t id,
+                                          const Attachment& attachment)
+  {
+    ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, Attachment>::iterator found = content.attachments_.find(attachment.contentType_);
+    if (found == content.attachments_.end())
+    {
+      AddUndo(UndoType_Attachment, id, attachment.contentType_, false, "");
+      found = content.attachments_.insert(std::make_pair(attachment.contentType_, attachment)).first;
+    }
+    else
+    {
+      AddUndo(UndoType_Attachment, id, attachment.contentType_, true, "");
+      if (transaction_)
+      {
+        undo_.back().attachment_ = found->second;
+      }
+
+      found->second = attachment;
+    }
+  }
+
+
+  bool IndexTables::RemoveAttachmentInternal(Attachment& removed,
+                                             int64_t id,
+                                             int32_t contentType)
+  {
+    ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, Attachment>::iterator found = content.attachments_.find(contentType);
+    if (found == content.attachments_.end())
+    {
+      return false;
+    }
+
+    AddUndo(UndoType_Attachment, id, contentType, true, "");
+    if (transaction_)
+    {
+      undo_.back().attachment_ = found->second;
+    }
+
+    removed = found->second;
+    content.attachments_.erase(found);
+    return true;
+  }
+
+
+  void IndexTables::RemoveLeafResource(Deletion& deletion,
+                                       int64_t id)
+  {
+    assert(firstChildren_[static_cast<size_t>(id)] == -1);
+    DeletedResource* resource = UnlinkResource(id);
+
+    deletion.resources_.push_back(std::make_pair(resource->publicId_, resource->type_));
+
+    for (std::map<int32_t, Attachment>::const_iterator it = resource->content_->attachments_.begin();
+         it != resource->content_->attachments_.end(); ++it)
+    {
+      deletion.attachments_.push_back(it->second);
+    }
+
+    if (transaction_)
+    {
+      // Keep the resource, so that the rollback can link it back
+      AddUndo(UndoType_DeleteResource, id, 0, true, "");
+      undo_.back().resource_ = resource;
+    }
+    else
+    {
+      delete resource;
+    }
+  }
+
+
+  void IndexTables::DeleteSubtree(Deletion& deletion,
+                                  int64_t id)
+  {
+    CheckExisting(id);
+
+    // Deleting the first child makes the next one the first child
+    while (firstChildren_[static_cast<size_t>(id)] != -1)
+    {
+      DeleteSubtree(deletion, firstChildren_[static_cast<size_t>(id)]);
+    }
+
+    RemoveLeafResource(deletion, id);
+  }
+
+
+  void IndexTables::ApplyUndo(UndoRecord& record)
+  {
+    switch (record.type_)
+    {
+      case UndoType_CreateResource:
+        delete UnlinkResource(record.id_);
+        break;
+
+      case UndoType_DeleteResource:
+        LinkResource(record.id_, *record.resource_, true);
+        break;
+
+      case UndoType_AttachChild:
+        CheckExisting(record.id_);
+        UnlinkChild(record.id_);
+        parents_[static_cast<size_t>(record.id_)] = record.key_;
+
+        if (IsExisting(record.key_))
+        {
+          LinkChild(record.key_, record.id_);
+        }
+        break;
+
+      case UndoType_MainDicomTag:
+      case UndoType_IdentifierTag:
+      {
+        const bool isIdentifier = (record.type_ == UndoType_IdentifierTag);
+        if (record.existed_)
+        {
+          SetTagInternal(record.id_, isIdentifier, static_cast<uint32_t>(record.key_), record.value_);
+        }
+        else
+        {
+          RemoveTagInternal(record.id_, isIdentifier, static_cast<uint32_t>(record.key_));
+        }
+        break;
+      }
+
+      case UndoType_Metadata:
+        if (record.existed_)
+        {
+          GetContent(record.id_).metadata_[static_cast<int32_t>(record.key_)] = record.value_;
+        }
+        else
+        {
+          GetContent(record.id_).metadata_.erase(static_cast<int32_t>(record.key_));
+        }
+        break;
+
+      case UndoType_Attachment:
+        if (record.existed_)
+        {
+          SetAttachmentInternal(record.id_, record.attachment_);
+        }
+        else
+        {
+          Attachment removed;
+          RemoveAttachmentInternal(removed, record.id_, static_cast<int32_t>(record.key_));
+        }
+        break;
+
+      case UndoType_GlobalProperty:
+        if (record.existed_)
+        {
+          globalProperties_[static_cast<int32_t>(record.key_)] = record.value_;
+        }
+        else
+        {
+          globalProperties_.erase(static_cast<int32_t>(record.key_));
+        }
+        break;
+
+      case UndoType_Recycling:
+        CheckExisting(record.id_);
+
+        if (IsRecyclable(record.id_))
+        {
+          RemoveFromRecycling(record.id_);
+        }
+
+        if (record.existed_)
+        {
+          InsertIntoRecycling(record.id_, record.key_);
+        }
+        break;
+
+      case UndoType_LogChange:
+        changes_.RemoveLast();
+        break;
+
+      case UndoType_ClearChanges:
+        changes_.Swap(*record.changes_);
+        break;
+
+      case UndoType_LogExportedResource:
+        exported_.pop_back();
+        break;
+
+      case UndoType_ClearExportedResources:
+        exported_.swap(*record.exported_);
+        break;
+
+      default:
+        throw DatabaseException(OrthancPluginErrorCode_InternalError);
+    }
+  }
+
+
+  void IndexTables::DiscardUndo()
+  {
+    for (size_t i = 0; i < undo_.size(); i++)
+    {
+      if (undo_[i].resource_ != NULL)
+      {
+        delete undo_[i].resource_;
+      }
+    }
+
+    undo_.clear();
+  }
+
+
+  bool IndexTables::IsDeletedChange(const Change& change) const
+  {
+    // The changes are not removed together with their resource (as
+    // the "ON DELETE CASCADE" of the SQLite index would do), but are
+    // skipped, as the internal IDs are never reused
+    return !IsExisting(change.resourceId_);
+  }
+
+
+  IndexTables::IndexTables() :
+    transaction_(false),
+    loadedEnd_(false)
+  {
+    Clear();
+  }
+
+
+  IndexTables::~IndexTables()
+  {
+    DiscardUndo();
+
+    for (size_t i = 0; i < contents_.size(); i++)
+    {
+      delete contents_[i];
+    }
+  }
+
+
+  void IndexTables::Clear()
+  {
+    DiscardUndo();
+    transaction_ = false;
+
+    for (size_t i = 0; i < contents_.size(); i++)
+    {
+      delete contents_[i];
+    }
+
+    types_.clear();
+    publicIds_.clear();
+    parents_.clear();
+    firstChildren_.clear();
+    nextSiblings_.clear();
+    previousSiblings_.clear();
+    recyclingPrevious_.clear();
+    recyclingNext_.clear();
+    contents_.clear();
+    AppendRow();   // The internal IDs start at 1, as in SQLite
+
+    publicIdIndex_.Clear();
+
+    for (size_t i = 0; i < 4; i++)
+    {
+      byType_[i].clear();
+    }
+
+    identifierIndex_.Clear();
+    recyclingFirst_ = -1;
+    recyclingLast_ = -1;
+    loadedRecyclingOrder_.clear();
+    globalProperties_.clear();
+    changes_.Clear();
+    exported_.clear();
+    nextChangeSeq_ = 1;
+    nextExportedSeq_ = 1;
+    loadedEnd_ = false;
+  }
+
+
+  void IndexTables::StartTransaction()
+  {
+    if (transaction_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    transaction_ = true;
+    savedResourcesCount_ = GetResourcesCount();
+    savedChangeSeq_ = nextChangeSeq_;
+    savedExportedSeq_ = nextExportedSeq_;
+  }
+
+
+  void IndexTables::CommitTransaction()
+  {
+    if (!transaction_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    DiscardUndo();
+    transaction_ = false;
+  }
+
+
+  void IndexTables::RollbackTransaction()
+  {
+    if (!transaction_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    // No undo record must be created while undoing
+    transaction_ = false;
+
+    while (!undo_.empty())
+    {
+      ApplyUndo(undo_.back());
+
+      if (undo_.back().resource_ != NULL)
+      {
+        delete undo_.back().resource_;
+      }
+
+      undo_.pop_back();
+    }
+
+    // The resources that were created by the transaction are all
+    // deleted by now
+    const size_t count = static_cast<size_t>(savedResourcesCount_);
+    types_.resize(count);
+    publicIds_.resize(count);
+    parents_.resize(count);
+    firstChildren_.resize(count);
+    nextSiblings_.resize(count);
+    previousSiblings_.resize(count);
+    recyclingPrevious_.resize(count);
+    recyclingNext_.resize(count);
+    contents_.resize(count);
+
+    nextChangeSeq_ = savedChangeSeq_;
+    nextExportedSeq_ = savedExportedSeq_;
+  }
+
+
+  int64_t IndexTables::CreateResource(const std::string& publicId,
+                                      OrthancPluginResourceType type)
+  {
+    if (!IsValidResourceType(type))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    int64_t existing;
+    if (publicIdIndex_.Find(existing, publicIds_, publicId))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_Database);
+    }
+
+    DeletedResource resource;
+    resource.type_ = type;
+    resource.publicId_ = publicId;
+    resource.parent_ = -1;
+
+    // The new patients are the last ones to be recycled
+    resource.recyclable_ = (type == OrthancPluginResourceType_Patient);
+    resource.recyclingPrevious_ = recyclingLast_;
+    resource.content_ = new ResourceContent;
+
+    const int64_t id = GetResourcesCount();
+    AppendRow();
+    LinkResource(id, resource, false);
+
+    AddUndo(UndoType_CreateResource, id, 0, false, "");
+
+    return id;
+  }
+
+
+  void IndexTables::AttachChild(int64_t parent,
+                                int64_t child)
+  {
+    CheckExisting(parent);
+    CheckExisting(child);
+
+    AddUndo(UndoType_AttachChild, child, parents_[static_cast<size_t>(child)], true, "");
+
+    UnlinkChild(child);
+    LinkChild(parent, child);
+  }
+
+
+  void IndexTables::DeleteResource(Deletion& deletion,
+                                   int64_t id)
+  {
+    deletion.resources_.clear();
+    deletion.attachments_.clear();
+    deletion.hasRemainingAncestor_ = false;
+
+    CheckExisting(id);
+    int64_t ancestor = parents_[static_cast<size_t>(id)];
+
+    DeleteSubtree(deletion, id);
+
+    // Delete the ancestors that have no child anymore, and report
+    // the first one that remains
+    while (IsExisting(ancestor))
+    {
+      const size_t i = static_cast<size_t>(ancestor);
+
+      if (firstChildren_[i] != -1)
+      {
+        deletion.hasRemainingAncestor_ = true;
+        deletion.remainingAncestorId_ = publicIds_[i];
+        deletion.remainingAncestorType_ = types_[i];
+        break;
+      }
+      else
+      {
+        int64_t next = parents_[i];
+        RemoveLeafResource(deletion, ancestor);
+        ancestor = next;
+      }
+    }
+  }
+
+
+  bool IndexTables::LookupResource(int64_t& id,
+                                   OrthancPluginResourceType& type,
+                                   const std::string& publicId) const
+  {
+    if (publicIdIndex_.Find(id, publicIds_, publicId))
+    {
+      type = types_[static_cast<size_t>(id)];
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool IndexTables::LookupParent(int64_t& parent,
+                                 int64_t id) const
+  {
+    CheckExisting(id);
+
+    if (parents_[static_cast<size_t>(id)] == -1)
+    {
+      return false;
+    }
+    else
+    {
+      parent = parents_[static_cast<size_t>(id)];
+      return true;
+    }
+  }
+
+
+  void IndexTables::GetChildrenInternalId(std::list<int64_t>& target,
+                                          int64_t id) const
+  {
+    CheckExisting(id);
+    target.clear();
+
+    for (int64_t child = firstChildren_[static_cast<size_t>(id)];
+         child != -1; child = nextSiblings_[static_cast<size_t>(child)])
+    {
+      target.push_back(child);
+    }
+  }
+
+
+  void IndexTables::GetChildrenPublicId(std::list<std::string>& target,
+                                        int64_t id) const
+  {
+    CheckExisting(id);
+    target.clear();
+
+    for (int64_t child = firstChildren_[static_cast<size_t>(id)];
+         child != -1; child = nextSiblings_[static_cast<size_t>(child)])
+    {
+      target.push_back(publicIds_[static_cast<size_t>(child)]);
+    }
+  }
+
+
+  uint64_t IndexTables::GetResourceCount(OrthancPluginResourceType type) const
+  {
+    if (!IsValidResourceType(type))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    return byType_[type].size();
+  }
+
+
+  void IndexTables::GetAllInternalIds(std::list<int64_t>& target,
+                                      OrthancPluginResourceType type) const
+  {
+    if (!IsValidResourceType(type))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    target.assign(byType_[type].begin(), byType_[type].end());
+  }
+
+
+  void IndexTables::GetAllPublicIds(std::list<std::string>& target,
+                                    OrthancPluginResourceType type) const
+  {
+    std::list<int64_t> ids;
+    GetAllInternalIds(ids, type);
+
+    target.clear();
+    for (std::list<int64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+      target.push_back(publicIds_[static_cast<size_t>(*it)]);
+    }
+  }
+
+
+  void IndexTables::GetAllPublicIds(std::list<std::string>& target,
+                                    OrthancPluginResourceType type,
+                                    uint64_t since,
+                                    uint64_t limit) const
+  {
+    if (!IsValidResourceType(type))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    target.clear();
+
+    const std::set<int64_t>& ids = byType_[type];
+    if (since >= ids.size())
+    {
+      return;
+    }
+
+    std::set<int64_t>::const_iterator it = ids.begin();
+    std::advance(it, static_cast<size_t>(since));
+
+    for (; it != ids.end() && target.size() < limit; ++it)
+    {
+      target.push_back(publicIds_[static_cast<size_t>(*it)]);
+    }
+  }
+
+
+  int64_t IndexTables::GetInternalIdsPage(std::vector<int64_t>& target,
+                                          OrthancPluginResourceType type,
+                                          int64_t cursor,
+                                          uint32_t limit) const
+  {
+    if (!IsValidResourceType(type))
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    target.clear();
+    target.reserve(std::min(static_cast<size_t>(limit), byType_[type].size()));
+
+    for (std::set<int64_t>::const_iterator it = byType_[type].upper_bound(cursor);
+         it != byType_[type].end() && target.size() < limit; ++it)
+    {
+      target.push_back(*it);
+    }
+
+    return (target.empty() ? cursor : target.back());
+  }
+
+
+  int64_t IndexTables::GetPublicIdsPage(std::vector<std::string>& target,
+                                        OrthancPluginResourceType type,
+                                        int64_t cursor,
+                                        uint32_t limit) const
+  {
+    std::vector<int64_t> ids;
+    cursor = GetInternalIdsPage(ids, type, cursor, limit);
+
+    target.resize(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      target[i] = publicIds_[static_cast<size_t>(ids[i])];
+    }
+
+    return cursor;
+  }
+
+
+  int64_t IndexTables::GetChildrenPage(std::vector<int64_t>& target,
+                                       int64_t id,
+                                       int64_t cursor,
+                                       uint32_t limit) const
+  {
+    CheckExisting(id);
+    target.clear();
+
+    int64_t child;
+    if (cursor == 0)
+    {
+      child = firstChildren_[static_cast<size_t>(id)];
+    }
+    else if (IsExisting(cursor) &&
+             parents_[static_cast<size_t>(cursor)] == id)
+    {
+      child = nextSiblings_[static_cast<size_t>(cursor)];
+    }
+    else
+    {
+      throw DatabaseException(OrthancPluginErrorCode_UnknownResource);
+    }
+
+    for (; child != -1 && target.size() < limit; child = nextSiblings_[static_cast<size_t>(child)])
+    {
+      target.push_back(child);
+    }
+
+    return (target.empty() ? cursor : target.back());
+  }
+
+
+  void IndexTables::ClearMainDicomTags(int64_t id)
+  {
+    const ResourceContent& content = GetContent(id);
+
+    std::vector<uint32_t> tags;
+    for (Tags::const_iterator it = content.mainDicomTags_.begin(); it != content.mainDicomTags_.end(); ++it)
+    {
+      tags.push_back(it->first);
+    }
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      RemoveTagInternal(id, false, tags[i]);
+    }
+
+    tags.clear();
+    for (Tags::const_iterator it = content.identifiers_.begin(); it != content.identifiers_.end(); ++it)
+    {
+      tags.push_back(it->first);
+    }
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      RemoveTagInternal(id, true, tags[i]);
+    }
+  }
+
+
+  void IndexTables::LookupIdentifier(std::list<int64_t>& target,
+                                     OrthancPluginResourceType type,
+                                     uint32_t tag,
+                                     OrthancPluginIdentifierConstraint constraint,
+                                     const std::string& value) const
+  {
+    target.clear();
+    identifierIndex_.Lookup(target, type, tag, constraint, value);
+  }
+
+
+
+  void IndexTables::SetMetadata(int64_t id,
+                                int32_t type,
+                                const std::string& value)
+  {
+    ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, std::string>::iterator found = content.metadata_.find(type);
+    if (found == content.metadata_.end())
+    {
+      AddUndo(UndoType_Metadata, id, type, false, "");
+      content.metadata_[type] = value;
+    }
+    else
+    {
+      AddUndo(UndoType_Metadata, id, type, true, found->second);
+      found->second = value;
+    }
+  }
+
+
+  void IndexTables::DeleteMetadata(int64_t id,
+                                   int32_t type)
+  {
+    ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, std::string>::iterator found = content.metadata_.find(type);
+    if (found != content.metadata_.end())
+    {
+      AddUndo(UndoType_Metadata, id, type, true, found->second);
+      content.metadata_.erase(found);
+    }
+  }
+
+
+  bool IndexTables::LookupMetadata(std::string& target,
+                                   int64_t id,
+                                   int32_t type) const
+  {
+    const ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, std::string>::const_iterator found = content.metadata_.find(type);
+    if (found == content.metadata_.end())
+    {
+      return false;
+    }
+    else
+    {
+      target = found->second;
+      return true;
+    }
+  }
+
+
+  void IndexTables::ListAvailableMetadata(std::list<int32_t>& target,
+                                          int64_t id) const
+  {
+    target.clear();
+
+    const ResourceContent& content = GetContent(id);
+    for (std::map<int32_t, std::string>::const_iterator it = content.metadata_.begin();
+         it != content.metadata_.end(); ++it)
+    {
+      target.push_back(it->first);
+    }
+  }
+
+
+  const IndexTables::Attachment* IndexTables::LookupAttachment(int64_t id,
+                                                               int32_t contentType) const
+  {
+    const ResourceContent& content = GetContent(id);
+
+    std::map<int32_t, Attachment>::const_iterator found = content.attachments_.find(contentType);
+    if (found == content.attachments_.end())
+    {
+      return NULL;
+    }
+    else
+    {
+      return &found->second;
+    }
+  }
+
+
+  void IndexTables::ListAvailableAttachments(std::list<int32_t>& target,
+                                             int64_t id) const
+  {
+    target.clear();
+
+    const ResourceContent& content = GetContent(id);
+    for (std::map<int32_t, Attachment>::const_iterator it = content.attachments_.begin();
+         it != content.attachments_.end(); ++it)
+    {
+      target.push_back(it->first);
+    }
+  }
+
+
+  void IndexTables::ComputeTotalSizes(uint64_t& compressed,
+                                      uint64_t& uncompressed) const
+  {
+    compressed = 0;
+    uncompressed = 0;
+
+    for (size_t i = 0; i < contents_.size(); i++)
+    {
+      if (contents_[i] != NULL)
+      {
+        const std::map<int32_t, Attachment>& attachments = contents_[i]->attachments_;
+        for (std::map<int32_t, Attachment>::const_iterator it = attachments.begin();
+             it != attachments.end(); ++it)
+        {
+          compressed += it->second.compressedSize_;
+          uncompressed += it->second.uncompressedSize_;
+        }
+      }
+    }
+  }
+
+
+  void IndexTables::SetGlobalProperty(int32_t property,
+                                      const std::string& value)
+  {
+    std::map<int32_t, std::string>::iterator found = globalProperties_.find(property);
+    if (found == globalProperties_.end())
+    {
+      AddUndo(UndoType_GlobalProperty, 0, property, false, "");
+      globalProperties_[property] = value;
+    }
+    else
+    {
+      AddUndo(UndoType_GlobalProperty, 0, property, true, found->second);
+      found->second = value;
+    }
+  }
+
+
+  bool IndexTables::LookupGlobalProperty(std::string& target,
+                                         int32_t property) const
+  {
+    std::map<int32_t, std::string>::const_iterator found = globalProperties_.find(property);
+    if (found == globalProperties_.end())
+    {
+      return false;
+    }
+    else
+    {
+      target = found->second;
+      return true;
+    }
+  }
+
+
+  bool IndexTables::IsProtectedPatient(int64_t id) const
+  {
+    CheckExisting(id);
+    return !IsRecyclable(id);
+  }
+
+
+  void IndexTables::SetProtectedPatient(int64_t id,
+                                        bool isProtected)
+  {
+    CheckExisting(id);
+
+    if (isProtected)
+    {
+      if (IsRecyclable(id))
+      {
+        UpdateRecycling(id, false);
+      }
+    }
+    else if (!IsRecyclable(id))
+    {
+      // An unprotected patient becomes the last one to be recycled
+      UpdateRecycling(id, true);
+    }
+  }
+
+
+  bool IndexTables::SelectPatientToRecycle(int64_t& id) const
+  {
+    if (recyclingFirst_ == -1)
+    {
+      return false;
+    }
+    else
+    {
+      id = recyclingFirst_;
+      return true;
+    }
+  }
+
+
+  bool IndexTables::SelectPatientToRecycle(int64_t& id,
+                                           int64_t patientIdToAvoid) const
+  {
+    int64_t candidate = recyclingFirst_;
+
+    if (candidate != -1 &&
+        candidate == patientIdToAvoid)
+    {
+      candidate = recyclingNext_[static_cast<size_t>(candidate)];
+    }
+
+    if (candidate == -1)
+    {
+      return false;
+    }
+    else
+    {
+      id = candidate;
+      return true;
+    }
+  }
+
+
+  int64_t IndexTables::LogChange(int32_t changeType,
+                                 int64_t resourceId,
+                                 OrthancPluginResourceType resourceType,
+                                 const std::string& date)
+  {
+    Change change;
+    change.seq_ = nextChangeSeq_++;
+    change.changeType_ = changeType;
+    change.resourceType_ = resourceType;
+    change.resourceId_ = resourceId;
+    change.date_ = date;
+
+    changes_.Append(change);
+    AddUndo(UndoType_LogChange, 0, 0, false, "");
+
+    if (changeType == OrthancPluginChangeType_NewInstance &&
+        IsExisting(resourceId))
+    {
+      int64_t patient = resourceId;
+      while (parents_[static_cast<size_t>(patient)] != -1)
+      {
+        patient = parents_[static_cast<size_t>(patient)];
+      }
+
+      if (types_[static_cast<size_t>(patient)] == OrthancPluginResourceType_Patient &&
+          IsRecyclable(patient) &&
+          patient != recyclingLast_)
+      {
+        UpdateRecycling(patient, true);
+      }
+    }
+
+    return change.seq_;
+  }
+
+
+  void IndexTables::GetChanges(std::list<Change>& target,
+                               bool& done,
+                               int64_t since,
+                               uint32_t maxResults) const
+  {
+    target.clear();
+    done = true;
+
+    for (uint64_t i = changes_.FindAfter(since); i < changes_.GetSize(); i++)
+    {
+      const Change& change = changes_.GetAt(i);
+
+      if (!IsDeletedChange(change))
+      {
+        if (target.size() == maxResults)
+        {
+          done = false;
+          break;
+        }
+
+        target.push_back(change);
+      }
+    }
+  }
+
+
+  bool IndexTables::GetLastChange(Change& target) const
+  {
+    // In O(1), unless the most recent changes are about deleted resources
+    for (uint64_t i = changes_.GetSize(); i > 0; i--)
+    {
+      const Change& change = changes_.GetAt(i - 1);
+
+      if (!IsDeletedChange(change))
+      {
+        target = change;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  void IndexTables::ClearChanges()
+  {
+    if (transaction_)
+    {
+      AddUndo(UndoType_ClearChanges, 0, 0, false, "");
+      undo_.back().changes_.reset(new ChangeLog);
+      undo_.back().changes_->Swap(changes_);
+    }
+    else
+    {
+      changes_.Clear();
+    }
+  }
+
+
+  void IndexTables::DropChanges(int64_t lastSeq)
+  {
+    if (transaction_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    changes_.DropUntil(lastSeq);
+  }
+
+
+  int64_t IndexTables::LogExportedResource(const ExportedResource& resource)
+  {
+    exported_.push_back(resource);
+    exported_.back().seq_ = nextExportedSeq_++;
+    AddUndo(UndoType_LogExportedResource, 0, 0, false, "");
+
+    return exported_.back().seq_;
+  }
+
+
+  void IndexTables::GetExportedResources(std::list<ExportedResource>& target,
+                                         bool& done,
+                                         int64_t since,
+                                         uint32_t maxResults) const
+  {
+    target.clear();
+
+    std::deque<ExportedResource>::const_iterator it =
+      std::upper_bound(exported_.begin(), exported_.end(), since, ExportedSeqComparator());
+
+    for (; it != exported_.end() && target.size() < maxResults; ++it)
+    {
+      target.push_back(*it);
+    }
+
+    done = (it == exported_.end());
+  }
+
+
+  bool IndexTables::GetLastExportedResource(ExportedResource& target) const
+  {
+    if (exported_.empty())
+    {
+      return false;
+    }
+    else
+    {
+      target = exported_.back();
+      return true;
+    }
+  }
+
+
+  void IndexTables::ClearExportedResources()
+  {
+    if (transaction_)
+    {
+      AddUndo(UndoType_ClearExportedResources, 0, 0, false, "");
+      undo_.back().exported_.reset(new std::deque<ExportedResource>);
+      undo_.back().exported_->swap(exported_);
+    }
+    else
+    {
+      exported_.clear();
+    }
+  }
+
+
+  void IndexTables::Save(RecordFile& target) const
+  {
+    if (transaction_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    // The recycling order is saved as a rank per resource (0 if not
+    // recyclable), which keeps the format of the records unchanged
+    std::vector<int64_t> recyclingRanks(contents_.size(), 0);
+    int64_t rank = 0;
+    for (int64_t id = recyclingFirst_; id != -1; id = recyclingNext_[static_cast<size_t>(id)])
+    {
+      recyclingRanks[static_cast<size_t>(id)] = ++rank;
+    }
+
+    RecordWriter writer;
+    writer.WriteUInt8(RecordType_Header);
+    writer.WriteUInt32(FORMAT_VERSION);
+    writer.WriteUInt64(contents_.size());
+    writer.WriteInt64(nextChangeSeq_);
+    writer.WriteInt64(nextExportedSeq_);
+    writer.WriteInt64(rank + 1);
+    target.Append(writer);
+
+    for (std::map<int32_t, std::string>::const_iterator it = globalProperties_.begin();
+         it != globalProperties_.end(); ++it)
+    {
+      writer.Clear();
+      writer.WriteUInt8(RecordType_GlobalProperty);
+      writer.WriteInt32(it->first);
+      writer.WriteString(it->second);
+      target.Append(writer);
+    }
+
+    for (size_t i = 0; i < contents_.size(); i++)
+    {
+      const ResourceContent* content = contents_[i];
+      if (content == NULL)
+      {
+        continue;
+      }
+
+      writer.Clear();
+      writer.WriteUInt8(RecordType_Resource);
+      writer.WriteInt64(static_cast<int64_t>(i));
+      writer.WriteInt32(types_[i]);
+      writer.WriteString(publicIds_[i]);
+      writer.WriteInt64(parents_[i]);
+      writer.WriteInt64(recyclingRanks[i]);
+      WriteTags(writer, content->mainDicomTags_);
+      WriteTags(writer, content->identifiers_);
+
+      writer.WriteUInt32(static_cast<uint32_t>(content->metadata_.size()));
+      for (std::map<int32_t, std::string>::const_iterator it = content->metadata_.begin();
+           it != content->metadata_.end(); ++it)
+      {
+        writer.WriteInt32(it->first);
+        writer.WriteString(it->second);
+      }
+
+      writer.WriteUInt32(static_cast<uint32_t>(content->attachments_.size()));
+      for (std::map<int32_t, Attachment>::const_iterator it = content->attachments_.begin();
+           it != content->attachments_.end(); ++it)
+      {
+        WriteAttachment(writer, it->second);
+      }
+
+      target.Append(writer);
+    }
+
+    for (uint64_t i = 0; i < changes_.GetSize(); i++)
+    {
+      const Change& change = changes_.GetAt(i);
+
+      if (!IsDeletedChange(change))
+      {
+        writer.Clear();
+        writer.WriteUInt8(RecordType_Change);
+        writer.WriteInt64(change.seq_);
+        writer.WriteInt32(change.changeType_);
+        writer.WriteInt32(change.resourceType_);
+        writer.WriteInt64(change.resourceId_);
+        writer.WriteString(change.date_);
+        target.Append(writer);
+      }
+    }
+
+    for (std::deque<ExportedResource>::const_iterator it = exported_.begin(); it != exported_.end(); ++it)
+    {
+      writer.Clear();
+      writer.WriteUInt8(RecordType_ExportedResource);
+      writer.WriteInt64(it->seq_);
+      writer.WriteInt32(it->resourceType_);
+      writer.WriteString(it->publicId_);
+      writer.WriteString(it->modality_);
+      writer.WriteString(it->date_);
+      writer.WriteString(it->patientId_);
+      writer.WriteString(it->studyInstanceUid_);
+      writer.WriteString(it->seriesInstanceUid_);
+      writer.WriteString(it->sopInstanceUid_);
+      target.Append(writer);
+    }
+
+    writer.Clear();
+    writer.WriteUInt8(RecordType_End);
+    target.Append(writer);
+  }
+
+
+  void IndexTables::LoadRecord(const std::string& record)
+  {
+    RecordReader reader(record);
+
+    switch (reader.ReadUInt8())
+    {
+      case RecordType_Header:
+      {
+        if (reader.ReadUInt32() != FORMAT_VERSION)
+        {
+          throw DatabaseException(OrthancPluginErrorCode_IncompatibleDatabaseVersion);
+        }
+
+        const uint64_t count = reader.ReadUInt64();
+        while (contents_.size() < count)
+        {
+          AppendRow();
+        }
+
+        nextChangeSeq_ = reader.ReadInt64();
+        nextExportedSeq_ = reader.ReadInt64();
+        reader.ReadInt64();  // Next recycling rank, unused since the order is a list
+        break;
+      }
+
+      case RecordType_GlobalProperty:
+      {
+        int32_t property = reader.ReadInt32();
+        reader.ReadString(globalProperties_[property]);
+        break;
+      }
+
+      case RecordType_Resource:
+      {
+        const int64_t id = reader.ReadInt64();
+
+        DeletedResource resource;
+        resource.content_ = new ResourceContent;
+        resource.type_ = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+        reader.ReadString(resource.publicId_);
+        resource.parent_ = reader.ReadInt64();
+        const int64_t recyclingRank = reader.ReadInt64();
+
+        ResourceContent& content = *resource.content_;
+        ReadTags(content.mainDicomTags_, reader);
+        ReadTags(content.identifiers_, reader);
+
+        uint32_t count = reader.ReadUInt32();
+        for (uint32_t i = 0; i < count; i++)
+        {
+          int32_t type = reader.ReadInt32();
+          reader.ReadString(content.metadata_[type]);
+        }
+
+        count = reader.ReadUInt32();
+        for (uint32_t i = 0; i < count; i++)
+        {
+          Attachment attachment;
+          ReadAttachment(attachment, reader);
+          content.attachments_[attachment.contentType_] = attachment;
+        }
+
+        if (id <= 0 ||
+            id >= GetResourcesCount() ||
+            IsExisting(id) ||
+            !IsValidResourceType(resource.type_))
+        {
+          throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+        }
+
+        // The children and the recycling order are linked by "FinalizeLoading()"
+        resource.recyclable_ = false;
+        LinkResource(id, resource, false);
+
+        if (recyclingRank != 0)
+        {
+          loadedRecyclingOrder_.push_back(std::make_pair(recyclingRank, id));
+        }
+        break;
+      }
+
+      case RecordType_Change:
+      {
+        Change change;
+        change.seq_ = reader.ReadInt64();
+        change.changeType_ = reader.ReadInt32();
+        change.resourceType_ = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+        change.resourceId_ = reader.ReadInt64();
+        reader.ReadString(change.date_);
+        changes_.Append(change);
+        break;
+      }
+
+      case RecordType_ExportedResource:
+      {
+        ExportedResource resource;
+        resource.seq_ = reader.ReadInt64();
+        resource.resourceType_ = static_cast<OrthancPluginResourceType>(reader.ReadInt32());
+        reader.ReadString(resource.publicId_);
+        reader.ReadString(resource.modality_);
+        reader.ReadString(resource.date_);
+        reader.ReadString(resource.patientId_);
+        reader.ReadString(resource.studyInstanceUid_);
+        reader.ReadString(resource.seriesInstanceUid_);
+        reader.ReadString(resource.sopInstanceUid_);
+        exported_.push_back(resource);
+        break;
+      }
+
+      case RecordType_End:
+        loadedEnd_ = true;
+        break;
+
+      default:
+        throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+    }
+  }
+
+
+  void IndexTables::FinalizeLoading()
+  {
+    if (!loadedEnd_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+    }
+
+    // A child can be saved before its parent, as the internal IDs
+    // are allocated in the order of the creation of the resources
+    for (size_t i = 0; i < contents_.size(); i++)
+    {
+      if (contents_[i] != NULL &&
+          IsExisting(parents_[i]))
+      {
+        LinkChild(parents_[i], static_cast<int64_t>(i));
+      }
+    }
+
+    std::sort(loadedRecyclingOrder_.begin(), loadedRecyclingOrder_.end());
+
+    for (size_t i = 0; i < loadedRecyclingOrder_.size(); i++)
+    {
+      const int64_t id = loadedRecyclingOrder_[i].second;
+      if (!IsExisting(id) ||
+          IsRecyclable(id) ||
+          types_[static_cast<size_t>(id)] != OrthancPluginResourceType_Patient)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+      }
+
+      InsertIntoRecycling(id, recyclingLast_);
+    }
+
+    loadedRecyclingOrder_.clear();
+  }
+}
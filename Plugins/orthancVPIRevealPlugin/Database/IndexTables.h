@@ -0,0 +1,538 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "ChangeLog.h"
+#include "IdentifierIndex.h"
+#include "RecordFile.h"
+
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * In-memory content of the index of Orthanc (resources, DICOM
+   * tags, metadata, attachments, changes...). All the tables are
+   * keyed by the internal identifier of the resources, which are
+   * allocated sequentially, and the resources themselves are stored
+   * as a structure of arrays. The modifications that are done between
+   * "StartTransaction()" and "CommitTransaction()" are recorded in an
+   * undo log, which is replayed backward by "RollbackTransaction()".
+   *
+   * This class is not thread-safe, as Orthanc serializes the calls to
+   * its database back-end.
+   **/
+  class IndexTables : public boost::noncopyable
+  {
+  public:
+    // The key of a DICOM tag is "(group << 16) | element"
+    typedef std::map<uint32_t, std::string>  Tags;
+
+    struct Attachment
+    {
+      std::string  uuid_;
+      int32_t      contentType_;
+      uint64_t     uncompressedSize_;
+      std::string  uncompressedHash_;
+      int32_t      compressionType_;
+      uint64_t     compressedSize_;
+      std::string  compressedHash_;
+    };
+
+    typedef ChangeLog::Change  Change;
+
+    struct ExportedResource
+    {
+      int64_t                    seq_;
+      OrthancPluginResourceType  resourceType_;
+      std::string                publicId_;
+      std::string                modality_;
+      std::string                date_;
+      std::string                patientId_;
+      std::string                studyInstanceUid_;
+      std::string                seriesInstanceUid_;
+      std::string                sopInstanceUid_;
+    };
+
+    // What was removed by "DeleteResource()", to be signaled to Orthanc
+    struct Deletion
+    {
+      std::vector<std::pair<std::string, OrthancPluginResourceType> >  resources_;
+      std::vector<Attachment>                                           attachments_;
+      bool                                                              hasRemainingAncestor_;
+      std::string                                                       remainingAncestorId_;
+      OrthancPluginResourceType                                         remainingAncestorType_;
+    };
+
+  private:
+    // The part of a resource that is not needed to navigate the
+    // hierarchy. It is allocated separately, so that the columns
+    // below stay compact.
+    struct ResourceContent
+    {
+      Tags                            mainDicomTags_;
+      Tags                            identifiers_;
+      std::map<int32_t, std::string>  metadata_;
+      std::map<int32_t, Attachment>   attachments_;
+    };
+
+    // A resource that was removed from the columns, kept by the undo
+    // log until the end of the transaction
+    struct DeletedResource : public boost::noncopyable
+    {
+      OrthancPluginResourceType  type_;
+      std::string                publicId_;
+      int64_t                    parent_;
+      bool                       recyclable_;
+      int64_t                    recyclingPrevious_;   // -1 if first in the recycling order
+      ResourceContent*           content_;   // Owned
+
+      DeletedResource() :
+        recyclable_(false),
+        recyclingPrevious_(-1),
+        content_(NULL)
+      {
+      }
+
+      ~DeletedResource()
+      {
+        delete content_;
+      }
+    };
+
+    /**
+     * Open-addressing hash table (with linear probing) from the
+     * public IDs to the internal IDs. The slots only store the hash
+     * and the internal ID, and the public ID is read back from the
+     * column of the resources.
+     **/
+    class PublicIdIndex : public boost::noncopyable
+    {
+    private:
+      struct Slot
+      {
+        uint64_t  hash_;
+        int64_t   id_;     // 0 if the slot is empty
+      };
+
+      std::vector<Slot>  slots_;   // The size is a power of 2
+      size_t             size_;
+
+      void Grow();
+
+    public:
+      PublicIdIndex();
+
+      void Clear();
+
+      bool Find(int64_t& id,
+                const std::vector<std::string>& publicIds,
+                const std::string& publicId) const;
+
+      void Insert(const std::vector<std::string>& publicIds,
+                  int64_t id);
+
+      void Erase(const std::vector<std::string>& publicIds,
+                 int64_t id);
+    };
+
+    enum UndoType
+    {
+      UndoType_CreateResource,
+      UndoType_DeleteResource,
+      UndoType_AttachChild,
+      UndoType_MainDicomTag,
+      UndoType_IdentifierTag,
+      UndoType_Metadata,
+      UndoType_Attachment,
+      UndoType_GlobalProperty,
+      UndoType_Recycling,
+      UndoType_LogChange,
+      UndoType_ClearChanges,
+      UndoType_LogExportedResource,
+      UndoType_ClearExportedResources
+    };
+
+    struct UndoRecord
+    {
+      UndoType                                       type_;
+      int64_t                                        id_;
+      int64_t                                        key_;
+      bool                                           existed_;   // Whether "value_" or "attachment_" is the previous value
+      std::string                                    value_;
+      Attachment                                     attachment_;
+      DeletedResource*                               resource_;  // Owned, for "UndoType_DeleteResource"
+      boost::shared_ptr<ChangeLog>                      changes_;
+      boost::shared_ptr<std::deque<ExportedResource> >  exported_;
+    };
+
+    // The resources are stored as columns indexed by internal ID. A
+    // deleted resource has a NULL content. The children of a resource
+    // form an intrusive doubly-linked list.
+    std::vector<OrthancPluginResourceType>  types_;
+    std::vector<std::string>                publicIds_;
+    std::vector<int64_t>                    parents_;          // -1 if none
+    std::vector<int64_t>                    firstChildren_;    // -1 if none
+    std::vector<int64_t>                    nextSiblings_;     // -1 if none
+    std::vector<int64_t>                    previousSiblings_; // -1 if none
+    std::vector<int64_t>                    recyclingPrevious_;
+    std::vector<int64_t>                    recyclingNext_;
+    std::vector<ResourceContent*>           contents_;
+
+    // The unprotected patients form a doubly-linked list, from the
+    // least to the most recently active. The other resources are not
+    // linked (cf. "IsRecyclable()").
+    int64_t  recyclingFirst_;   // -1 if none
+    int64_t  recyclingLast_;    // -1 if none
+    std::vector<std::pair<int64_t, int64_t> >  loadedRecyclingOrder_;
+
+    PublicIdIndex                         publicIdIndex_;
+    std::set<int64_t>                     byType_[4];        // Resources of each level, by internal ID
+    IdentifierIndex                       identifierIndex_;
+    std::map<int32_t, std::string>        globalProperties_;
+    ChangeLog                             changes_;
+    std::deque<ExportedResource>          exported_;
+    int64_t                               nextChangeSeq_;
+    int64_t                               nextExportedSeq_;
+
+    bool                     transaction_;
+    std::vector<UndoRecord>  undo_;
+    int64_t                  savedResourcesCount_;
+    int64_t                  savedChangeSeq_;
+    int64_t                  savedExportedSeq_;
+    bool                     loadedEnd_;
+
+    int64_t GetResourcesCount() const
+    {
+      return static_cast<int64_t>(contents_.size());
+    }
+
+    bool IsExisting(int64_t id) const
+    {
+      return (id >= 0 &&
+              id < GetResourcesCount() &&
+              contents_[static_cast<size_t>(id)] != NULL);
+    }
+
+    void CheckExisting(int64_t id) const;
+
+    ResourceContent& GetContent(int64_t id) const;
+
+    void AddUndo(UndoType type,
+                 int64_t id,
+                 int64_t key,
+                 bool existed,
+                 const std::string& value);
+
+    void AppendRow();
+
+    void LinkChild(int64_t parent,
+                   int64_t child);
+
+    void UnlinkChild(int64_t child);
+
+    // Takes the ownership of "resource.content_"
+    void LinkResource(int64_t id,
+                      DeletedResource& resource,
+                      bool linkParent);
+
+    DeletedResource* UnlinkResource(int64_t id);
+
+    bool IsRecyclable(int64_t id) const;
+
+    // Inserts after "previous" in the recycling order (first if -1)
+    void InsertIntoRecycling(int64_t id,
+                             int64_t previous);
+
+    // Returns the previous patient in the recycling order (-1 if none)
+    int64_t RemoveFromRecycling(int64_t id);
+
+    // Moves the patient to the end of the recycling order, or removes
+    // it from the order if it is not recyclable anymore
+    void UpdateRecycling(int64_t id,
+                         bool recyclable);
+
+    void SetTagInternal(int64_t id,
+                        bool isIdentifier,
+                        uint32_t tag,
+                        const std::string& value);
+
+    bool RemoveTagInternal(int64_t id,
+                           bool isIdentifier,
+                           uint32_t tag);
+
+    void SetAttachmentInternal(int64_t id,
+                               const Attachment& attachment);
+
+    bool RemoveAttachmentInternal(Attachment& removed,
+                                  int64_t id,
+                                  int32_t contentType);
+
+    void RemoveLeafResource(Deletion& deletion,
+                            int64_t id);
+
+    void DeleteSubtree(Deletion& deletion,
+                       int64_t id);
+
+    void ApplyUndo(UndoRecord& record);
+
+    void DiscardUndo();
+
+    bool IsDeletedChange(const Change& change) const;
+
+  public:
+    IndexTables();
+
+    ~IndexTables();
+
+    void Clear();
+
+    void StartTransaction();
+
+    void CommitTransaction();
+
+    void RollbackTransaction();
+
+    bool IsTransactionActive() const
+    {
+      return transaction_;
+    }
+
+    int64_t CreateResource(const std::string& publicId,
+                           OrthancPluginResourceType type);
+
+    void AttachChild(int64_t parent,
+                     int64_t child);
+
+    // Also deletes the ancestors that are left without child
+    void DeleteResource(Deletion& deletion,
+                        int64_t id);
+
+    bool IsExistingResource(int64_t id) const
+    {
+      return IsExisting(id);
+    }
+
+    bool LookupResource(int64_t& id,
+                        OrthancPluginResourceType& type,
+                        const std::string& publicId) const;
+
+    const std::string& GetPublicId(int64_t id) const
+    {
+      CheckExisting(id);
+      return publicIds_[static_cast<size_t>(id)];
+    }
+
+    OrthancPluginResourceType GetResourceType(int64_t id) const
+    {
+      CheckExisting(id);
+      return types_[static_cast<size_t>(id)];
+    }
+
+    bool LookupParent(int64_t& parent,
+                      int64_t id) const;
+
+    void GetChildrenInternalId(std::list<int64_t>& target,
+                               int64_t id) const;
+
+    void GetChildrenPublicId(std::list<std::string>& target,
+                             int64_t id) const;
+
+    uint64_t GetResourceCount(OrthancPluginResourceType type) const;
+
+    void GetAllInternalIds(std::list<int64_t>& target,
+                           OrthancPluginResourceType type) const;
+
+    void GetAllPublicIds(std::list<std::string>& target,
+                         OrthancPluginResourceType type) const;
+
+    // By increasing internal ID. This skips the "since" first
+    // resources, in O(since): Prefer "GetPublicIdsPage()" if possible.
+    void GetAllPublicIds(std::list<std::string>& target,
+                         OrthancPluginResourceType type,
+                         uint64_t since,
+                         uint64_t limit) const;
+
+    // Cursor-based enumeration by increasing internal ID: Stores at
+    // most "limit" resources whose internal ID is greater than
+    // "cursor" (0 for the first page), in O(log(n) + limit). Returns
+    // the cursor of the next page, which is the internal ID of the
+    // last appended resource, or "cursor" if no resource remains.
+    // Unlike an offset, the cursor is not shifted by the resources
+    // that are created or deleted between two pages.
+    int64_t GetInternalIdsPage(std::vector<int64_t>& target,
+                               OrthancPluginResourceType type,
+                               int64_t cursor,
+                               uint32_t limit) const;
+
+    int64_t GetPublicIdsPage(std::vector<std::string>& target,
+                             OrthancPluginResourceType type,
+                             int64_t cursor,
+                             uint32_t limit) const;
+
+    // Same for the children of a resource, in the order of
+    // "GetChildrenInternalId()" (most recently attached first): The
+    // cursor is the last child that was returned. Throws
+    // "UnknownResource" if this child was deleted or moved meanwhile.
+    int64_t GetChildrenPage(std::vector<int64_t>& target,
+                            int64_t id,
+                            int64_t cursor,
+                            uint32_t limit) const;
+
+    void SetMainDicomTag(int64_t id,
+                         uint32_t tag,
+                         const std::string& value)
+    {
+      SetTagInternal(id, false, tag, value);
+    }
+
+    void SetIdentifierTag(int64_t id,
+                          uint32_t tag,
+                          const std::string& value)
+    {
+      SetTagInternal(id, true, tag, value);
+    }
+
+    // Clears both the main DICOM tags and the identifiers
+    void ClearMainDicomTags(int64_t id);
+
+    const Tags& GetMainDicomTags(int64_t id) const
+    {
+      return GetContent(id).mainDicomTags_;
+    }
+
+    void LookupIdentifier(std::list<int64_t>& target,
+                          OrthancPluginResourceType type,
+                          uint32_t tag,
+                          OrthancPluginIdentifierConstraint constraint,
+                          const std::string& value) const;
+
+    void SetMetadata(int64_t id,
+                     int32_t type,
+                     const std::string& value);
+
+    void DeleteMetadata(int64_t id,
+                        int32_t type);
+
+    bool LookupMetadata(std::string& target,
+                        int64_t id,
+                        int32_t type) const;
+
+    void ListAvailableMetadata(std::list<int32_t>& target,
+                               int64_t id) const;
+
+    void AddAttachment(int64_t id,
+                       const Attachment& attachment)
+    {
+      SetAttachmentInternal(id, attachment);
+    }
+
+    bool DeleteAttachment(Attachment& deleted,
+                          int64_t id,
+                          int32_t contentType)
+    {
+      return RemoveAttachmentInternal(deleted, id, contentType);
+    }
+
+    const Attachment* LookupAttachment(int64_t id,
+                                       int32_t contentType) const;
+
+    void ListAvailableAttachments(std::list<int32_t>& target,
+                                  int64_t id) const;
+
+    // Full scan of the attachments (cf. "DatabaseSizeAccounting")
+    void ComputeTotalSizes(uint64_t& compressed,
+                           uint64_t& uncompressed) const;
+
+    void SetGlobalProperty(int32_t property,
+                           const std::string& value);
+
+    bool LookupGlobalProperty(std::string& target,
+                              int32_t property) const;
+
+    bool IsProtectedPatient(int64_t id) const;
+
+    void SetProtectedPatient(int64_t id,
+                             bool isProtected);
+
+    // The unprotected patient that received no instance for the
+    // longest time is recycled first
+    bool SelectPatientToRecycle(int64_t& id) const;
+
+    bool SelectPatientToRecycle(int64_t& id,
+                                int64_t patientIdToAvoid) const;
+
+    // The changes about deleted resources are skipped. A new instance
+    // makes its patient the last one to be recycled.
+    int64_t LogChange(int32_t changeType,
+                      int64_t resourceId,
+                      OrthancPluginResourceType resourceType,
+                      const std::string& date);
+
+    void GetChanges(std::list<Change>& target,
+                    bool& done,
+                    int64_t since,
+                    uint32_t maxResults) const;
+
+    bool GetLastChange(Change& target) const;
+
+    void ClearChanges();
+
+    // Retention of the changes (cf. "ChangeLog::LookupExpired()"),
+    // that can only be applied outside of a transaction
+    bool LookupExpiredChanges(int64_t& lastSeq,
+                              uint64_t maxCount,
+                              const std::string& minDate) const
+    {
+      return changes_.LookupExpired(lastSeq, maxCount, minDate);
+    }
+
+    void DropChanges(int64_t lastSeq);
+
+    int64_t LogExportedResource(const ExportedResource& resource);
+
+    void GetExportedResources(std::list<ExportedResource>& target,
+                              bool& done,
+                              int64_t since,
+                              uint32_t maxResults) const;
+
+    bool GetLastExportedResource(ExportedResource& target) const;
+
+    void ClearExportedResources();
+
+    // Writes the whole content as a sequence of records
+    void Save(RecordFile& target) const;
+
+    // Reads back the records written by "Save()", in the same
+    // order. The tables must have been cleared beforehand.
+    void LoadRecord(const std::string& record);
+
+    // To be called once all the records have been loaded
+    void FinalizeLoading();
+  };
+}
@@ -0,0 +1,627 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "MemoryDatabaseBackend.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+namespace OrthancPlugins
+{
+  // Schema of the index that is expected by Orthanc 1.2.0
+  static const uint32_t DATABASE_VERSION = 6;
+
+  // Orthanc reserves the global properties 10 to 19 for the internal
+  // use of the database plugins ("GlobalProperty_DatabaseInternal0"
+  // to "9"): Unlike the properties above 1023, they cannot collide
+  // with the properties that other plugins set through the SDK
+  static const int32_t GLOBAL_PROPERTY_TOTAL_SIZES = 10;
+
+
+  static uint32_t GetTagKey(uint16_t group,
+                            uint16_t element)
+  {
+    return (static_cast<uint32_t>(group) << 16) | static_cast<uint32_t>(element);
+  }
+
+
+  class MemoryDatabaseBackend::SnapshotLoader : public RecordFile::IVisitor
+  {
+  private:
+    IndexTables&  tables_;
+
+  public:
+    SnapshotLoader(IndexTables& tables) :
+      tables_(tables)
+    {
+    }
+
+    virtual void Visit(const std::string& record)
+    {
+      tables_.LoadRecord(record);
+    }
+  };
+
+
+  void MemoryDatabaseBackend::DropExpiredChanges()
+  {
+    if (changesMaxCount_ == 0 &&
+        changesMaxAge_ == 0)
+    {
+      return;
+    }
+
+    // The dates of the changes are given by Orthanc in local time
+    std::string minDate;
+    if (changesMaxAge_ != 0)
+    {
+      minDate = boost::posix_time::to_iso_string(boost::posix_time::second_clock::local_time() -
+                                                 boost::posix_time::seconds(changesMaxAge_));
+    }
+
+    int64_t lastSeq;
+    if (tables_.LookupExpiredChanges(lastSeq, changesMaxCount_, minDate))
+    {
+      DropChanges(lastSeq);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::LoadSizes()
+  {
+    if (!sizes_.Load(*this))
+    {
+      // No total was stored yet (new or older index)
+      uint64_t compressed, uncompressed;
+      tables_.ComputeTotalSizes(compressed, uncompressed);
+      sizes_.Reset(0, 0);
+      sizes_.Reconcile(compressed, uncompressed);
+    }
+    else if (verifySizes_)
+    {
+      // Done before Orthanc uses the index, so that no call waits for
+      // the full scan
+      uint64_t compressed, uncompressed;
+      tables_.ComputeTotalSizes(compressed, uncompressed);
+
+      if (!sizes_.Reconcile(compressed, uncompressed))
+      {
+        GetOutput().LogWarning("The total size of the attachments had drifted, and was reconciled");
+      }
+    }
+  }
+
+
+  MemoryDatabaseBackend::MemoryDatabaseBackend(const std::string& snapshot) :
+    snapshot_(snapshot),
+    sizes_(GLOBAL_PROPERTY_TOTAL_SIZES),
+    verifySizes_(false),
+    changesMaxCount_(0),
+    changesMaxAge_(0)
+  {
+  }
+
+
+  void MemoryDatabaseBackend::Open()
+  {
+    tables_.Clear();
+
+    if (!snapshot_.empty())
+    {
+      SnapshotLoader loader(tables_);
+      if (RecordFile::Read(snapshot_, loader, false))
+      {
+        tables_.FinalizeLoading();
+        GetOutput().LogWarning("In-memory index loaded from the snapshot: " + snapshot_);
+      }
+    }
+
+    LoadSizes();
+  }
+
+
+  void MemoryDatabaseBackend::Close()
+  {
+    if (tables_.IsTransactionActive())
+    {
+      RollbackTransaction();
+    }
+
+    if (!snapshot_.empty())
+    {
+      StoreSizes();
+
+      // Write to a temporary file first, so that a crash cannot leave
+      // a partial snapshot behind
+      const std::string tmp = snapshot_ + ".tmp";
+
+      {
+        RecordFile snapshot(tmp, true);
+        tables_.Save(snapshot);
+        snapshot.Flush(true);
+      }
+
+      RecordFile::Replace(tmp, snapshot_);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::AddAttachment(int64_t id,
+                                            const OrthancPluginAttachment& attachment)
+  {
+    IndexTables::Attachment a;
+    a.uuid_ = attachment.uuid;
+    a.contentType_ = attachment.contentType;
+    a.uncompressedSize_ = attachment.uncompressedSize;
+    a.uncompressedHash_ = attachment.uncompressedHash;
+    a.compressionType_ = attachment.compressionType;
+    a.compressedSize_ = attachment.compressedSize;
+    a.compressedHash_ = attachment.compressedHash;
+
+    const IndexTables::Attachment* previous = tables_.LookupAttachment(id, a.contentType_);
+    if (previous != NULL)
+    {
+      sizes_.DeleteAttachment(previous->compressedSize_, previous->uncompressedSize_);
+    }
+
+    tables_.AddAttachment(id, a);
+    sizes_.AddAttachment(a.compressedSize_, a.uncompressedSize_);
+  }
+
+
+  void MemoryDatabaseBackend::AttachChild(int64_t parent,
+                                          int64_t child)
+  {
+    tables_.AttachChild(parent, child);
+  }
+
+
+  void MemoryDatabaseBackend::ClearChanges()
+  {
+    tables_.ClearChanges();
+  }
+
+
+  void MemoryDatabaseBackend::ClearExportedResources()
+  {
+    tables_.ClearExportedResources();
+  }
+
+
+  int64_t MemoryDatabaseBackend::CreateResource(const char* publicId,
+                                                OrthancPluginResourceType type)
+  {
+    return tables_.CreateResource(publicId, type);
+  }
+
+
+  void MemoryDatabaseBackend::DeleteAttachment(int64_t id,
+                                               int32_t attachment)
+  {
+    IndexTables::Attachment deleted;
+    if (tables_.DeleteAttachment(deleted, id, attachment))
+    {
+      sizes_.DeleteAttachment(deleted.compressedSize_, deleted.uncompressedSize_);
+
+      GetOutput().SignalDeletedAttachment(deleted.uuid_, deleted.contentType_,
+                                          deleted.uncompressedSize_, deleted.uncompressedHash_,
+                                          deleted.compressionType_,
+                                          deleted.compressedSize_, deleted.compressedHash_);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::DeleteMetadata(int64_t id,
+                                             int32_t metadataType)
+  {
+    tables_.DeleteMetadata(id, metadataType);
+  }
+
+
+  void MemoryDatabaseBackend::DeleteResource(int64_t id)
+  {
+    IndexTables::Deletion deletion;
+    tables_.DeleteResource(deletion, id);
+
+    for (size_t i = 0; i < deletion.attachments_.size(); i++)
+    {
+      const IndexTables::Attachment& a = deletion.attachments_[i];
+      sizes_.DeleteAttachment(a.compressedSize_, a.uncompressedSize_);
+
+      GetOutput().SignalDeletedAttachment(a.uuid_, a.contentType_,
+                                          a.uncompressedSize_, a.uncompressedHash_,
+                                          a.compressionType_, a.compressedSize_, a.compressedHash_);
+    }
+
+    for (size_t i = 0; i < deletion.resources_.size(); i++)
+    {
+      GetOutput().SignalDeletedResource(deletion.resources_[i].first, deletion.resources_[i].second);
+    }
+
+    if (deletion.hasRemainingAncestor_)
+    {
+      GetOutput().SignalRemainingAncestor(deletion.remainingAncestorId_, deletion.remainingAncestorType_);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::GetAllInternalIds(std::list<int64_t>& target,
+                                                OrthancPluginResourceType resourceType)
+  {
+    tables_.GetAllInternalIds(target, resourceType);
+  }
+
+
+  void MemoryDatabaseBackend::GetAllPublicIds(std::list<std::string>& target,
+                                              OrthancPluginResourceType resourceType)
+  {
+    tables_.GetAllPublicIds(target, resourceType);
+  }
+
+
+  void MemoryDatabaseBackend::GetAllPublicIds(std::list<std::string>& target,
+                                              OrthancPluginResourceType resourceType,
+                                              uint64_t since,
+                                              uint64_t limit)
+  {
+    tables_.GetAllPublicIds(target, resourceType, since, limit);
+  }
+
+
+  void MemoryDatabaseBackend::GetChanges(bool& done /*out*/,
+                                         int64_t since,
+                                         uint32_t maxResults)
+  {
+    std::list<IndexTables::Change> changes;
+    tables_.GetChanges(changes, done, since, maxResults);
+
+    for (std::list<IndexTables::Change>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+    {
+      GetOutput().AnswerChange(it->seq_, it->changeType_, it->resourceType_,
+                               tables_.GetPublicId(it->resourceId_), it->date_);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::GetChildrenInternalId(std::list<int64_t>& target /*out*/,
+                                                    int64_t id)
+  {
+    tables_.GetChildrenInternalId(target, id);
+  }
+
+
+  void MemoryDatabaseBackend::GetChildrenPublicId(std::list<std::string>& target /*out*/,
+                                                  int64_t id)
+  {
+    tables_.GetChildrenPublicId(target, id);
+  }
+
+
+  static void AnswerExportedResource(DatabaseBackendOutput& output,
+                                     const IndexTables::ExportedResource& resource)
+  {
+    output.AnswerExportedResource(resource.seq_, resource.resourceType_, resource.publicId_,
+                                  resource.modality_, resource.date_, resource.patientId_,
+                                  resource.studyInstanceUid_, resource.seriesInstanceUid_,
+                                  resource.sopInstanceUid_);
+  }
+
+
+  void MemoryDatabaseBackend::GetExportedResources(bool& done /*out*/,
+                                                   int64_t since,
+                                                   uint32_t maxResults)
+  {
+    std::list<IndexTables::ExportedResource> resources;
+    tables_.GetExportedResources(resources, done, since, maxResults);
+
+    for (std::list<IndexTables::ExportedResource>::const_iterator
+           it = resources.begin(); it != resources.end(); ++it)
+    {
+      AnswerExportedResource(GetOutput(), *it);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::GetLastChange()
+  {
+    IndexTables::Change change;
+    if (tables_.GetLastChange(change))
+    {
+      GetOutput().AnswerChange(change.seq_, change.changeType_, change.resourceType_,
+                               tables_.GetPublicId(change.resourceId_), change.date_);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::GetLastExportedResource()
+  {
+    IndexTables::ExportedResource resource;
+    if (tables_.GetLastExportedResource(resource))
+    {
+      AnswerExportedResource(GetOutput(), resource);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::GetMainDicomTags(int64_t id)
+  {
+    const IndexTables::Tags& tags = tables_.GetMainDicomTags(id);
+
+    for (IndexTables::Tags::const_iterator it = tags.begin(); it != tags.end(); ++it)
+    {
+      GetOutput().AnswerDicomTag(static_cast<uint16_t>(it->first >> 16),
+                                 static_cast<uint16_t>(it->first & 0xffff), it->second);
+    }
+  }
+
+
+  std::string MemoryDatabaseBackend::GetPublicId(int64_t resourceId)
+  {
+    return tables_.GetPublicId(resourceId);
+  }
+
+
+  uint64_t MemoryDatabaseBackend::GetResourceCount(OrthancPluginResourceType resourceType)
+  {
+    return tables_.GetResourceCount(resourceType);
+  }
+
+
+  OrthancPluginResourceType MemoryDatabaseBackend::GetResourceType(int64_t resourceId)
+  {
+    return tables_.GetResourceType(resourceId);
+  }
+
+
+  uint64_t MemoryDatabaseBackend::GetTotalCompressedSize()
+  {
+    return sizes_.GetTotalCompressedSize();
+  }
+
+
+  uint64_t MemoryDatabaseBackend::GetTotalUncompressedSize()
+  {
+    return sizes_.GetTotalUncompressedSize();
+  }
+
+
+  bool MemoryDatabaseBackend::IsExistingResource(int64_t internalId)
+  {
+    return tables_.IsExistingResource(internalId);
+  }
+
+
+  bool MemoryDatabaseBackend::IsProtectedPatient(int64_t internalId)
+  {
+    return tables_.IsProtectedPatient(internalId);
+  }
+
+
+  void MemoryDatabaseBackend::ListAvailableMetadata(std::list<int32_t>& target /*out*/,
+                                                    int64_t id)
+  {
+    tables_.ListAvailableMetadata(target, id);
+  }
+
+
+  void MemoryDatabaseBackend::ListAvailableAttachments(std::list<int32_t>& target /*out*/,
+                                                       int64_t id)
+  {
+    tables_.ListAvailableAttachments(target, id);
+  }
+
+
+  void MemoryDatabaseBackend::LogChange(const OrthancPluginChange& change)
+  {
+    int64_t id;
+    OrthancPluginResourceType type;
+    if (!tables_.LookupResource(id, type, change.publicId) ||
+        type != change.resourceType)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_UnknownResource);
+    }
+
+    tables_.LogChange(change.changeType, id, type, change.date);
+  }
+
+
+  void MemoryDatabaseBackend::LogExportedResource(const OrthancPluginExportedResource& resource)
+  {
+    IndexTables::ExportedResource r;
+    r.resourceType_ = resource.resourceType;
+    r.publicId_ = resource.publicId;
+    r.modality_ = resource.modality;
+    r.date_ = resource.date;
+    r.patientId_ = resource.patientId;
+    r.studyInstanceUid_ = resource.studyInstanceUid;
+    r.seriesInstanceUid_ = resource.seriesInstanceUid;
+    r.sopInstanceUid_ = resource.sopInstanceUid;
+
+    tables_.LogExportedResource(r);
+  }
+
+
+  bool MemoryDatabaseBackend::LookupAttachment(int64_t id,
+                                               int32_t contentType)
+  {
+    const IndexTables::Attachment* a = tables_.LookupAttachment(id, contentType);
+    if (a == NULL)
+    {
+      return false;
+    }
+    else
+    {
+      GetOutput().AnswerAttachment(a->uuid_, a->contentType_, a->uncompressedSize_, a->uncompressedHash_,
+                                   a->compressionType_, a->compressedSize_, a->compressedHash_);
+      return true;
+    }
+  }
+
+
+  bool MemoryDatabaseBackend::LookupGlobalProperty(std::string& target /*out*/,
+                                                   int32_t property)
+  {
+    return tables_.LookupGlobalProperty(target, property);
+  }
+
+
+  void MemoryDatabaseBackend::LookupIdentifier(std::list<int64_t>& target /*out*/,
+                                               OrthancPluginResourceType resourceType,
+                                               uint16_t group,
+                                               uint16_t element,
+                                               OrthancPluginIdentifierConstraint constraint,
+                                               const char* value)
+  {
+    tables_.LookupIdentifier(target, resourceType, GetTagKey(group, element), constraint, value);
+  }
+
+
+  bool MemoryDatabaseBackend::LookupMetadata(std::string& target /*out*/,
+                                             int64_t id,
+                                             int32_t metadataType)
+  {
+    return tables_.LookupMetadata(target, id, metadataType);
+  }
+
+
+  bool MemoryDatabaseBackend::LookupParent(int64_t& parentId /*out*/,
+                                           int64_t resourceId)
+  {
+    return tables_.LookupParent(parentId, resourceId);
+  }
+
+
+  bool MemoryDatabaseBackend::LookupResource(int64_t& id /*out*/,
+                                             OrthancPluginResourceType& type /*out*/,
+                                             const char* publicId)
+  {
+    return tables_.LookupResource(id, type, publicId);
+  }
+
+
+  bool MemoryDatabaseBackend::SelectPatientToRecycle(int64_t& internalId /*out*/)
+  {
+    return tables_.SelectPatientToRecycle(internalId);
+  }
+
+
+  bool MemoryDatabaseBackend::SelectPatientToRecycle(int64_t& internalId /*out*/,
+                                                     int64_t patientIdToAvoid)
+  {
+    return tables_.SelectPatientToRecycle(internalId, patientIdToAvoid);
+  }
+
+
+  void MemoryDatabaseBackend::SetGlobalProperty(int32_t property,
+                                                const char* value)
+  {
+    tables_.SetGlobalProperty(property, value);
+  }
+
+
+  void MemoryDatabaseBackend::SetMainDicomTag(int64_t id,
+                                              uint16_t group,
+                                              uint16_t element,
+                                              const char* value)
+  {
+    tables_.SetMainDicomTag(id, GetTagKey(group, element), value);
+  }
+
+
+  void MemoryDatabaseBackend::SetIdentifierTag(int64_t id,
+                                               uint16_t group,
+                                               uint16_t element,
+                                               const char* value)
+  {
+    tables_.SetIdentifierTag(id, GetTagKey(group, element), value);
+  }
+
+
+  void MemoryDatabaseBackend::SetMetadata(int64_t id,
+                                          int32_t metadataType,
+                                          const char* value)
+  {
+    tables_.SetMetadata(id, metadataType, value);
+  }
+
+
+  void MemoryDatabaseBackend::SetProtectedPatient(int64_t internalId,
+                                                  bool isProtected)
+  {
+    tables_.SetProtectedPatient(internalId, isProtected);
+  }
+
+
+  void MemoryDatabaseBackend::StartTransaction()
+  {
+    tables_.StartTransaction();
+    sizes_.StartTransaction();
+  }
+
+
+  void MemoryDatabaseBackend::RollbackTransaction()
+  {
+    tables_.RollbackTransaction();
+    sizes_.RollbackTransaction();
+  }
+
+
+  void MemoryDatabaseBackend::CommitTables()
+  {
+    if (!tables_.IsTransactionActive())
+    {
+      throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+    }
+
+    StoreSizes();
+    tables_.CommitTransaction();
+    sizes_.CommitTransaction();
+  }
+
+
+  void MemoryDatabaseBackend::CommitTransaction()
+  {
+    CommitTables();
+    DropExpiredChanges();
+  }
+
+
+  uint32_t MemoryDatabaseBackend::GetDatabaseVersion()
+  {
+    return DATABASE_VERSION;
+  }
+
+
+  void MemoryDatabaseBackend::UpgradeDatabase(uint32_t  targetVersion,
+                                              OrthancPluginStorageArea* storageArea)
+  {
+    if (targetVersion != DATABASE_VERSION)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_IncompatibleDatabaseVersion);
+    }
+  }
+
+
+  void MemoryDatabaseBackend::ClearMainDicomTags(int64_t internalId)
+  {
+    tables_.ClearMainDicomTags(internalId);
+  }
+}
@@ -0,0 +1,253 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IndexTables.h"
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Index for Orthanc that lives in memory only (cf. "IndexTables"),
+   * for the nodes that need no persistent index, such as the
+   * auto-routing nodes. The rollbacks are implemented by the undo
+   * log of the tables. If a snapshot file is given, the index is
+   * saved into it by "Close()", and loaded back by "Open()";
+   * otherwise, the index is lost when Orthanc stops.
+   *
+   * The total sizes of the attachments are maintained by a
+   * "DatabaseSizeAccounting". They can be verified against a full
+   * scan of the tables when the index is opened. As Orthanc
+   * serializes the calls to the back-end, a later scan would stall
+   * the call that runs it while Orthanc holds the lock of its index.
+   *
+   * The retention of the changes (by count and/or by age) is applied
+   * after each commit, by dropping the oldest segments of the log of
+   * the changes (cf. "ChangeLog").
+   **/
+  class MemoryDatabaseBackend : public IDatabaseBackend
+  {
+  private:
+    class SnapshotLoader;
+
+    IndexTables                  tables_;
+    std::string                  snapshot_;
+    DatabaseSizeAccounting       sizes_;
+    bool                         verifySizes_;
+    uint64_t                     changesMaxCount_;
+    unsigned int                 changesMaxAge_;
+
+  protected:
+    IndexTables& GetTables()
+    {
+      return tables_;
+    }
+
+    // To be called once the tables are loaded
+    void LoadSizes();
+
+    // Persists the total sizes as a global property, if they have
+    // changed. Inside a transaction, this must be done right before
+    // committing it.
+    void StoreSizes()
+    {
+      sizes_.Store(*this);
+    }
+
+    // Commits the active transaction in memory, without applying the
+    // retention of the changes. This is the commit point.
+    void CommitTables();
+
+    // Applies the retention of the changes, outside of a transaction
+    void DropExpiredChanges();
+
+    // Overridden by the back-ends that persist the operations
+    virtual void DropChanges(int64_t lastSeq)
+    {
+      tables_.DropChanges(lastSeq);
+    }
+
+  public:
+    // An empty "snapshot" path disables the snapshot
+    explicit MemoryDatabaseBackend(const std::string& snapshot);
+
+    // Whether the stored totals are verified against a full scan by
+    // "Open()". To be called before "Open()".
+    void SetSizesVerification(bool verify)
+    {
+      verifySizes_ = verify;
+    }
+
+    // At least "maxCount" changes are kept, as well as the changes
+    // younger than "maxAge" seconds. A value of 0 disables the
+    // corresponding limit, and the changes are kept forever if both
+    // limits are disabled.
+    void SetChangesRetention(uint64_t maxCount,
+                             unsigned int maxAge)
+    {
+      changesMaxCount_ = maxCount;
+      changesMaxAge_ = maxAge;
+    }
+
+    virtual void Open();
+
+    virtual void Close();
+
+    virtual void AddAttachment(int64_t id,
+                               const OrthancPluginAttachment& attachment);
+
+    virtual void AttachChild(int64_t parent,
+                             int64_t child);
+
+    virtual void ClearChanges();
+
+    virtual void ClearExportedResources();
+
+    virtual int64_t CreateResource(const char* publicId,
+                                   OrthancPluginResourceType type);
+
+    virtual void DeleteAttachment(int64_t id,
+                                  int32_t attachment);
+
+    virtual void DeleteMetadata(int64_t id,
+                                int32_t metadataType);
+
+    virtual void DeleteResource(int64_t id);
+
+    virtual void GetAllInternalIds(std::list<int64_t>& target,
+                                   OrthancPluginResourceType resourceType);
+
+    virtual void GetAllPublicIds(std::list<std::string>& target,
+                                 OrthancPluginResourceType resourceType);
+
+    virtual void GetAllPublicIds(std::list<std::string>& target,
+                                 OrthancPluginResourceType resourceType,
+                                 uint64_t since,
+                                 uint64_t limit);
+
+    virtual void GetChanges(bool& done /*out*/,
+                            int64_t since,
+                            uint32_t maxResults);
+
+    virtual void GetChildrenInternalId(std::list<int64_t>& target /*out*/,
+                                       int64_t id);
+
+    virtual void GetChildrenPublicId(std::list<std::string>& target /*out*/,
+                                     int64_t id);
+
+    virtual void GetExportedResources(bool& done /*out*/,
+                                      int64_t since,
+                                      uint32_t maxResults);
+
+    virtual void GetLastChange();
+
+    virtual void GetLastExportedResource();
+
+    virtual void GetMainDicomTags(int64_t id);
+
+    virtual std::string GetPublicId(int64_t resourceId);
+
+    virtual uint64_t GetResourceCount(OrthancPluginResourceType resourceType);
+
+    virtual OrthancPluginResourceType GetResourceType(int64_t resourceId);
+
+    virtual uint64_t GetTotalCompressedSize();
+
+    virtual uint64_t GetTotalUncompressedSize();
+
+    virtual bool IsExistingResource(int64_t internalId);
+
+    virtual bool IsProtectedPatient(int64_t internalId);
+
+    virtual void ListAvailableMetadata(std::list<int32_t>& target /*out*/,
+                                       int64_t id);
+
+    virtual void ListAvailableAttachments(std::list<int32_t>& target /*out*/,
+                                          int64_t id);
+
+    virtual void LogChange(const OrthancPluginChange& change);
+
+    virtual void LogExportedResource(const OrthancPluginExportedResource& resource);
+
+    virtual bool LookupAttachment(int64_t id,
+                                  int32_t contentType);
+
+    virtual bool LookupGlobalProperty(std::string& target /*out*/,
+                                      int32_t property);
+
+    virtual void LookupIdentifier(std::list<int64_t>& target /*out*/,
+                                  OrthancPluginResourceType resourceType,
+                                  uint16_t group,
+                                  uint16_t element,
+                                  OrthancPluginIdentifierConstraint constraint,
+                                  const char* value);
+
+    virtual bool LookupMetadata(std::string& target /*out*/,
+                                int64_t id,
+                                int32_t metadataType);
+
+    virtual bool LookupParent(int64_t& parentId /*out*/,
+                              int64_t resourceId);
+
+    virtual bool LookupResource(int64_t& id /*out*/,
+                                OrthancPluginResourceType& type /*out*/,
+                                const char* publicId);
+
+    virtual bool SelectPatientToRecycle(int64_t& internalId /*out*/);
+
+    virtual bool SelectPatientToRecycle(int64_t& internalId /*out*/,
+                                        int64_t patientIdToAvoid);
+
+    virtual void SetGlobalProperty(int32_t property,
+                                   const char* value);
+
+    virtual void SetMainDicomTag(int64_t id,
+                                 uint16_t group,
+                                 uint16_t element,
+                                 const char* value);
+
+    virtual void SetIdentifierTag(int64_t id,
+                                  uint16_t group,
+                                  uint16_t element,
+                                  const char* value);
+
+    virtual void SetMetadata(int64_t id,
+                             int32_t metadataType,
+                             const char* value);
+
+    virtual void SetProtectedPatient(int64_t internalId,
+                                     bool isProtected);
+
+    virtual void StartTransaction();
+
+    virtual void RollbackTransaction();
+
+    virtual void CommitTransaction();
+
+    virtual uint32_t GetDatabaseVersion();
+
+    virtual void UpgradeDatabase(uint32_t  targetVersion,
+                                 OrthancPluginStorageArea* storageArea);
+
+    virtual void ClearMainDicomTags(int64_t internalId);
+  };
+}
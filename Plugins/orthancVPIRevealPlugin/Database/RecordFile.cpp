@@ -0,0 +1,429 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "RecordFile.h"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <vector>
+
+#if defined(_WIN32)
+#  include <io.h>
+#else
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+
+namespace OrthancPlugins
+{
+  static const size_t HEADER_SIZE = 8;   // Size and CRC32 of the record
+
+  // Protects against reading garbage as a huge record size
+  static const uint32_t MAX_RECORD_SIZE = 256 * 1024 * 1024;
+
+
+  static uint32_t ComputeCrc32(const void* data,
+                               size_t size)
+  {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+  }
+
+
+  static void EncodeUInt32(uint8_t* target,
+                           uint32_t value)
+  {
+    target[0] = static_cast<uint8_t>(value);
+    target[1] = static_cast<uint8_t>(value >> 8);
+    target[2] = static_cast<uint8_t>(value >> 16);
+    target[3] = static_cast<uint8_t>(value >> 24);
+  }
+
+
+  static uint32_t DecodeUInt32(const uint8_t* source)
+  {
+    return (static_cast<uint32_t>(source[0]) |
+            (static_cast<uint32_t>(source[1]) << 8) |
+            (static_cast<uint32_t>(source[2]) << 16) |
+            (static_cast<uint32_t>(source[3]) << 24));
+  }
+
+
+  void RecordWriter::WriteUInt32(uint32_t value)
+  {
+    uint8_t tmp[4];
+    EncodeUInt32(tmp, value);
+    buffer_.append(reinterpret_cast<const char*>(tmp), 4);
+  }
+
+
+  void RecordWriter::WriteUInt64(uint64_t value)
+  {
+    WriteUInt32(static_cast<uint32_t>(value));
+    WriteUInt32(static_cast<uint32_t>(value >> 32));
+  }
+
+
+  void RecordWriter::WriteString(const std::string& value)
+  {
+    WriteUInt32(static_cast<uint32_t>(value.size()));
+    buffer_.append(value);
+  }
+
+
+  void RecordWriter::WriteString(const char* value)
+  {
+    if (value == NULL)
+    {
+      WriteUInt32(0);
+    }
+    else
+    {
+      WriteString(std::string(value));
+    }
+  }
+
+
+  const uint8_t* RecordReader::Consume(size_t size)
+  {
+    if (size > size_ - position_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+    }
+
+    const uint8_t* p = data_ + position_;
+    position_ += size;
+    return p;
+  }
+
+
+  uint8_t RecordReader::ReadUInt8()
+  {
+    return *Consume(1);
+  }
+
+
+  uint32_t RecordReader::ReadUInt32()
+  {
+    return DecodeUInt32(Consume(4));
+  }
+
+
+  uint64_t RecordReader::ReadUInt64()
+  {
+    uint64_t low = ReadUInt32();
+    uint64_t high = ReadUInt32();
+    return low | (high << 32);
+  }
+
+
+  void RecordReader::ReadString(std::string& target)
+  {
+    uint32_t size = ReadUInt32();
+    const uint8_t* p = Consume(size);
+    target.assign(reinterpret_cast<const char*>(p), size);
+  }
+
+
+  RecordFile::RecordFile(const std::string& path,
+                         bool truncate) :
+    path_(path),
+    size_(0),
+    flushedSize_(0),
+    failed_(false)
+  {
+    file_ = fopen(path.c_str(), truncate ? "wb" : "ab");
+    if (file_ == NULL)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CannotWriteFile);
+    }
+
+#if defined(_WIN32)
+    syncDescriptor_ = _dup(_fileno(file_));
+#else
+    syncDescriptor_ = dup(fileno(file_));
+#endif
+
+    if (syncDescriptor_ < 0)
+    {
+      fclose(file_);
+      throw DatabaseException(OrthancPluginErrorCode_CannotWriteFile);
+    }
+
+    if (!truncate)
+    {
+      boost::system::error_code error;
+      size_ = boost::filesystem::file_size(path, error);
+      if (error)
+      {
+        fclose(file_);
+#if defined(_WIN32)
+        _close(syncDescriptor_);
+#else
+        close(syncDescriptor_);
+#endif
+        throw DatabaseException(OrthancPluginErrorCode_CannotWriteFile);
+      }
+
+      flushedSize_ = size_;
+    }
+  }
+
+
+  RecordFile::~RecordFile()
+  {
+    if (file_ != NULL)
+    {
+      fclose(file_);
+    }
+
+#if defined(_WIN32)
+    _close(syncDescriptor_);
+#else
+    close(syncDescriptor_);
+#endif
+  }
+
+
+  void RecordFile::CheckWritable() const
+  {
+    if (failed_)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+  }
+
+
+  void RecordFile::Rollback()
+  {
+    // Closing the file may write the end of the buffer of stdio: Cut
+    // it off afterwards
+    fclose(file_);
+    file_ = NULL;
+    failed_ = true;
+
+    boost::system::error_code error;
+    boost::filesystem::resize_file(path_, flushedSize_, error);
+    if (!error)
+    {
+      file_ = fopen(path_.c_str(), "ab");
+      if (file_ != NULL)
+      {
+        size_ = flushedSize_;
+        failed_ = false;
+      }
+    }
+  }
+
+
+  void RecordFile::Append(const std::string& record)
+  {
+    CheckWritable();
+
+    if (record.size() > MAX_RECORD_SIZE)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_ParameterOutOfRange);
+    }
+
+    uint8_t header[HEADER_SIZE];
+    EncodeUInt32(header, static_cast<uint32_t>(record.size()));
+    EncodeUInt32(header + 4, ComputeCrc32(record.c_str(), record.size()));
+
+    if (fwrite(header, HEADER_SIZE, 1, file_) != 1 ||
+        (!record.empty() &&
+         fwrite(record.c_str(), record.size(), 1, file_) != 1))
+    {
+      Rollback();
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+
+    size_ += HEADER_SIZE + record.size();
+  }
+
+
+  void RecordFile::Flush(bool synchronous)
+  {
+    CheckWritable();
+
+    if (fflush(file_) != 0)
+    {
+      Rollback();
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+
+    if (synchronous)
+    {
+      try
+      {
+        Sync();
+      }
+      catch (DatabaseException&)
+      {
+        // The system may have dropped the pages that it could not
+        // write, and a later sync would not report them again
+        Rollback();
+        failed_ = true;
+        throw;
+      }
+    }
+
+    flushedSize_ = size_;
+  }
+
+
+  void RecordFile::Sync()
+  {
+    // The descriptor refers to the same file as "file_", which may be
+    // reopened concurrently by the writer
+#if defined(_WIN32)
+    bool success = (_commit(syncDescriptor_) == 0);
+#else
+    bool success = (fsync(syncDescriptor_) == 0);
+#endif
+
+    if (!success)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+  }
+
+
+  bool RecordFile::Read(const std::string& path,
+                        IVisitor& visitor,
+                        bool truncateTornTail)
+  {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+    {
+      return false;
+    }
+
+    uint64_t valid = 0;
+    bool torn = false;
+
+    try
+    {
+      std::string record;
+
+      for (;;)
+      {
+        uint8_t header[HEADER_SIZE];
+        size_t count = fread(header, 1, HEADER_SIZE, file);
+        if (count == 0)
+        {
+          break;   // Clean end of file
+        }
+
+        const uint32_t size = DecodeUInt32(header);
+        if (count != HEADER_SIZE ||
+            size > MAX_RECORD_SIZE)
+        {
+          torn = true;
+          break;
+        }
+
+        record.resize(size);
+        if (size > 0 &&
+            fread(&record[0], size, 1, file) != 1)
+        {
+          torn = true;
+          break;
+        }
+
+        if (ComputeCrc32(record.c_str(), record.size()) != DecodeUInt32(header + 4))
+        {
+          torn = true;
+          break;
+        }
+
+        visitor.Visit(record);
+        valid += HEADER_SIZE + size;
+      }
+    }
+    catch (...)
+    {
+      fclose(file);
+      throw;
+    }
+
+    fclose(file);
+
+    if (torn &&
+        !truncateTornTail)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CorruptedFile);
+    }
+
+    if (torn)
+    {
+      // Drop the end of the file, so that the next records are
+      // appended right after the last valid one
+      boost::system::error_code error;
+      boost::filesystem::resize_file(path, valid, error);
+      if (error)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_CannotWriteFile);
+      }
+    }
+
+    return true;
+  }
+
+
+  void RecordFile::Replace(const std::string& source,
+                           const std::string& target)
+  {
+    boost::system::error_code error;
+    boost::filesystem::rename(source, target, error);
+    if (error)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_CannotWriteFile);
+    }
+
+#if !defined(_WIN32)
+    // The rename is only durable once the directory is synced. On
+    // Windows, NTFS journals the renames itself.
+    std::string directory = boost::filesystem::path(target).parent_path().string();
+    if (directory.empty())
+    {
+      directory = ".";
+    }
+
+    int descriptor = open(directory.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+
+    // EINVAL: The file system cannot sync directories
+    const bool success = (fsync(descriptor) == 0 || errno == EINVAL);
+    close(descriptor);
+
+    if (!success)
+    {
+      throw DatabaseException(OrthancPluginErrorCode_FileStorageCannotWrite);
+    }
+#endif
+  }
+}
@@ -0,0 +1,226 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <orthanc/OrthancCppDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <stdio.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  // Encodes the fields of a record, in little endian
+  class RecordWriter : public boost::noncopyable
+  {
+  private:
+    std::string  buffer_;
+
+  public:
+    void WriteUInt8(uint8_t value)
+    {
+      buffer_.push_back(static_cast<char>(value));
+    }
+
+    void WriteUInt32(uint32_t value);
+
+    void WriteUInt64(uint64_t value);
+
+    void WriteInt32(int32_t value)
+    {
+      WriteUInt32(static_cast<uint32_t>(value));
+    }
+
+    void WriteInt64(int64_t value)
+    {
+      WriteUInt64(static_cast<uint64_t>(value));
+    }
+
+    void WriteString(const std::string& value);
+
+    void WriteString(const char* value);
+
+    const std::string& GetContent() const
+    {
+      return buffer_;
+    }
+
+    size_t GetSize() const
+    {
+      return buffer_.size();
+    }
+
+    bool IsEmpty() const
+    {
+      return buffer_.empty();
+    }
+
+    void Clear()
+    {
+      buffer_.clear();
+    }
+  };
+
+
+  // Decodes the fields written by "RecordWriter". Reading past the
+  // end of the record throws "OrthancPluginErrorCode_CorruptedFile".
+  class RecordReader : public boost::noncopyable
+  {
+  private:
+    const uint8_t*  data_;
+    size_t          size_;
+    size_t          position_;
+
+    const uint8_t* Consume(size_t size);
+
+  public:
+    RecordReader(const std::string& record) :
+      data_(reinterpret_cast<const uint8_t*>(record.c_str())),
+      size_(record.size()),
+      position_(0)
+    {
+    }
+
+    uint8_t ReadUInt8();
+
+    uint32_t ReadUInt32();
+
+    uint64_t ReadUInt64();
+
+    int32_t ReadInt32()
+    {
+      return static_cast<int32_t>(ReadUInt32());
+    }
+
+    int64_t ReadInt64()
+    {
+      return static_cast<int64_t>(ReadUInt64());
+    }
+
+    void ReadString(std::string& target);
+
+    std::string ReadString()
+    {
+      std::string s;
+      ReadString(s);
+      return s;
+    }
+
+    bool IsEnd() const
+    {
+      return position_ == size_;
+    }
+  };
+
+
+  /**
+   * File made of a sequence of records, each one being prefixed by
+   * its size and its CRC32. A record is thus either entirely read
+   * back, or entirely discarded if it was torn by a crash. New
+   * records are always appended at the end of the file.
+   *
+   * If writing fails, the records that were appended since the last
+   * successful "Flush()" are cut off the file, as some of their bytes
+   * may already have reached it: Otherwise, they would be read back
+   * although the caller was told that they were not written. If they
+   * cannot be cut off, or if the disk reports an error while syncing,
+   * the file refuses any further write.
+   **/
+  class RecordFile : public boost::noncopyable
+  {
+  public:
+    class IVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IVisitor()
+      {
+      }
+
+      virtual void Visit(const std::string& record) = 0;
+    };
+
+  private:
+    std::string  path_;
+    FILE*        file_;
+    uint64_t     size_;
+    uint64_t     flushedSize_;   // Size at the last successful "Flush()"
+    bool         failed_;
+    int          syncDescriptor_;   // Survives the reopening of "file_" by "Rollback()"
+
+    void CheckWritable() const;
+
+    void Rollback();
+
+  public:
+    // Creates the file, or empties it if "truncate" is "true". The
+    // file must have been cleaned by "Read()" beforehand if it is
+    // reopened.
+    RecordFile(const std::string& path,
+               bool truncate);
+
+    ~RecordFile();
+
+    const std::string& GetPath() const
+    {
+      return path_;
+    }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    // The record is buffered until the next call to "Flush()"
+    void Append(const std::string& record);
+
+    void Append(const RecordWriter& record)
+    {
+      Append(record.GetContent());
+    }
+
+    // If "synchronous" is "true", waits until the records are on the
+    // disk (fsync)
+    void Flush(bool synchronous);
+
+    // Waits until the records that were flushed are on the disk. This
+    // may be called from another thread than the writer.
+    void Sync();
+
+    // Visits the records of the file, in order. Returns "false" if
+    // the file does not exist. A torn or corrupted record throws
+    // "OrthancPluginErrorCode_CorruptedFile", except if
+    // "truncateTornTail" is "true": The file is then cut after the
+    // last valid record. This is only meant for the files that are
+    // appended to, where a crash can leave a partial record at the
+    // end, not for the files that are written at once and renamed.
+    static bool Read(const std::string& path,
+                     IVisitor& visitor,
+                     bool truncateTornTail);
+
+    // Renames "source" to "target", replacing "target" if it exists,
+    // and waits until the rename is on the disk (fsync of the parent
+    // directory)
+    static void Replace(const std::string& source,
+                        const std::string& target);
+  };
+}
@@ -37,6 +37,7 @@
 
 #include <stdexcept>
 #include <list>
+#include <sstream>
 #include <string>
 
 namespace OrthancPlugins
@@ -87,6 +88,12 @@ namespace OrthancPlugins
 
 
   /**
+   * Each answer is handed to Orthanc as soon as the back-end
+   * produces it. The answers are not buffered: The plugin SDK of
+   * Orthanc 1.2 has no service that answers several rows at once,
+   * so a buffer could only delay the calls to the core, not merge
+   * them.
+   *
    * @ingroup Callbacks
    **/
   class DatabaseBackendOutput : public NonCopyable
@@ -272,6 +279,87 @@ namespace OrthancPlugins
   };
 
 
+  /**
+   * The callbacks of the database back-ends, as timed by
+   * "IDatabaseMetrics".
+   **/
+  enum DatabaseCall
+  {
+    DatabaseCall_AddAttachment,
+    DatabaseCall_AttachChild,
+    DatabaseCall_ClearChanges,
+    DatabaseCall_ClearExportedResources,
+    DatabaseCall_CreateResource,
+    DatabaseCall_DeleteAttachment,
+    DatabaseCall_DeleteMetadata,
+    DatabaseCall_DeleteResource,
+    DatabaseCall_GetAllInternalIds,
+    DatabaseCall_GetAllPublicIds,
+    DatabaseCall_GetAllPublicIdsWithLimit,
+    DatabaseCall_GetChanges,
+    DatabaseCall_GetChildrenInternalId,
+    DatabaseCall_GetChildrenPublicId,
+    DatabaseCall_GetExportedResources,
+    DatabaseCall_GetLastChange,
+    DatabaseCall_GetLastExportedResource,
+    DatabaseCall_GetMainDicomTags,
+    DatabaseCall_GetPublicId,
+    DatabaseCall_GetResourceCount,
+    DatabaseCall_GetResourceType,
+    DatabaseCall_GetTotalCompressedSize,
+    DatabaseCall_GetTotalUncompressedSize,
+    DatabaseCall_IsExistingResource,
+    DatabaseCall_IsProtectedPatient,
+    DatabaseCall_ListAvailableMetadata,
+    DatabaseCall_ListAvailableAttachments,
+    DatabaseCall_LogChange,
+    DatabaseCall_LogExportedResource,
+    DatabaseCall_LookupAttachment,
+    DatabaseCall_LookupGlobalProperty,
+    DatabaseCall_LookupIdentifier3,
+    DatabaseCall_LookupMetadata,
+    DatabaseCall_LookupParent,
+    DatabaseCall_LookupResource,
+    DatabaseCall_SelectPatientToRecycle,
+    DatabaseCall_SelectPatientToRecycle2,
+    DatabaseCall_SetGlobalProperty,
+    DatabaseCall_SetMainDicomTag,
+    DatabaseCall_SetIdentifierTag,
+    DatabaseCall_SetMetadata,
+    DatabaseCall_SetProtectedPatient,
+    DatabaseCall_StartTransaction,
+    DatabaseCall_RollbackTransaction,
+    DatabaseCall_CommitTransaction,
+    DatabaseCall_Open,
+    DatabaseCall_Close,
+    DatabaseCall_GetDatabaseVersion,
+    DatabaseCall_UpgradeDatabase,
+    DatabaseCall_ClearMainDicomTags,
+    DatabaseCall_Count   // Number of callbacks
+  };
+
+
+  /**
+   * Receives the duration and the outcome of each call from Orthanc
+   * to a database back-end, cf. "IDatabaseBackend::SetMetrics()".
+   * These methods must not throw exceptions.
+   **/
+  class IDatabaseMetrics : public NonCopyable
+  {
+  public:
+    virtual ~IDatabaseMetrics()
+    {
+    }
+
+    // Returns an opaque timestamp
+    virtual uint64_t StartCall() = 0;
+
+    virtual void EndCall(DatabaseCall call,
+                         uint64_t start,
+                         bool success) = 0;
+  };
+
+
   /**
    * @ingroup Callbacks
    **/
@@ -281,6 +369,7 @@ namespace OrthancPlugins
 
   private:
     DatabaseBackendOutput*  output_;
+    IDatabaseMetrics*       metrics_;
 
     void Finalize()
     {
@@ -298,7 +387,7 @@ namespace OrthancPlugins
     }
 
   public:
-    IDatabaseBackend() : output_(NULL)
+    IDatabaseBackend() : output_(NULL), metrics_(NULL)
     {
     }
 
@@ -314,6 +403,13 @@ namespace OrthancPlugins
       output_ = output;
     }
 
+    // The metrics are disabled if "metrics" is NULL (the default).
+    // This does not take the ownership.
+    void SetMetrics(IDatabaseMetrics* metrics)
+    {
+      metrics_ = metrics;
+    }
+
     virtual void Open() = 0;
 
     virtual void Close() = 0;
@@ -470,6 +566,197 @@ namespace OrthancPlugins
 
 
 
+  /**
+   * @brief Running totals of the sizes of the attachments.
+   *
+   * Helper for the database engines, so that
+   * "GetTotalCompressedSize()" and "GetTotalUncompressedSize()" run
+   * in constant time instead of scanning all the attachments. The
+   * engine reports each attachment that it adds or deletes, and
+   * forwards its transaction boundaries: The changes are only kept
+   * if the transaction is committed. The totals are persisted as a
+   * global property of the engine, that must be written by "Store()"
+   * inside the transaction, right before committing it. The index
+   * of this property should be in the range that Orthanc reserves
+   * for the internal use of the database plugins (10 to 19), as the
+   * properties above 1023 are shared with the other plugins. A full
+   * scan of the attachments can be reconciled with the totals at any
+   * time outside of a transaction.
+   *
+   * @ingroup Toolbox
+   **/
+  class DatabaseSizeAccounting : public NonCopyable
+  {
+  private:
+    int32_t   property_;
+    uint64_t  compressed_;     // Committed totals
+    uint64_t  uncompressed_;
+    int64_t   deltaCompressed_;     // Changes of the current transaction
+    int64_t   deltaUncompressed_;
+    bool      transaction_;
+    bool      modified_;       // Whether the global property is outdated
+    bool      savedModified_;
+
+    void Apply(int64_t compressed,
+               int64_t uncompressed)
+    {
+      if (transaction_)
+      {
+        deltaCompressed_ += compressed;
+        deltaUncompressed_ += uncompressed;
+      }
+      else
+      {
+        compressed_ += compressed;
+        uncompressed_ += uncompressed;
+      }
+
+      modified_ = true;
+    }
+
+  public:
+    DatabaseSizeAccounting(int32_t property) :
+      property_(property)
+    {
+      Reset(0, 0);
+    }
+
+    void Reset(uint64_t compressed,
+               uint64_t uncompressed)
+    {
+      compressed_ = compressed;
+      uncompressed_ = uncompressed;
+      deltaCompressed_ = 0;
+      deltaUncompressed_ = 0;
+      transaction_ = false;
+      modified_ = false;
+      savedModified_ = false;
+    }
+
+    // Returns "false" if the global property is missing or invalid:
+    // The totals must then be reconciled with a full scan
+    bool Load(IDatabaseBackend& backend)
+    {
+      std::string value;
+      if (!backend.LookupGlobalProperty(value, property_))
+      {
+        return false;
+      }
+
+      std::istringstream stream(value);
+      uint64_t compressed, uncompressed;
+      if (!(stream >> compressed >> uncompressed))
+      {
+        return false;
+      }
+
+      Reset(compressed, uncompressed);
+      return true;
+    }
+
+    void Store(IDatabaseBackend& backend)
+    {
+      if (modified_)
+      {
+        std::ostringstream stream;
+        stream << GetTotalCompressedSize() << " " << GetTotalUncompressedSize();
+        backend.SetGlobalProperty(property_, stream.str().c_str());
+        modified_ = false;
+      }
+    }
+
+    bool IsModified() const
+    {
+      return modified_;
+    }
+
+    void StartTransaction()
+    {
+      if (transaction_)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      transaction_ = true;
+      savedModified_ = modified_;
+    }
+
+    void CommitTransaction()
+    {
+      if (!transaction_)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      compressed_ += deltaCompressed_;
+      uncompressed_ += deltaUncompressed_;
+      deltaCompressed_ = 0;
+      deltaUncompressed_ = 0;
+      transaction_ = false;
+    }
+
+    void RollbackTransaction()
+    {
+      if (!transaction_)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      // The global property written by "Store()" is rolled back too
+      deltaCompressed_ = 0;
+      deltaUncompressed_ = 0;
+      transaction_ = false;
+      modified_ = savedModified_;
+    }
+
+    void AddAttachment(uint64_t compressedSize,
+                       uint64_t uncompressedSize)
+    {
+      Apply(static_cast<int64_t>(compressedSize), static_cast<int64_t>(uncompressedSize));
+    }
+
+    void DeleteAttachment(uint64_t compressedSize,
+                          uint64_t uncompressedSize)
+    {
+      Apply(-static_cast<int64_t>(compressedSize), -static_cast<int64_t>(uncompressedSize));
+    }
+
+    uint64_t GetTotalCompressedSize() const
+    {
+      return compressed_ + deltaCompressed_;
+    }
+
+    uint64_t GetTotalUncompressedSize() const
+    {
+      return uncompressed_ + deltaUncompressed_;
+    }
+
+    // Replaces the totals by the result of a full scan. Returns
+    // "false" if the running totals had drifted from the scan.
+    bool Reconcile(uint64_t compressed,
+                   uint64_t uncompressed)
+    {
+      if (transaction_)
+      {
+        throw DatabaseException(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      if (compressed == compressed_ &&
+          uncompressed == uncompressed_)
+      {
+        return true;
+      }
+      else
+      {
+        compressed_ = compressed;
+        uncompressed_ = uncompressed;
+        modified_ = true;
+        return false;
+      }
+    }
+  };
+
+
   /**
    * @brief Bridge between C and C++ database engines.
    * 
@@ -494,11 +781,52 @@ namespace OrthancPlugins
     }
 
 
+    // Reports the duration of one callback to the metrics of the
+    // back-end, if any
+    class CallTimer : public NonCopyable
+    {
+    private:
+      IDatabaseMetrics*  metrics_;
+      DatabaseCall       call_;
+      uint64_t           start_;
+      bool               success_;
+
+    public:
+      CallTimer(IDatabaseMetrics* metrics,
+                DatabaseCall call) :
+        metrics_(metrics),
+        call_(call),
+        start_(0),
+        success_(true)
+      {
+        if (metrics_ != NULL)
+        {
+          start_ = metrics_->StartCall();
+        }
+      }
+
+      ~CallTimer()
+      {
+        if (metrics_ != NULL)
+        {
+          metrics_->EndCall(call_, start_, success_);
+        }
+      }
+
+      OrthancPluginErrorCode Fail(OrthancPluginErrorCode code)
+      {
+        success_ = false;
+        return code;
+      }
+    };
+
+
     static OrthancPluginErrorCode  AddAttachment(void* payload,
                                                  int64_t id,
                                                  const OrthancPluginAttachment* attachment)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_AddAttachment);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -509,11 +837,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -523,6 +851,7 @@ namespace OrthancPlugins
                                                int64_t child)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_AttachChild);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -533,11 +862,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -545,6 +874,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode  ClearChanges(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_ClearChanges);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -555,11 +885,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
                              
@@ -567,6 +897,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode  ClearExportedResources(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_ClearExportedResources);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -577,11 +908,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -592,6 +923,7 @@ namespace OrthancPlugins
                                                   OrthancPluginResourceType resourceType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_CreateResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -602,11 +934,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -616,6 +948,7 @@ namespace OrthancPlugins
                                                     int32_t contentType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_DeleteAttachment);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -626,11 +959,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
    
@@ -640,6 +973,7 @@ namespace OrthancPlugins
                                                   int32_t metadataType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_DeleteMetadata);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -650,11 +984,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
    
@@ -663,6 +997,7 @@ namespace OrthancPlugins
                                                   int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_DeleteResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -673,11 +1008,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -687,6 +1022,7 @@ namespace OrthancPlugins
                                                      OrthancPluginResourceType resourceType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetAllInternalIds);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -706,11 +1042,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -720,6 +1056,7 @@ namespace OrthancPlugins
                                                    OrthancPluginResourceType resourceType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetAllPublicIds);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -740,11 +1077,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -756,6 +1093,7 @@ namespace OrthancPlugins
                                                             uint64_t limit)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetAllPublicIdsWithLimit);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -776,11 +1114,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -791,6 +1129,7 @@ namespace OrthancPlugins
                                               uint32_t maxResult)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetChanges);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_Change);
 
       try
@@ -809,11 +1148,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -823,6 +1162,7 @@ namespace OrthancPlugins
                                                          int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetChildrenInternalId);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -842,11 +1182,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -856,6 +1196,7 @@ namespace OrthancPlugins
                                                        int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetChildrenPublicId);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -876,11 +1217,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -891,6 +1232,7 @@ namespace OrthancPlugins
                                                         uint32_t  maxResult)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetExportedResources);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_ExportedResource);
 
       try
@@ -908,11 +1250,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -921,6 +1263,7 @@ namespace OrthancPlugins
                                                  void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetLastChange);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_Change);
 
       try
@@ -931,11 +1274,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -944,6 +1287,7 @@ namespace OrthancPlugins
                                                            void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetLastExportedResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_ExportedResource);
 
       try
@@ -954,11 +1298,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
     
@@ -968,6 +1312,7 @@ namespace OrthancPlugins
                                                     int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetMainDicomTags);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_DicomTag);
 
       try
@@ -978,11 +1323,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -992,6 +1337,7 @@ namespace OrthancPlugins
                                                int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetPublicId);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1006,11 +1352,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1020,6 +1366,7 @@ namespace OrthancPlugins
                                                     OrthancPluginResourceType  resourceType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetResourceCount);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1030,11 +1377,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
                    
@@ -1044,6 +1391,7 @@ namespace OrthancPlugins
                                                    int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetResourceType);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1054,11 +1402,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1067,6 +1415,7 @@ namespace OrthancPlugins
                                                           void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetTotalCompressedSize);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1077,11 +1426,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -1090,6 +1439,7 @@ namespace OrthancPlugins
                                                             void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetTotalUncompressedSize);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1100,11 +1450,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
                    
@@ -1114,6 +1464,7 @@ namespace OrthancPlugins
                                                       int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_IsExistingResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1124,11 +1475,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1138,6 +1489,7 @@ namespace OrthancPlugins
                                                       int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_IsProtectedPatient);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1148,11 +1500,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1162,6 +1514,7 @@ namespace OrthancPlugins
                                                          int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_ListAvailableMetadata);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1182,11 +1535,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -1196,6 +1549,7 @@ namespace OrthancPlugins
                                                             int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_ListAvailableAttachments);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1216,11 +1570,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1229,6 +1583,7 @@ namespace OrthancPlugins
                                              const OrthancPluginChange* change)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LogChange);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1239,11 +1594,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -1252,6 +1607,7 @@ namespace OrthancPlugins
                                                        const OrthancPluginExportedResource* exported)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LogExportedResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1262,11 +1618,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
           
@@ -1277,6 +1633,7 @@ namespace OrthancPlugins
                                                     int32_t contentType)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupAttachment);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_Attachment);
 
       try
@@ -1287,11 +1644,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1301,6 +1658,7 @@ namespace OrthancPlugins
                                                         int32_t property)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupGlobalProperty);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1318,11 +1676,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1334,6 +1692,7 @@ namespace OrthancPlugins
                                                      OrthancPluginIdentifierConstraint constraint)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupIdentifier3);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1353,11 +1712,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1368,6 +1727,7 @@ namespace OrthancPlugins
                                                   int32_t metadata)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupMetadata);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1384,11 +1744,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1398,6 +1758,7 @@ namespace OrthancPlugins
                                                 int64_t id)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupParent);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1414,11 +1775,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1428,6 +1789,7 @@ namespace OrthancPlugins
                                                   const char* publicId)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_LookupResource);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1446,11 +1808,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1459,6 +1821,7 @@ namespace OrthancPlugins
                                                           void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SelectPatientToRecycle);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1475,11 +1838,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1489,6 +1852,7 @@ namespace OrthancPlugins
                                                            int64_t patientIdToAvoid)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SelectPatientToRecycle2);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1505,11 +1869,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1519,6 +1883,7 @@ namespace OrthancPlugins
                                                      const char* value)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SetGlobalProperty);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1529,11 +1894,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1543,6 +1908,7 @@ namespace OrthancPlugins
                                                    const OrthancPluginDicomTag* tag)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SetMainDicomTag);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1553,11 +1919,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1567,6 +1933,7 @@ namespace OrthancPlugins
                                                     const OrthancPluginDicomTag* tag)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SetIdentifierTag);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1577,11 +1944,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1592,6 +1959,7 @@ namespace OrthancPlugins
                                                const char* value)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SetMetadata);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1602,11 +1970,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1616,6 +1984,7 @@ namespace OrthancPlugins
                                                        int32_t isProtected)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_SetProtectedPatient);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1626,11 +1995,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1638,6 +2007,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode StartTransaction(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_StartTransaction);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1648,11 +2018,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1660,6 +2030,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode RollbackTransaction(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_RollbackTransaction);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1670,11 +2041,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1682,6 +2053,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode CommitTransaction(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_CommitTransaction);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1692,11 +2064,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1704,6 +2076,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode Open(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_Open);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1714,11 +2087,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1726,6 +2099,7 @@ namespace OrthancPlugins
     static OrthancPluginErrorCode Close(void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_Close);
       backend->GetOutput().SetAllowedAnswers(DatabaseBackendOutput::AllowedAnswers_None);
 
       try
@@ -1736,11 +2110,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1749,6 +2123,7 @@ namespace OrthancPlugins
                                                      void* payload)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_GetDatabaseVersion);
       
       try
       {
@@ -1758,11 +2133,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1772,6 +2147,7 @@ namespace OrthancPlugins
                                                   OrthancPluginStorageArea* storageArea)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_UpgradeDatabase);
       
       try
       {
@@ -1781,11 +2157,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
@@ -1794,6 +2170,7 @@ namespace OrthancPlugins
                                                      int64_t internalId)
     {
       IDatabaseBackend* backend = reinterpret_cast<IDatabaseBackend*>(payload);
+      CallTimer timer(backend->metrics_, DatabaseCall_ClearMainDicomTags);
       
       try
       {
@@ -1803,11 +2180,11 @@ namespace OrthancPlugins
       catch (std::runtime_error& e)
       {
         LogError(backend, e);
-        return OrthancPluginErrorCode_DatabasePlugin;
+        return timer.Fail(OrthancPluginErrorCode_DatabasePlugin);
       }
       catch (DatabaseException& e)
       {
-        return e.GetErrorCode();
+        return timer.Fail(e.GetErrorCode());
       }
     }
 
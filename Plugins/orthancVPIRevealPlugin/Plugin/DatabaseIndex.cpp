@@ -0,0 +1,139 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "DatabaseIndex.h"
+
+#include "../Database/DatabaseMetrics.h"
+#include "../Database/EmbeddedDatabaseBackend.h"
+#include "../Database/MemoryDatabaseBackend.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+
+
+static OrthancPluginContext* context_ = NULL;
+static boost::scoped_ptr<OrthancPlugins::DatabaseMetrics> metrics_;
+static boost::scoped_ptr<OrthancPlugins::IDatabaseBackend> backend_;
+
+
+static void ServeMetrics(OrthancPluginRestOutput* output,
+                         const char* url,
+                         const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  std::string s;
+  metrics_->Format(s);
+  OrthancPluginAnswerBuffer(context_, output, s.c_str(), s.size(), "text/plain; version=0.0.4");
+}
+
+
+void RegisterDatabaseIndex(OrthancPluginContext* context,
+                           const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  const std::string type = configuration.GetStringValue("IndexBackend", "");
+
+  // Both back-ends derive from the in-memory index
+  OrthancPlugins::MemoryDatabaseBackend* backend = NULL;
+
+  if (type.empty())
+  {
+    return;   // Keep the SQLite index of Orthanc
+  }
+  else if (type == "Memory")
+  {
+    const std::string snapshot = configuration.GetStringValue("IndexSnapshot", "");
+
+    backend = new OrthancPlugins::MemoryDatabaseBackend(snapshot);
+
+    if (snapshot.empty())
+    {
+      OrthancPlugins::LogWarning(context, "Using an in-memory index, that is lost when Orthanc stops");
+    }
+    else
+    {
+      OrthancPlugins::LogWarning(context, "Using an in-memory index, saved on shutdown into: " + snapshot);
+    }
+  }
+  else if (type == "Embedded")
+  {
+    const std::string directory = configuration.GetStringValue("IndexDirectory", "VPI_Index");
+    const bool synchronous = configuration.GetBooleanValue("IndexSynchronous", true);
+    const unsigned int checkpointSize = configuration.GetUnsignedIntegerValue("IndexCheckpointSize", 64);   // In MB
+    const unsigned int asyncCommitDelay = configuration.GetUnsignedIntegerValue("IndexAsyncCommitDelay", 0);   // In ms
+
+    OrthancPlugins::EmbeddedDatabaseBackend* embedded = new OrthancPlugins::EmbeddedDatabaseBackend(
+      directory, synchronous, static_cast<uint64_t>(checkpointSize) * 1024 * 1024);
+    embedded->SetAsyncCommitDelay(asyncCommitDelay);
+    backend = embedded;
+
+    OrthancPlugins::LogWarning(context, "Using the embedded index, stored in: " + directory);
+
+    if (synchronous &&
+        asyncCommitDelay > 0)
+    {
+      OrthancPlugins::LogWarning(context, "Asynchronous commits are enabled for the embedded index: A crash "
+                                 "may lose the transactions of the last " +
+                                 boost::lexical_cast<std::string>(asyncCommitDelay) + " ms");
+    }
+  }
+  else
+  {
+    OrthancPlugins::LogError(context, "Unknown index back-end: " + type);
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  backend_.reset(backend);
+
+  // The running totals of the sizes of the attachments are verified
+  // against a full scan of the index at startup by default
+  backend->SetSizesVerification(configuration.GetBooleanValue("IndexVerifySizes", true));
+
+  // By default, the changes are kept forever, as in the SQLite index
+  backend->SetChangesRetention(configuration.GetUnsignedIntegerValue("IndexChangesRetentionCount", 0),
+                               configuration.GetUnsignedIntegerValue("IndexChangesRetentionAge", 0));   // In seconds
+
+  // The calls from Orthanc to the index are only timed on demand
+  if (configuration.GetBooleanValue("IndexMetrics", false))
+  {
+    metrics_.reset(new OrthancPlugins::DatabaseMetrics);
+    backend->SetMetrics(metrics_.get());
+    OrthancPlugins::RegisterRestCallback<ServeMetrics>(context, "/plugin/index/metrics", true);
+  }
+
+  OrthancPlugins::DatabaseBackendAdapter::Register(context, *backend_);
+}
+
+
+void FinalizeDatabaseIndex()
+{
+  backend_.reset(NULL);
+  metrics_.reset(NULL);
+}
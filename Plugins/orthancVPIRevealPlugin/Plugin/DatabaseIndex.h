@@ -0,0 +1,39 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Replaces the SQLite index of Orthanc by the embedded index of the
+ * plugin, if the "IndexBackend" option is set to "Embedded". The
+ * index is stored in the "IndexDirectory" folder.
+ **/
+void RegisterDatabaseIndex(OrthancPluginContext* context,
+                           const OrthancPlugins::OrthancConfiguration& configuration);
+
+// Releases the index, once Orthanc has closed it
+void FinalizeDatabaseIndex();
@@ -0,0 +1,441 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "ImageDicomization.h"
+
+#include "../Common/PixelFormatConversion.h"
+#include "../Common/ScopedThreadGroup.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <json/reader.h>
+#include <json/writer.h>
+
+
+static OrthancPluginContext* context_ = NULL;
+
+
+namespace
+{
+  struct ConversionJob
+  {
+    const char*                                      data_;
+    size_t                                           size_;
+    OrthancPluginImageFormat                         format_;
+    Json::Value                                      tags_;
+    boost::shared_ptr<OrthancPlugins::MemoryBuffer>  dicom_;
+    OrthancPluginErrorCode                           error_;
+  };
+}
+
+
+// Converts an UUID to a DICOM UID, using the "2.25" root that is
+// reserved for UUIDs (PS 3.5, B.2)
+static std::string GenerateDicomUid()
+{
+  char* uuid = OrthancPluginGenerateUuid(context_);
+  if (uuid == NULL)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_InternalError);
+  }
+
+  // The 128-bit value, as 4 words of 32 bits (most significant first)
+  uint32_t words[4] = { 0, 0, 0, 0 };
+  unsigned int digits = 0;
+
+  for (const char* p = uuid; *p != '\0' && digits < 32; p++)
+  {
+    int value;
+    if (*p >= '0' && *p <= '9')
+    {
+      value = *p - '0';
+    }
+    else if (*p >= 'a' && *p <= 'f')
+    {
+      value = *p - 'a' + 10;
+    }
+    else if (*p >= 'A' && *p <= 'F')
+    {
+      value = *p - 'A' + 10;
+    }
+    else
+    {
+      continue;  // Dash
+    }
+
+    words[digits / 8] = (words[digits / 8] << 4) | static_cast<uint32_t>(value);
+    digits++;
+  }
+
+  OrthancPluginFreeString(context_, uuid);
+
+  // Repeated divisions by 10 give the decimal digits, least
+  // significant first
+  std::string decimal;
+  for (;;)
+  {
+    uint64_t remainder = 0;
+    bool isZero = true;
+
+    for (unsigned int i = 0; i < 4; i++)
+    {
+      uint64_t current = (remainder << 32) | words[i];
+      words[i] = static_cast<uint32_t>(current / 10);
+      remainder = current % 10;
+      isZero = isZero && (words[i] == 0);
+    }
+
+    decimal.push_back(static_cast<char>('0' + remainder));
+
+    if (isZero)
+    {
+      break;
+    }
+  }
+
+  return "2.25." + std::string(decimal.rbegin(), decimal.rend());
+}
+
+
+static std::string GetDispositionParameter(const OrthancPlugins::MultipartItem& item,
+                                           const std::string& parameter)
+{
+  std::map<std::string, std::string>::const_iterator found = item.headers_.find("content-disposition");
+  if (found == item.headers_.end())
+  {
+    return "";
+  }
+
+  const std::string& disposition = found->second;
+  const std::string key = parameter + "=\"";
+
+  // Make sure that "name" does not match "filename"
+  size_t position = 0;
+  for (;;)
+  {
+    position = disposition.find(key, position);
+    if (position == std::string::npos)
+    {
+      return "";
+    }
+
+    if (position == 0 ||
+        disposition[position - 1] == ' ' ||
+        disposition[position - 1] == ';')
+    {
+      break;
+    }
+
+    position++;
+  }
+
+  const size_t start = position + key.size();
+  const size_t end = disposition.find('"', start);
+  return (end == std::string::npos ? "" : disposition.substr(start, end - start));
+}
+
+
+static bool LookupImageFormat(OrthancPluginImageFormat& format,
+                              const OrthancPlugins::MultipartItem& item)
+{
+  std::map<std::string, std::string>::const_iterator found = item.headers_.find("content-type");
+  const std::string contentType = (found == item.headers_.end() ? "" : found->second);
+  const std::string filename = GetDispositionParameter(item, "filename");
+
+  if (boost::algorithm::istarts_with(contentType, "image/png") ||
+      boost::algorithm::iends_with(filename, ".png"))
+  {
+    format = OrthancPluginImageFormat_Png;
+    return true;
+  }
+  else if (boost::algorithm::istarts_with(contentType, "image/jpeg") ||
+           boost::algorithm::iends_with(filename, ".jpg") ||
+           boost::algorithm::iends_with(filename, ".jpeg"))
+  {
+    format = OrthancPluginImageFormat_Jpeg;
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+static void ConvertImage(ConversionJob& job)
+{
+  OrthancPlugins::OrthancImage image(context_);
+
+  if (job.format_ == OrthancPluginImageFormat_Png)
+  {
+    image.UncompressPngImage(job.data_, job.size_);
+  }
+  else
+  {
+    image.UncompressJpegImage(job.data_, job.size_);
+  }
+
+  job.dicom_.reset(new OrthancPlugins::MemoryBuffer(context_));
+
+  // DICOM has no alpha channel
+  if (image.GetPixelFormat() == OrthancPluginPixelFormat_RGBA32)
+  {
+    const unsigned int width = image.GetWidth();
+    const unsigned int height = image.GetHeight();
+    const unsigned int pitch = 3 * width;
+
+    OrthancPlugins::PooledBuffer buffer(static_cast<size_t>(pitch) * height);
+    OrthancPlugins::ConvertPixelFormat(buffer.GetData(), OrthancPluginPixelFormat_RGB24, pitch,
+                                       image.GetBuffer(), image.GetPixelFormat(), image.GetPitch(),
+                                       width, height, 1.0f, 0.0f);
+
+    OrthancPlugins::OrthancImage rgb(context_, OrthancPluginPixelFormat_RGB24, width, height, pitch, buffer.GetData());
+    job.dicom_->CreateDicom(job.tags_, rgb, OrthancPluginCreateDicomFlags_GenerateIdentifiers);
+  }
+  else
+  {
+    job.dicom_->CreateDicom(job.tags_, image, OrthancPluginCreateDicomFlags_GenerateIdentifiers);
+  }
+}
+
+
+static void ConvertImages(std::vector<ConversionJob>* jobs,
+                          size_t first,
+                          size_t step)
+{
+  for (size_t i = first; i < jobs->size(); i += step)
+  {
+    ConversionJob& job = (*jobs)[i];
+
+    try
+    {
+      ConvertImage(job);
+      job.error_ = OrthancPluginErrorCode_Success;
+    }
+#if HAS_ORTHANC_EXCEPTION == 1
+    catch (Orthanc::OrthancException& e)
+    {
+      job.error_ = static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    }
+#else
+    catch (OrthancPlugins::PluginException& e)
+    {
+      job.error_ = e.GetErrorCode();
+    }
+#endif
+    catch (std::bad_alloc&)
+    {
+      job.error_ = OrthancPluginErrorCode_NotEnoughMemory;
+    }
+    catch (...)
+    {
+      job.error_ = OrthancPluginErrorCode_Plugin;
+    }
+  }
+}
+
+
+static void SetDefaultTag(Json::Value& tags,
+                          const std::string& name,
+                          const std::string& value)
+{
+  if (!tags.isMember(name))
+  {
+    tags[name] = value;
+  }
+}
+
+
+// Rollback of a partially stored batch. Failing to delete an instance
+// is only logged, as the original error is the one to be reported.
+static void DeleteInstances(const std::vector<std::string>& instances)
+{
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    if (!OrthancPlugins::RestApiDelete(context_, "/instances/" + instances[i], false))
+    {
+      OrthancPlugins::LogWarning(context_, "Cannot delete instance " + instances[i] +
+                                 " of a batch of images that could not be stored");
+    }
+  }
+}
+
+
+static void DicomizeImages(OrthancPluginRestOutput* output,
+                           const char* url,
+                           const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "POST");
+    return;
+  }
+
+  std::string contentType;
+  std::vector<OrthancPlugins::MultipartItem> items;
+
+  if (!OrthancPlugins::LookupHttpHeader(contentType, request, "content-type") ||
+      !OrthancPlugins::ParseMultipartBody(items, contentType, request->body, request->bodySize))
+  {
+    OrthancPlugins::LogError(context_, "The images to be converted to DICOM must be sent as a multipart body");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadRequest);
+  }
+
+  // Tags that are shared by all the instances: Each call creates a
+  // new series in a new study, unless the UIDs are provided
+  Json::Value tags = Json::objectValue;
+  std::vector<ConversionJob> jobs;
+
+  for (size_t i = 0; i < items.size(); i++)
+  {
+    if (GetDispositionParameter(items[i], "name") == "tags")
+    {
+      Json::Reader reader;
+      if (!reader.parse(items[i].data_, items[i].data_ + items[i].size_, tags) ||
+          tags.type() != Json::objectValue)
+      {
+        OrthancPlugins::LogError(context_, "The \"tags\" part must be a JSON object");
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+      }
+
+      continue;
+    }
+
+    ConversionJob job;
+    job.data_ = items[i].data_;
+    job.size_ = items[i].size_;
+    job.error_ = OrthancPluginErrorCode_Success;
+
+    if (!LookupImageFormat(job.format_, items[i]))
+    {
+      OrthancPlugins::LogError(context_, "Only PNG and JPEG images can be converted to DICOM");
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+    }
+
+    jobs.push_back(job);
+  }
+
+  if (jobs.empty())
+  {
+    OrthancPlugins::LogError(context_, "No image to be converted to DICOM");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadRequest);
+  }
+
+  SetDefaultTag(tags, "StudyInstanceUID", GenerateDicomUid());
+  SetDefaultTag(tags, "SeriesInstanceUID", GenerateDicomUid());
+  SetDefaultTag(tags, "SOPClassUID", "1.2.840.10008.5.1.4.1.1.7");   // Secondary Capture Image Storage
+  SetDefaultTag(tags, "Modality", "OT");
+  SetDefaultTag(tags, "ConversionType", "WSD");                        // Workstation
+
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    jobs[i].tags_ = tags;
+    SetDefaultTag(jobs[i].tags_, "InstanceNumber", boost::lexical_cast<std::string>(i + 1));
+  }
+
+  // Decode the images and create the DICOM instances in parallel
+  size_t threadsCount = boost::thread::hardware_concurrency();
+  if (threadsCount == 0)
+  {
+    threadsCount = 1;
+  }
+
+  if (threadsCount > jobs.size())
+  {
+    threadsCount = jobs.size();
+  }
+
+  {
+    // The threads are joined before "jobs" is destroyed, even if one
+    // of them cannot be created
+    OrthancPlugins::ScopedThreadGroup threads;
+    for (size_t i = 1; i < threadsCount; i++)
+    {
+      threads.CreateThread(boost::bind(ConvertImages, &jobs, i, threadsCount));
+    }
+
+    ConvertImages(&jobs, 0, threadsCount);
+    threads.JoinAll();
+  }
+
+  // Nothing is stored unless all the images could be converted
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    if (jobs[i].error_ != OrthancPluginErrorCode_Success)
+    {
+      OrthancPlugins::LogError(context_, "Cannot convert image " + boost::lexical_cast<std::string>(i + 1) + " to DICOM");
+      ORTHANC_PLUGINS_THROW_EXCEPTION(jobs[i].error_);
+    }
+  }
+
+  // If one of the instances cannot be stored, the instances of this
+  // batch that are already stored are deleted, so that the caller
+  // can simply retry the whole batch
+  Json::Value answer = Json::arrayValue;
+  std::vector<std::string> created;
+
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    Json::Value stored;
+    if (!OrthancPlugins::RestApiPost(stored, context_, "/instances", jobs[i].dicom_->GetData(),
+                                     jobs[i].dicom_->GetSize(), false) ||
+        stored.type() != Json::objectValue ||
+        !stored.isMember("ID") ||
+        stored["ID"].type() != Json::stringValue)
+    {
+      OrthancPlugins::LogError(context_, "Cannot store image " + boost::lexical_cast<std::string>(i + 1) +
+                               " as DICOM, removing the " + boost::lexical_cast<std::string>(created.size()) +
+                               " instance(s) already stored by this request");
+      DeleteInstances(created);
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_CannotStoreInstance);
+    }
+
+    const std::string id = stored["ID"].asString();
+
+    // An instance that was already present before this request
+    // (e.g. because of an explicit "SOPInstanceUID" tag) is kept
+    if (!stored.isMember("Status") ||
+        stored["Status"].type() != Json::stringValue ||
+        stored["Status"].asString() != "AlreadyStored")
+    {
+      created.push_back(id);
+    }
+
+    answer.append(id);
+    jobs[i].dicom_.reset();   // Release memory as soon as possible
+  }
+
+  Json::FastWriter writer;
+  const std::string s = writer.write(answer);
+  OrthancPluginAnswerBuffer(context_, output, s.c_str(), s.size(), "application/json");
+}
+
+
+void RegisterImageDicomization(OrthancPluginContext* context)
+{
+  context_ = context;
+  OrthancPlugins::RegisterRestCallback<DicomizeImages>(context, "/plugin/dicomize", true);
+}
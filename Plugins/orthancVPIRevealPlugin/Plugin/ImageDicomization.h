@@ -0,0 +1,38 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Route "/plugin/dicomize", that converts a batch of PNG/JPEG images
+ * (e.g. scanned documents) into secondary capture DICOM instances of
+ * one new series. The body is a "multipart/form-data" upload. A part
+ * named "tags" can contain the DICOM tags shared by all the
+ * instances (e.g. "PatientID"), as a JSON object. All the other
+ * parts must be PNG or JPEG images.
+ **/
+void RegisterImageDicomization(OrthancPluginContext* context);
@@ -0,0 +1,444 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "ImageRendering.h"
+
+#include "../Common/ImageResampling.h"
+#include "../Common/PixelFormatConversion.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <algorithm>
+#include <json/value.h>
+#include <limits>
+
+
+static OrthancPluginContext* context_ = NULL;
+static boost::scoped_ptr<OrthancPlugins::DecodedFrameCache> cache_;
+
+
+static bool ParseDecimal(float& target,
+                         const std::string& value)
+{
+  // Only keep the first item of multi-valued DICOM tags (e.g. the
+  // "WindowCenter" tag can contain several presets)
+  std::string s = value.substr(0, value.find('\\'));
+  boost::algorithm::trim(s);
+
+  try
+  {
+    target = boost::lexical_cast<float>(s);
+    return true;
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    return false;
+  }
+}
+
+
+static bool LookupDecimalTag(float& target,
+                             const Json::Value& tags,
+                             const char* tag)
+{
+  return (tags.isMember(tag) &&
+          tags[tag].type() == Json::stringValue &&
+          ParseDecimal(target, tags[tag].asString()));
+}
+
+
+static unsigned int GetUnsignedArgument(const OrthancPluginHttpRequest* request,
+                                        const std::string& key,
+                                        unsigned int defaultValue)
+{
+  std::string value;
+  if (!OrthancPlugins::LookupHttpGetArgument(value, request, key))
+  {
+    return defaultValue;
+  }
+
+  try
+  {
+    return boost::lexical_cast<unsigned int>(value);
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    OrthancPlugins::LogError(context_, "Bad value for GET argument \"" + key + "\": " + value);
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+RenderingParameters::RenderingParameters() :
+  slope_(1),
+  intercept_(0),
+  hasWindow_(false),
+  windowCenter_(0),
+  windowWidth_(0),
+  isInverted_(false)
+{
+}
+
+
+void RenderingParameters::ReadDicomTags(const Json::Value& tags)
+{
+  float value;
+  if (LookupDecimalTag(value, tags, "0028,1053"))
+  {
+    slope_ = value;
+  }
+
+  if (LookupDecimalTag(value, tags, "0028,1052"))
+  {
+    intercept_ = value;
+  }
+
+  float center, width;
+  if (LookupDecimalTag(center, tags, "0028,1050") &&
+      LookupDecimalTag(width, tags, "0028,1051") &&
+      width > 0)
+  {
+    SetWindow(center, width);
+  }
+
+  if (tags.isMember("0028,0004") &&
+      tags["0028,0004"].type() == Json::stringValue)
+  {
+    std::string photometric = tags["0028,0004"].asString();
+    boost::algorithm::trim(photometric);
+    isInverted_ = (photometric == "MONOCHROME1");
+  }
+}
+
+
+void RenderingParameters::ReadHttpArguments(const OrthancPluginHttpRequest* request)
+{
+  std::string wc, ww;
+  const bool hasCenter = OrthancPlugins::LookupHttpGetArgument(wc, request, "wc");
+  const bool hasWidth = OrthancPlugins::LookupHttpGetArgument(ww, request, "ww");
+
+  if (!hasCenter && !hasWidth)
+  {
+    return;
+  }
+
+  float center = windowCenter_;
+  float width = windowWidth_;
+
+  if ((!hasCenter && !hasWindow_) ||
+      (!hasWidth && !hasWindow_) ||
+      (hasCenter && !ParseDecimal(center, wc)) ||
+      (hasWidth && !ParseDecimal(width, ww)) ||
+      width <= 0)
+  {
+    OrthancPlugins::LogError(context_, "Bad window, both \"wc\" and \"ww\" must be provided, with \"ww\" > 0");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  SetWindow(center, width);
+}
+
+
+void RenderingParameters::SetWindow(float center,
+                                    float width)
+{
+  hasWindow_ = true;
+  windowCenter_ = center;
+  windowWidth_ = width;
+}
+
+
+template <typename T>
+static void GetMinMaxValue(float& minValue,
+                           float& maxValue,
+                           OrthancPlugins::OrthancImage& image)
+{
+  const unsigned int width = image.GetWidth();
+  const unsigned int height = image.GetHeight();
+  const unsigned int pitch = image.GetPitch();
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(image.GetBuffer());
+
+  T a = std::numeric_limits<T>::max();
+  T b = std::numeric_limits<T>::min();
+
+  for (unsigned int y = 0; y < height; y++)
+  {
+    const T* p = reinterpret_cast<const T*>(buffer + static_cast<size_t>(y) * pitch);
+    for (unsigned int x = 0; x < width; x++)
+    {
+      a = (p[x] < a ? p[x] : a);
+      b = (p[x] > b ? p[x] : b);
+    }
+  }
+
+  minValue = static_cast<float>(a);
+  maxValue = static_cast<float>(b);
+}
+
+
+static void ComputeAutomaticWindow(float& center,
+                                   float& width,
+                                   OrthancPlugins::OrthancImage& frame,
+                                   const RenderingParameters& parameters)
+{
+  float a, b;
+
+  switch (frame.GetPixelFormat())
+  {
+    case OrthancPluginPixelFormat_Grayscale8:
+      GetMinMaxValue<uint8_t>(a, b, frame);
+      break;
+
+    case OrthancPluginPixelFormat_Grayscale16:
+      GetMinMaxValue<uint16_t>(a, b, frame);
+      break;
+
+    case OrthancPluginPixelFormat_SignedGrayscale16:
+      GetMinMaxValue<int16_t>(a, b, frame);
+      break;
+
+    default:
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_InternalError);
+  }
+
+  // Window expressed in modality units
+  a = a * parameters.GetRescaleSlope() + parameters.GetRescaleIntercept();
+  b = b * parameters.GetRescaleSlope() + parameters.GetRescaleIntercept();
+
+  center = (a + b) / 2.0f;
+  width = (a < b ? b - a : a - b) + 1.0f;
+}
+
+
+static OrthancPluginPixelFormat GetRenderedFormat(OrthancPlugins::OrthancImage& frame)
+{
+  switch (frame.GetPixelFormat())
+  {
+    case OrthancPluginPixelFormat_Grayscale8:
+    case OrthancPluginPixelFormat_Grayscale16:
+    case OrthancPluginPixelFormat_SignedGrayscale16:
+      return OrthancPluginPixelFormat_Grayscale8;
+
+    case OrthancPluginPixelFormat_RGB24:
+    case OrthancPluginPixelFormat_RGBA32:
+      // JPEG has no alpha channel
+      return OrthancPluginPixelFormat_RGB24;
+
+    default:
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_NotImplemented);
+  }
+}
+
+
+// The target must have the size of the frame, and the format given
+// by "GetRenderedFormat()"
+static void ApplyWindowing(OrthancPlugins::OrthancImage& target,
+                           OrthancPlugins::OrthancImage& frame,
+                           const RenderingParameters& parameters)
+{
+  float slope = 1.0f;
+  float intercept = 0.0f;
+
+  if (target.GetPixelFormat() == OrthancPluginPixelFormat_Grayscale8)
+  {
+    float center, width;
+    if (parameters.HasWindow())
+    {
+      center = parameters.GetWindowCenter();
+      width = parameters.GetWindowWidth();
+    }
+    else
+    {
+      ComputeAutomaticWindow(center, width, frame, parameters);
+    }
+
+    if (width < 2.0f)
+    {
+      width = 2.0f;
+    }
+
+    // Linear VOI LUT function from the DICOM standard (PS 3.3,
+    // C.11.2.1.2), merged with the modality rescale into a single
+    // affine transform that is run by the vectorized kernels
+    slope = 255.0f * parameters.GetRescaleSlope() / (width - 1.0f);
+    intercept = 255.0f * ((parameters.GetRescaleIntercept() - (center - 0.5f)) / (width - 1.0f) + 0.5f);
+
+    if (parameters.IsInverted())
+    {
+      slope = -slope;
+      intercept = 255.0f - intercept;
+    }
+  }
+
+  OrthancPlugins::ConvertPixelFormat(target.GetWritableBuffer(), target.GetPixelFormat(), target.GetPitch(),
+                                     frame.GetBuffer(), frame.GetPixelFormat(), frame.GetPitch(),
+                                     frame.GetWidth(), frame.GetHeight(), slope, intercept);
+}
+
+
+static bool FitsIn(unsigned int width,
+                   unsigned int height,
+                   unsigned int maxSize)
+{
+  return (maxSize == 0 ||
+          (width <= maxSize && height <= maxSize));
+}
+
+
+OrthancPlugins::OrthancImage* ShrinkToFit(OrthancPlugins::OrthancImage& image,
+                                          unsigned int maxSize)
+{
+  const unsigned int width = image.GetWidth();
+  const unsigned int height = image.GetHeight();
+
+  if (FitsIn(width, height, maxSize))
+  {
+    return NULL;
+  }
+
+  // Preserve the aspect ratio
+  unsigned int targetWidth, targetHeight;
+  if (width >= height)
+  {
+    targetWidth = maxSize;
+    targetHeight = std::max(1u, static_cast<unsigned int>(static_cast<uint64_t>(height) * maxSize / width));
+  }
+  else
+  {
+    targetWidth = std::max(1u, static_cast<unsigned int>(static_cast<uint64_t>(width) * maxSize / height));
+    targetHeight = maxSize;
+  }
+
+  return OrthancPlugins::ResizeImage(image, targetWidth, targetHeight, 0);
+}
+
+
+OrthancPlugins::OrthancImage* RenderFrame(OrthancPlugins::OrthancImage& frame,
+                                          const RenderingParameters& parameters,
+                                          unsigned int maxSize)
+{
+  const OrthancPluginPixelFormat format = GetRenderedFormat(frame);
+  const unsigned int width = frame.GetWidth();
+  const unsigned int height = frame.GetHeight();
+
+  if (FitsIn(width, height, maxSize))
+  {
+    OrthancPlugins::OrthancImage* rendered = new OrthancPlugins::OrthancImage(frame.GetContext(), format, width, height);
+
+    try
+    {
+      ApplyWindowing(*rendered, frame, parameters);
+      return rendered;
+    }
+    catch (...)
+    {
+      delete rendered;
+      throw;
+    }
+  }
+  else
+  {
+    // The resampling is done on the 8-bit rendered image, which is
+    // cheaper than resampling the 16-bit frame. This intermediate
+    // image is rendered into a recycled buffer.
+    const unsigned int pitch = width * OrthancPlugins::GetBytesPerPixel(format);
+    OrthancPlugins::PooledBuffer buffer(static_cast<size_t>(pitch) * height);
+    OrthancPlugins::OrthancImage rendered(frame.GetContext(), format, width, height, pitch, buffer.GetData());
+
+    ApplyWindowing(rendered, frame, parameters);
+    return ShrinkToFit(rendered, maxSize);
+  }
+}
+
+
+static void RenderInstance(OrthancPluginRestOutput* output,
+                           const char* url,
+                           const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  const std::string instanceId(request->groups[0]);
+  const unsigned int frame = GetUnsignedArgument(request, "frame", 0);
+  const unsigned int size = GetUnsignedArgument(request, "size", 0);
+  const unsigned int quality = GetUnsignedArgument(request, "quality", 90);
+
+  std::string format = "jpeg";
+  OrthancPlugins::LookupHttpGetArgument(format, request, "format");
+
+  if ((format != "jpeg" && format != "png") ||
+      quality == 0 ||
+      quality > 100)
+  {
+    OrthancPlugins::LogError(context_, "The rendering format must be \"jpeg\" or \"png\", with a quality between 1 and 100");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  OrthancPlugins::DecodedFramePointer decoded = GetDecodedFrameCache().Acquire(instanceId, frame);
+
+  RenderingParameters parameters;
+  parameters.ReadDicomTags(decoded->GetTags());
+  parameters.ReadHttpArguments(request);
+
+  boost::scoped_ptr<OrthancPlugins::OrthancImage> rendered(RenderFrame(decoded->GetImage(), parameters, size));
+
+  if (format == "png")
+  {
+    rendered->AnswerPngImage(output);
+  }
+  else
+  {
+    rendered->AnswerJpegImage(output, static_cast<uint8_t>(quality));
+  }
+}
+
+
+OrthancPlugins::DecodedFrameCache& GetDecodedFrameCache()
+{
+  if (cache_.get() == NULL)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadSequenceOfCalls);
+  }
+
+  return *cache_;
+}
+
+
+void RegisterImageRendering(OrthancPluginContext* context,
+                            const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  // Size of the cache of the decoded frames, in MB
+  const unsigned int cacheSize = configuration.GetUnsignedIntegerValue("DecodedFrameCacheSize", 256);
+  cache_.reset(new OrthancPlugins::DecodedFrameCache(context, static_cast<size_t>(cacheSize) * 1024 * 1024));
+
+  // Memory kept by the pool of the scratch buffers, in MB
+  const unsigned int poolSize = configuration.GetUnsignedIntegerValue("BufferPoolSize", 64);
+  OrthancPlugins::BufferPool::GetInstance().SetMaxPooledSize(static_cast<size_t>(poolSize) * 1024 * 1024);
+
+  // Rendering is CPU-bound and stateless: Allow concurrent requests
+  OrthancPlugins::RegisterRestCallback<RenderInstance>(context, "/plugin/render/([^/]+)", true);
+}
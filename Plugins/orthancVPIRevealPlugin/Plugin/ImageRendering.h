@@ -0,0 +1,106 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "../Common/DecodedFrameCache.h"
+
+
+/**
+ * Parameters of the conversion of one DICOM frame into an image that
+ * can be displayed by a Web browser. The rescale slope/intercept and
+ * the default VOI window are read from the DICOM tags, the window can
+ * be overridden by the "wc" and "ww" GET arguments.
+ **/
+class RenderingParameters
+{
+private:
+  float  slope_;
+  float  intercept_;
+  bool   hasWindow_;
+  float  windowCenter_;
+  float  windowWidth_;
+  bool   isInverted_;   // MONOCHROME1
+
+public:
+  RenderingParameters();
+
+  // The tags must be in the "short" format
+  void ReadDicomTags(const Json::Value& tags);
+
+  void ReadHttpArguments(const OrthancPluginHttpRequest* request);
+
+  float GetRescaleSlope() const
+  {
+    return slope_;
+  }
+
+  float GetRescaleIntercept() const
+  {
+    return intercept_;
+  }
+
+  bool HasWindow() const
+  {
+    return hasWindow_;
+  }
+
+  float GetWindowCenter() const
+  {
+    return windowCenter_;
+  }
+
+  float GetWindowWidth() const
+  {
+    return windowWidth_;
+  }
+
+  void SetWindow(float center,
+                 float width);
+
+  bool IsInverted() const
+  {
+    return isInverted_;
+  }
+};
+
+
+// Applies the window/level to a grayscale frame (or converts a color
+// frame to RGB24), then shrinks the result so that it fits a square
+// of "maxSize" pixels ("0" means no resizing). This transfers
+// ownership.
+OrthancPlugins::OrthancImage* RenderFrame(OrthancPlugins::OrthancImage& frame,
+                                          const RenderingParameters& parameters,
+                                          unsigned int maxSize);
+
+// Shrinks an image so that it fits a square of "maxSize" pixels,
+// preserving its aspect ratio. Returns NULL if the image already
+// fits. This transfers ownership.
+OrthancPlugins::OrthancImage* ShrinkToFit(OrthancPlugins::OrthancImage& image,
+                                          unsigned int maxSize);
+
+// The cache of the decoded frames is shared by all the routes that
+// render images
+OrthancPlugins::DecodedFrameCache& GetDecodedFrameCache();
+
+void RegisterImageRendering(OrthancPluginContext* context,
+                            const OrthancPlugins::OrthancConfiguration& configuration);
@@ -0,0 +1,331 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "ImageTiles.h"
+
+#include "ImageRendering.h"
+#include "../Common/KeyedMutex.h"
+#include "../Common/SizeLimitedCache.h"
+#include "../Common/TilePyramid.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/writer.h>
+#include <map>
+
+
+static OrthancPluginContext* context_ = NULL;
+static unsigned int tileSize_ = 256;
+static uint8_t quality_ = 90;
+static std::string contentType_ = "1026";
+
+
+namespace
+{
+  typedef boost::shared_ptr<const OrthancPlugins::TilePyramid>  PyramidPointer;
+
+  // LRU cache of the pyramids, limited by their total size. Each
+  // instance whose pyramid is being computed has a revision that
+  // counts its invalidations, so that the pyramid of an instance that
+  // was deleted during the computation is not stored.
+  class PyramidCache : public boost::noncopyable
+  {
+  private:
+    struct Computation
+    {
+      uint64_t      revision_;
+      unsigned int  count_;     // Concurrent computations for this instance
+    };
+
+    typedef std::map<std::string, Computation>  Computations;
+
+    boost::mutex                                      mutex_;
+    OrthancPlugins::SizeLimitedCache<PyramidPointer>  content_;
+    Computations                                      computations_;
+
+  public:
+    PyramidCache(size_t maxSize) :
+      content_(maxSize)
+    {
+    }
+
+    PyramidPointer Lookup(const std::string& instance)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      PyramidPointer pyramid;
+      content_.Lookup(pyramid, instance);
+      return pyramid;
+    }
+
+    // The revision must be given back to "EndComputation()", which
+    // must be called even if the computation fails
+    uint64_t StartComputation(const std::string& instance)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Computations::iterator computation = computations_.find(instance);
+      if (computation == computations_.end())
+      {
+        Computation item;
+        item.revision_ = 0;
+        item.count_ = 0;
+        computation = computations_.insert(std::make_pair(instance, item)).first;
+      }
+
+      computation->second.count_++;
+      return computation->second.revision_;
+    }
+
+    // The pyramid is NULL if the computation has failed
+    void EndComputation(const std::string& instance,
+                        uint64_t revision,
+                        PyramidPointer pyramid)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Computations::iterator computation = computations_.find(instance);
+      if (computation == computations_.end())
+      {
+        return;  // Should never happen
+      }
+
+      const bool isStale = (computation->second.revision_ != revision);
+
+      computation->second.count_--;
+      if (computation->second.count_ == 0)
+      {
+        computations_.erase(computation);
+      }
+
+      if (pyramid.get() != NULL &&
+          !isStale)
+      {
+        content_.Store(instance, pyramid, pyramid->GetContent().size());
+      }
+    }
+
+    void Invalidate(const std::string& instance)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Computations::iterator computation = computations_.find(instance);
+      if (computation != computations_.end())
+      {
+        computation->second.revision_++;
+      }
+
+      content_.Invalidate(instance);
+    }
+  };
+}
+
+
+static boost::scoped_ptr<PyramidCache> cache_;
+static OrthancPlugins::KeyedMutex computeMutexes_;   // One per instance
+
+
+// This transfers ownership
+static OrthancPlugins::TilePyramid* LoadPyramid(const std::string& instance)
+{
+  const std::string uri = "/instances/" + instance + "/attachments/" + contentType_;
+
+  OrthancPlugins::MemoryBuffer stored(context_);
+  if (stored.RestApiGet(uri + "/data", false))
+  {
+    try
+    {
+      return OrthancPlugins::TilePyramid::Parse(stored.GetData(), stored.GetSize());
+    }
+    catch (...)
+    {
+      OrthancPlugins::LogWarning(context_, "Corrupted pyramid of tiles, computing it again for instance " + instance);
+    }
+  }
+
+  OrthancPlugins::DecodedFramePointer frame = GetDecodedFrameCache().Acquire(instance, 0);
+
+  RenderingParameters parameters;
+  parameters.ReadDicomTags(frame->GetTags());
+
+  boost::scoped_ptr<OrthancPlugins::OrthancImage> rendered(RenderFrame(frame->GetImage(), parameters, 0));
+  OrthancPlugins::TilePyramid* pyramid = OrthancPlugins::TilePyramid::Build(*rendered, tileSize_, quality_);
+
+  // Failing to store the pyramid is not fatal: It will be computed
+  // again by the next plugin instance
+  const std::string& content = pyramid->GetContent();
+  OrthancPlugins::MemoryBuffer answer(context_);
+  if (!answer.RestApiPut(uri, content.c_str(), content.size(), false))
+  {
+    OrthancPlugins::LogWarning(context_, "Cannot store the pyramid of tiles of instance " + instance);
+  }
+
+  return pyramid;
+}
+
+
+static PyramidPointer GetPyramid(const std::string& instance)
+{
+  PyramidPointer pyramid = cache_->Lookup(instance);
+  if (pyramid.get() != NULL)
+  {
+    return pyramid;
+  }
+
+  // The first requests of a viewer ask for many tiles at once: Only
+  // one of them computes the pyramid. The other instances are not
+  // blocked by this computation.
+  OrthancPlugins::KeyedMutex::ScopedLock lock(computeMutexes_, instance);
+
+  pyramid = cache_->Lookup(instance);
+  if (pyramid.get() != NULL)
+  {
+    return pyramid;
+  }
+
+  const uint64_t revision = cache_->StartComputation(instance);
+
+  try
+  {
+    pyramid.reset(LoadPyramid(instance));
+  }
+  catch (...)
+  {
+    cache_->EndComputation(instance, revision, PyramidPointer());
+    throw;
+  }
+
+  cache_->EndComputation(instance, revision, pyramid);
+  return pyramid;
+}
+
+
+static unsigned int ParseUnsigned(const char* value)
+{
+  try
+  {
+    return boost::lexical_cast<unsigned int>(value);
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+}
+
+
+static void ServePyramid(OrthancPluginRestOutput* output,
+                         const char* url,
+                         const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  Json::Value description;
+  GetPyramid(request->groups[0])->Format(description);
+
+  Json::FastWriter writer;
+  const std::string s = writer.write(description);
+  OrthancPluginAnswerBuffer(context_, output, s.c_str(), s.size(), "application/json");
+}
+
+
+static void ServeTile(OrthancPluginRestOutput* output,
+                      const char* url,
+                      const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  PyramidPointer pyramid = GetPyramid(request->groups[0]);
+
+  const char* jpeg = NULL;
+  size_t size = 0;
+  if (!pyramid->LookupTile(jpeg, size,
+                           ParseUnsigned(request->groups[1]),
+                           ParseUnsigned(request->groups[2]),
+                           ParseUnsigned(request->groups[3])))
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  OrthancPluginAnswerBuffer(context_, output, jpeg, size, "image/jpeg");
+}
+
+
+void RegisterImageTiles(OrthancPluginContext* context,
+                        const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  tileSize_ = configuration.GetUnsignedIntegerValue("TileSize", 256);
+  if (tileSize_ < 16)
+  {
+    OrthancPlugins::LogError(context_, "The option \"TileSize\" must be at least 16");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  const unsigned int quality = configuration.GetUnsignedIntegerValue("TileQuality", 90);
+  if (quality == 0 ||
+      quality > 100)
+  {
+    OrthancPlugins::LogError(context_, "The option \"TileQuality\" must be between 1 and 100");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  quality_ = static_cast<uint8_t>(quality);
+
+  const unsigned int contentType = configuration.GetUnsignedIntegerValue("TilesContentType", 1026);
+  if (contentType < 1024 ||
+      contentType > 65535)
+  {
+    OrthancPlugins::LogError(context_, "The option \"TilesContentType\" must be between 1024 and 65535");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  contentType_ = boost::lexical_cast<std::string>(contentType);
+
+  // Size of the cache of the pyramids, in MB
+  const unsigned int cacheSize = configuration.GetUnsignedIntegerValue("TileCacheSize", 128);
+  cache_.reset(new PyramidCache(static_cast<size_t>(cacheSize) * 1024 * 1024));
+
+  OrthancPlugins::RegisterRestCallback<ServePyramid>(context, "/plugin/tiles/([^/]+)", true);
+  OrthancPlugins::RegisterRestCallback<ServeTile>(context, "/plugin/tiles/([^/]+)/([0-9]+)/([0-9]+)/([0-9]+)", true);
+}
+
+
+void InvalidateImageTiles(const std::string& instanceId)
+{
+  if (cache_.get() != NULL)
+  {
+    cache_->Invalidate(instanceId);
+  }
+}
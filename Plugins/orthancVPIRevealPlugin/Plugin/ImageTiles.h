@@ -0,0 +1,41 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Routes "/plugin/tiles/{instance}" (description of the levels of
+ * the pyramid, as JSON) and "/plugin/tiles/{instance}/{level}/{x}/{y}"
+ * (one JPEG tile). The pyramid of the first frame is rendered with
+ * the default window of the instance on the first request, then
+ * stored as an attachment of the instance.
+ **/
+void RegisterImageTiles(OrthancPluginContext* context,
+                        const OrthancPlugins::OrthancConfiguration& configuration);
+
+// Must be called whenever an instance is deleted
+void InvalidateImageTiles(const std::string& instanceId);
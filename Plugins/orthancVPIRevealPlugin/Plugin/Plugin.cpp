@@ -20,6 +20,16 @@
 
 #include <orthanc/OrthancCPlugin.h>
 
+#include "DatabaseIndex.h"
+#include "ImageDicomization.h"
+#include "ImageRendering.h"
+#include "ImageTiles.h"
+#include "PreviewGeneration.h"
+#include "SeriesStreaming.h"
+#include "SeriesVolume.h"
+#include "WeasisManifest.h"
+#include "WorklistServer.h"
+
 #include <string.h>
 #include <stdio.h>
 #include <direct.h>
@@ -241,6 +251,9 @@ OrthancPluginErrorCode OnStoredCallback(OrthancPluginDicomInstance* instance,
   FILE* fp;
   char* json;
 
+  // The previews are rendered in the background
+  SchedulePreviews(instanceId);
+
   sprintf(buffer, "+++ OnStoredCallback: Received DICOM instance of size %d and ID %s from origin %d (AET %s)", 
           (int) OrthancPluginGetInstanceSize(context, instance), instanceId, 
           OrthancPluginGetInstanceOrigin(context, instance),
@@ -365,6 +378,17 @@ ORTHANC_PLUGINS_API OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeT
   sprintf(info, "+++ OnChangeCallback: Change %d on resource %s of type %d", changeType, resourceId, resourceType);
   OrthancPluginLogWarning(context, info);
 
+  if (changeType == OrthancPluginChangeType_Deleted &&
+      resourceType == OrthancPluginResourceType_Instance)
+  {
+    // Evict the frames and the tiles of the deleted instance from
+    // the caches
+    GetDecodedFrameCache().Invalidate(resourceId);
+    InvalidateImageTiles(resourceId);
+  }
+
+  InvalidateWeasisManifest(changeType, resourceId);
+
   if (changeType == OrthancPluginChangeType_NewInstance)
   {
     sprintf(info, "/instances/%s/metadata/AnonymizedFrom", resourceId);
@@ -444,6 +468,50 @@ extern "C"
 		OrthancPluginLogWarning(context, "VPI Plugin: Register the callbacks");
 		OrthancPluginRegisterRestCallback(context, "/plugin/create", CallbackCreateDicom);
 
+		try
+		{
+			OrthancPlugins::OrthancConfiguration configuration(context);
+
+			OrthancPlugins::OrthancConfiguration vpi;
+			configuration.GetSection(vpi, "VpiReveal");
+
+			RegisterImageRendering(context, vpi);
+			RegisterSeriesVolume(context, vpi);
+			RegisterSeriesStreaming(context, vpi);
+			RegisterPreviews(context, vpi);
+			RegisterImageTiles(context, vpi);
+			RegisterImageDicomization(context);
+			RegisterWeasisManifest(context, vpi);
+			RegisterWorklistServer(context, vpi);
+			RegisterDatabaseIndex(context, vpi);
+		}
+#if HAS_ORTHANC_EXCEPTION == 1
+		catch (Orthanc::OrthancException& e)
+		{
+			std::string message = std::string("VPI Plugin: Cannot initialize the plugin: ") + e.What();
+			OrthancPluginLogError(context, message.c_str());
+			return -1;
+		}
+#else
+		catch (OrthancPlugins::PluginException& e)
+		{
+			std::string message = std::string("VPI Plugin: Cannot initialize the plugin: ") + e.What(context);
+			OrthancPluginLogError(context, message.c_str());
+			return -1;
+		}
+#endif
+		catch (std::exception& e)
+		{
+			std::string message = std::string("VPI Plugin: Cannot initialize the plugin: ") + e.what();
+			OrthancPluginLogError(context, message.c_str());
+			return -1;
+		}
+		catch (...)
+		{
+			OrthancPluginLogError(context, "VPI Plugin: Cannot initialize the plugin: Unknown error");
+			return -1;
+		}
+
 		OrthancPluginRegisterOnStoredInstanceCallback(context, OnStoredCallback);
 		OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
 
@@ -469,6 +537,10 @@ extern "C"
 	ORTHANC_PLUGINS_API void OrthancPluginFinalize()
 	{
 		OrthancPluginLogWarning(context, "VPI Reveal plugin is finalizing");
+		FinalizePreviews();
+		FinalizeWorklistServer();
+		FinalizeDatabaseIndex();
+		OrthancPlugins::BufferPool::GetInstance().Finalize();
 	}
 
 
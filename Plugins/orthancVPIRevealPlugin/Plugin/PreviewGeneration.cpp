@@ -0,0 +1,479 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "PreviewGeneration.h"
+
+#include "ImageRendering.h"
+#include "../Common/MultiFrameDecoder.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <set>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#elif defined(__linux__)
+#  include <sys/resource.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+
+static OrthancPluginContext* context_ = NULL;
+
+static unsigned int thumbnailSize_ = 128;
+static unsigned int previewSize_ = 512;
+static uint8_t quality_ = 90;
+static std::string thumbnailType_ = "1024";
+static std::string previewType_ = "1025";
+
+
+namespace
+{
+  /**
+   * Queue of the instances whose previews must be rendered. The
+   * rendering is deferred as long as instances are being received,
+   * so that it does not compete with the ingest, and it is done by
+   * threads with a low priority.
+   **/
+  class PreviewQueue : public boost::noncopyable
+  {
+  private:
+    boost::mutex                      mutex_;
+    boost::condition_variable         changed_;
+    std::deque<std::string>           queue_;
+    std::set<std::string>             queued_;
+    boost::system_time                lastIngest_;
+    boost::posix_time::time_duration  idleDelay_;
+    bool                              stopped_;
+    boost::thread_group               threads_;
+
+    // Returns "false" if the queue is stopped
+    bool Dequeue(std::string& instance);
+
+    void Worker();
+
+  public:
+    PreviewQueue(unsigned int threadsCount,
+                 unsigned int idleDelay);
+
+    ~PreviewQueue()
+    {
+      Stop();
+    }
+
+    void Enqueue(const std::string& instance);
+
+    void Stop();
+  };
+}
+
+
+static boost::scoped_ptr<PreviewQueue> queue_;
+
+
+static void LowerThreadPriority()
+{
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+  // On Linux, the "nice" value is a property of the thread
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+}
+
+
+static std::string GetAttachmentUri(const std::string& instance,
+                                    const std::string& type)
+{
+  return "/instances/" + instance + "/attachments/" + type;
+}
+
+
+static void StoreAttachment(const std::string& instance,
+                            const std::string& type,
+                            OrthancPlugins::OrthancImage& image)
+{
+  OrthancPlugins::MemoryBuffer jpeg(context_);
+  image.CompressJpegImage(jpeg, quality_);
+
+  OrthancPlugins::MemoryBuffer answer(context_);
+  if (!answer.RestApiPut(GetAttachmentUri(instance, type), jpeg.GetData(), jpeg.GetSize(), false))
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_CannotWriteFile);
+  }
+}
+
+
+// Returns "false" if the instance does not exist anymore
+static bool GeneratePreviews(const std::string& instance)
+{
+  OrthancPlugins::MemoryBuffer dicom(context_);
+  if (!dicom.RestApiGet("/instances/" + instance + "/file", false))
+  {
+    return false;
+  }
+
+  Json::Value tags;
+  dicom.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short,
+                    OrthancPluginDicomToJsonFlags_None, 256);
+
+  // The middle frame is the most representative of a multi-frame
+  // instance (e.g. the middle of an ultrasound loop)
+  OrthancPlugins::OrthancImage frame(context_);
+  frame.DecodeDicomImage(dicom.GetData(), dicom.GetSize(),
+                         OrthancPlugins::MultiFrameDecoder::GetFramesCount(tags) / 2);
+
+  RenderingParameters parameters;
+  parameters.ReadDicomTags(tags);
+
+  boost::scoped_ptr<OrthancPlugins::OrthancImage> preview(RenderFrame(frame, parameters, previewSize_));
+  StoreAttachment(instance, previewType_, *preview);
+
+  // The thumbnail is derived from the preview, which is cheaper than
+  // rendering the full frame once again
+  boost::scoped_ptr<OrthancPlugins::OrthancImage> thumbnail(ShrinkToFit(*preview, thumbnailSize_));
+  StoreAttachment(instance, thumbnailType_, thumbnail.get() == NULL ? *preview : *thumbnail);
+
+  return true;
+}
+
+
+PreviewQueue::PreviewQueue(unsigned int threadsCount,
+                           unsigned int idleDelay) :
+  lastIngest_(boost::get_system_time()),
+  idleDelay_(boost::posix_time::milliseconds(idleDelay)),
+  stopped_(false)
+{
+  try
+  {
+    for (unsigned int i = 0; i < threadsCount; i++)
+    {
+      threads_.create_thread(boost::bind(&PreviewQueue::Worker, this));
+    }
+  }
+  catch (...)
+  {
+    Stop();
+    throw;
+  }
+}
+
+
+bool PreviewQueue::Dequeue(std::string& instance)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (;;)
+  {
+    if (stopped_)
+    {
+      return false;
+    }
+
+    if (queue_.empty())
+    {
+      changed_.wait(lock);
+      continue;
+    }
+
+    // Yield to the ingest: Wait until no instance has been received
+    // for "idleDelay_"
+    const boost::system_time resume = lastIngest_ + idleDelay_;
+    if (boost::get_system_time() < resume)
+    {
+      changed_.timed_wait(lock, resume);
+      continue;
+    }
+
+    instance = queue_.front();
+    queue_.pop_front();
+    queued_.erase(instance);
+    return true;
+  }
+}
+
+
+void PreviewQueue::Worker()
+{
+  LowerThreadPriority();
+
+  std::string instance;
+  while (Dequeue(instance))
+  {
+    try
+    {
+      if (!GeneratePreviews(instance))
+      {
+        OrthancPlugins::LogInfo(context_, "Instance deleted before the rendering of its previews: " + instance);
+      }
+    }
+    catch (...)
+    {
+      // Not all the instances contain an image (e.g. structured reports)
+      OrthancPlugins::LogInfo(context_, "Cannot render the previews of instance " + instance);
+    }
+  }
+}
+
+
+void PreviewQueue::Enqueue(const std::string& instance)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  lastIngest_ = boost::get_system_time();
+
+  if (queued_.insert(instance).second)
+  {
+    queue_.push_back(instance);
+  }
+
+  changed_.notify_one();
+}
+
+
+void PreviewQueue::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    changed_.notify_all();
+  }
+
+  threads_.join_all();
+}
+
+
+// The MD5 of the attachments is stored by Orthanc together with their
+// content (option "StoreMD5ForAttachments", enabled by default), so
+// that the conditional requests neither read nor hash the JPEG
+static bool LookupStoredMd5(std::string& md5,
+                            const std::string& attachmentUri)
+{
+  OrthancPlugins::MemoryBuffer answer(context_);
+  if (!answer.RestApiGet(attachmentUri + "/md5", false))
+  {
+    return false;
+  }
+
+  answer.ToString(md5);
+  boost::algorithm::trim(md5);
+  return !md5.empty();
+}
+
+
+static std::string ComputeMd5(const OrthancPlugins::MemoryBuffer& content)
+{
+  char* md5 = OrthancPluginComputeMd5(context_, content.GetData(), content.GetSize());
+  if (md5 == NULL)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_InternalError);
+  }
+
+  const std::string result(md5);
+  OrthancPluginFreeString(context_, md5);
+  return result;
+}
+
+
+// Evaluates the value of a "If-None-Match" header, that is either
+// "*" or a comma-separated list of entity tags (RFC 7232, section
+// 3.2). The comparison is weak: The "W/" prefix is ignored.
+static bool MatchesEntityTag(const std::string& header,
+                             const std::string& etag)
+{
+  size_t start = 0;
+  for (;;)
+  {
+    size_t end = header.find(',', start);
+    std::string item = header.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    boost::algorithm::trim(item);
+
+    if (boost::algorithm::starts_with(item, "W/"))
+    {
+      item = item.substr(2);
+    }
+
+    if (item == "*" ||
+        item == etag)
+    {
+      return true;
+    }
+
+    if (end == std::string::npos)
+    {
+      return false;
+    }
+
+    start = end + 1;
+  }
+}
+
+
+static void ServePreview(OrthancPluginRestOutput* output,
+                         const OrthancPluginHttpRequest* request,
+                         const std::string& type)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  const std::string instance(request->groups[0]);
+  const std::string attachment = GetAttachmentUri(instance, type);
+
+  OrthancPlugins::MemoryBuffer jpeg(context_);
+  bool hasContent = false;
+
+  std::string md5;
+  if (!LookupStoredMd5(md5, attachment))
+  {
+    if (!jpeg.RestApiGet(attachment + "/data", false))
+    {
+      // Instance received before the plugin was enabled, or whose
+      // previews are still in the queue
+      if (!GeneratePreviews(instance) ||
+          !jpeg.RestApiGet(attachment + "/data", false))
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+      }
+    }
+
+    hasContent = true;
+
+    if (!LookupStoredMd5(md5, attachment))
+    {
+      md5 = ComputeMd5(jpeg);  // The MD5 of the attachments is not stored
+    }
+  }
+
+  const std::string etag = "\"" + md5 + "\"";
+
+  // The previews can change if the configuration changes: The
+  // clients must revalidate their copy
+  OrthancPluginSetHttpHeader(context_, output, "ETag", etag.c_str());
+  OrthancPluginSetHttpHeader(context_, output, "Cache-Control", "private, no-cache");
+
+  std::string match;
+  if (OrthancPlugins::LookupHttpHeader(match, request, "if-none-match") &&
+      MatchesEntityTag(match, etag))
+  {
+    OrthancPluginSendHttpStatusCode(context_, output, 304);
+    return;
+  }
+
+  if (!hasContent &&
+      !jpeg.RestApiGet(attachment + "/data", false))
+  {
+    // The instance has been deleted in the meantime
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  OrthancPluginAnswerBuffer(context_, output, jpeg.GetData(), jpeg.GetSize(), "image/jpeg");
+}
+
+
+static void ServeThumbnail(OrthancPluginRestOutput* output,
+                           const char* url,
+                           const OrthancPluginHttpRequest* request)
+{
+  ServePreview(output, request, thumbnailType_);
+}
+
+
+static void ServeFullPreview(OrthancPluginRestOutput* output,
+                             const char* url,
+                             const OrthancPluginHttpRequest* request)
+{
+  ServePreview(output, request, previewType_);
+}
+
+
+static std::string GetContentType(const OrthancPlugins::OrthancConfiguration& configuration,
+                                  const std::string& key,
+                                  unsigned int defaultValue)
+{
+  const unsigned int type = configuration.GetUnsignedIntegerValue(key, defaultValue);
+
+  // Range of the user-defined content types of Orthanc
+  if (type < 1024 ||
+      type > 65535)
+  {
+    OrthancPlugins::LogError(context_, "The option \"" + key + "\" must be between 1024 and 65535");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  return boost::lexical_cast<std::string>(type);
+}
+
+
+void RegisterPreviews(OrthancPluginContext* context,
+                      const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  thumbnailSize_ = configuration.GetUnsignedIntegerValue("ThumbnailSize", 128);
+  previewSize_ = configuration.GetUnsignedIntegerValue("PreviewSize", 512);
+  thumbnailType_ = GetContentType(configuration, "ThumbnailContentType", 1024);
+  previewType_ = GetContentType(configuration, "PreviewContentType", 1025);
+
+  const unsigned int quality = configuration.GetUnsignedIntegerValue("PreviewQuality", 90);
+  if (quality == 0 ||
+      quality > 100)
+  {
+    OrthancPlugins::LogError(context_, "The option \"PreviewQuality\" must be between 1 and 100");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  quality_ = static_cast<uint8_t>(quality);
+
+  if (configuration.GetBooleanValue("GeneratePreviews", true))
+  {
+    queue_.reset(new PreviewQueue(configuration.GetUnsignedIntegerValue("PreviewThreads", 1),
+                                  configuration.GetUnsignedIntegerValue("PreviewIdleDelay", 1000)));
+  }
+
+  OrthancPlugins::RegisterRestCallback<ServeThumbnail>(context, "/plugin/thumbnail/([^/]+)", true);
+  OrthancPlugins::RegisterRestCallback<ServeFullPreview>(context, "/plugin/preview/([^/]+)", true);
+}
+
+
+void SchedulePreviews(const std::string& instanceId)
+{
+  if (queue_.get() != NULL)
+  {
+    queue_->Enqueue(instanceId);
+  }
+}
+
+
+void FinalizePreviews()
+{
+  queue_.reset(NULL);
+}
@@ -0,0 +1,44 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Thumbnails and previews of the instances, rendered in the
+ * background as soon as the instances are received, and stored as
+ * user-defined attachments. They are served by the routes
+ * "/plugin/thumbnail/{instance}" and "/plugin/preview/{instance}",
+ * and rendered on demand if they are not available yet.
+ **/
+void RegisterPreviews(OrthancPluginContext* context,
+                      const OrthancPlugins::OrthancConfiguration& configuration);
+
+// Queues the rendering of the previews of a newly received instance
+void SchedulePreviews(const std::string& instanceId);
+
+// Stops the background threads
+void FinalizePreviews();
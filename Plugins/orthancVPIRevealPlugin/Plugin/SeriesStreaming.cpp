@@ -0,0 +1,587 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "SeriesStreaming.h"
+
+#include "ImageRendering.h"
+#include "../Common/MultiFrameDecoder.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+
+
+static OrthancPluginContext* context_ = NULL;
+static size_t maxPrefetchSize_ = 64 * 1024 * 1024;
+
+
+namespace
+{
+  enum StreamingFormat
+  {
+    StreamingFormat_Dicom,
+    StreamingFormat_Jpeg,
+    StreamingFormat_Png
+  };
+
+
+  struct Part
+  {
+    std::string  content_;
+    std::string  location_;
+  };
+
+
+  // The parts of one instance (one part per frame if rendering) that
+  // have been produced, but not handed out yet
+  struct Item
+  {
+    std::deque<Part>  parts_;
+    bool              complete_;
+
+    Item() : complete_(false)
+    {
+    }
+  };
+
+
+  /**
+   * Produces the items in the background, and hands out their parts
+   * by increasing index. The producers stay at most "maxItems" items
+   * and "maxSize" bytes ahead of the consumer. As a multi-frame
+   * instance can be much larger than "maxSize", this limit also
+   * applies to the frames of one item: Only the item that is waited
+   * for by the consumer can always produce its next part.
+   **/
+  class Prefetcher : public boost::noncopyable
+  {
+  private:
+    typedef std::map<size_t, Item>  ReadyItems;
+
+    class FrameRenderer : public OrthancPlugins::MultiFrameDecoder::IFrameHandler
+    {
+    private:
+      Prefetcher&                 prefetcher_;
+      size_t                      index_;
+      const std::string&          instance_;
+      const RenderingParameters&  parameters_;
+
+    public:
+      FrameRenderer(Prefetcher& prefetcher,
+                    size_t index,
+                    const std::string& instance,
+                    const RenderingParameters& parameters) :
+        prefetcher_(prefetcher),
+        index_(index),
+        instance_(instance),
+        parameters_(parameters)
+      {
+      }
+
+      virtual void Handle(unsigned int frame,
+                          OrthancPlugins::OrthancImage& image)
+      {
+        boost::scoped_ptr<OrthancPlugins::OrthancImage> rendered(RenderFrame(image, parameters_, prefetcher_.size_));
+
+        OrthancPlugins::MemoryBuffer compressed(context_);
+        if (prefetcher_.format_ == StreamingFormat_Png)
+        {
+          rendered->CompressPngImage(compressed);
+        }
+        else
+        {
+          rendered->CompressJpegImage(compressed, prefetcher_.quality_);
+        }
+
+        Part part;
+        compressed.ToString(part.content_);
+        part.location_ = ("/plugin/render/" + instance_ + "?frame=" +
+                          boost::lexical_cast<std::string>(frame));
+        prefetcher_.AddPart(index_, part);
+      }
+    };
+
+    const std::vector<std::string>&  instances_;
+    const OrthancPluginHttpRequest*  request_;
+    StreamingFormat                  format_;
+    unsigned int                     size_;
+    uint8_t                          quality_;
+    unsigned int                     decodingThreads_;
+
+    boost::mutex                     mutex_;
+    boost::condition_variable        changed_;
+    size_t                           next_;        // Next item to be produced
+    size_t                           consumed_;    // Next item to be consumed
+    size_t                           pendingSize_;
+    size_t                           maxItems_;
+    size_t                           maxSize_;
+    bool                             stopped_;
+    bool                             hasError_;
+    size_t                           errorIndex_;
+    OrthancPluginErrorCode           error_;
+    ReadyItems                       ready_;
+    boost::thread_group              threads_;
+
+    // Waits until the look-ahead allows one more part. This swaps the
+    // content of "part".
+    void AddPart(size_t index,
+                 Part& part)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Item& item = ready_[index];
+
+      while (!stopped_ &&
+             pendingSize_ >= maxSize_ &&
+             (index != consumed_ || !item.parts_.empty()))
+      {
+        changed_.wait(lock);
+      }
+
+      if (stopped_)
+      {
+        // Interrupts the decoding of the item
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadSequenceOfCalls);
+      }
+
+      item.parts_.push_back(Part());
+      item.parts_.back().content_.swap(part.content_);
+      item.parts_.back().location_.swap(part.location_);
+      pendingSize_ += item.parts_.back().content_.size();
+
+      changed_.notify_all();
+    }
+
+    void Produce(size_t index,
+                 const std::string& instance)
+    {
+      OrthancPlugins::MemoryBuffer dicom(context_);
+      if (!dicom.RestApiGet("/instances/" + instance + "/file", false))
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+      }
+
+      if (format_ == StreamingFormat_Dicom)
+      {
+        Part part;
+        dicom.ToString(part.content_);
+        part.location_ = "/instances/" + instance + "/file";
+        AddPart(index, part);
+        return;
+      }
+
+      Json::Value tags;
+      dicom.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short,
+                        OrthancPluginDicomToJsonFlags_None, 256);
+
+      RenderingParameters parameters;
+      parameters.ReadDicomTags(tags);
+      parameters.ReadHttpArguments(request_);
+
+      FrameRenderer renderer(*this, index, instance, parameters);
+
+      OrthancPlugins::MultiFrameDecoder decoder(context_, dicom.GetData(), dicom.GetSize());
+      decoder.SetThreadsCount(decodingThreads_);
+      decoder.DecodeFrames(renderer, 0, OrthancPlugins::MultiFrameDecoder::GetFramesCount(tags));
+    }
+
+    // Never throws: The error code is returned instead
+    OrthancPluginErrorCode SafeProduce(size_t index,
+                                       const std::string& instance)
+    {
+      try
+      {
+        Produce(index, instance);
+        return OrthancPluginErrorCode_Success;
+      }
+#if HAS_ORTHANC_EXCEPTION == 1
+      catch (Orthanc::OrthancException& e)
+      {
+        return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+      }
+#else
+      catch (OrthancPlugins::PluginException& e)
+      {
+        return e.GetErrorCode();
+      }
+#endif
+      catch (std::bad_alloc&)
+      {
+        return OrthancPluginErrorCode_NotEnoughMemory;
+      }
+      catch (...)
+      {
+        return OrthancPluginErrorCode_Plugin;
+      }
+    }
+
+    bool IsThrottled() const
+    {
+      return (next_ != consumed_ &&
+              (next_ - consumed_ >= maxItems_ ||
+               pendingSize_ >= maxSize_));
+    }
+
+    void Worker()
+    {
+      for (;;)
+      {
+        size_t index;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          while (!stopped_ &&
+                 !hasError_ &&
+                 next_ < instances_.size() &&
+                 IsThrottled())
+          {
+            changed_.wait(lock);
+          }
+
+          if (stopped_ ||
+              hasError_ ||
+              next_ >= instances_.size())
+          {
+            return;
+          }
+
+          index = next_++;
+        }
+
+        OrthancPluginErrorCode error = SafeProduce(index, instances_[index]);
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (error == OrthancPluginErrorCode_Success)
+        {
+          ready_[index].complete_ = true;
+        }
+        else if (!hasError_ ||
+                 index < errorIndex_)
+        {
+          hasError_ = true;
+          errorIndex_ = index;
+          error_ = error;
+        }
+
+        changed_.notify_all();
+      }
+    }
+
+  public:
+    Prefetcher(const std::vector<std::string>& instances,
+               const OrthancPluginHttpRequest* request,
+               StreamingFormat format,
+               unsigned int size,
+               uint8_t quality) :
+      instances_(instances),
+      request_(request),
+      format_(format),
+      size_(size),
+      quality_(quality),
+      next_(0),
+      consumed_(0),
+      pendingSize_(0),
+      maxSize_(maxPrefetchSize_),
+      stopped_(false),
+      hasError_(false),
+      errorIndex_(0),
+      error_(OrthancPluginErrorCode_Success)
+    {
+      unsigned int threadsCount = boost::thread::hardware_concurrency();
+      if (threadsCount == 0)
+      {
+        threadsCount = 1;
+      }
+
+      if (threadsCount > instances.size())
+      {
+        threadsCount = static_cast<unsigned int>(instances.size());
+      }
+
+      // The frames of a lone multi-frame instance are decoded in
+      // parallel, otherwise the parallelism is across the instances
+      decodingThreads_ = (instances.size() == 1 ? 0 : 1);
+      maxItems_ = 2 * threadsCount;
+
+      try
+      {
+        for (unsigned int i = 0; i < threadsCount; i++)
+        {
+          threads_.create_thread(boost::bind(&Prefetcher::Worker, this));
+        }
+      }
+      catch (...)
+      {
+        Stop();
+        throw;
+      }
+    }
+
+    ~Prefetcher()
+    {
+      Stop();
+    }
+
+    void Stop()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        changed_.notify_all();
+      }
+
+      threads_.join_all();
+    }
+
+    // Waits for the next part of the given item. Returns "false" once
+    // all the parts of this item have been handed out, the next call
+    // being for the next item.
+    bool WaitPart(Part& part,
+                  size_t index)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (;;)
+      {
+        ReadyItems::iterator found = ready_.find(index);
+        if (found != ready_.end())
+        {
+          Item& item = found->second;
+
+          if (!item.parts_.empty())
+          {
+            part.content_.swap(item.parts_.front().content_);
+            part.location_.swap(item.parts_.front().location_);
+            item.parts_.pop_front();
+
+            pendingSize_ -= part.content_.size();
+            changed_.notify_all();
+            return true;
+          }
+
+          if (item.complete_)
+          {
+            ready_.erase(found);
+            consumed_ = index + 1;
+            changed_.notify_all();
+            return false;
+          }
+        }
+
+        if (hasError_ &&
+            errorIndex_ == index)
+        {
+          OrthancPlugins::LogError(context_, "Cannot stream instance " + instances_[index]);
+          ORTHANC_PLUGINS_THROW_EXCEPTION(error_);
+        }
+
+        changed_.wait(lock);
+      }
+    }
+  };
+
+}
+
+
+static unsigned int GetUnsignedArgument(const OrthancPluginHttpRequest* request,
+                                        const std::string& key,
+                                        unsigned int defaultValue)
+{
+  std::string value;
+  if (!OrthancPlugins::LookupHttpGetArgument(value, request, key))
+  {
+    return defaultValue;
+  }
+
+  try
+  {
+    return boost::lexical_cast<unsigned int>(value);
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    OrthancPlugins::LogError(context_, "Bad value for GET argument \"" + key + "\": " + value);
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+// Lists the instances of the series, in the order of the series
+static void ListInstances(std::vector<std::string>& instances,
+                          const std::string& series)
+{
+  Json::Value children;
+  if (!OrthancPlugins::RestApiGet(children, context_, "/series/" + series + "/instances", false) ||
+      children.type() != Json::arrayValue ||
+      children.size() == 0)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  std::vector<std::pair<int, std::string> > sorted;
+  sorted.reserve(children.size());
+
+  for (Json::Value::ArrayIndex i = 0; i < children.size(); i++)
+  {
+    const Json::Value& child = children[i];
+    int index = 0;
+
+    if (child.isMember("IndexInSeries") &&
+        child["IndexInSeries"].isInt())
+    {
+      index = child["IndexInSeries"].asInt();
+    }
+
+    sorted.push_back(std::make_pair(index, child["ID"].asString()));
+  }
+
+  std::sort(sorted.begin(), sorted.end());
+
+  instances.resize(sorted.size());
+  for (size_t i = 0; i < sorted.size(); i++)
+  {
+    instances[i] = sorted[i].second;
+  }
+}
+
+
+static void StreamSeries(OrthancPluginRestOutput* output,
+                         const char* url,
+                         const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  std::string s = "dicom";
+  OrthancPlugins::LookupHttpGetArgument(s, request, "format");
+
+  const unsigned int size = GetUnsignedArgument(request, "size", 0);
+  const unsigned int quality = GetUnsignedArgument(request, "quality", 90);
+
+  StreamingFormat format;
+  std::string contentType;
+
+  if (s == "dicom")
+  {
+    format = StreamingFormat_Dicom;
+    contentType = "application/dicom";
+  }
+  else if (s == "jpeg")
+  {
+    format = StreamingFormat_Jpeg;
+    contentType = "image/jpeg";
+  }
+  else if (s == "png")
+  {
+    format = StreamingFormat_Png;
+    contentType = "image/png";
+  }
+  else
+  {
+    OrthancPlugins::LogError(context_, "The streaming format must be \"dicom\", \"jpeg\" or \"png\"");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  if (quality == 0 ||
+      quality > 100)
+  {
+    OrthancPlugins::LogError(context_, "The JPEG quality must be between 1 and 100");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_ParameterOutOfRange);
+  }
+
+  std::vector<std::string> instances;
+  ListInstances(instances, request->groups[0]);
+
+  Prefetcher prefetcher(instances, request, format, size, static_cast<uint8_t>(quality));
+
+  // The answer is only started once the first part is available, so
+  // that an error on the first instance can still be reported as a
+  // HTTP error
+  boost::scoped_ptr<OrthancPlugins::MultipartWriter> writer;
+
+  try
+  {
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      Part part;
+
+      for (;;)
+      {
+        const bool hasPart = prefetcher.WaitPart(part, i);
+
+        if (writer.get() == NULL)
+        {
+          writer.reset(new OrthancPlugins::MultipartWriter(context_, output, "related", contentType));
+        }
+
+        if (!hasPart)
+        {
+          break;
+        }
+
+        std::map<std::string, std::string> headers;
+        headers["Content-Location"] = part.location_;
+
+        const std::string& content = part.content_;
+        if (!writer->SendItem(content.empty() ? NULL : content.c_str(), content.size(), headers))
+        {
+          OrthancPlugins::LogInfo(context_, "The client has closed the connection while streaming a series");
+          return;
+        }
+      }
+    }
+  }
+  catch (...)
+  {
+    if (writer.get() == NULL)
+    {
+      throw;
+    }
+
+    // The multipart answer has started, so no HTTP error can be sent
+    // anymore: The answer ends before the instance that has failed
+    OrthancPlugins::LogError(context_, "Error while streaming series " + std::string(request->groups[0]) +
+                             ", the answer is truncated");
+  }
+}
+
+
+void RegisterSeriesStreaming(OrthancPluginContext* context,
+                             const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  // Maximum size of the parts that are prefetched ahead of the part
+  // being sent, in MB
+  maxPrefetchSize_ = static_cast<size_t>(configuration.GetUnsignedIntegerValue("StreamingPrefetchSize", 64)) * 1024 * 1024;
+
+  OrthancPlugins::RegisterRestCallback<StreamSeries>(context, "/plugin/stream/([^/]+)", true);
+}
@@ -0,0 +1,38 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Route "/plugin/stream/{series}", that sends all the instances of a
+ * series in one multipart/related answer, either as DICOM files or
+ * as rendered frames (JPEG or PNG). The items are downloaded and
+ * rendered in the background by a pool of threads, ahead of the
+ * item that is being sent, within a bounded amount of memory.
+ **/
+void RegisterSeriesStreaming(OrthancPluginContext* context,
+                             const OrthancPlugins::OrthancConfiguration& configuration);
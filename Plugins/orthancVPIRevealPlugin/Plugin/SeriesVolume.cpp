@@ -0,0 +1,777 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "SeriesVolume.h"
+
+#include "../Common/KeyedMutex.h"
+#include "../Common/MultiFrameDecoder.h"
+#include "../Common/PixelFormatConversion.h"
+#include "../Common/SizeLimitedCache.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <json/writer.h>
+
+
+static OrthancPluginContext* context_ = NULL;
+
+
+namespace
+{
+  struct Volume
+  {
+    std::vector<std::string>  instances_;   // Sorted identifiers of the source instances
+    std::string               content_;     // Header, then voxels
+  };
+
+  typedef boost::shared_ptr<const Volume>  VolumePointer;
+
+
+  /**
+   * LRU cache of the recently computed volumes, so that the
+   * successive requests of the same volume do not decode the series
+   * again. An entry is only used if the series still contains the
+   * same instances.
+   **/
+  class VolumeCache : public boost::noncopyable
+  {
+  private:
+    boost::mutex                                     mutex_;
+    OrthancPlugins::SizeLimitedCache<VolumePointer>  content_;
+
+  public:
+    VolumeCache(size_t maxSize) :
+      content_(maxSize)
+    {
+    }
+
+    VolumePointer Lookup(const std::string& series,
+                         const std::vector<std::string>& instances)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      VolumePointer volume;
+      if (!content_.Lookup(volume, series))
+      {
+        return VolumePointer();
+      }
+      else if (volume->instances_ != instances)
+      {
+        // The series has changed since the volume was computed
+        content_.Invalidate(series);
+        return VolumePointer();
+      }
+      else
+      {
+        return volume;
+      }
+    }
+
+    void Store(const std::string& series,
+               VolumePointer volume)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      content_.Store(series, volume, volume->content_.size());
+    }
+  };
+
+
+  struct Slice
+  {
+    std::string                                      instance_;
+    Json::Value                                      tags_;
+    boost::shared_ptr<OrthancPlugins::OrthancImage>  image_;
+    double                                           position_;   // Along the normal
+    int                                              instanceNumber_;
+    float                                            slope_;
+    float                                            intercept_;
+    float                                            offset_;     // Added to the stored values
+  };
+
+
+  /**
+   * Downloads and decodes the slices using a pool of threads. The
+   * REST API of Orthanc and the decoding of DICOM images can be
+   * called concurrently.
+   **/
+  class SliceLoader : public boost::noncopyable
+  {
+  private:
+    std::vector<Slice>&     slices_;
+    boost::mutex            mutex_;
+    size_t                  next_;
+    bool                    hasError_;
+    OrthancPluginErrorCode  error_;
+
+    static void LoadSlice(Slice& slice)
+    {
+      OrthancPlugins::MemoryBuffer dicom(context_);
+      if (!dicom.RestApiGet("/instances/" + slice.instance_ + "/file", false))
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+      }
+
+      dicom.DicomToJson(slice.tags_, OrthancPluginDicomToJsonFormat_Short,
+                        OrthancPluginDicomToJsonFlags_None, 256);
+
+      slice.image_.reset(new OrthancPlugins::OrthancImage(context_));
+      slice.image_->DecodeDicomImage(dicom.GetData(), dicom.GetSize(), 0);
+    }
+
+    // Never throws: The error code is returned instead
+    static OrthancPluginErrorCode SafeLoadSlice(Slice& slice)
+    {
+      try
+      {
+        LoadSlice(slice);
+        return OrthancPluginErrorCode_Success;
+      }
+#if HAS_ORTHANC_EXCEPTION == 1
+      catch (Orthanc::OrthancException& e)
+      {
+        return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+      }
+#else
+      catch (OrthancPlugins::PluginException& e)
+      {
+        return e.GetErrorCode();
+      }
+#endif
+      catch (std::bad_alloc&)
+      {
+        return OrthancPluginErrorCode_NotEnoughMemory;
+      }
+      catch (...)
+      {
+        return OrthancPluginErrorCode_Plugin;
+      }
+    }
+
+    void Worker()
+    {
+      for (;;)
+      {
+        size_t index;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (hasError_ ||
+              next_ >= slices_.size())
+          {
+            return;
+          }
+
+          index = next_++;
+        }
+
+        OrthancPluginErrorCode error = SafeLoadSlice(slices_[index]);
+
+        if (error != OrthancPluginErrorCode_Success)
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (!hasError_)
+          {
+            OrthancPlugins::LogError(context_, "Cannot decode instance " + slices_[index].instance_);
+            hasError_ = true;
+            error_ = error;
+          }
+        }
+      }
+    }
+
+  public:
+    SliceLoader(std::vector<Slice>& slices) :
+      slices_(slices),
+      next_(0),
+      hasError_(false),
+      error_(OrthancPluginErrorCode_Success)
+    {
+    }
+
+    void Run()
+    {
+      unsigned int threadsCount = boost::thread::hardware_concurrency();
+      if (threadsCount > slices_.size())
+      {
+        threadsCount = static_cast<unsigned int>(slices_.size());
+      }
+
+      // The calling thread takes part in the loading
+      boost::thread_group threads;
+
+      try
+      {
+        for (unsigned int i = 1; i < threadsCount; i++)
+        {
+          threads.create_thread(boost::bind(&SliceLoader::Worker, this));
+        }
+      }
+      catch (...)
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          hasError_ = true;
+          error_ = OrthancPluginErrorCode_InternalError;
+        }
+
+        threads.join_all();
+        throw;
+      }
+
+      Worker();
+      threads.join_all();
+
+      if (hasError_)
+      {
+        ORTHANC_PLUGINS_THROW_EXCEPTION(error_);
+      }
+    }
+  };
+
+
+  struct SliceOrdering
+  {
+    bool operator() (const Slice& a,
+                     const Slice& b) const
+    {
+      if (a.position_ != b.position_)
+      {
+        return a.position_ < b.position_;
+      }
+      else if (a.instanceNumber_ != b.instanceNumber_)
+      {
+        return a.instanceNumber_ < b.instanceNumber_;
+      }
+      else
+      {
+        return a.instance_ < b.instance_;
+      }
+    }
+  };
+}
+
+
+static boost::scoped_ptr<VolumeCache> cache_;
+static OrthancPlugins::KeyedMutex computeMutexes_;   // One per series
+
+
+// Parses a multi-valued decimal DICOM tag
+static bool LookupVector(std::vector<double>& target,
+                         const Json::Value& tags,
+                         const char* tag)
+{
+  target.clear();
+
+  if (!tags.isMember(tag) ||
+      tags[tag].type() != Json::stringValue)
+  {
+    return false;
+  }
+
+  const std::string value = tags[tag].asString();
+
+  size_t start = 0;
+  for (;;)
+  {
+    size_t end = value.find('\\', start);
+    std::string item = value.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    boost::algorithm::trim(item);
+
+    try
+    {
+      target.push_back(boost::lexical_cast<double>(item));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      target.clear();
+      return false;
+    }
+
+    if (end == std::string::npos)
+    {
+      return true;
+    }
+
+    start = end + 1;
+  }
+}
+
+
+static double GetDecimalTag(const Json::Value& tags,
+                            const char* tag,
+                            double defaultValue)
+{
+  std::vector<double> values;
+  if (LookupVector(values, tags, tag) &&
+      !values.empty())
+  {
+    return values[0];
+  }
+  else
+  {
+    return defaultValue;
+  }
+}
+
+
+static Json::Value FormatVector(const std::vector<double>& values)
+{
+  Json::Value result = Json::arrayValue;
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    result.append(values[i]);
+  }
+
+  return result;
+}
+
+
+static void GetPixelSpacing(Json::Value& header,
+                            const Json::Value& tags)
+{
+  // "PixelSpacing" is (spacing between rows, spacing between columns)
+  std::vector<double> spacing;
+  if (LookupVector(spacing, tags, "0028,0030") &&
+      spacing.size() == 2)
+  {
+    header["Spacing"].append(spacing[1]);
+    header["Spacing"].append(spacing[0]);
+  }
+  else
+  {
+    header["Spacing"].append(1.0);
+    header["Spacing"].append(1.0);
+  }
+}
+
+
+static double GetSliceThickness(const Json::Value& tags)
+{
+  double thickness = GetDecimalTag(tags, "0018,0088", 0);   // Spacing between slices
+
+  if (thickness <= 0)
+  {
+    thickness = GetDecimalTag(tags, "0018,0050", 0);        // Slice thickness
+  }
+
+  return (thickness > 0 ? thickness : 1.0);
+}
+
+
+static void CheckGrayscale(const Json::Value& tags)
+{
+  if (GetDecimalTag(tags, "0028,0002", 1) != 1)   // Samples per pixel
+  {
+    OrthancPlugins::LogError(context_, "Only grayscale series can be converted to a volume");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_IncompatibleImageFormat);
+  }
+}
+
+
+// The unsigned 16-bit values do not fit in the signed 16-bit voxels:
+// They are shifted by -32768, which is compensated by adding 32768
+// times the slope to the rescale intercept
+static bool IsFullRangeUnsigned(const Json::Value& tags)
+{
+  return (GetDecimalTag(tags, "0028,0103", 0) == 0 &&    // Pixel representation
+          GetDecimalTag(tags, "0028,0101", 16) > 15);    // Bits stored
+}
+
+
+// Writes the header, and returns the location of the voxels
+static uint8_t* AllocateVolume(std::string& content,
+                               const Json::Value& header,
+                               unsigned int width,
+                               unsigned int height,
+                               unsigned int depth)
+{
+  Json::FastWriter writer;
+  std::string json = writer.write(header);
+
+  // Align the voxels on 8 bytes, so that the clients can map them
+  // directly onto typed arrays
+  while ((4 + json.size()) % 8 != 0)
+  {
+    json.push_back(' ');
+  }
+
+  const size_t headerSize = 4 + json.size();
+  const size_t voxelsSize = static_cast<size_t>(width) * height * depth * sizeof(int16_t);
+
+  content.resize(headerSize + voxelsSize);
+
+  const uint32_t length = static_cast<uint32_t>(json.size());
+  content[0] = static_cast<char>(length & 0xff);
+  content[1] = static_cast<char>((length >> 8) & 0xff);
+  content[2] = static_cast<char>((length >> 16) & 0xff);
+  content[3] = static_cast<char>((length >> 24) & 0xff);
+  std::copy(json.begin(), json.end(), content.begin() + 4);
+
+  return reinterpret_cast<uint8_t*>(&content[headerSize]);
+}
+
+
+static void ToLittleEndian(uint8_t* voxels,
+                           size_t count)
+{
+  const uint16_t probe = 1;
+  if (*reinterpret_cast<const uint8_t*>(&probe) == 1)
+  {
+    return;  // Little-endian CPU, nothing to do
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    std::swap(voxels[2 * i], voxels[2 * i + 1]);
+  }
+}
+
+
+// Single instance, possibly multi-frame (enhanced CT/MR)
+static void ComputeMultiFrameVolume(Volume& volume,
+                                    const std::string& instance)
+{
+  OrthancPlugins::MemoryBuffer dicom(context_);
+  if (!dicom.RestApiGet("/instances/" + instance + "/file", false))
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  Json::Value tags;
+  dicom.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short,
+                    OrthancPluginDicomToJsonFlags_None, 256);
+
+  CheckGrayscale(tags);
+
+  const unsigned int width = static_cast<unsigned int>(GetDecimalTag(tags, "0028,0011", 0));
+  const unsigned int height = static_cast<unsigned int>(GetDecimalTag(tags, "0028,0010", 0));
+  const unsigned int depth = OrthancPlugins::MultiFrameDecoder::GetFramesCount(tags);
+
+  if (width == 0 ||
+      height == 0)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_BadFileFormat);
+  }
+
+  // The per-frame functional groups are not parsed: The frames are
+  // kept in the order of the file
+  Json::Value header = Json::objectValue;
+  header["Width"] = width;
+  header["Height"] = height;
+  header["Depth"] = depth;
+  GetPixelSpacing(header, tags);
+  header["Spacing"].append(GetSliceThickness(tags));
+  const bool shifted = IsFullRangeUnsigned(tags);
+  const double slope = GetDecimalTag(tags, "0028,1053", 1);
+  const double intercept = GetDecimalTag(tags, "0028,1052", 0);
+
+  header["RescaleSlope"] = slope;
+  header["RescaleIntercept"] = (shifted ? intercept + 32768.0 * slope : intercept);
+
+  Json::Value item = Json::objectValue;
+  item["ID"] = instance;
+  item["RescaleSlope"] = header["RescaleSlope"];
+  item["RescaleIntercept"] = header["RescaleIntercept"];
+  header["Instances"].append(item);
+
+  uint8_t* voxels = AllocateVolume(volume.content_, header, width, height, depth);
+
+  OrthancPlugins::MultiFrameDecoder decoder(context_, dicom.GetData(), dicom.GetSize());
+
+  if (shifted)
+  {
+    decoder.DecodeFrames(voxels, OrthancPluginPixelFormat_Grayscale16,
+                         width * sizeof(uint16_t), width, height, 0, depth);
+
+    // Subtracting 32768 from an unsigned 16-bit value gives the same
+    // bits as flipping its most significant bit
+    uint16_t* p = reinterpret_cast<uint16_t*>(voxels);
+    const size_t count = static_cast<size_t>(width) * height * depth;
+    for (size_t i = 0; i < count; i++)
+    {
+      p[i] ^= 0x8000;
+    }
+  }
+  else
+  {
+    decoder.DecodeFrames(voxels, OrthancPluginPixelFormat_SignedGrayscale16,
+                         width * sizeof(int16_t), width, height, 0, depth);
+  }
+
+  ToLittleEndian(voxels, static_cast<size_t>(width) * height * depth);
+}
+
+
+static void ComputeSeriesVolume(Volume& volume)
+{
+  std::vector<Slice> slices(volume.instances_.size());
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    slices[i].instance_ = volume.instances_[i];
+  }
+
+  {
+    SliceLoader loader(slices);
+    loader.Run();
+  }
+
+  const unsigned int width = slices[0].image_->GetWidth();
+  const unsigned int height = slices[0].image_->GetHeight();
+
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    switch (slices[i].image_->GetPixelFormat())
+    {
+      case OrthancPluginPixelFormat_Grayscale8:
+      case OrthancPluginPixelFormat_Grayscale16:
+      case OrthancPluginPixelFormat_SignedGrayscale16:
+        break;
+
+      default:
+        OrthancPlugins::LogError(context_, "Only grayscale series can be converted to a volume");
+        ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_IncompatibleImageFormat);
+    }
+
+    if (slices[i].image_->GetWidth() != width ||
+        slices[i].image_->GetHeight() != height)
+    {
+      OrthancPlugins::LogError(context_, "The slices of the series do not have the same size");
+      ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_IncompatibleImageSize);
+    }
+  }
+
+  // Sort the slices along the normal to the first slice, or by
+  // instance number if the geometry is not available
+  std::vector<double> orientation;
+  bool hasGeometry = (LookupVector(orientation, slices[0].tags_, "0020,0037") &&
+                      orientation.size() == 6);
+
+  double normal[3] = { 0, 0, 0 };
+  if (hasGeometry)
+  {
+    normal[0] = orientation[1] * orientation[5] - orientation[2] * orientation[4];
+    normal[1] = orientation[2] * orientation[3] - orientation[0] * orientation[5];
+    normal[2] = orientation[0] * orientation[4] - orientation[1] * orientation[3];
+  }
+
+  bool uniformRescale = true;
+
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    Slice& slice = slices[i];
+
+    std::vector<double> position;
+    if (hasGeometry &&
+        LookupVector(position, slice.tags_, "0020,0032") &&
+        position.size() == 3)
+    {
+      slice.position_ = position[0] * normal[0] + position[1] * normal[1] + position[2] * normal[2];
+    }
+    else
+    {
+      hasGeometry = false;
+    }
+
+    slice.instanceNumber_ = static_cast<int>(GetDecimalTag(slice.tags_, "0020,0013", 0));
+    slice.slope_ = static_cast<float>(GetDecimalTag(slice.tags_, "0028,1053", 1));
+    slice.intercept_ = static_cast<float>(GetDecimalTag(slice.tags_, "0028,1052", 0));
+    slice.offset_ = 0;
+
+    if (slice.image_->GetPixelFormat() == OrthancPluginPixelFormat_Grayscale16 &&
+        IsFullRangeUnsigned(slice.tags_))
+    {
+      slice.offset_ = -32768.0f;
+      slice.intercept_ += 32768.0f * slice.slope_;
+    }
+
+    if (slice.slope_ != slices[0].slope_ ||
+        slice.intercept_ != slices[0].intercept_)
+    {
+      uniformRescale = false;
+    }
+  }
+
+  if (!hasGeometry)
+  {
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+      slices[i].position_ = 0;
+    }
+  }
+
+  std::sort(slices.begin(), slices.end(), SliceOrdering());
+
+  const unsigned int depth = static_cast<unsigned int>(slices.size());
+
+  Json::Value header = Json::objectValue;
+  header["Width"] = width;
+  header["Height"] = height;
+  header["Depth"] = depth;
+  GetPixelSpacing(header, slices[0].tags_);
+
+  if (hasGeometry && depth > 1)
+  {
+    header["Spacing"].append(std::fabs(slices[depth - 1].position_ - slices[0].position_) / (depth - 1));
+  }
+  else
+  {
+    header["Spacing"].append(GetSliceThickness(slices[0].tags_));
+  }
+
+  std::vector<double> origin;
+  if (hasGeometry &&
+      LookupVector(origin, slices[0].tags_, "0020,0032"))
+  {
+    header["Origin"] = FormatVector(origin);
+    header["Orientation"] = FormatVector(orientation);
+  }
+
+  // If the rescale varies across the slices (e.g. PET), the clients
+  // must apply the rescale of each slice
+  if (uniformRescale)
+  {
+    header["RescaleSlope"] = slices[0].slope_;
+    header["RescaleIntercept"] = slices[0].intercept_;
+  }
+
+  header["Instances"] = Json::arrayValue;
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    Json::Value item = Json::objectValue;
+    item["ID"] = slices[i].instance_;
+    item["RescaleSlope"] = slices[i].slope_;
+    item["RescaleIntercept"] = slices[i].intercept_;
+    header["Instances"].append(item);
+  }
+
+  uint8_t* voxels = AllocateVolume(volume.content_, header, width, height, depth);
+
+  const unsigned int pitch = width * sizeof(int16_t);
+  const size_t sliceSize = static_cast<size_t>(pitch) * height;
+
+  for (size_t i = 0; i < slices.size(); i++)
+  {
+    OrthancPlugins::OrthancImage& image = *slices[i].image_;
+
+    OrthancPlugins::ConvertPixelFormat(voxels + i * sliceSize, OrthancPluginPixelFormat_SignedGrayscale16, pitch,
+                                       image.GetBuffer(), image.GetPixelFormat(), image.GetPitch(),
+                                       width, height, 1.0f, slices[i].offset_);
+
+    slices[i].image_.reset();   // Release memory as soon as possible
+  }
+
+  ToLittleEndian(voxels, static_cast<size_t>(width) * height * depth);
+}
+
+
+static VolumePointer GetVolume(const std::string& series)
+{
+  Json::Value info;
+  if (!OrthancPlugins::RestApiGet(info, context_, "/series/" + series, false) ||
+      info.type() != Json::objectValue ||
+      !info.isMember("Instances") ||
+      info["Instances"].type() != Json::arrayValue ||
+      info["Instances"].size() == 0)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  std::vector<std::string> instances;
+  for (Json::Value::ArrayIndex i = 0; i < info["Instances"].size(); i++)
+  {
+    instances.push_back(info["Instances"][i].asString());
+  }
+
+  std::sort(instances.begin(), instances.end());
+
+  VolumePointer volume = cache_->Lookup(series, instances);
+  if (volume.get() != NULL)
+  {
+    return volume;
+  }
+
+  // Prevents the concurrent requests of the same volume from
+  // computing it several times
+  OrthancPlugins::KeyedMutex::ScopedLock lock(computeMutexes_, series);
+
+  volume = cache_->Lookup(series, instances);
+  if (volume.get() != NULL)
+  {
+    return volume;
+  }
+
+  boost::shared_ptr<Volume> computed(new Volume);
+  computed->instances_ = instances;
+
+  if (instances.size() == 1)
+  {
+    ComputeMultiFrameVolume(*computed, instances[0]);
+  }
+  else
+  {
+    ComputeSeriesVolume(*computed);
+  }
+
+  cache_->Store(series, computed);
+  return computed;
+}
+
+
+static void ServeVolume(OrthancPluginRestOutput* output,
+                        const char* url,
+                        const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  VolumePointer volume = GetVolume(request->groups[0]);
+
+  // The "Range" header is ignored, which is allowed by RFC 7233: The
+  // plugins cannot send the status 206, and a partial body with the
+  // status 200 would be taken as the full volume by the caches
+  const std::string& content = volume->content_;
+  OrthancPluginAnswerBuffer(context_, output, content.c_str(), content.size(), "application/octet-stream");
+}
+
+
+void RegisterSeriesVolume(OrthancPluginContext* context,
+                          const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  // Size of the cache of the volumes, in MB
+  const unsigned int cacheSize = configuration.GetUnsignedIntegerValue("VolumeCacheSize", 512);
+
+  cache_.reset(new VolumeCache(static_cast<size_t>(cacheSize) * 1024 * 1024));
+
+  OrthancPlugins::RegisterRestCallback<ServeVolume>(context, "/plugin/volume/([^/]+)", true);
+}
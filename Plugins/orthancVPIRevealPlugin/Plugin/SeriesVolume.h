@@ -0,0 +1,40 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#pragma once
+
+#include "../Common/OrthancPluginCppWrapper.h"
+
+
+/**
+ * Route "/plugin/volume/{series}", that answers all the slices of a
+ * series as one contiguous volume of little-endian signed 16-bit
+ * integers, sorted along the normal of the slices. The answer starts
+ * with the size of a JSON header (32-bit little-endian integer),
+ * followed by this header (dimensions, spacing, rescale...) and by
+ * the voxels. The header is padded so that the voxels start at an
+ * offset that is a multiple of 8 bytes.
+ **/
+void RegisterSeriesVolume(OrthancPluginContext* context,
+                          const OrthancPlugins::OrthancConfiguration& configuration);
@@ -0,0 +1,553 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "WeasisManifest.h"
+
+#include "../Common/SizeLimitedCache.h"
+
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+
+static OrthancPluginContext* context_ = NULL;
+static std::string orthancUrl_;
+
+
+namespace
+{
+  // "<Patient>" element of the manifest of one patient, together
+  // with the Orthanc identifiers of all the resources it lists
+  struct Manifest
+  {
+    std::string               xml_;
+    std::vector<std::string>  resources_;
+  };
+
+  typedef boost::shared_ptr<const Manifest>  ManifestPointer;
+
+
+  typedef std::map<std::string, std::string>  Owners;
+
+
+  // Keeps track of the patient of each resource listed by a cached
+  // manifest
+  class ManifestContent : public OrthancPlugins::SizeLimitedCache<ManifestPointer>
+  {
+  private:
+    Owners&  owners_;
+
+  protected:
+    virtual void OnRemoved(const std::string& patient,
+                           const ManifestPointer& manifest)
+    {
+      for (size_t i = 0; i < manifest->resources_.size(); i++)
+      {
+        owners_.erase(manifest->resources_[i]);
+      }
+    }
+
+  public:
+    ManifestContent(Owners& owners,
+                    size_t maxSize) :
+      SizeLimitedCache<ManifestPointer>(maxSize),
+      owners_(owners)
+    {
+    }
+  };
+
+
+  // LRU cache of the manifests, limited by their total size. Each
+  // patient whose manifest is being computed has a revision that
+  // counts the changes of this patient, so that a manifest computed
+  // while one of its changes was reported is not stored, as it might
+  // be stale. The changes of the other patients do not matter.
+  class ManifestCache : public boost::noncopyable
+  {
+  private:
+    struct Computation
+    {
+      uint64_t      revision_;
+      unsigned int  count_;     // Concurrent computations for this patient
+    };
+
+    typedef std::map<std::string, Computation>  Computations;
+
+    boost::mutex     mutex_;
+    Owners           owners_;    // Patient of each resource listed by a manifest
+    ManifestContent  content_;
+    Computations     computations_;
+
+    void InvalidatePatientInternal(const std::string& patient)
+    {
+      Computations::iterator computation = computations_.find(patient);
+      if (computation != computations_.end())
+      {
+        computation->second.revision_++;
+      }
+
+      content_.Invalidate(patient);
+    }
+
+  public:
+    ManifestCache(size_t maxSize) :
+      content_(owners_, maxSize)
+    {
+    }
+
+    ManifestPointer Lookup(const std::string& patient)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      ManifestPointer manifest;
+      content_.Lookup(manifest, patient);
+      return manifest;
+    }
+
+    // The revision must be given back to "EndComputation()", which
+    // must be called even if the computation fails
+    uint64_t StartComputation(const std::string& patient)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Computations::iterator computation = computations_.find(patient);
+      if (computation == computations_.end())
+      {
+        Computation item;
+        item.revision_ = 0;
+        item.count_ = 0;
+        computation = computations_.insert(std::make_pair(patient, item)).first;
+      }
+
+      computation->second.count_++;
+      return computation->second.revision_;
+    }
+
+    // The manifest is NULL if the computation has failed
+    void EndComputation(const std::string& patient,
+                        uint64_t revision,
+                        ManifestPointer manifest)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Computations::iterator computation = computations_.find(patient);
+      if (computation == computations_.end())
+      {
+        return;  // Should never happen
+      }
+
+      const bool isStale = (computation->second.revision_ != revision);
+
+      computation->second.count_--;
+      if (computation->second.count_ == 0)
+      {
+        computations_.erase(computation);
+      }
+
+      if (manifest.get() != NULL &&
+          !isStale)
+      {
+        content_.Store(patient, manifest, manifest->xml_.size());
+
+        for (size_t i = 0; i < manifest->resources_.size(); i++)
+        {
+          owners_[manifest->resources_[i]] = patient;
+        }
+      }
+    }
+
+    // Whether no manifest is cached or being computed, in which case
+    // the changes can be ignored
+    bool IsIdle()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return content_.IsEmpty() && computations_.empty();
+    }
+
+    void InvalidatePatient(const std::string& patient)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      InvalidatePatientInternal(patient);
+    }
+
+    // The resource is either a patient, or any resource listed by one
+    // of the manifests. Otherwise, its patient is unknown (e.g. a
+    // deleted instance that was not listed yet), and all the
+    // computations in progress are invalidated.
+    void InvalidateResource(const std::string& resource)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Owners::const_iterator owner = owners_.find(resource);
+      if (owner != owners_.end())
+      {
+        InvalidatePatientInternal(owner->second);
+      }
+      else if (content_.Contains(resource) ||
+               computations_.find(resource) != computations_.end())
+      {
+        InvalidatePatientInternal(resource);
+      }
+      else
+      {
+        for (Computations::iterator it = computations_.begin(); it != computations_.end(); ++it)
+        {
+          it->second.revision_++;
+        }
+      }
+    }
+  };
+}
+
+
+static boost::scoped_ptr<ManifestCache> cache_;
+
+
+static std::string EscapeXml(const std::string& value)
+{
+  std::string result;
+  result.reserve(value.size());
+
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    switch (value[i])
+    {
+      case '&':
+        result += "&amp;";
+        break;
+
+      case '<':
+        result += "&lt;";
+        break;
+
+      case '>':
+        result += "&gt;";
+        break;
+
+      case '"':
+        result += "&quot;";
+        break;
+
+      case '\'':
+        result += "&apos;";
+        break;
+
+      default:
+        result += value[i];
+    }
+  }
+
+  return result;
+}
+
+
+static std::string GetTag(const Json::Value& tags,
+                          const std::string& name)
+{
+  if (tags.type() == Json::objectValue &&
+      tags.isMember(name) &&
+      tags[name].type() == Json::stringValue)
+  {
+    return tags[name].asString();
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+static void AddAttribute(std::string& xml,
+                         const std::string& name,
+                         const Json::Value& tags)
+{
+  xml += " " + name + "=\"" + EscapeXml(GetTag(tags, name)) + "\"";
+}
+
+
+typedef std::vector<Json::Value::ArrayIndex>        Indexes;
+typedef std::map<std::string, Indexes>              Children;
+
+
+// Sorts the given resources by the value of an "IS" tag (e.g.
+// "SeriesNumber"), keeping the original order on ties
+static void SortByNumber(Indexes& indexes,
+                         const Json::Value& resources,
+                         const std::string& tag)
+{
+  std::vector<std::pair<int, Json::Value::ArrayIndex> > keys;
+  keys.reserve(indexes.size());
+
+  for (size_t i = 0; i < indexes.size(); i++)
+  {
+    int number = 0;
+
+    try
+    {
+      number = boost::lexical_cast<int>(boost::trim_copy(GetTag(resources[indexes[i]]["MainDicomTags"], tag)));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      // Missing or malformed number: Sort this resource first
+    }
+
+    keys.push_back(std::make_pair(number, indexes[i]));
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    indexes[i] = keys[i].second;
+  }
+}
+
+
+static void GroupByParent(Children& children,
+                          std::vector<std::string>& resources,
+                          const Json::Value& items,
+                          const std::string& parentField)
+{
+  for (Json::Value::ArrayIndex i = 0; i < items.size(); i++)
+  {
+    children[items[i][parentField].asString()].push_back(i);
+    resources.push_back(items[i]["ID"].asString());
+  }
+}
+
+
+// Gathers the whole hierarchy of the patient with one request per
+// level, whatever the number of studies and series
+static ManifestPointer ComputeManifest(const std::string& patient)
+{
+  const std::string base = "/patients/" + patient;
+
+  Json::Value studies, series, instances;
+  if (!OrthancPlugins::RestApiGet(studies, context_, base + "/studies", false) ||
+      !OrthancPlugins::RestApiGet(series, context_, base + "/series", false) ||
+      !OrthancPlugins::RestApiGet(instances, context_, base + "/instances", false) ||
+      studies.type() != Json::arrayValue ||
+      series.type() != Json::arrayValue ||
+      instances.type() != Json::arrayValue ||
+      studies.size() == 0)
+  {
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_UnknownResource);
+  }
+
+  boost::shared_ptr<Manifest> manifest(new Manifest);
+  manifest->resources_.reserve(studies.size() + series.size() + instances.size());
+
+  Children seriesOfStudy, instancesOfSeries;
+  GroupByParent(seriesOfStudy, manifest->resources_, series, "ParentStudy");
+  GroupByParent(instancesOfSeries, manifest->resources_, instances, "ParentSeries");
+
+  std::string& xml = manifest->xml_;
+
+  const Json::Value& patientTags = studies[0]["PatientMainDicomTags"];
+  xml += "  <Patient";
+  AddAttribute(xml, "PatientID", patientTags);
+  AddAttribute(xml, "PatientName", patientTags);
+  AddAttribute(xml, "PatientBirthDate", patientTags);
+  xml += ">\n";
+
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    const Json::Value& study = studies[i];
+    const std::string studyId = study["ID"].asString();
+    manifest->resources_.push_back(studyId);
+
+    xml += "    <Study";
+    AddAttribute(xml, "StudyInstanceUID", study["MainDicomTags"]);
+    AddAttribute(xml, "StudyDescription", study["MainDicomTags"]);
+    AddAttribute(xml, "StudyDate", study["MainDicomTags"]);
+    AddAttribute(xml, "StudyTime", study["MainDicomTags"]);
+    xml += ">\n";
+
+    Indexes& studySeries = seriesOfStudy[studyId];
+    SortByNumber(studySeries, series, "SeriesNumber");
+
+    for (size_t j = 0; j < studySeries.size(); j++)
+    {
+      const Json::Value& s = series[studySeries[j]];
+
+      xml += "      <Series";
+      AddAttribute(xml, "SeriesInstanceUID", s["MainDicomTags"]);
+      AddAttribute(xml, "SeriesDescription", s["MainDicomTags"]);
+      AddAttribute(xml, "SeriesNumber", s["MainDicomTags"]);
+      AddAttribute(xml, "Modality", s["MainDicomTags"]);
+      xml += ">\n";
+
+      Indexes& seriesInstances = instancesOfSeries[s["ID"].asString()];
+      SortByNumber(seriesInstances, instances, "InstanceNumber");
+
+      for (size_t k = 0; k < seriesInstances.size(); k++)
+      {
+        const Json::Value& instance = instances[seriesInstances[k]];
+
+        xml += "        <Instance";
+        AddAttribute(xml, "SOPInstanceUID", instance["MainDicomTags"]);
+        AddAttribute(xml, "InstanceNumber", instance["MainDicomTags"]);
+        xml += " DirectDownloadFile=\"" + EscapeXml(instance["ID"].asString()) + "/file\" />\n";
+      }
+
+      xml += "      </Series>\n";
+    }
+
+    xml += "    </Study>\n";
+  }
+
+  xml += "  </Patient>\n";
+
+  return manifest;
+}
+
+
+static void ServeManifest(OrthancPluginRestOutput* output,
+                          const char* url,
+                          const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+    return;
+  }
+
+  const std::string patient(request->groups[0]);
+
+  ManifestPointer manifest = cache_->Lookup(patient);
+  if (manifest.get() == NULL)
+  {
+    const uint64_t revision = cache_->StartComputation(patient);
+
+    try
+    {
+      manifest = ComputeManifest(patient);
+    }
+    catch (...)
+    {
+      cache_->EndComputation(patient, revision, ManifestPointer());
+      throw;
+    }
+
+    cache_->EndComputation(patient, revision, manifest);
+  }
+
+  // By default, Weasis downloads the instances from the address
+  // that was used to reach Orthanc
+  std::string orthancUrl = orthancUrl_;
+  std::string host;
+  if (orthancUrl.empty() &&
+      OrthancPlugins::LookupHttpHeader(host, request, "host"))
+  {
+    orthancUrl = "http://" + host;
+  }
+
+  std::string xml;
+  xml.reserve(manifest->xml_.size() + 512);
+  xml += "<?xml version=\"1.0\" encoding=\"utf-8\" ?>\n";
+  xml += ("<wado_query xmlns=\"http://www.weasis.org/xsd\" "
+          "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+          "wadoURL=\"" + EscapeXml(orthancUrl + "/instances/") + "\" "
+          "requireOnlySOPInstanceUID=\"false\" additionnalParameters=\"\" overrideDicomTagsList=\"\">\n");
+  xml += manifest->xml_;
+  xml += "</wado_query>\n";
+
+  OrthancPluginAnswerBuffer(context_, output, xml.c_str(), xml.size(), "application/xml");
+}
+
+
+void RegisterWeasisManifest(OrthancPluginContext* context,
+                            const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  orthancUrl_ = configuration.GetStringValue("WeasisOrthancUrl", "");
+  while (!orthancUrl_.empty() &&
+         orthancUrl_[orthancUrl_.size() - 1] == '/')
+  {
+    orthancUrl_.resize(orthancUrl_.size() - 1);
+  }
+
+  // Size of the cache of the manifests, in MB
+  const unsigned int cacheSize = configuration.GetUnsignedIntegerValue("WeasisCacheSize", 16);
+  cache_.reset(new ManifestCache(static_cast<size_t>(cacheSize) * 1024 * 1024));
+
+  OrthancPlugins::RegisterRestCallback<ServeManifest>(context, "/plugin/weasis/([^/]+)", true);
+}
+
+
+void InvalidateWeasisManifest(OrthancPluginChangeType changeType,
+                              const std::string& resourceId)
+{
+  if (cache_.get() == NULL)
+  {
+    return;
+  }
+
+  try
+  {
+    switch (changeType)
+    {
+      case OrthancPluginChangeType_Deleted:
+        cache_->InvalidateResource(resourceId);
+        break;
+
+      case OrthancPluginChangeType_NewInstance:
+      {
+        // The new instance is not listed by any manifest yet: Look
+        // for its patient, unless no manifest is cached or being
+        // computed
+        if (!cache_->IsIdle())
+        {
+          Json::Value parent;
+          if (OrthancPlugins::RestApiGet(parent, context_, "/instances/" + resourceId + "/patient", false) &&
+              parent.type() == Json::objectValue &&
+              parent.isMember("ID") &&
+              parent["ID"].type() == Json::stringValue)
+          {
+            cache_->InvalidatePatient(parent["ID"].asString());
+          }
+          else
+          {
+            cache_->InvalidateResource(resourceId);
+          }
+        }
+
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+  catch (...)
+  {
+    OrthancPlugins::LogError(context_, "Cannot invalidate the Weasis manifest of the patient of resource " + resourceId);
+  }
+}
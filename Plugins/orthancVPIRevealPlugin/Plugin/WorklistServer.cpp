@@ -0,0 +1,442 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "WorklistServer.h"
+
+#include "../Common/WorklistStore.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <set>
+
+#if defined(__linux__)
+#  include <poll.h>
+#  include <sys/inotify.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+static OrthancPluginContext* context_ = NULL;
+static boost::filesystem::path directory_;
+static OrthancPlugins::WorklistStore store_;
+static unsigned int limit_ = 0;
+static unsigned int timeout_ = 0;
+
+
+static bool IsWorklistFile(const boost::filesystem::path& path)
+{
+  return boost::algorithm::to_lower_copy(path.extension().string()) == ".wl";
+}
+
+
+// Changes whenever the file is rewritten. The modification time of
+// Boost only has a resolution of one second, which misses a rewrite
+// of the same size within the same second.
+static std::string GetFileVersion(const boost::filesystem::path& path)
+{
+#if defined(__linux__)
+  struct stat info;
+  if (stat(path.string().c_str(), &info) == 0)
+  {
+    // The inode changes if the file is replaced by a renaming
+    return (boost::lexical_cast<std::string>(info.st_mtim.tv_sec) + "." +
+            boost::lexical_cast<std::string>(info.st_mtim.tv_nsec) + "-" +
+            boost::lexical_cast<std::string>(info.st_size) + "-" +
+            boost::lexical_cast<std::string>(info.st_ino));
+  }
+#endif
+
+  return (boost::lexical_cast<std::string>(boost::filesystem::last_write_time(path)) + "-" +
+          boost::lexical_cast<std::string>(boost::filesystem::file_size(path)));
+}
+
+
+// Loads the file again if it was modified since it was stored, or
+// removes it from the store if it was deleted. If "force" is true
+// (the file is reported as written by inotify), the file is loaded
+// again whatever its version.
+static void RefreshFile(const boost::filesystem::path& path,
+                        bool force)
+{
+  const std::string key = path.string();
+
+  try
+  {
+    boost::system::error_code error;
+    if (!boost::filesystem::is_regular_file(path, error))
+    {
+      store_.Remove(key);
+      return;
+    }
+
+    const std::string version = GetFileVersion(path);
+
+    std::string stored;
+    if (!force &&
+        store_.LookupVersion(stored, key) &&
+        stored == version)
+    {
+      return;
+    }
+
+    OrthancPlugins::MemoryBuffer buffer(context_);
+    buffer.ReadFile(key);
+
+    std::string dicom;
+    buffer.ToString(dicom);
+
+    OrthancPlugins::MatchableDatasetPointer dataset(
+      new OrthancPlugins::MatchableDataset(context_, dicom.c_str(), dicom.size()));
+    store_.Store(key, version, dicom, dataset);
+  }
+  catch (...)
+  {
+    OrthancPlugins::LogWarning(context_, "Cannot load the worklist file: " + key);
+    store_.Remove(key);
+  }
+}
+
+
+static void RescanDirectory()
+{
+  try
+  {
+    std::set<std::string> files;
+
+    // A missing directory has no worklist
+    boost::system::error_code error;
+    if (boost::filesystem::is_directory(directory_, error))
+    {
+      boost::filesystem::directory_iterator end;
+      for (boost::filesystem::directory_iterator it(directory_); it != end; ++it)
+      {
+        if (IsWorklistFile(it->path()))
+        {
+          files.insert(it->path().string());
+          RefreshFile(it->path(), false);
+        }
+      }
+    }
+
+    std::vector<std::string> keys;
+    store_.ListKeys(keys);
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+      if (files.find(keys[i]) == files.end())
+      {
+        store_.Remove(keys[i]);
+      }
+    }
+  }
+  catch (...)
+  {
+    OrthancPlugins::LogError(context_, "Cannot read the worklists directory: " + directory_.string());
+  }
+}
+
+
+namespace
+{
+  // Thread that keeps the store in sync with the directory
+  class DirectoryWatcher : public boost::noncopyable
+  {
+  private:
+    boost::mutex                      mutex_;
+    boost::condition_variable         changed_;
+    bool                              stopped_;
+    boost::posix_time::time_duration  pollingInterval_;
+    boost::thread                     thread_;
+
+    bool IsStopped()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return stopped_;
+    }
+
+    // Returns "false" if the watcher is stopped
+    bool WaitPollingInterval()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      const boost::system_time timeout = boost::get_system_time() + pollingInterval_;
+      while (!stopped_ &&
+             boost::get_system_time() < timeout)
+      {
+        changed_.timed_wait(lock, timeout);
+      }
+
+      return !stopped_;
+    }
+
+#if defined(__linux__)
+    static int AddWatch(int fd)
+    {
+      return inotify_add_watch(fd, directory_.string().c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                               IN_DELETE_SELF | IN_MOVE_SELF);
+    }
+
+    // Returns "false" if inotify cannot be used on the directory
+    bool WatchWithInotify()
+    {
+      int fd = inotify_init();
+      if (fd < 0)
+      {
+        return false;
+      }
+
+      int watch = AddWatch(fd);
+      if (watch < 0)
+      {
+        close(fd);
+        return false;
+      }
+
+      // Catch the files that were changed between the initial scan
+      // and the creation of the watch
+      RescanDirectory();
+
+      char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+      while (!IsStopped())
+      {
+        if (watch < 0)
+        {
+          // The directory was removed: Wait for it to be created again
+          if (!WaitPollingInterval())
+          {
+            break;
+          }
+
+          watch = AddWatch(fd);
+          if (watch >= 0)
+          {
+            OrthancPlugins::LogWarning(context_, "Watching the worklists directory again: " + directory_.string());
+            RescanDirectory();
+          }
+
+          continue;
+        }
+
+        // The timeout regularly checks whether the watcher is stopped
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+
+        if (poll(&p, 1, 500) <= 0)
+        {
+          continue;
+        }
+
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+
+        for (ssize_t offset = 0; offset < length; )
+        {
+          const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+
+          if (event->mask & IN_Q_OVERFLOW)
+          {
+            // Some events were lost
+            RescanDirectory();
+          }
+          else if (event->mask & IN_MOVE_SELF)
+          {
+            // The watch would follow the directory to its new place:
+            // Remove it, which is then reported by "IN_IGNORED"
+            OrthancPlugins::LogWarning(context_, "The worklists directory was moved: " + directory_.string());
+            inotify_rm_watch(fd, event->wd);
+          }
+          else if (event->mask & IN_DELETE_SELF)
+          {
+            OrthancPlugins::LogWarning(context_, "The worklists directory was removed: " + directory_.string());
+          }
+          else if (event->mask & IN_IGNORED)
+          {
+            // The watch is gone (directory removed or moved, file
+            // system unmounted): Serve no worklist until it is back
+            if (event->wd == watch)
+            {
+              OrthancPlugins::LogWarning(context_, "The worklists directory is not watched anymore: " +
+                                         directory_.string());
+              watch = -1;
+              RescanDirectory();
+            }
+          }
+          else if (event->len > 0)
+          {
+            // The file was written or moved: Load it again, even if
+            // its version seems unchanged
+            boost::filesystem::path path = directory_ / event->name;
+            if (IsWorklistFile(path))
+            {
+              RefreshFile(path, true);
+            }
+          }
+
+          offset += sizeof(struct inotify_event) + event->len;
+        }
+      }
+
+      close(fd);
+      return true;
+    }
+#endif
+
+    void Worker()
+    {
+#if defined(__linux__)
+      if (WatchWithInotify())
+      {
+        return;
+      }
+
+      OrthancPlugins::LogWarning(context_, "Cannot watch the worklists directory with inotify, polling it instead");
+#endif
+
+      while (WaitPollingInterval())
+      {
+        RescanDirectory();
+      }
+    }
+
+  public:
+    DirectoryWatcher(unsigned int pollingInterval) :
+      stopped_(false),
+      pollingInterval_(boost::posix_time::seconds(pollingInterval))
+    {
+      thread_ = boost::thread(boost::bind(&DirectoryWatcher::Worker, this));
+    }
+
+    ~DirectoryWatcher()
+    {
+      Stop();
+    }
+
+    void Stop()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopped_ = true;
+        changed_.notify_all();
+      }
+
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+    }
+  };
+}
+
+
+static boost::scoped_ptr<DirectoryWatcher> watcher_;
+
+
+static OrthancPluginErrorCode FindWorklists(OrthancPluginWorklistAnswers*     answers,
+                                            const OrthancPluginWorklistQuery* query,
+                                            const char*                       issuerAet,
+                                            const char*                       calledAet)
+{
+  try
+  {
+    OrthancPlugins::MemoryBuffer dicom(context_);
+    dicom.GetDicomQuery(query);
+
+    Json::Value tags;
+    dicom.DicomToJson(tags, OrthancPluginDicomToJsonFormat_Short, OrthancPluginDicomToJsonFlags_None, 0);
+
+    OrthancPlugins::CompiledFindMatcher matcher(context_, tags);
+
+    OrthancPlugins::FindAnswersWriter writer(context_, answers, query, limit_, timeout_);
+    store_.Find(writer, tags, matcher);
+
+    return OrthancPluginErrorCode_Success;
+  }
+#if HAS_ORTHANC_EXCEPTION == 1
+  catch (Orthanc::OrthancException& e)
+  {
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+#else
+  catch (OrthancPlugins::PluginException& e)
+  {
+    return e.GetErrorCode();
+  }
+#endif
+  catch (...)
+  {
+    return OrthancPluginErrorCode_Plugin;
+  }
+}
+
+
+void RegisterWorklistServer(OrthancPluginContext* context,
+                            const OrthancPlugins::OrthancConfiguration& configuration)
+{
+  context_ = context;
+
+  const std::string directory = configuration.GetStringValue("WorklistsDirectory", "");
+  if (directory.empty())
+  {
+    return;   // The worklist server is disabled
+  }
+
+  directory_ = directory;
+
+  boost::system::error_code error;
+  if (!boost::filesystem::is_directory(directory_, error))
+  {
+    OrthancPlugins::LogError(context_, "The worklists directory does not exist: " + directory);
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_InexistentFile);
+  }
+
+  RescanDirectory();
+  OrthancPlugins::LogWarning(context_, "Worklists loaded from " + directory + ": " +
+                             boost::lexical_cast<std::string>(store_.GetSize()));
+
+  limit_ = configuration.GetUnsignedIntegerValue("WorklistsLimit", 0);
+  timeout_ = 1000 * configuration.GetUnsignedIntegerValue("WorklistsTimeout", 10);
+
+  // Only used if inotify is not available
+  const unsigned int pollingInterval = configuration.GetUnsignedIntegerValue("WorklistsPollingInterval", 10);
+  watcher_.reset(new DirectoryWatcher(pollingInterval == 0 ? 1 : pollingInterval));
+
+  if (OrthancPluginRegisterWorklistCallback(context, FindWorklists) != OrthancPluginErrorCode_Success)
+  {
+    OrthancPlugins::LogError(context_, "Cannot register the worklist server");
+    ORTHANC_PLUGINS_THROW_EXCEPTION(OrthancPluginErrorCode_Plugin);
+  }
+}
+
+
+void FinalizeWorklistServer()
+{
+  watcher_.reset(NULL);
+}
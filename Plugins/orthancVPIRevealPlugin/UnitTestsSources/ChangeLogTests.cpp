@@ -0,0 +1,133 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/ChangeLog.h"
+
+#include <gtest/gtest.h>
+
+
+using namespace OrthancPlugins;
+
+
+namespace
+{
+  // The segments of the log hold 1024 changes
+  static const uint64_t SEGMENT = 1024;
+
+  static const char* const OLD_DATE = "20100101T000000";
+  static const char* const YOUNG_DATE = "20300101T000000";
+  static const char* const MIN_DATE = "20200101T000000";
+
+
+  // 5 full segments. The changes of the first 2 segments are older
+  // than "MIN_DATE", the other ones are younger. The sequence number
+  // of the change at index "i" is "i + 1".
+  void Fill(ChangeLog& log)
+  {
+    for (uint64_t i = 0; i < 5 * SEGMENT; i++)
+    {
+      ChangeLog::Change change;
+      change.seq_ = static_cast<int64_t>(i + 1);
+      change.changeType_ = 1;
+      change.resourceType_ = OrthancPluginResourceType_Instance;
+      change.resourceId_ = static_cast<int64_t>(i);
+      change.date_ = (i < 2 * SEGMENT ? OLD_DATE : YOUNG_DATE);
+      log.Append(change);
+    }
+  }
+}
+
+
+TEST(ChangeLog, NoRetention)
+{
+  ChangeLog log;
+  Fill(log);
+
+  int64_t lastSeq;
+  ASSERT_FALSE(log.LookupExpired(lastSeq, 0, ""));
+}
+
+
+TEST(ChangeLog, RetentionByCount)
+{
+  ChangeLog log;
+  Fill(log);
+
+  // Dropping a segment must leave at least 1024 changes
+  int64_t lastSeq;
+  ASSERT_TRUE(log.LookupExpired(lastSeq, SEGMENT, ""));
+  ASSERT_EQ(static_cast<int64_t>(4 * SEGMENT), lastSeq);
+
+  ASSERT_TRUE(log.LookupExpired(lastSeq, SEGMENT + 1, ""));
+  ASSERT_EQ(static_cast<int64_t>(3 * SEGMENT), lastSeq);
+
+  ASSERT_FALSE(log.LookupExpired(lastSeq, 5 * SEGMENT, ""));
+
+  log.DropUntil(static_cast<int64_t>(3 * SEGMENT));
+  ASSERT_EQ(2 * SEGMENT, log.GetSize());
+  ASSERT_EQ(static_cast<int64_t>(3 * SEGMENT + 1), log.GetAt(0).seq_);
+}
+
+
+TEST(ChangeLog, RetentionByAge)
+{
+  ChangeLog log;
+  Fill(log);
+
+  int64_t lastSeq;
+  ASSERT_TRUE(log.LookupExpired(lastSeq, 0, MIN_DATE));
+  ASSERT_EQ(static_cast<int64_t>(2 * SEGMENT), lastSeq);
+
+  ASSERT_FALSE(log.LookupExpired(lastSeq, 0, OLD_DATE));
+}
+
+
+// "At least maxCount changes are kept, as well as the changes younger
+// than maxAge": A segment is only dropped if both limits allow it
+TEST(ChangeLog, RetentionByCountAndAge)
+{
+  ChangeLog log;
+  Fill(log);
+
+  int64_t lastSeq;
+
+  // The count alone would drop 4 segments: The young changes are kept
+  ASSERT_TRUE(log.LookupExpired(lastSeq, SEGMENT, MIN_DATE));
+  ASSERT_EQ(static_cast<int64_t>(2 * SEGMENT), lastSeq);
+
+  // The age alone would drop 2 segments: At least 4000 changes are kept
+  ASSERT_TRUE(log.LookupExpired(lastSeq, 4000, MIN_DATE));
+  ASSERT_EQ(static_cast<int64_t>(SEGMENT), lastSeq);
+
+  // Each limit keeps all the changes on its own
+  ASSERT_FALSE(log.LookupExpired(lastSeq, 5 * SEGMENT, MIN_DATE));
+  ASSERT_FALSE(log.LookupExpired(lastSeq, SEGMENT, OLD_DATE));
+
+  log.DropUntil(static_cast<int64_t>(SEGMENT));
+  ASSERT_EQ(4 * SEGMENT, log.GetSize());
+
+  ASSERT_TRUE(log.LookupExpired(lastSeq, SEGMENT, MIN_DATE));
+  ASSERT_EQ(static_cast<int64_t>(2 * SEGMENT), lastSeq);
+
+  log.DropUntil(lastSeq);
+  ASSERT_EQ(3 * SEGMENT, log.GetSize());
+  ASSERT_FALSE(log.LookupExpired(lastSeq, SEGMENT, MIN_DATE));
+}
@@ -0,0 +1,322 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/IdentifierIndex.h"
+
+#include <gtest/gtest.h>
+#include <boost/lexical_cast.hpp>
+#include <set>
+
+
+using namespace OrthancPlugins;
+
+
+namespace
+{
+  struct Entry
+  {
+    OrthancPluginResourceType  level_;
+    uint32_t                   tag_;
+    std::string                value_;
+    int64_t                    id_;
+
+    Entry(OrthancPluginResourceType level,
+          uint32_t tag,
+          const std::string& value,
+          int64_t id) :
+      level_(level),
+      tag_(tag),
+      value_(value),
+      id_(id)
+    {
+    }
+
+    bool operator< (const Entry& other) const
+    {
+      if (level_ != other.level_)
+      {
+        return level_ < other.level_;
+      }
+      else if (tag_ != other.tag_)
+      {
+        return tag_ < other.tag_;
+      }
+      else if (value_ != other.value_)
+      {
+        return value_ < other.value_;
+      }
+      else
+      {
+        return id_ < other.id_;
+      }
+    }
+  };
+
+  typedef std::set<Entry>  Model;
+
+
+  // Reference implementation of the wildcard matching
+  bool Match(const char* pattern,
+             const char* value)
+  {
+    if (*pattern == '\0')
+    {
+      return *value == '\0';
+    }
+    else if (*pattern == '*')
+    {
+      return Match(pattern + 1, value) || (*value != '\0' && Match(pattern, value + 1));
+    }
+    else
+    {
+      return (*value != '\0' &&
+              (*pattern == '?' || *pattern == *value) &&
+              Match(pattern + 1, value + 1));
+    }
+  }
+
+
+  std::list<int64_t> LookupModel(const Model& model,
+                                 OrthancPluginResourceType level,
+                                 uint32_t tag,
+                                 OrthancPluginIdentifierConstraint constraint,
+                                 const std::string& value)
+  {
+    std::list<int64_t> result;
+
+    for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+    {
+      if (it->level_ == level &&
+          it->tag_ == tag)
+      {
+        bool matches;
+        switch (constraint)
+        {
+          case OrthancPluginIdentifierConstraint_Equal:
+            matches = (it->value_ == value);
+            break;
+
+          case OrthancPluginIdentifierConstraint_SmallerOrEqual:
+            matches = (it->value_ <= value);
+            break;
+
+          case OrthancPluginIdentifierConstraint_GreaterOrEqual:
+            matches = (it->value_ >= value);
+            break;
+
+          default:
+            matches = Match(value.c_str(), it->value_.c_str());
+        }
+
+        if (matches)
+        {
+          result.push_back(it->id_);
+        }
+      }
+    }
+
+    return result;
+  }
+
+
+  std::list<int64_t> LookupIndex(const IdentifierIndex& index,
+                                 OrthancPluginResourceType level,
+                                 uint32_t tag,
+                                 OrthancPluginIdentifierConstraint constraint,
+                                 const std::string& value)
+  {
+    std::list<int64_t> result;
+    index.Lookup(result, level, tag, constraint, value);
+    return result;
+  }
+
+
+  // UIDs sharing a long prefix, as in real life, so that the front
+  // coding is exercised
+  std::string MakeUid(unsigned int i)
+  {
+    return "1.2.840.113619.2.55.3." + boost::lexical_cast<std::string>(i % 97) + "." +
+      boost::lexical_cast<std::string>(i);
+  }
+
+
+  void CheckAll(const IdentifierIndex& index,
+                const Model& model)
+  {
+    ASSERT_EQ(model.size(), index.GetSize());
+
+    static const char* const patterns[] = {
+      "*", "1.2.840.*", "*.5", "*.1?", "1.2.840.113619.2.55.3.4.*", "*.3.1?.*", "?", "*9*9*", "nomatch*"
+    };
+
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+    {
+      ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_Wildcard, patterns[i]),
+                LookupIndex(index, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_Wildcard, patterns[i])) << patterns[i];
+    }
+
+    for (unsigned int i = 0; i < 2000; i += 37)
+    {
+      const std::string value = MakeUid(i);
+
+      ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_Equal, value),
+                LookupIndex(index, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_Equal, value));
+      ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_SmallerOrEqual, value),
+                LookupIndex(index, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_SmallerOrEqual, value));
+      ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_GreaterOrEqual, value),
+                LookupIndex(index, OrthancPluginResourceType_Study, 0x0020000d,
+                            OrthancPluginIdentifierConstraint_GreaterOrEqual, value));
+    }
+
+    // The other tag and the other level must not leak into the results
+    ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Series, 0x0020000e,
+                          OrthancPluginIdentifierConstraint_Wildcard, "*"),
+              LookupIndex(index, OrthancPluginResourceType_Series, 0x0020000e,
+                          OrthancPluginIdentifierConstraint_Wildcard, "*"));
+    ASSERT_EQ(LookupModel(model, OrthancPluginResourceType_Patient, 0x00100020,
+                          OrthancPluginIdentifierConstraint_Wildcard, "*"),
+              LookupIndex(index, OrthancPluginResourceType_Patient, 0x00100020,
+                          OrthancPluginIdentifierConstraint_Wildcard, "*"));
+  }
+
+
+  void Add(IdentifierIndex& index,
+           Model& model,
+           OrthancPluginResourceType level,
+           uint32_t tag,
+           const std::string& value,
+           int64_t id)
+  {
+    index.Add(level, tag, value, id);
+    model.insert(Entry(level, tag, value, id));
+  }
+}
+
+
+TEST(IdentifierIndex, Empty)
+{
+  IdentifierIndex index;
+  ASSERT_EQ(0u, index.GetSize());
+  ASSERT_FALSE(index.Remove(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 1));
+  ASSERT_TRUE(LookupIndex(index, OrthancPluginResourceType_Study, 0x0020000d,
+                          OrthancPluginIdentifierConstraint_Wildcard, "*").empty());
+}
+
+
+TEST(IdentifierIndex, Duplicates)
+{
+  IdentifierIndex index;
+  index.Add(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 1);
+  index.Add(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 1);
+  index.Add(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 2);
+  ASSERT_EQ(2u, index.GetSize());
+
+  ASSERT_TRUE(index.Remove(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 1));
+  ASSERT_FALSE(index.Remove(OrthancPluginResourceType_Study, 0x0020000d, "1.2", 1));
+  ASSERT_EQ(1u, index.GetSize());
+}
+
+
+// Thousands of entries span many blocks: The insertions in random
+// order split the blocks, and the removals empty some of them
+TEST(IdentifierIndex, AcrossBlocks)
+{
+  IdentifierIndex index;
+  Model model;
+
+  // Deterministic pseudo-random order (linear congruential generator)
+  uint32_t seed = 12345;
+  std::vector<unsigned int> order;
+  for (unsigned int i = 0; i < 2000; i++)
+  {
+    order.push_back(i);
+  }
+
+  for (size_t i = order.size() - 1; i > 0; i--)
+  {
+    seed = seed * 1103515245u + 12345u;
+    std::swap(order[i], order[(seed >> 8) % (i + 1)]);
+  }
+
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    const unsigned int k = order[i];
+    Add(index, model, OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k);
+
+    // Some values are shared by several resources
+    if (k % 7 == 0)
+    {
+      Add(index, model, OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k + 100000);
+    }
+
+    Add(index, model, OrthancPluginResourceType_Series, 0x0020000e, MakeUid(k) + ".1", k + 200000);
+
+    if (k % 3 == 0)
+    {
+      Add(index, model, OrthancPluginResourceType_Patient, 0x00100020, "P" + boost::lexical_cast<std::string>(k), k);
+    }
+  }
+
+  CheckAll(index, model);
+
+  // Remove a contiguous range (which empties whole blocks), then
+  // every third entry of the remaining ones
+  for (unsigned int k = 500; k < 1200; k++)
+  {
+    ASSERT_TRUE(index.Remove(OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k));
+    model.erase(Entry(OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k));
+  }
+
+  CheckAll(index, model);
+
+  for (size_t i = 0; i < order.size(); i += 3)
+  {
+    const unsigned int k = order[i];
+    const bool present = (model.erase(Entry(OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k)) == 1);
+    ASSERT_EQ(present, index.Remove(OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k));
+  }
+
+  CheckAll(index, model);
+
+  // Add back some of the removed entries, in the emptied range
+  for (unsigned int k = 600; k < 700; k++)
+  {
+    Add(index, model, OrthancPluginResourceType_Study, 0x0020000d, MakeUid(k), k);
+  }
+
+  CheckAll(index, model);
+
+  // Remove everything
+  for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+  {
+    ASSERT_TRUE(index.Remove(it->level_, it->tag_, it->value_, it->id_));
+  }
+
+  model.clear();
+  CheckAll(index, model);
+}
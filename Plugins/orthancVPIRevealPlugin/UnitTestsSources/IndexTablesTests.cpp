@@ -0,0 +1,243 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+
+
+#include "../Database/IndexTables.h"
+
+#include <gtest/gtest.h>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+
+
+using namespace OrthancPlugins;
+
+
+namespace
+{
+  // Creates "count" patients with 3 studies each, and returns the
+  // internal IDs of the patients
+  std::vector<int64_t> Populate(IndexTables& tables,
+                                size_t count)
+  {
+    std::vector<int64_t> patients;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      const std::string id = boost::lexical_cast<std::string>(i);
+      int64_t patient = tables.CreateResource("patient-" + id, OrthancPluginResourceType_Patient);
+      patients.push_back(patient);
+
+      for (size_t j = 0; j < 3; j++)
+      {
+        int64_t study = tables.CreateResource("study-" + id + "-" + boost::lexical_cast<std::string>(j),
+                                              OrthancPluginResourceType_Study);
+        tables.AttachChild(patient, study);
+      }
+    }
+
+    return patients;
+  }
+
+
+  std::vector<int64_t> ReadAllPages(const IndexTables& tables,
+                                    OrthancPluginResourceType type,
+                                    uint32_t limit)
+  {
+    std::vector<int64_t> result;
+
+    int64_t cursor = 0;
+    for (;;)
+    {
+      std::vector<int64_t> page;
+      cursor = tables.GetInternalIdsPage(page, type, cursor, limit);
+
+      EXPECT_LE(page.size(), limit);
+      if (page.empty())
+      {
+        return result;
+      }
+
+      result.insert(result.end(), page.begin(), page.end());
+    }
+  }
+}
+
+
+TEST(IndexTables, InternalIdsPages)
+{
+  IndexTables tables;
+  Populate(tables, 100);
+
+  std::list<int64_t> expected;
+  tables.GetAllInternalIds(expected, OrthancPluginResourceType_Study);
+  ASSERT_EQ(300u, expected.size());
+
+  const uint32_t limits[] = { 1, 7, 300, 1000 };
+  for (size_t i = 0; i < sizeof(limits) / sizeof(uint32_t); i++)
+  {
+    std::vector<int64_t> pages = ReadAllPages(tables, OrthancPluginResourceType_Study, limits[i]);
+    ASSERT_EQ(expected.size(), pages.size());
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), pages.begin()));
+  }
+
+  // The offset-based listing of the SDK gives the same resources
+  std::list<std::string> all;
+  tables.GetAllPublicIds(all, OrthancPluginResourceType_Study);
+
+  std::vector<std::string> pages;
+  int64_t cursor = 0;
+  uint64_t since = 0;
+  for (;;)
+  {
+    std::vector<std::string> page;
+    cursor = tables.GetPublicIdsPage(page, OrthancPluginResourceType_Study, cursor, 13);
+
+    std::list<std::string> offsetPage;
+    tables.GetAllPublicIds(offsetPage, OrthancPluginResourceType_Study, since, 13);
+    ASSERT_EQ(page.size(), offsetPage.size());
+    ASSERT_TRUE(std::equal(offsetPage.begin(), offsetPage.end(), page.begin()));
+
+    if (page.empty())
+    {
+      break;
+    }
+
+    pages.insert(pages.end(), page.begin(), page.end());
+    since += page.size();
+  }
+
+  ASSERT_EQ(all.size(), pages.size());
+  ASSERT_TRUE(std::equal(all.begin(), all.end(), pages.begin()));
+
+  std::vector<int64_t> ids;
+  ASSERT_THROW(tables.GetInternalIdsPage(ids, static_cast<OrthancPluginResourceType>(42), 0, 10),
+               DatabaseException);
+}
+
+
+TEST(IndexTables, CursorNotShiftedByChanges)
+{
+  IndexTables tables;
+  std::vector<int64_t> patients = Populate(tables, 20);
+
+  std::vector<int64_t> page;
+  int64_t cursor = tables.GetInternalIdsPage(page, OrthancPluginResourceType_Patient, 0, 5);
+  ASSERT_EQ(5u, page.size());
+  ASSERT_EQ(patients[4], cursor);
+
+  // Delete the resources of the first page, and one patient that was
+  // not returned yet. Then create a new patient.
+  for (size_t i = 0; i < 5; i++)
+  {
+    IndexTables::Deletion deletion;
+    tables.DeleteResource(deletion, patients[i]);
+  }
+
+  IndexTables::Deletion deletion;
+  tables.DeleteResource(deletion, patients[10]);
+
+  int64_t created = tables.CreateResource("patient-new", OrthancPluginResourceType_Patient);
+
+  // An offset of 5 would now skip 5 patients. The cursor continues
+  // right after the last patient that was returned.
+  std::vector<int64_t> expected(patients.begin() + 5, patients.end());
+  expected.erase(std::find(expected.begin(), expected.end(), patients[10]));
+  expected.push_back(created);
+
+  std::vector<int64_t> remaining;
+  for (;;)
+  {
+    cursor = tables.GetInternalIdsPage(page, OrthancPluginResourceType_Patient, cursor, 4);
+    if (page.empty())
+    {
+      break;
+    }
+
+    remaining.insert(remaining.end(), page.begin(), page.end());
+  }
+
+  ASSERT_EQ(expected, remaining);
+
+  // The last cursor stays valid, and gives an empty page
+  ASSERT_EQ(created, cursor);
+  ASSERT_EQ(created, tables.GetInternalIdsPage(page, OrthancPluginResourceType_Patient, cursor, 4));
+  ASSERT_TRUE(page.empty());
+}
+
+
+TEST(IndexTables, ChildrenPages)
+{
+  IndexTables tables;
+  int64_t patient = tables.CreateResource("patient", OrthancPluginResourceType_Patient);
+
+  for (size_t i = 0; i < 50; i++)
+  {
+    int64_t study = tables.CreateResource("study-" + boost::lexical_cast<std::string>(i),
+                                          OrthancPluginResourceType_Study);
+    tables.AttachChild(patient, study);
+  }
+
+  std::list<int64_t> expected;
+  tables.GetChildrenInternalId(expected, patient);
+  ASSERT_EQ(50u, expected.size());
+
+  std::vector<int64_t> children;
+  std::vector<int64_t> page;
+  int64_t cursor = 0;
+  int64_t lastCursor = 0;
+  for (;;)
+  {
+    lastCursor = cursor;
+    cursor = tables.GetChildrenPage(page, patient, cursor, 8);
+    ASSERT_LE(page.size(), 8u);
+
+    if (page.empty())
+    {
+      ASSERT_EQ(lastCursor, cursor);
+      break;
+    }
+
+    children.insert(children.end(), page.begin(), page.end());
+  }
+
+  ASSERT_EQ(expected.size(), children.size());
+  ASSERT_TRUE(std::equal(expected.begin(), expected.end(), children.begin()));
+
+  // A child attached meanwhile goes to the front of the list, and
+  // does not disturb the pages that follow
+  cursor = tables.GetChildrenPage(page, patient, 0, 10);
+  int64_t added = tables.CreateResource("study-added", OrthancPluginResourceType_Study);
+  tables.AttachChild(patient, added);
+
+  tables.GetChildrenPage(page, patient, cursor, 10);
+  ASSERT_EQ(10u, page.size());
+  ASSERT_EQ(children[10], page[0]);
+
+  // The cursor is a deleted child
+  IndexTables::Deletion deletion;
+  tables.DeleteResource(deletion, cursor);
+  ASSERT_THROW(tables.GetChildrenPage(page, patient, cursor, 10), DatabaseException);
+
+  // The cursor is not a child of this resource
+  ASSERT_THROW(tables.GetChildrenPage(page, patient, patient, 10), DatabaseException);
+}
@@ -0,0 +1,215 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../Database/RecordFile.h"
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace OrthancPlugins;
+
+
+namespace
+{
+  class Collector : public RecordFile::IVisitor
+  {
+  private:
+    std::vector<std::string>&  records_;
+
+  public:
+    Collector(std::vector<std::string>& records) :
+      records_(records)
+    {
+    }
+
+    virtual void Visit(const std::string& record)
+    {
+      records_.push_back(record);
+    }
+  };
+
+
+  // Removes the temporary file of the test, whatever its outcome
+  class TemporaryFile : public boost::noncopyable
+  {
+  private:
+    std::string  path_;
+
+  public:
+    TemporaryFile()
+    {
+      path_ = (boost::filesystem::temp_directory_path() /
+               boost::filesystem::unique_path("RecordFileTests-%%%%-%%%%-%%%%")).string();
+    }
+
+    ~TemporaryFile()
+    {
+      boost::system::error_code error;
+      boost::filesystem::remove(path_, error);
+    }
+
+    const std::string& GetPath() const
+    {
+      return path_;
+    }
+  };
+
+
+  // 3 records, then the first 5 bytes of a 4th record, as left by a
+  // crash in the middle of an append
+  void WriteTornFile(const std::string& path)
+  {
+    {
+      RecordFile file(path, true);
+      file.Append("first");
+      file.Append("");
+      file.Append("third");
+      file.Flush(false);
+    }
+
+    FILE* fp = fopen(path.c_str(), "ab");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(5u, fwrite("\x10\x00\x00\x00\xab", 1, 5, fp));
+    fclose(fp);
+  }
+}
+
+
+TEST(RecordFile, Missing)
+{
+  TemporaryFile tmp;
+
+  std::vector<std::string> records;
+  Collector collector(records);
+  ASSERT_FALSE(RecordFile::Read(tmp.GetPath(), collector, false));
+  ASSERT_FALSE(RecordFile::Read(tmp.GetPath(), collector, true));
+  ASSERT_TRUE(records.empty());
+}
+
+
+TEST(RecordFile, TornTailTruncated)
+{
+  TemporaryFile tmp;
+  WriteTornFile(tmp.GetPath());
+
+  std::vector<std::string> records;
+  Collector collector(records);
+  ASSERT_TRUE(RecordFile::Read(tmp.GetPath(), collector, true));
+
+  ASSERT_EQ(3u, records.size());
+  ASSERT_EQ("first", records[0]);
+  ASSERT_EQ("", records[1]);
+  ASSERT_EQ("third", records[2]);
+
+  // 8 bytes of header per record
+  ASSERT_EQ(8u * 3u + 10u, boost::filesystem::file_size(tmp.GetPath()));
+
+  // The records are appended right after the last valid one
+  {
+    RecordFile file(tmp.GetPath(), false);
+    file.Append("fourth");
+    file.Flush(false);
+  }
+
+  records.clear();
+  ASSERT_TRUE(RecordFile::Read(tmp.GetPath(), collector, true));
+  ASSERT_EQ(4u, records.size());
+  ASSERT_EQ("fourth", records[3]);
+}
+
+
+TEST(RecordFile, TornTailRejected)
+{
+  TemporaryFile tmp;
+  WriteTornFile(tmp.GetPath());
+
+  const uintmax_t size = boost::filesystem::file_size(tmp.GetPath());
+
+  std::vector<std::string> records;
+  Collector collector(records);
+
+  try
+  {
+    RecordFile::Read(tmp.GetPath(), collector, false);
+    FAIL();
+  }
+  catch (DatabaseException& e)
+  {
+    ASSERT_EQ(OrthancPluginErrorCode_CorruptedFile, e.GetErrorCode());
+  }
+
+  // The file is left untouched
+  ASSERT_EQ(size, boost::filesystem::file_size(tmp.GetPath()));
+}
+
+
+TEST(RecordFile, BadChecksumRejected)
+{
+  TemporaryFile tmp;
+
+  {
+    RecordFile file(tmp.GetPath(), true);
+    file.Append("first");
+    file.Append("second");
+    file.Flush(false);
+  }
+
+  // Flip one byte of the content of the second record
+  FILE* fp = fopen(tmp.GetPath().c_str(), "r+b");
+  ASSERT_TRUE(fp != NULL);
+  ASSERT_EQ(0, fseek(fp, 8 + 5 + 8, SEEK_SET));
+  ASSERT_EQ(1u, fwrite("S", 1, 1, fp));
+  fclose(fp);
+
+  std::vector<std::string> records;
+  Collector collector(records);
+  ASSERT_THROW(RecordFile::Read(tmp.GetPath(), collector, false), DatabaseException);
+  ASSERT_EQ(8u * 2u + 11u, boost::filesystem::file_size(tmp.GetPath()));
+}
+
+
+TEST(RecordFile, Replace)
+{
+  TemporaryFile source, target;
+
+  {
+    RecordFile file(source.GetPath(), true);
+    file.Append("new");
+    file.Flush(true);
+  }
+
+  {
+    RecordFile file(target.GetPath(), true);
+    file.Append("old");
+    file.Flush(true);
+  }
+
+  RecordFile::Replace(source.GetPath(), target.GetPath());
+  ASSERT_FALSE(boost::filesystem::exists(source.GetPath()));
+
+  std::vector<std::string> records;
+  Collector collector(records);
+  ASSERT_TRUE(RecordFile::Read(target.GetPath(), collector, false));
+  ASSERT_EQ(1u, records.size());
+  ASSERT_EQ("new", records[0]);
+}